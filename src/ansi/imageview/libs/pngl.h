@@ -46,11 +46,86 @@ PNGLDEF const char *pngl_failure_reason(void);
 
 PNGLDEF void pngl_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+typedef struct pngl_stream pngl_stream;
+
+typedef void (*pngl_row_callback)(void *user, int y, pngl_uc const *row,
+                                  int width, int comp);
+
+PNGLDEF pngl_stream *pngl_stream_begin(int req_comp, pngl_row_callback cb,
+                                       void *user);
+
+PNGLDEF int pngl_stream_feed(pngl_stream *st, pngl_uc const *data, int len);
+
+PNGLDEF int pngl_stream_next_rows(pngl_stream *st, pngl_uc *out, int stride,
+                                  int max_rows);
+
+PNGLDEF int pngl_stream_info(pngl_stream *st, int *x, int *y, int *comp);
+
+PNGLDEF void pngl_stream_free(pngl_stream *st);
+
 #ifdef PNGL_IMPLEMENTATION
 
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define PNGL__X64_TARGET
+#elif defined(__i386) || defined(_M_IX86)
+#define PNGL__X86_TARGET
+#endif
+
+#if defined(__GNUC__) && defined(PNGL__X86_TARGET) && !defined(__SSE2__) &&    \
+    !defined(PNGL_NO_SIMD)
+#define PNGL_NO_SIMD
+#endif
+
+#if !defined(PNGL_NO_SIMD) &&                                                  \
+    (defined(PNGL__X86_TARGET) || defined(PNGL__X64_TARGET))
+#define PNGL_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+static int _pngl_sse2_available(void) {
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] >> 26) & 1;
+}
+#else
+static int _pngl_sse2_available(void) { return 1; }
+#endif
+#endif
+
+/* SSSE3 kernels are compiled per function and chosen at run time, so the
+   rest of the unit keeps building for plain SSE2. */
+#if defined(PNGL_SSE2) && !defined(PNGL_NO_SSSE3) &&                           \
+    (defined(_MSC_VER) || defined(__GNUC__))
+#define PNGL_SSSE3
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#define PNGL__TARGET_SSSE3
+static int _pngl_ssse3_available(void) {
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] >> 9) & 1;
+}
+#else
+#define PNGL__TARGET_SSSE3 __attribute__((target("ssse3")))
+static int _pngl_ssse3_available(void) {
+  return __builtin_cpu_supports("ssse3");
+}
+#endif
+#endif
+
+#ifdef _MSC_VER
+typedef unsigned __int64 _pngl_uint64;
+#else
+typedef unsigned long long _pngl_uint64;
+#endif
+
+#define PNGL__ZFAST_BITS 11
+#define PNGL__ZFAST_MASK ((1 << PNGL__ZFAST_BITS) - 1)
+#define PNGL__ZSLACK (258 + 16)
+
 static const char *_pngl_g_failure_reason = 0;
 
 typedef struct {
@@ -73,7 +148,7 @@ typedef struct {
 } _pngl_result_info;
 
 typedef struct {
-  pngl_us fast[1 << 9];
+  _pngl_uint32 fast[1 << PNGL__ZFAST_BITS];
   pngl_us firstcode[16];
   int maxcode[17];
   pngl_us firstsymbol[16];
@@ -85,7 +160,7 @@ typedef struct {
   pngl_uc *zbuffer, *zbuffer_end;
   int num_bits;
   int hit_zeof_once;
-  _pngl_uint32 code_buffer;
+  _pngl_uint64 code_buffer;
   char *zout;
   char *zout_start;
   char *zout_end;
@@ -271,10 +346,90 @@ static pngl_uc _pngl_compute_y(int r, int g, int b) {
   return (pngl_uc)(((r * 77) + (g * 150) + (29 * b)) >> 8);
 }
 
+static int _pngl_convert_row(unsigned char *dest, const unsigned char *src,
+                             int img_n, int req_comp, unsigned int x) {
+  int i;
+  switch (((img_n) * 8 + (req_comp))) {
+  case ((1) * 8 + (2)):
+    for (i = (int)x - 1; i >= 0; --i, src += 1, dest += 2) {
+      dest[0] = src[0];
+      dest[1] = 255;
+    }
+    break;
+  case ((1) * 8 + (3)):
+    for (i = (int)x - 1; i >= 0; --i, src += 1, dest += 3) {
+      dest[0] = dest[1] = dest[2] = src[0];
+    }
+    break;
+  case ((1) * 8 + (4)):
+    for (i = (int)x - 1; i >= 0; --i, src += 1, dest += 4) {
+      dest[0] = dest[1] = dest[2] = src[0];
+      dest[3] = 255;
+    }
+    break;
+  case ((2) * 8 + (1)):
+    for (i = (int)x - 1; i >= 0; --i, src += 2, dest += 1) {
+      dest[0] = src[0];
+    }
+    break;
+  case ((2) * 8 + (3)):
+    for (i = (int)x - 1; i >= 0; --i, src += 2, dest += 3) {
+      dest[0] = dest[1] = dest[2] = src[0];
+    }
+    break;
+  case ((2) * 8 + (4)):
+    for (i = (int)x - 1; i >= 0; --i, src += 2, dest += 4) {
+      dest[0] = dest[1] = dest[2] = src[0];
+      dest[3] = src[1];
+    }
+    break;
+  case ((3) * 8 + (4)):
+    for (i = (int)x - 1; i >= 0; --i, src += 3, dest += 4) {
+      dest[0] = src[0];
+      dest[1] = src[1];
+      dest[2] = src[2];
+      dest[3] = 255;
+    }
+    break;
+  case ((3) * 8 + (1)):
+    for (i = (int)x - 1; i >= 0; --i, src += 3, dest += 1) {
+      dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
+    }
+    break;
+  case ((3) * 8 + (2)):
+    for (i = (int)x - 1; i >= 0; --i, src += 3, dest += 2) {
+      dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
+      dest[1] = 255;
+    }
+    break;
+  case ((4) * 8 + (1)):
+    for (i = (int)x - 1; i >= 0; --i, src += 4, dest += 1) {
+      dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
+    }
+    break;
+  case ((4) * 8 + (2)):
+    for (i = (int)x - 1; i >= 0; --i, src += 4, dest += 2) {
+      dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
+      dest[1] = src[3];
+    }
+    break;
+  case ((4) * 8 + (3)):
+    for (i = (int)x - 1; i >= 0; --i, src += 4, dest += 3) {
+      dest[0] = src[0];
+      dest[1] = src[1];
+      dest[2] = src[2];
+    }
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
 static unsigned char *_pngl_convert_format(unsigned char *data, int img_n,
                                            int req_comp, unsigned int x,
                                            unsigned int y) {
-  int i, j;
+  int j;
   unsigned char *good;
   if (req_comp == img_n)
     return data;
@@ -286,80 +441,8 @@ static unsigned char *_pngl_convert_format(unsigned char *data, int img_n,
   }
 
   for (j = 0; j < (int)y; ++j) {
-    unsigned char *src = data + j * x * img_n;
-    unsigned char *dest = good + j * x * req_comp;
-    switch (((img_n) * 8 + (req_comp))) {
-    case ((1) * 8 + (2)):
-      for (i = (int)x - 1; i >= 0; --i, src += 1, dest += 2) {
-        dest[0] = src[0];
-        dest[1] = 255;
-      }
-      break;
-    case ((1) * 8 + (3)):
-      for (i = (int)x - 1; i >= 0; --i, src += 1, dest += 3) {
-        dest[0] = dest[1] = dest[2] = src[0];
-      }
-      break;
-    case ((1) * 8 + (4)):
-      for (i = (int)x - 1; i >= 0; --i, src += 1, dest += 4) {
-        dest[0] = dest[1] = dest[2] = src[0];
-        dest[3] = 255;
-      }
-      break;
-    case ((2) * 8 + (1)):
-      for (i = (int)x - 1; i >= 0; --i, src += 2, dest += 1) {
-        dest[0] = src[0];
-      }
-      break;
-    case ((2) * 8 + (3)):
-      for (i = (int)x - 1; i >= 0; --i, src += 2, dest += 3) {
-        dest[0] = dest[1] = dest[2] = src[0];
-      }
-      break;
-    case ((2) * 8 + (4)):
-      for (i = (int)x - 1; i >= 0; --i, src += 2, dest += 4) {
-        dest[0] = dest[1] = dest[2] = src[0];
-        dest[3] = src[1];
-      }
-      break;
-    case ((3) * 8 + (4)):
-      for (i = (int)x - 1; i >= 0; --i, src += 3, dest += 4) {
-        dest[0] = src[0];
-        dest[1] = src[1];
-        dest[2] = src[2];
-        dest[3] = 255;
-      }
-      break;
-    case ((3) * 8 + (1)):
-      for (i = (int)x - 1; i >= 0; --i, src += 3, dest += 1) {
-        dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
-      }
-      break;
-    case ((3) * 8 + (2)):
-      for (i = (int)x - 1; i >= 0; --i, src += 3, dest += 2) {
-        dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
-        dest[1] = 255;
-      }
-      break;
-    case ((4) * 8 + (1)):
-      for (i = (int)x - 1; i >= 0; --i, src += 4, dest += 1) {
-        dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
-      }
-      break;
-    case ((4) * 8 + (2)):
-      for (i = (int)x - 1; i >= 0; --i, src += 4, dest += 2) {
-        dest[0] = _pngl_compute_y(src[0], src[1], src[2]);
-        dest[1] = src[3];
-      }
-      break;
-    case ((4) * 8 + (3)):
-      for (i = (int)x - 1; i >= 0; --i, src += 4, dest += 3) {
-        dest[0] = src[0];
-        dest[1] = src[1];
-        dest[2] = src[2];
-      }
-      break;
-    default:
+    if (!_pngl_convert_row(good + j * x * req_comp, data + j * x * img_n,
+                           img_n, req_comp, x)) {
       free(data);
       free(good);
       return (unsigned char *)(size_t)(_pngl_err("unsupported") ? 0 : 0);
@@ -434,12 +517,12 @@ static int _pngl_zbuild_huffman(_pngl_zhuffman *z, const pngl_uc *sizelist,
     int s = sizelist[i];
     if (s) {
       int c = next_code[s] - z->firstcode[s] + z->firstsymbol[s];
-      pngl_us fastv = (pngl_us)((s << 9) | i);
+      _pngl_uint32 fastv = (_pngl_uint32)((s << 21) | (s << 9) | i);
       z->size[c] = (pngl_uc)s;
       z->value[c] = (pngl_us)i;
-      if (s <= 9) {
+      if (s <= PNGL__ZFAST_BITS) {
         int j = _pngl_bit_reverse(next_code[s], s);
-        while (j < (1 << 9)) {
+        while (j < (1 << PNGL__ZFAST_BITS)) {
           z->fast[j] = fastv;
           j += (1 << s);
         }
@@ -450,6 +533,23 @@ static int _pngl_zbuild_huffman(_pngl_zhuffman *z, const pngl_uc *sizelist,
   return 1;
 }
 
+static void _pngl_zbuild_pairs(_pngl_zhuffman *z) {
+  _pngl_uint32 e, e2;
+  int j, s, s2;
+  for (j = (1 << PNGL__ZFAST_BITS) - 1; j >= 0; --j) {
+    e = z->fast[j];
+    s = (int)(e >> 9) & 15;
+    if (!e || (e & 511) >= 256 || s >= PNGL__ZFAST_BITS)
+      continue;
+    e2 = z->fast[j >> s];
+    s2 = (int)(e2 >> 9) & 15;
+    if (!e2 || (e2 & 511) >= 256 || s2 > PNGL__ZFAST_BITS - s)
+      continue;
+    z->fast[j] = (e & 0x1fff) | ((e2 & 255) << 13) |
+                 ((_pngl_uint32)(s + s2) << 21) | (1U << 26);
+  }
+}
+
 static int _pngl_zeof(_pngl_zbuf *z) { return (z->zbuffer >= z->zbuffer_end); }
 
 static pngl_uc _pngl_zget8(_pngl_zbuf *z) {
@@ -458,11 +558,11 @@ static pngl_uc _pngl_zget8(_pngl_zbuf *z) {
 
 static void _pngl_fill_bits(_pngl_zbuf *z) {
   do {
-    if (z->code_buffer >= (1U << z->num_bits)) {
+    if (z->code_buffer >= ((_pngl_uint64)1 << z->num_bits)) {
       z->zbuffer = z->zbuffer_end;
       return;
     }
-    z->code_buffer |= (unsigned int)_pngl_zget8(z) << z->num_bits;
+    z->code_buffer |= (_pngl_uint64)_pngl_zget8(z) << z->num_bits;
     z->num_bits += 8;
   } while (z->num_bits <= 24);
 }
@@ -471,16 +571,30 @@ static unsigned int _pngl_zreceive(_pngl_zbuf *z, int n) {
   unsigned int k;
   if (z->num_bits < n)
     _pngl_fill_bits(z);
-  k = z->code_buffer & ((1 << n) - 1);
+  k = (unsigned int)(z->code_buffer & ((1U << n) - 1));
   z->code_buffer >>= n;
   z->num_bits -= n;
   return k;
 }
 
-static int _pngl_zhuffman_decode_slowpath(_pngl_zbuf *a, _pngl_zhuffman *z) {
+static _pngl_uint64 _pngl_zload64(const pngl_uc *p) {
+#if defined(PNGL__X86_TARGET) || defined(PNGL__X64_TARGET)
+  _pngl_uint64 v;
+  memcpy(&v, p, 8);
+  return v;
+#else
+  return (_pngl_uint64)p[0] | ((_pngl_uint64)p[1] << 8) |
+         ((_pngl_uint64)p[2] << 16) | ((_pngl_uint64)p[3] << 24) |
+         ((_pngl_uint64)p[4] << 32) | ((_pngl_uint64)p[5] << 40) |
+         ((_pngl_uint64)p[6] << 48) | ((_pngl_uint64)p[7] << 56);
+#endif
+}
+
+static int _pngl_zhuffman_slow(_pngl_zhuffman *z, _pngl_uint64 bits,
+                               int *size) {
   int b, s, k;
-  k = _pngl_bit_reverse(a->code_buffer, 16);
-  for (s = 9 + 1;; ++s)
+  k = _pngl_bit_reverse((int)(bits & 0xffff), 16);
+  for (s = PNGL__ZFAST_BITS + 1;; ++s)
     if (k < z->maxcode[s])
       break;
   if (s >= 16)
@@ -490,9 +604,17 @@ static int _pngl_zhuffman_decode_slowpath(_pngl_zbuf *a, _pngl_zhuffman *z) {
     return -1;
   if (z->size[b] != s)
     return -1;
+  *size = s;
+  return z->value[b];
+}
+
+static int _pngl_zhuffman_decode_slowpath(_pngl_zbuf *a, _pngl_zhuffman *z) {
+  int s, v = _pngl_zhuffman_slow(z, a->code_buffer, &s);
+  if (v < 0)
+    return -1;
   a->code_buffer >>= s;
   a->num_bits -= s;
-  return z->value[b];
+  return v;
 }
 
 static int _pngl_zhuffman_decode(_pngl_zbuf *a, _pngl_zhuffman *z) {
@@ -509,9 +631,9 @@ static int _pngl_zhuffman_decode(_pngl_zbuf *a, _pngl_zhuffman *z) {
       _pngl_fill_bits(a);
     }
   }
-  b = z->fast[a->code_buffer & ((1 << 9) - 1)];
+  b = (int)z->fast[a->code_buffer & PNGL__ZFAST_MASK];
   if (b) {
-    s = b >> 9;
+    s = (b >> 9) & 15;
     a->code_buffer >>= s;
     a->num_bits -= s;
     return b & 511;
@@ -557,8 +679,98 @@ static const int _pngl_zdist_extra[32] = {0, 0, 0,  0,  1,  1,  2,  2,  3,  3,
                                           4, 4, 5,  5,  6,  6,  7,  7,  8,  8,
                                           9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
 
-static int _pngl_parse_huffman_block(_pngl_zbuf *a) {
+static int _pngl_parse_huffman_fast(_pngl_zbuf *a, int *done) {
+  const pngl_uc *in = a->zbuffer;
+  _pngl_uint64 bits = a->code_buffer;
+  int nb = a->num_bits;
   char *zout = a->zout;
+  _pngl_uint32 e;
+  pngl_uc *p;
+  int z, s, len, dist;
+  while (a->zbuffer_end - in >= 8 && a->zout_end - zout >= PNGL__ZSLACK) {
+    bits |= _pngl_zload64(in) << nb;
+    in += (63 - nb) >> 3;
+    nb |= 56;
+    e = a->z_length.fast[bits & PNGL__ZFAST_MASK];
+    if (e) {
+      z = (int)(e & 511);
+      s = (int)(e >> 21) & 31;
+    } else {
+      z = _pngl_zhuffman_slow(&a->z_length, bits, &s);
+      if (z < 0)
+        return _pngl_err("bad huffman code");
+    }
+    bits >>= s;
+    nb -= s;
+    if (z < 256) {
+      *zout++ = (char)z;
+      if (e >> 26)
+        *zout++ = (char)(e >> 13);
+      continue;
+    }
+    if (z == 256) {
+      *done = 1;
+      break;
+    }
+    if (z >= 286)
+      return _pngl_err("bad huffman code");
+    z -= 257;
+    len = _pngl_zlength_base[z];
+    s = _pngl_zlength_extra[z];
+    len += (int)(bits & ((1U << s) - 1));
+    bits >>= s;
+    nb -= s;
+    e = a->z_distance.fast[bits & PNGL__ZFAST_MASK];
+    if (e) {
+      z = (int)(e & 511);
+      s = (int)(e >> 9) & 15;
+    } else {
+      z = _pngl_zhuffman_slow(&a->z_distance, bits, &s);
+    }
+    if (z < 0 || z >= 30)
+      return _pngl_err("bad huffman code");
+    bits >>= s;
+    nb -= s;
+    dist = _pngl_zdist_base[z];
+    s = _pngl_zdist_extra[z];
+    dist += (int)(bits & ((1U << s) - 1));
+    bits >>= s;
+    nb -= s;
+    if (zout - a->zout_start < dist)
+      return _pngl_err("bad dist");
+    p = (pngl_uc *)(zout - dist);
+    if (dist >= 8) {
+      char *end = zout + len;
+      do {
+        memcpy(zout, p, 8);
+        zout += 8;
+        p += 8;
+      } while (zout < end);
+      zout = end;
+    } else if (dist == 1) {
+      memset(zout, *p, len);
+      zout += len;
+    } else {
+      do
+        *zout++ = (char)*p++;
+      while (--len);
+    }
+  }
+  a->zbuffer = (pngl_uc *)in;
+  a->code_buffer = bits & (((_pngl_uint64)1 << nb) - 1);
+  a->num_bits = nb;
+  a->zout = zout;
+  return 1;
+}
+
+static int _pngl_parse_huffman_block(_pngl_zbuf *a) {
+  char *zout;
+  int done = 0;
+  if (!_pngl_parse_huffman_fast(a, &done))
+    return 0;
+  if (done)
+    return 1;
+  zout = a->zout;
   for (;;) {
     int z = _pngl_zhuffman_decode(a, &a->z_length);
     if (z < 256) {
@@ -678,14 +890,12 @@ static int _pngl_parse_uncompressed_block(_pngl_zbuf *a) {
   int len, nlen, k;
   if (a->num_bits & 7)
     _pngl_zreceive(a, a->num_bits & 7);
-  k = 0;
-  while (a->num_bits > 0) {
-    header[k++] = (pngl_uc)(a->code_buffer & 255);
-    a->code_buffer >>= 8;
-    a->num_bits -= 8;
-  }
-  if (a->num_bits < 0)
+  if (a->num_bits < 0 || a->hit_zeof_once)
     return _pngl_err("zlib corrupt");
+  a->zbuffer -= a->num_bits >> 3;
+  a->code_buffer = 0;
+  a->num_bits = 0;
+  k = 0;
   while (k < 4)
     header[k++] = _pngl_zget8(a);
   len = header[1] * 256 + header[0];
@@ -761,6 +971,7 @@ static int _pngl_parse_zlib(_pngl_zbuf *a, int parse_header) {
         if (!_pngl_compute_huffman_codes(a))
           return 0;
       }
+      _pngl_zbuild_pairs(&a->z_length);
       if (!_pngl_parse_huffman_block(a))
         return 0;
     }
@@ -783,12 +994,15 @@ static char *pngl_zlib_decode_malloc_guesssize_headerflag(const char *buffer,
                                                           int *outlen,
                                                           int parse_header) {
   _pngl_zbuf a;
-  char *p = (char *)_pngl_malloc(initial_size);
+  char *p;
+  if (!_pngl_addsizes_valid(initial_size, PNGL__ZSLACK))
+    return (char *)(size_t)(_pngl_err("too large") ? 0 : 0);
+  p = (char *)_pngl_malloc((size_t)initial_size + PNGL__ZSLACK);
   if (p == 0)
     return 0;
   a.zbuffer = (pngl_uc *)buffer;
   a.zbuffer_end = (pngl_uc *)buffer + len;
-  if (_pngl_do_zlib(&a, p, initial_size, 1, parse_header)) {
+  if (_pngl_do_zlib(&a, p, initial_size + PNGL__ZSLACK, 1, parse_header)) {
     if (outlen)
       *outlen = (int)(a.zout - a.zout_start);
     return a.zout_start;
@@ -847,21 +1061,311 @@ static void _pngl_create_png_alpha_expand8(pngl_uc *dest, pngl_uc *src,
   }
 }
 
+static void _pngl_finish_row(pngl_uc *dest, pngl_uc *cur, _pngl_uint32 x,
+                             int img_n, int out_n, int depth, int color) {
+  _pngl_uint32 i;
+  if (depth < 8) {
+    pngl_uc scale = (color == 0) ? _pngl_depth_scale_table[depth] : 1;
+    pngl_uc *in = cur;
+    pngl_uc *out = dest;
+    pngl_uc inb = 0;
+    _pngl_uint32 nsmp = x * img_n;
+    if (depth == 4) {
+      for (i = 0; i < nsmp; ++i) {
+        if ((i & 1) == 0)
+          inb = *in++;
+        *out++ = (pngl_uc)(scale * (inb >> 4));
+        inb <<= 4;
+      }
+    } else if (depth == 2) {
+      for (i = 0; i < nsmp; ++i) {
+        if ((i & 3) == 0)
+          inb = *in++;
+        *out++ = (pngl_uc)(scale * (inb >> 6));
+        inb <<= 2;
+      }
+    } else {
+      for (i = 0; i < nsmp; ++i) {
+        if ((i & 7) == 0)
+          inb = *in++;
+        *out++ = (pngl_uc)(scale * (inb >> 7));
+        inb <<= 1;
+      }
+    }
+    if (img_n != out_n)
+      _pngl_create_png_alpha_expand8(dest, dest, x, img_n);
+  } else {
+    _pngl_convert_row(dest, cur, img_n, out_n, x);
+  }
+}
+
+static void _pngl_unfilter_row(pngl_uc *cur, const pngl_uc *prior,
+                               const pngl_uc *raw, int nk, int filter_bytes,
+                               int filter) {
+  int k;
+  switch (filter) {
+  case PNGL__F_none:
+    memcpy(cur, raw, nk);
+    break;
+  case PNGL__F_sub:
+    memcpy(cur, raw, filter_bytes);
+    for (k = filter_bytes; k < nk; ++k)
+      cur[k] = (pngl_uc)(raw[k] + cur[k - filter_bytes]);
+    break;
+  case PNGL__F_up:
+    for (k = 0; k < nk; ++k)
+      cur[k] = (pngl_uc)(raw[k] + prior[k]);
+    break;
+  case PNGL__F_avg:
+    for (k = 0; k < filter_bytes; ++k)
+      cur[k] = (pngl_uc)(raw[k] + (prior[k] >> 1));
+    for (k = filter_bytes; k < nk; ++k)
+      cur[k] = (pngl_uc)(raw[k] + ((prior[k] + cur[k - filter_bytes]) >> 1));
+    break;
+  case PNGL__F_paeth:
+    for (k = 0; k < filter_bytes; ++k)
+      cur[k] = (pngl_uc)(raw[k] + prior[k]);
+    for (k = filter_bytes; k < nk; ++k)
+      cur[k] = (pngl_uc)(raw[k] + _pngl_paeth(cur[k - filter_bytes], prior[k],
+                                              prior[k - filter_bytes]));
+    break;
+  case PNGL__F_avg_first:
+    memcpy(cur, raw, filter_bytes);
+    for (k = filter_bytes; k < nk; ++k)
+      cur[k] = (pngl_uc)(raw[k] + (cur[k - filter_bytes] >> 1));
+    break;
+  }
+}
+
+#ifdef PNGL_SSE2
+static __m128i _pngl_load_pixel(const pngl_uc *p, int n) {
+  int v;
+  if (n == 4)
+    memcpy(&v, p, 4);
+  else
+    v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return _mm_cvtsi32_si128(v);
+}
+
+static void _pngl_store_pixel(pngl_uc *p, __m128i v, int n) {
+  int x = _mm_cvtsi128_si32(v);
+  if (n == 4) {
+    memcpy(p, &x, 4);
+  } else {
+    p[0] = (pngl_uc)x;
+    p[1] = (pngl_uc)(x >> 8);
+    p[2] = (pngl_uc)(x >> 16);
+  }
+}
+
+static __m128i _pngl_abs16(__m128i v) {
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+static __m128i _pngl_select(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void _pngl_unfilter_paeth_sse2(pngl_uc *cur, const pngl_uc *prior,
+                                      const pngl_uc *raw, int nk, int n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero, b, pa, pb, pc, d, m;
+  int k;
+  for (k = 0; k < nk; k += n) {
+    b = _mm_unpacklo_epi8(_pngl_load_pixel(prior + k, n), zero);
+    pa = _mm_sub_epi16(b, c);
+    pb = _mm_sub_epi16(a, c);
+    pc = _pngl_abs16(_mm_add_epi16(pa, pb));
+    pa = _pngl_abs16(pa);
+    pb = _pngl_abs16(pb);
+    m = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    d = _pngl_select(_mm_cmpeq_epi16(pb, m), b, c);
+    d = _pngl_select(_mm_cmpeq_epi16(pa, m), a, d);
+    d = _mm_add_epi8(_mm_packus_epi16(d, d), _pngl_load_pixel(raw + k, n));
+    _pngl_store_pixel(cur + k, d, n);
+    a = _mm_unpacklo_epi8(d, zero);
+    c = b;
+  }
+}
+
+static int _pngl_unfilter_row_sse2(pngl_uc *cur, const pngl_uc *prior,
+                                   const pngl_uc *raw, int nk, int n,
+                                   int filter) {
+  __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128(), b;
+  int k = 0;
+  if (filter == PNGL__F_up) {
+    for (; k + 16 <= nk; k += 16) {
+      b = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(raw + k)),
+                       _mm_loadu_si128((const __m128i *)(prior + k)));
+      _mm_storeu_si128((__m128i *)(cur + k), b);
+    }
+    for (; k < nk; ++k)
+      cur[k] = (pngl_uc)(raw[k] + prior[k]);
+    return 1;
+  }
+  if (n != 3 && n != 4)
+    return 0;
+  switch (filter) {
+  case PNGL__F_sub:
+    for (; k < nk; k += n) {
+      a = _mm_add_epi8(a, _pngl_load_pixel(raw + k, n));
+      _pngl_store_pixel(cur + k, a, n);
+    }
+    return 1;
+  case PNGL__F_avg:
+    for (; k < nk; k += n) {
+      b = _pngl_load_pixel(prior + k, n);
+      b = _mm_sub_epi8(_mm_avg_epu8(a, b),
+                       _mm_and_si128(_mm_xor_si128(a, b), one));
+      a = _mm_add_epi8(b, _pngl_load_pixel(raw + k, n));
+      _pngl_store_pixel(cur + k, a, n);
+    }
+    return 1;
+  case PNGL__F_paeth:
+    if (n == 3)
+      _pngl_unfilter_paeth_sse2(cur, prior, raw, nk, 3);
+    else
+      _pngl_unfilter_paeth_sse2(cur, prior, raw, nk, 4);
+    return 1;
+  case PNGL__F_avg_first:
+    for (; k < nk; k += n) {
+      a = _mm_add_epi8(_pngl_load_pixel(raw + k, n),
+                       _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(127)));
+      _pngl_store_pixel(cur + k, a, n);
+    }
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+#ifdef PNGL_SSSE3
+/* Sub as a prefix sum over four pixels per step: two shifted adds, then
+   the carried pixel broadcast across all four lanes. */
+PNGL__TARGET_SSSE3
+static void _pngl_unfilter_sub_ssse3(pngl_uc *cur, const pngl_uc *raw, int nk,
+                                     int n) {
+  __m128i a = _mm_setzero_si128(), x, last;
+  int k = 0, step = n * 4;
+  if (n == 4) {
+    last = _mm_set_epi8(15, 14, 13, 12, 15, 14, 13, 12, 15, 14, 13, 12, 15, 14,
+                        13, 12);
+    for (; k + 16 <= nk; k += 16) {
+      x = _mm_loadu_si128((const __m128i *)(raw + k));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, a);
+      _mm_storeu_si128((__m128i *)(cur + k), x);
+      a = _mm_shuffle_epi8(x, last);
+    }
+  } else {
+    last = _mm_set_epi8(-1, -1, -1, -1, 11, 10, 9, 11, 10, 9, 11, 10, 9, 11, 10,
+                        9);
+    for (; k + 16 <= nk; k += step) {
+      x = _mm_loadu_si128((const __m128i *)(raw + k));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+      x = _mm_add_epi8(x, a);
+      _mm_storeu_si128((__m128i *)(cur + k), x);
+      a = _mm_shuffle_epi8(x, last);
+    }
+  }
+  for (; k < nk; k += n) {
+    a = _mm_add_epi8(a, _pngl_load_pixel(raw + k, n));
+    _pngl_store_pixel(cur + k, a, n);
+  }
+}
+
+PNGL__TARGET_SSSE3
+static void _pngl_unfilter_paeth_ssse3(pngl_uc *cur, const pngl_uc *prior,
+                                       const pngl_uc *raw, int nk, int n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero, b, pa, pb, pc, d, m;
+  int k;
+  for (k = 0; k < nk; k += n) {
+    b = _mm_unpacklo_epi8(_pngl_load_pixel(prior + k, n), zero);
+    pa = _mm_sub_epi16(b, c);
+    pb = _mm_sub_epi16(a, c);
+    pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+    pa = _mm_abs_epi16(pa);
+    pb = _mm_abs_epi16(pb);
+    m = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    d = _pngl_select(_mm_cmpeq_epi16(pb, m), b, c);
+    d = _pngl_select(_mm_cmpeq_epi16(pa, m), a, d);
+    d = _mm_add_epi8(_mm_packus_epi16(d, d), _pngl_load_pixel(raw + k, n));
+    _pngl_store_pixel(cur + k, d, n);
+    a = _mm_unpacklo_epi8(d, zero);
+    c = b;
+  }
+}
+
+static int _pngl_unfilter_row_ssse3(pngl_uc *cur, const pngl_uc *prior,
+                                    const pngl_uc *raw, int nk, int n,
+                                    int filter) {
+  if (n != 3 && n != 4)
+    return 0;
+  if (filter == PNGL__F_sub) {
+    _pngl_unfilter_sub_ssse3(cur, raw, nk, n);
+    return 1;
+  }
+  if (filter == PNGL__F_paeth) {
+    _pngl_unfilter_paeth_ssse3(cur, prior, raw, nk, n);
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+/* 0 = scalar, 1 = SSE2, 2 = SSE2 plus the SSSE3 Sub/Paeth kernels. */
+static int _pngl_simd_available(void) {
+#ifdef PNGL_SSE2
+  if (!_pngl_sse2_available())
+    return 0;
+#ifdef PNGL_SSSE3
+  if (_pngl_ssse3_available())
+    return 2;
+#endif
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static void _pngl_unfilter(pngl_uc *cur, const pngl_uc *prior,
+                           const pngl_uc *raw, int nk, int filter_bytes,
+                           int filter, int simd) {
+#ifdef PNGL_SSSE3
+  if (simd > 1 &&
+      _pngl_unfilter_row_ssse3(cur, prior, raw, nk, filter_bytes, filter))
+    return;
+#endif
+#ifdef PNGL_SSE2
+  if (simd &&
+      _pngl_unfilter_row_sse2(cur, prior, raw, nk, filter_bytes, filter))
+    return;
+#else
+  (void)simd;
+#endif
+  _pngl_unfilter_row(cur, prior, raw, nk, filter_bytes, filter);
+}
+
 static int _pngl_create_png_image_raw(_pngl_png *a, pngl_uc *raw,
                                       _pngl_uint32 raw_len, int out_n,
                                       _pngl_uint32 x, _pngl_uint32 y, int depth,
                                       int color) {
   int bytes = 1;
   _pngl_context *s = a->s;
-  _pngl_uint32 i, j, stride = x * out_n * bytes;
+  _pngl_uint32 j, stride = x * out_n * bytes;
   _pngl_uint32 img_len, img_width_bytes;
   pngl_uc *filter_buf;
   int all_ok = 1;
-  int k;
   int img_n = s->img_n;
   int output_bytes = out_n * bytes;
   int filter_bytes = img_n * bytes;
   int width = (int)x;
+  int direct = depth == 8 && img_n == out_n;
+  int simd = _pngl_simd_available();
   pngl_uc first_row_filter[5] = {PNGL__F_none, PNGL__F_sub, PNGL__F_none,
                                  PNGL__F_avg_first, PNGL__F_sub};
 
@@ -903,76 +1407,15 @@ static int _pngl_create_png_image_raw(_pngl_png *a, pngl_uc *raw,
     }
     if (j == 0)
       filter = first_row_filter[filter];
-
-    switch (filter) {
-    case PNGL__F_none:
-      memcpy(cur, raw, nk);
-      break;
-    case PNGL__F_sub:
-      memcpy(cur, raw, filter_bytes);
-      for (k = filter_bytes; k < nk; ++k)
-        cur[k] = (pngl_uc)(raw[k] + cur[k - filter_bytes]);
-      break;
-    case PNGL__F_up:
-      for (k = 0; k < nk; ++k)
-        cur[k] = (pngl_uc)(raw[k] + prior[k]);
-      break;
-    case PNGL__F_avg:
-      for (k = 0; k < filter_bytes; ++k)
-        cur[k] = (pngl_uc)(raw[k] + (prior[k] >> 1));
-      for (k = filter_bytes; k < nk; ++k)
-        cur[k] = (pngl_uc)(raw[k] + ((prior[k] + cur[k - filter_bytes]) >> 1));
-      break;
-    case PNGL__F_paeth:
-      for (k = 0; k < filter_bytes; ++k)
-        cur[k] = (pngl_uc)(raw[k] + prior[k]);
-      for (k = filter_bytes; k < nk; ++k)
-        cur[k] = (pngl_uc)(raw[k] + _pngl_paeth(cur[k - filter_bytes], prior[k],
-                                                prior[k - filter_bytes]));
-      break;
-    case PNGL__F_avg_first:
-      memcpy(cur, raw, filter_bytes);
-      for (k = filter_bytes; k < nk; ++k)
-        cur[k] = (pngl_uc)(raw[k] + (cur[k - filter_bytes] >> 1));
-      break;
+    if (direct) {
+      cur = dest;
+      prior = j ? dest - stride : dest;
     }
+
+    _pngl_unfilter(cur, prior, raw, nk, filter_bytes, filter, simd);
     raw += nk;
-    if (depth < 8) {
-      pngl_uc scale = (color == 0) ? _pngl_depth_scale_table[depth] : 1;
-      pngl_uc *in = cur;
-      pngl_uc *out = dest;
-      pngl_uc inb = 0;
-      _pngl_uint32 nsmp = x * img_n;
-      if (depth == 4) {
-        for (i = 0; i < nsmp; ++i) {
-          if ((i & 1) == 0)
-            inb = *in++;
-          *out++ = (pngl_uc)(scale * (inb >> 4));
-          inb <<= 4;
-        }
-      } else if (depth == 2) {
-        for (i = 0; i < nsmp; ++i) {
-          if ((i & 3) == 0)
-            inb = *in++;
-          *out++ = (pngl_uc)(scale * (inb >> 6));
-          inb <<= 2;
-        }
-      } else {
-        for (i = 0; i < nsmp; ++i) {
-          if ((i & 7) == 0)
-            inb = *in++;
-          *out++ = (pngl_uc)(scale * (inb >> 7));
-          inb <<= 1;
-        }
-      }
-      if (img_n != out_n)
-        _pngl_create_png_alpha_expand8(dest, dest, x, img_n);
-    } else if (depth == 8) {
-      if (img_n == out_n)
-        memcpy(dest, cur, x * img_n);
-      else
-        _pngl_create_png_alpha_expand8(dest, cur, x, img_n);
-    }
+    if (!direct)
+      _pngl_finish_row(dest, cur, x, img_n, out_n, depth, color);
   }
   free(filter_buf);
   if (!all_ok)
@@ -1034,11 +1477,9 @@ static int _pngl_create_png_image(_pngl_png *a, pngl_uc *image_data,
   return 1;
 }
 
-static int _pngl_compute_transparency(_pngl_png *z, pngl_uc tc[3], int out_n) {
-  _pngl_context *s = z->s;
-  _pngl_uint32 i, pixel_count = s->img_x * s->img_y;
-  pngl_uc *p = z->out;
-
+static int _pngl_compute_transparency(pngl_uc *p, _pngl_uint32 pixel_count,
+                                      pngl_uc tc[3], int out_n) {
+  _pngl_uint32 i;
   if (out_n == 2) {
     for (i = 0; i < pixel_count; ++i) {
       p[1] = (p[0] == tc[0] ? 0 : 255);
@@ -1129,13 +1570,84 @@ static void _pngl_de_iphone(_pngl_png *z) {
   }
 }
 
+static _pngl_uint32 _pngl_raw_size(_pngl_uint32 x, _pngl_uint32 y, int img_n,
+                                   int depth, int interlaced) {
+  static const int xorig[] = {0, 4, 0, 2, 0, 1, 0};
+  static const int yorig[] = {0, 0, 4, 0, 2, 0, 1};
+  static const int xspc[] = {8, 8, 4, 4, 2, 2, 1};
+  static const int yspc[] = {8, 8, 8, 4, 4, 2, 2};
+  _pngl_uint32 total = 0, px, py;
+  int p;
+  if (!interlaced)
+    return (((img_n * x * depth) + 7) >> 3) * y + y;
+  for (p = 0; p < 7; ++p) {
+    px = (x - xorig[p] + xspc[p] - 1) / xspc[p];
+    py = (y - yorig[p] + yspc[p] - 1) / yspc[p];
+    if (x > (_pngl_uint32)xorig[p] && y > (_pngl_uint32)yorig[p])
+      total += ((((img_n * px * depth) + 7) >> 3) + 1) * py;
+  }
+  return total;
+}
+
+static int _pngl_unknown_chunk(_pngl_uint32 type) {
+  static char invalid_chunk[] = "XXXX PNG chunk not known";
+  invalid_chunk[0] = (pngl_uc)((type >> 24) & 255);
+  invalid_chunk[1] = (pngl_uc)((type >> 16) & 255);
+  invalid_chunk[2] = (pngl_uc)((type >> 8) & 255);
+  invalid_chunk[3] = (pngl_uc)((type >> 0) & 255);
+  return _pngl_err(invalid_chunk);
+}
+
+static int _pngl_parse_ihdr(_pngl_png *z, _pngl_pngchunk c, int *color,
+                            int *interlace, pngl_uc *pal_img_n) {
+  _pngl_context *s = z->s;
+  int comp, filter;
+  if (c.length != 13)
+    return _pngl_err("bad IHDR len");
+  s->img_x = _pngl_get32be(s);
+  s->img_y = _pngl_get32be(s);
+
+  z->depth = _pngl_get8(s);
+  if (z->depth != 1 && z->depth != 2 && z->depth != 4 && z->depth != 8)
+    return _pngl_err("1/2/4/8-bit only (16-bit removed)");
+  *color = _pngl_get8(s);
+  if (*color > 6)
+    return _pngl_err("bad ctype");
+  if (*color & 1)
+    return _pngl_err("bad ctype");
+  comp = _pngl_get8(s);
+  if (comp)
+    return _pngl_err("bad comp method");
+  filter = _pngl_get8(s);
+  if (filter)
+    return _pngl_err("bad filter method");
+  *interlace = _pngl_get8(s);
+  if (*interlace > 1)
+    return _pngl_err("bad interlace method");
+
+  if (!s->img_x || !s->img_y)
+    return _pngl_err("0-pixel image");
+
+  if (*color == 3) {
+    *pal_img_n = 3;
+    s->img_n = 1;
+    if (0x7fffffff / s->img_x / 4 < s->img_y)
+      return _pngl_err("too large");
+  } else {
+    s->img_n = (*color & 2 ? 3 : 1) + (*color & 4 ? 1 : 0);
+    if (0x7fffffff / s->img_x / s->img_n < s->img_y)
+      return _pngl_err("too large");
+  }
+  return 1;
+}
+
 static int _pngl_parse_png_file(_pngl_png *z, int scan, int req_comp) {
   pngl_uc palette[1024], pal_img_n = 0;
   pngl_uc has_trans = 0, tc[3] = {0};
   _pngl_uint32 ioff = 0, idata_limit = 0, i, pal_len = 0;
   int first = 1, k, interlace = 0, color = 0, is_iphone = 0;
   _pngl_context *s = z->s;
-  _pngl_uint32 raw_len, bpl;
+  _pngl_uint32 raw_len;
 
   z->expanded = 0;
   z->idata = 0;
@@ -1161,46 +1673,11 @@ static int _pngl_parse_png_file(_pngl_png *z, int scan, int req_comp) {
       break;
     case (((unsigned)('I') << 24) + ((unsigned)('H') << 16) +
           ((unsigned)('D') << 8) + (unsigned)('R')): {
-      int comp, filter;
       if (!first)
         return _pngl_err("multiple IHDR");
       first = 0;
-      if (c.length != 13)
-        return _pngl_err("bad IHDR len");
-      s->img_x = _pngl_get32be(s);
-      s->img_y = _pngl_get32be(s);
-
-      z->depth = _pngl_get8(s);
-      if (z->depth != 1 && z->depth != 2 && z->depth != 4 && z->depth != 8)
-        return _pngl_err("1/2/4/8-bit only (16-bit removed)");
-      color = _pngl_get8(s);
-      if (color > 6)
-        return _pngl_err("bad ctype");
-      if (color & 1)
-        return _pngl_err("bad ctype");
-      comp = _pngl_get8(s);
-      if (comp)
-        return _pngl_err("bad comp method");
-      filter = _pngl_get8(s);
-      if (filter)
-        return _pngl_err("bad filter method");
-      interlace = _pngl_get8(s);
-      if (interlace > 1)
-        return _pngl_err("bad interlace method");
-
-      if (!s->img_x || !s->img_y)
-        return _pngl_err("0-pixel image");
-
-      if (color == 3) {
-        pal_img_n = 3;
-        s->img_n = 1;
-        if (0x7fffffff / s->img_x / 4 < s->img_y)
-          return _pngl_err("too large");
-      } else {
-        s->img_n = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
-        if (0x7fffffff / s->img_x / s->img_n < s->img_y)
-          return _pngl_err("too large");
-      }
+      if (!_pngl_parse_ihdr(z, c, &color, &interlace, &pal_img_n))
+        return 0;
       break;
     }
     case (((unsigned)('P') << 24) + ((unsigned)('L') << 16) +
@@ -1288,14 +1765,8 @@ static int _pngl_parse_png_file(_pngl_png *z, int scan, int req_comp) {
     default:
       if (first)
         return _pngl_err("first not IHDR");
-      if ((c.type & (1 << 29)) == 0) {
-        static char invalid_chunk[] = "XXXX PNG chunk not known";
-        invalid_chunk[0] = (pngl_uc)((c.type >> 24) & 255);
-        invalid_chunk[1] = (pngl_uc)((c.type >> 16) & 255);
-        invalid_chunk[2] = (pngl_uc)((c.type >> 8) & 255);
-        invalid_chunk[3] = (pngl_uc)((c.type >> 0) & 255);
-        return _pngl_err(invalid_chunk);
-      }
+      if ((c.type & (1 << 29)) == 0)
+        return _pngl_unknown_chunk(c.type);
       _pngl_skip(s, (int)c.length);
       break;
     }
@@ -1307,8 +1778,7 @@ static int _pngl_parse_png_file(_pngl_png *z, int scan, int req_comp) {
 
   if (z->idata == 0)
     return _pngl_err("no IDAT");
-  bpl = (s->img_x * z->depth + 7) / 8;
-  raw_len = bpl * s->img_y * s->img_n + s->img_y;
+  raw_len = _pngl_raw_size(s->img_x, s->img_y, s->img_n, z->depth, interlace);
 
   z->expanded = (pngl_uc *)pngl_zlib_decode_malloc_guesssize_headerflag(
       (char *)z->idata, (int)ioff, (int)raw_len, (int *)&raw_len, !is_iphone);
@@ -1319,7 +1789,10 @@ static int _pngl_parse_png_file(_pngl_png *z, int scan, int req_comp) {
   free(z->idata);
   z->idata = 0;
 
-  if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) || has_trans)
+  if (req_comp && z->depth == 8 && !pal_img_n && !has_trans && !is_iphone)
+    s->img_out_n = req_comp;
+  else if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) ||
+           has_trans)
     s->img_out_n = s->img_n + 1;
   else
     s->img_out_n = s->img_n;
@@ -1329,7 +1802,8 @@ static int _pngl_parse_png_file(_pngl_png *z, int scan, int req_comp) {
     return 0;
 
   if (has_trans) {
-    if (!_pngl_compute_transparency(z, tc, s->img_out_n))
+    if (!_pngl_compute_transparency(z->out, s->img_x * s->img_y, tc,
+                                    s->img_out_n))
       return 0;
   }
 
@@ -1472,6 +1946,503 @@ PNGLDEF void pngl_set_flip_vertically_on_load(int flag_true_if_should_flip) {
   _pngl_vertically_flip_on_load_global = flag_true_if_should_flip;
 }
 
+
+#define PNGL__CHUNK(a, b, c, d)                                                \
+  (((unsigned)(a) << 24) + ((unsigned)(b) << 16) + ((unsigned)(c) << 8) +     \
+   (unsigned)(d))
+
+#define PNGL__STREAM_WINDOW 32768
+#define PNGL__STREAM_INPUT 65536
+
+enum {
+  PNGL__ST_sig = 0,
+  PNGL__ST_head,
+  PNGL__ST_body,
+  PNGL__ST_crc,
+  PNGL__ST_end
+};
+
+enum {
+  PNGL__ZS_header = 0,
+  PNGL__ZS_block,
+  PNGL__ZS_huffman,
+  PNGL__ZS_stored,
+  PNGL__ZS_done
+};
+
+struct pngl_stream {
+  _pngl_context s;
+  _pngl_png png;
+  _pngl_zbuf z;
+  pngl_row_callback cb;
+  void *user;
+  int req_comp, mid_n, out_n;
+  int state, zstate, last_block, stored_left;
+  int failed, started, final, first;
+  int color, interlace, has_trans, simd;
+  pngl_uc pal_img_n, tc[3];
+  pngl_uc head[8], small[16];
+  int head_len;
+  _pngl_uint32 chunk_type, chunk_len, chunk_pos;
+  pngl_uc *in;
+  int in_len, in_cap;
+  char *win, *rpos;
+  int win_cap;
+  pngl_uc *filter_buf, *row, *conv;
+  _pngl_uint32 row_bytes, y;
+};
+
+static int _pngl_stream_setup(pngl_stream *st) {
+  _pngl_context *s = &st->s;
+  int depth = st->png.depth;
+  int req = st->req_comp;
+  int window;
+  if (st->interlace)
+    return _pngl_err("interlaced stream unsupported");
+  if (req && depth == 8 && !st->has_trans)
+    st->mid_n = req;
+  else if ((req == s->img_n + 1 && req != 3) || st->has_trans)
+    st->mid_n = s->img_n + 1;
+  else
+    st->mid_n = s->img_n;
+  st->out_n = req ? req : st->mid_n;
+  if (!_pngl_mad3sizes_valid(s->img_n, (int)s->img_x, depth, 7))
+    return _pngl_err("too large");
+  st->row_bytes = ((s->img_n * s->img_x * depth) + 7) >> 3;
+  window = 2 * (int)(st->row_bytes + 1);
+  if (!_pngl_mad2sizes_valid((int)st->row_bytes + 1, 2, 0) ||
+      !_pngl_addsizes_valid(window, PNGL__STREAM_WINDOW + PNGL__ZSLACK))
+    return _pngl_err("too large");
+  if (window < 8 * PNGL__STREAM_WINDOW)
+    window = 8 * PNGL__STREAM_WINDOW;
+  st->win_cap = window + PNGL__STREAM_WINDOW + PNGL__ZSLACK;
+  st->win = (char *)_pngl_malloc((size_t)st->win_cap);
+  st->filter_buf = (pngl_uc *)_pngl_malloc_mad2((int)st->row_bytes, 2, 0);
+  st->row = (pngl_uc *)_pngl_malloc_mad3((int)s->img_x, 4, 2, 0);
+  if (!st->win || !st->filter_buf || !st->row)
+    return _pngl_err("outofmem");
+  st->conv = st->row + s->img_x * 4;
+  st->z.zout_start = st->z.zout = st->rpos = st->win;
+  st->z.zout_end = st->win + st->win_cap;
+  st->z.z_expandable = 0;
+  st->z.zbuffer = st->z.zbuffer_end = st->in;
+  st->simd = _pngl_simd_available();
+  st->started = 1;
+  return 1;
+}
+
+static int _pngl_stream_append(pngl_stream *st, pngl_uc const *data, int len) {
+  _pngl_zbuf *a = &st->z;
+  int pos = (int)(a->zbuffer - st->in);
+  int keep = pos > 8 ? pos - 8 : 0;
+  if (keep && st->in_len + len + 16 > st->in_cap) {
+    memmove(st->in, st->in + keep, (size_t)(st->in_len - keep));
+    st->in_len -= keep;
+    pos -= keep;
+  }
+  if (!_pngl_addsizes_valid(st->in_len, len + 16))
+    return _pngl_err("too large");
+  if (st->in_len + len + 16 > st->in_cap) {
+    int cap = st->in_cap ? st->in_cap : 4096;
+    pngl_uc *p;
+    while (cap < st->in_len + len + 16) {
+      if (cap > 0x7fffffff / 2)
+        return _pngl_err("outofmem");
+      cap *= 2;
+    }
+    p = (pngl_uc *)realloc(st->in, (size_t)cap);
+    if (p == 0)
+      return _pngl_err("outofmem");
+    st->in = p;
+    st->in_cap = cap;
+  }
+  if (len)
+    memcpy(st->in + st->in_len, data, (size_t)len);
+  st->in_len += len;
+  a->zbuffer = st->in + pos;
+  a->zbuffer_end = st->in + st->in_len;
+  return 1;
+}
+
+static int _pngl_stream_block(pngl_stream *st) {
+  _pngl_zbuf *a = &st->z;
+  int type, len, nlen;
+  st->last_block = (int)_pngl_zreceive(a, 1);
+  type = (int)_pngl_zreceive(a, 2);
+  if (type == 0) {
+    if (a->num_bits & 7)
+      _pngl_zreceive(a, a->num_bits & 7);
+    if (a->num_bits < 0 || a->hit_zeof_once)
+      return _pngl_err("zlib corrupt");
+    a->zbuffer -= a->num_bits >> 3;
+    a->code_buffer = 0;
+    a->num_bits = 0;
+    len = _pngl_zget8(a);
+    len += _pngl_zget8(a) * 256;
+    nlen = _pngl_zget8(a);
+    nlen += _pngl_zget8(a) * 256;
+    if (nlen != (len ^ 0xffff))
+      return _pngl_err("zlib corrupt");
+    st->stored_left = len;
+    st->zstate = PNGL__ZS_stored;
+    return 1;
+  }
+  if (type == 3)
+    return _pngl_err("zlib corrupt");
+  if (type == 1) {
+    if (!_pngl_zbuild_huffman(&a->z_length, _pngl_zdefault_length, 288))
+      return 0;
+    if (!_pngl_zbuild_huffman(&a->z_distance, _pngl_zdefault_distance, 32))
+      return 0;
+  } else {
+    if (!_pngl_compute_huffman_codes(a))
+      return 0;
+  }
+  _pngl_zbuild_pairs(&a->z_length);
+  st->zstate = PNGL__ZS_huffman;
+  return 1;
+}
+
+static int _pngl_stream_inflate(pngl_stream *st) {
+  _pngl_zbuf *a = &st->z;
+  pngl_uc *end = st->in + st->in_len;
+  int done, n;
+  for (;;) {
+    switch (st->zstate) {
+    case PNGL__ZS_header:
+      if (!st->final && end - a->zbuffer < 3)
+        return 1;
+      if (!_pngl_parse_zlib_header(a))
+        return 0;
+      a->num_bits = 0;
+      a->code_buffer = 0;
+      a->hit_zeof_once = 0;
+      st->zstate = PNGL__ZS_block;
+      break;
+    case PNGL__ZS_block:
+      if (!st->final && end - a->zbuffer < 1024)
+        return 1;
+      if (!_pngl_stream_block(st))
+        return 0;
+      break;
+    case PNGL__ZS_huffman:
+      done = 0;
+      if (!_pngl_parse_huffman_fast(a, &done))
+        return 0;
+      if (done) {
+        if (a->zbuffer - (a->num_bits >> 3) > end)
+          return _pngl_err("unexpected end");
+        st->zstate = st->last_block ? PNGL__ZS_done : PNGL__ZS_block;
+        break;
+      }
+      if (a->zout_end - a->zout < PNGL__ZSLACK || !st->final)
+        return 1;
+      return _pngl_err("unexpected end");
+    case PNGL__ZS_stored:
+      n = st->stored_left;
+      if (n > end - a->zbuffer)
+        n = (int)(end - a->zbuffer);
+      if (n > a->zout_end - a->zout)
+        n = (int)(a->zout_end - a->zout);
+      memcpy(a->zout, a->zbuffer, (size_t)n);
+      a->zout += n;
+      a->zbuffer += n;
+      st->stored_left -= n;
+      if (st->stored_left == 0) {
+        st->zstate = st->last_block ? PNGL__ZS_done : PNGL__ZS_block;
+        break;
+      }
+      if (a->zout == a->zout_end || !st->final)
+        return 1;
+      return _pngl_err("read past buffer");
+    default:
+      return 1;
+    }
+  }
+}
+
+static void _pngl_stream_slide(pngl_stream *st) {
+  _pngl_zbuf *a = &st->z;
+  char *keep = a->zout - PNGL__STREAM_WINDOW;
+  int n;
+  if (keep > st->rpos)
+    keep = st->rpos;
+  if (keep <= st->win)
+    return;
+  n = (int)(keep - st->win);
+  memmove(st->win, keep, (size_t)(a->zout - keep));
+  a->zout -= n;
+  st->rpos -= n;
+}
+
+static int _pngl_stream_row(pngl_stream *st, pngl_uc *dest) {
+  static const pngl_uc first_row_filter[5] = {
+      PNGL__F_none, PNGL__F_sub, PNGL__F_none, PNGL__F_avg_first, PNGL__F_sub};
+  _pngl_context *s = &st->s;
+  pngl_uc *raw = (pngl_uc *)st->rpos;
+  pngl_uc *cur = st->filter_buf + (st->y & 1) * st->row_bytes;
+  pngl_uc *prior = st->filter_buf + (~st->y & 1) * st->row_bytes;
+  pngl_uc *px = cur;
+  int filter = *raw++;
+  if (filter > 4)
+    return _pngl_err("invalid filter");
+  if (st->y == 0)
+    filter = first_row_filter[filter];
+  _pngl_unfilter(cur, prior, raw, (int)st->row_bytes,
+                 st->png.depth < 8 ? 1 : s->img_n, filter, st->simd);
+  st->rpos += st->row_bytes + 1;
+  if (st->png.depth < 8 || s->img_n != st->mid_n) {
+    _pngl_finish_row(st->row, cur, s->img_x, s->img_n, st->mid_n,
+                     st->png.depth, st->color);
+    px = st->row;
+  }
+  if (st->has_trans)
+    _pngl_compute_transparency(px, s->img_x, st->tc, st->mid_n);
+  if (st->out_n != st->mid_n) {
+    if (!_pngl_convert_row(st->conv, px, st->mid_n, st->out_n, s->img_x))
+      return _pngl_err("unsupported");
+    px = st->conv;
+  }
+  if (dest)
+    memcpy(dest, px, (size_t)s->img_x * st->out_n);
+  else
+    st->cb(st->user, (int)st->y, px, (int)s->img_x, st->out_n);
+  ++st->y;
+  return 1;
+}
+
+static int _pngl_stream_pump(pngl_stream *st, pngl_uc *out, int stride,
+                             int max_rows) {
+  _pngl_zbuf *a = &st->z;
+  int n = 0;
+  if (st->failed)
+    return -1;
+  if (!st->started)
+    return 0;
+  while (n < max_rows && st->y < st->s.img_y) {
+    char *zout;
+    pngl_uc *zin;
+    int zstate;
+    if (a->zout - st->rpos > (int)st->row_bytes) {
+      if (!_pngl_stream_row(st, out ? out + (size_t)n * stride : 0)) {
+        st->failed = 1;
+        return -1;
+      }
+      ++n;
+      continue;
+    }
+    if (st->zstate == PNGL__ZS_done) {
+      st->failed = 1;
+      return _pngl_err("not enough pixels") - 1;
+    }
+    if (a->zout_end - a->zout < PNGL__ZSLACK)
+      _pngl_stream_slide(st);
+    zout = a->zout;
+    zin = a->zbuffer;
+    zstate = st->zstate;
+    if (!_pngl_stream_inflate(st)) {
+      st->failed = 1;
+      return -1;
+    }
+    if (a->zout == zout && a->zbuffer == zin && st->zstate == zstate)
+      break;
+  }
+  return n;
+}
+
+static int _pngl_stream_chunk(pngl_stream *st) {
+  _pngl_context *s = &st->s;
+  _pngl_pngchunk c;
+  int k;
+  c.length = st->chunk_len;
+  c.type = st->chunk_type;
+  _pngl_start_mem(s, st->small, (int)c.length);
+  if (c.type == PNGL__CHUNK('I', 'H', 'D', 'R'))
+    return _pngl_parse_ihdr(&st->png, c, &st->color, &st->interlace,
+                            &st->pal_img_n);
+  if (c.type == PNGL__CHUNK('t', 'R', 'N', 'S')) {
+    if (!(s->img_n & 1))
+      return _pngl_err("tRNS with alpha");
+    if (c.length != (_pngl_uint32)s->img_n * 2)
+      return _pngl_err("bad tRNS len");
+    st->has_trans = 1;
+    for (k = 0; k < s->img_n && k < 3; ++k)
+      st->tc[k] = (pngl_uc)(_pngl_get16be(s) & 255) *
+                  _pngl_depth_scale_table[st->png.depth];
+  }
+  return 1;
+}
+
+static int _pngl_stream_head(pngl_stream *st) {
+  pngl_uc *h = st->head;
+  _pngl_uint32 type;
+  st->chunk_len = ((_pngl_uint32)h[0] << 24) + (h[1] << 16) + (h[2] << 8) +
+                  h[3];
+  st->chunk_type = type = PNGL__CHUNK(h[4], h[5], h[6], h[7]);
+  st->chunk_pos = 0;
+  st->state = PNGL__ST_body;
+  if (type == PNGL__CHUNK('I', 'E', 'N', 'D')) {
+    st->state = PNGL__ST_end;
+    if (!st->started)
+      return _pngl_err("no IDAT");
+    if (!_pngl_stream_append(st, 0, 0))
+      return 0;
+    memset(st->in + st->in_len, 0, 16);
+    st->z.zbuffer_end += 16;
+    st->final = 1;
+    return 1;
+  }
+  if (type == PNGL__CHUNK('I', 'H', 'D', 'R')) {
+    if (!st->first)
+      return _pngl_err("multiple IHDR");
+    st->first = 0;
+    if (st->chunk_len > sizeof(st->small))
+      return _pngl_err("bad IHDR len");
+    return 1;
+  }
+  if (st->first)
+    return _pngl_err("first not IHDR");
+  switch (type) {
+  case PNGL__CHUNK('C', 'g', 'B', 'I'):
+    return _pngl_err("CgBI stream unsupported");
+  case PNGL__CHUNK('t', 'R', 'N', 'S'):
+    if (st->started)
+      return _pngl_err("tRNS after IDAT");
+    if (st->chunk_len > sizeof(st->small))
+      return _pngl_err("bad tRNS len");
+    return 1;
+  case PNGL__CHUNK('I', 'D', 'A', 'T'):
+    if (st->chunk_len > (1U << 30))
+      return _pngl_err("IDAT size limit");
+    if (!st->started && !_pngl_stream_setup(st))
+      return 0;
+    return 1;
+  case PNGL__CHUNK('P', 'L', 'T', 'E'):
+    return 1;
+  }
+  if ((type & (1 << 29)) == 0)
+    return _pngl_unknown_chunk(type);
+  return 1;
+}
+
+static int _pngl_stream_parse(pngl_stream *st, pngl_uc const *data, int len) {
+  static const pngl_uc png_sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  while (len > 0) {
+    int n;
+    switch (st->state) {
+    case PNGL__ST_sig:
+      if (*data != png_sig[st->head_len])
+        return _pngl_err("bad png sig");
+      ++data;
+      --len;
+      if (++st->head_len == 8) {
+        st->head_len = 0;
+        st->state = PNGL__ST_head;
+      }
+      break;
+    case PNGL__ST_head:
+      st->head[st->head_len++] = *data++;
+      --len;
+      if (st->head_len == 8) {
+        st->head_len = 0;
+        if (!_pngl_stream_head(st))
+          return 0;
+      }
+      break;
+    case PNGL__ST_body:
+      n = (int)(st->chunk_len - st->chunk_pos);
+      if (n > len)
+        n = len;
+      if (st->chunk_type == PNGL__CHUNK('I', 'D', 'A', 'T')) {
+        if (st->cb && n > PNGL__STREAM_INPUT)
+          n = PNGL__STREAM_INPUT;
+        if (!_pngl_stream_append(st, data, n))
+          return 0;
+        if (st->cb && _pngl_stream_pump(st, 0, 0, 0x7fffffff) < 0)
+          return 0;
+      } else if (st->chunk_len <= sizeof(st->small)) {
+        memcpy(st->small + st->chunk_pos, data, (size_t)n);
+      }
+      data += n;
+      len -= n;
+      st->chunk_pos += (_pngl_uint32)n;
+      break;
+    case PNGL__ST_crc:
+      ++data;
+      --len;
+      if (++st->head_len == 4) {
+        st->head_len = 0;
+        st->state = PNGL__ST_head;
+      }
+      break;
+    default:
+      return 1;
+    }
+    if (st->state == PNGL__ST_body && st->chunk_pos == st->chunk_len) {
+      if (!_pngl_stream_chunk(st))
+        return 0;
+      st->state = PNGL__ST_crc;
+    }
+  }
+  return 1;
+}
+
+PNGLDEF pngl_stream *pngl_stream_begin(int req_comp, pngl_row_callback cb,
+                                       void *user) {
+  pngl_stream *st;
+  if (req_comp < 0 || req_comp > 4)
+    return (pngl_stream *)(size_t)(_pngl_err("bad req_comp") ? 0 : 0);
+  st = (pngl_stream *)_pngl_malloc(sizeof(pngl_stream));
+  if (!st)
+    return (pngl_stream *)(size_t)(_pngl_err("outofmem") ? 0 : 0);
+  memset(st, 0, sizeof(*st));
+  st->png.s = &st->s;
+  st->req_comp = req_comp;
+  st->cb = cb;
+  st->user = user;
+  st->first = 1;
+  return st;
+}
+
+PNGLDEF int pngl_stream_feed(pngl_stream *st, pngl_uc const *data, int len) {
+  if (st->failed)
+    return 0;
+  if (!_pngl_stream_parse(st, data, len)) {
+    st->failed = 1;
+    return 0;
+  }
+  if (st->cb && _pngl_stream_pump(st, 0, 0, 0x7fffffff) < 0)
+    return 0;
+  return 1;
+}
+
+PNGLDEF int pngl_stream_next_rows(pngl_stream *st, pngl_uc *out, int stride,
+                                  int max_rows) {
+  return _pngl_stream_pump(st, out, stride, max_rows);
+}
+
+PNGLDEF int pngl_stream_info(pngl_stream *st, int *x, int *y, int *comp) {
+  if (!st->started)
+    return 0;
+  if (x)
+    *x = (int)st->s.img_x;
+  if (y)
+    *y = (int)st->s.img_y;
+  if (comp)
+    *comp = st->s.img_n + st->has_trans;
+  return 1;
+}
+
+PNGLDEF void pngl_stream_free(pngl_stream *st) {
+  if (!st)
+    return;
+  free(st->in);
+  free(st->win);
+  free(st->filter_buf);
+  free(st->row);
+  free(st);
+}
+
 #endif /* PNGL_IMPLEMENTATION */
 
 #endif /* INCLUDE_PNGL */
@@ -1502,6 +2473,11 @@ PNGLWDEF int pngl_write_png_to_func(pngl_write_func *func, void *context, int w,
                                     int h, int comp, const void *data,
                                     int stride_in_bytes);
 PNGLWDEF void pngl_flip_vertically_on_write(int flip_boolean);
+typedef void pngl_write_band_func(void *data, int b0, int b1);
+typedef void pngl_write_parallel_func(pngl_write_band_func *func, void *data,
+                                      int count);
+PNGLWDEF void pngl_write_set_parallel(pngl_write_parallel_func *func,
+                                      int max_bands);
 #endif
 #ifdef PNGL_WRITE_IMPLEMENTATION
 #ifndef PNGL_WRITE_NO_STDIO
@@ -1535,9 +2511,16 @@ int pngl_write_png_compression_level = 8;
 int pngl_write_force_png_filter = -1;
 #endif
 static int _pngl_flip_vertically_on_write = 0;
+static pngl_write_parallel_func *_pngl_write_parallel = 0;
+static int _pngl_write_max_bands = 1;
 PNGLWDEF void pngl_flip_vertically_on_write(int flag) {
   _pngl_flip_vertically_on_write = flag;
 }
+PNGLWDEF void pngl_write_set_parallel(pngl_write_parallel_func *func,
+                                      int max_bands) {
+  _pngl_write_parallel = func;
+  _pngl_write_max_bands = max_bands < 1 ? 1 : max_bands;
+}
 #ifndef PNGLW_ZLIB_COMPRESS
 #define pnglw__sbraw(a) ((int *)(void *)(a) - 2)
 #define pnglw__sbm(a) pnglw__sbraw(a)[0]
@@ -1585,44 +2568,103 @@ static int pnglw__zlib_bitrev(int code, int codebits) {
 }
 static unsigned int pnglw__zlib_countm(unsigned char *a, unsigned char *b,
                                        int limit) {
-  int i;
-  for (i = 0; i < limit && i < 258; ++i)
-    if (a[i] != b[i])
-      break;
+  int i = 0;
+  if (limit > 258)
+    limit = 258;
+  while (i + 8 <= limit && memcmp(a + i, b + i, 8) == 0)
+    i += 8;
+  while (i < limit && a[i] == b[i])
+    ++i;
   return i;
 }
+#define pnglw__ZHASH_BITS 15
+#define pnglw__ZHASH (1 << pnglw__ZHASH_BITS)
 static unsigned int pnglw__zhash(unsigned char *data) {
   unsigned int hash = data[0] + (data[1] << 8) + (data[2] << 16);
-  hash ^= hash << 3;
-  hash += hash >> 5;
-  hash ^= hash << 4;
-  hash += hash >> 17;
-  hash ^= hash << 25;
-  hash += hash >> 6;
-  return hash;
+  return (hash * 2654435761u) >> (32 - pnglw__ZHASH_BITS);
 }
 #define pnglw__zlib_flush() (out = pnglw__zlib_flushf(out, &bitbuf, &bitcount))
 #define pnglw__zlib_add(code, codebits)                                        \
   (bitbuf |= (code) << bitcount, bitcount += (codebits), pnglw__zlib_flush())
-#define pnglw__zlib_huffa(b, c) pnglw__zlib_add(pnglw__zlib_bitrev(b, c), c)
-#define pnglw__zlib_huff1(n) pnglw__zlib_huffa(0x30 + (n), 8)
-#define pnglw__zlib_huff2(n) pnglw__zlib_huffa(0x190 + (n) - 144, 9)
-#define pnglw__zlib_huff3(n) pnglw__zlib_huffa(0 + (n) - 256, 7)
-#define pnglw__zlib_huff4(n) pnglw__zlib_huffa(0xc0 + (n) - 280, 8)
-#define pnglw__zlib_huff(n)                                                    \
-  ((n) <= 143   ? pnglw__zlib_huff1(n)                                         \
-   : (n) <= 255 ? pnglw__zlib_huff2(n)                                         \
-   : (n) <= 279 ? pnglw__zlib_huff3(n)                                         \
-                : pnglw__zlib_huff4(n))
-#define pnglw__zlib_huffb(n)                                                   \
-  ((n) <= 143 ? pnglw__zlib_huff1(n) : pnglw__zlib_huff2(n))
-#define pnglw__ZHASH 16384
+#define pnglw__zlib_lit(c) pnglw__zlib_add(zc.lcode[c], zc.lbits[c])
+#define pnglw__zlib_copy(len, d)                                               \
+  (k = zc.lsym[len], pnglw__zlib_add(zc.lcode[k + 257], zc.lbits[k + 257]),    \
+   pnglw__zlib_add((len) - lengthc[k], lengtheb[k]),                           \
+   k = zc.dsym[(d) <= 256 ? (d) - 1 : 256 + (((d) - 1) >> 7)],                 \
+   pnglw__zlib_add(zc.dcode[k], 5), pnglw__zlib_add((d) - distc[k], disteb[k]))
+#define pnglw__zlib_insert(p)                                                  \
+  (k = (int)pnglw__zhash(data + (p)), prev[(p) & 32767] = head[k],             \
+   head[k] = (p), prev[(p) & 32767])
+typedef struct {
+  unsigned short lcode[286];
+  unsigned char lbits[286];
+  unsigned char lsym[259];
+  unsigned char dsym[512];
+  unsigned char dcode[30];
+} pnglw__zcodes;
+static void pnglw__zlib_codes(pnglw__zcodes *zc, const unsigned short *lengthc,
+                              const unsigned short *distc) {
+  int i, j;
+  for (i = 0; i < 286; ++i) {
+    int code = i <= 143   ? 0x30 + i
+               : i <= 255 ? 0x190 + i - 144
+               : i <= 279 ? i - 256
+                          : 0xc0 + i - 280;
+    int bits = i <= 143 ? 8 : i <= 255 ? 9 : i <= 279 ? 7 : 8;
+    zc->lcode[i] = (unsigned short)pnglw__zlib_bitrev(code, bits);
+    zc->lbits[i] = (unsigned char)bits;
+  }
+  for (i = 0; i < 29; ++i)
+    for (j = lengthc[i]; j < lengthc[i + 1] && j <= 258; ++j)
+      zc->lsym[j] = (unsigned char)i;
+  for (i = 0; i < 30; ++i) {
+    zc->dcode[i] = (unsigned char)pnglw__zlib_bitrev(i, 5);
+    for (j = distc[i]; j < distc[i + 1]; ++j)
+      zc->dsym[j <= 256 ? j - 1 : 256 + ((j - 1) >> 7)] = (unsigned char)i;
+  }
+}
 #endif
-PNGLWDEF unsigned char *pngl_zlib_compress(unsigned char *data, int data_len,
-                                           int *out_len, int quality) {
-#ifdef PNGLW_ZLIB_COMPRESS
-  return PNGLW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else
+static unsigned int pnglw__adler32(unsigned int adler, unsigned char *data,
+                                   int data_len) {
+  unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+  int i, j = 0, blocklen = (int)(data_len % 5552);
+  while (j < data_len) {
+    for (i = 0; i < blocklen; ++i) {
+      s1 += data[j + i];
+      s2 += s1;
+    }
+    s1 %= 65521;
+    s2 %= 65521;
+    j += blocklen;
+    blocklen = 5552;
+  }
+  return (s2 << 16) | s1;
+}
+#ifndef PNGLW_ZLIB_COMPRESS
+static int pnglw__zlib_longest(unsigned char *data, int *prev, int cand, int i,
+                               int limit, int best, int chain, int nice,
+                               int *loc) {
+  unsigned char *p = data + i;
+  int stop = i - 32768 < -1 ? -1 : i - 32768;
+  if (best >= limit)
+    return best;
+  while (cand > stop && chain-- > 0) {
+    unsigned char *q = data + cand;
+    if (q[best] == p[best] && q[0] == p[0] && q[1] == p[1]) {
+      int len = (int)pnglw__zlib_countm(q, p, limit);
+      if (len > best) {
+        best = len;
+        *loc = cand;
+        if (len >= nice || len >= limit)
+          break;
+      }
+    }
+    cand = prev[cand & 32767];
+  }
+  return best;
+}
+static int pnglw__zlib_deflate(unsigned char **outp, unsigned char *data,
+                               int start, int data_len, int level, int last) {
   static unsigned short lengthc[] = {
       3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23,  27,
       31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259};
@@ -1636,118 +2678,140 @@ PNGLWDEF unsigned char *pngl_zlib_compress(unsigned char *data, int data_len,
   static unsigned char disteb[] = {0, 0, 0,  0,  1,  1,  2,  2,  3,  3,
                                    4, 4, 5,  5,  6,  6,  7,  7,  8,  8,
                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+  static unsigned short chains[] = {1, 1, 8, 32, 16, 32, 64, 128, 128, 1024};
+  static unsigned short lazies[] = {0, 0, 5, 6, 4, 16, 16, 16, 32, 258};
+  static unsigned short goods[] = {4, 4, 4, 4, 4, 8, 8, 8, 8, 32};
+  static unsigned short nices[] = {8, 8, 16, 32, 16, 32, 64, 128, 128, 258};
+  pnglw__zcodes zc;
   unsigned int bitbuf = 0;
-  int i, j, bitcount = 0;
-  unsigned char *out = NULL;
-  unsigned char ***hash_table =
-      (unsigned char ***)PNGLW_MALLOC(pnglw__ZHASH * sizeof(unsigned char **));
-  if (hash_table == NULL)
-    return NULL;
-  if (quality < 5)
-    quality = 5;
-  pnglw__sbpush(out, 0x78);
-  pnglw__sbpush(out, 0x5e);
-  pnglw__zlib_add(1, 1);
+  int i, j, k, bitcount = 0;
+  int chain, lazy, good, nice, end = data_len - 3;
+  unsigned char *out = *outp;
+  int base = pnglw__sbcount(out), raw_len = data_len - start;
+  int *head = (int *)PNGLW_MALLOC((pnglw__ZHASH + 32768) * sizeof(int));
+  int *prev = head + pnglw__ZHASH;
+  if (head == NULL)
+    return 0;
+  if (level < 1)
+    level = 1;
+  if (level > 9)
+    level = 9;
+  chain = chains[level];
+  lazy = lazies[level];
+  good = goods[level];
+  nice = nices[level];
+  pnglw__zlib_codes(&zc, lengthc, distc);
+  memset(head, 0xff, pnglw__ZHASH * sizeof(int));
+  pnglw__zlib_add(last, 1);
   pnglw__zlib_add(1, 2);
-  for (i = 0; i < pnglw__ZHASH; ++i)
-    hash_table[i] = NULL;
-  i = 0;
-  while (i < data_len - 3) {
-    int h = pnglw__zhash(data + i) & (pnglw__ZHASH - 1), best = 3;
-    unsigned char *bestloc = 0;
-    unsigned char **hlist = hash_table[h];
-    int n = pnglw__sbcount(hlist);
-    for (j = 0; j < n; ++j) {
-      if (hlist[j] - data > i - 32768) {
-        int d = pnglw__zlib_countm(hlist[j], data + i, data_len - i);
-        if (d >= best) {
-          best = d;
-          bestloc = hlist[j];
-        }
+  for (i = start > 32768 ? start - 32768 : 0; i < start && i < end; ++i)
+    (void)pnglw__zlib_insert(i);
+  i = start;
+  if (level < 4) {
+    while (i < end) {
+      int loc = 0, best, cand = pnglw__zlib_insert(i);
+      int limit = data_len - i < 258 ? data_len - i : 258;
+      best = pnglw__zlib_longest(data, prev, cand, i, limit, 2, chain, nice,
+                                 &loc);
+      if (best >= 3) {
+        pnglw__zlib_copy(best, i - loc);
+        if (best <= lazy)
+          for (j = i + 1; j < i + best && j < end; ++j)
+            (void)pnglw__zlib_insert(j);
+        i += best;
+      } else {
+        pnglw__zlib_lit(data[i]);
+        ++i;
       }
     }
-    if (hash_table[h] && pnglw__sbn(hash_table[h]) == 2 * quality) {
-      PNGLW_MEMMOVE(hash_table[h], hash_table[h] + quality,
-                    sizeof(hash_table[h][0]) * quality);
-      pnglw__sbn(hash_table[h]) = quality;
-    }
-    pnglw__sbpush(hash_table[h], data + i);
-    if (bestloc) {
-      h = pnglw__zhash(data + i + 1) & (pnglw__ZHASH - 1);
-      hlist = hash_table[h];
-      n = pnglw__sbcount(hlist);
-      for (j = 0; j < n; ++j) {
-        if (hlist[j] - data > i - 32767) {
-          int e = pnglw__zlib_countm(hlist[j], data + i + 1, data_len - i - 1);
-          if (e > best) {
-            bestloc = NULL;
-            break;
-          }
+  } else {
+    int prev_len = 2, prev_loc = 0, avail = 0;
+    while (i < data_len) {
+      int len = 2, loc = 0;
+      if (i < end) {
+        int cand = pnglw__zlib_insert(i);
+        int limit = data_len - i < 258 ? data_len - i : 258;
+        if (prev_len < lazy) {
+          len = pnglw__zlib_longest(data, prev, cand, i, limit, prev_len,
+                                    prev_len >= good ? chain >> 2 : chain,
+                                    nice, &loc);
+          if (len <= prev_len)
+            len = 2;
         }
       }
+      if (prev_len >= 3 && len <= prev_len) {
+        int stop = i - 1 + prev_len;
+        pnglw__zlib_copy(prev_len, i - 1 - prev_loc);
+        for (j = i + 1; j < stop && j < end; ++j)
+          (void)pnglw__zlib_insert(j);
+        i = stop;
+        avail = 0;
+        prev_len = 2;
+      } else {
+        if (avail)
+          pnglw__zlib_lit(data[i - 1]);
+        avail = 1;
+        prev_len = len;
+        prev_loc = loc;
+        ++i;
+      }
     }
-    if (bestloc) {
-      int d = (int)(data + i - bestloc);
-      PNGLW_ASSERT(d <= 32767 && best <= 258);
-      for (j = 0; best > lengthc[j + 1] - 1; ++j)
-        ;
-      pnglw__zlib_huff(j + 257);
-      if (lengtheb[j])
-        pnglw__zlib_add(best - lengthc[j], lengtheb[j]);
-      for (j = 0; d > distc[j + 1] - 1; ++j)
-        ;
-      pnglw__zlib_add(pnglw__zlib_bitrev(j, 5), 5);
-      if (disteb[j])
-        pnglw__zlib_add(d - distc[j], disteb[j]);
-      i += best;
-    } else {
-      pnglw__zlib_huffb(data[i]);
-      ++i;
-    }
+    if (avail)
+      pnglw__zlib_lit(data[i - 1]);
   }
   for (; i < data_len; ++i)
-    pnglw__zlib_huffb(data[i]);
-  pnglw__zlib_huff(256);
+    pnglw__zlib_lit(data[i]);
+  pnglw__zlib_lit(256);
+  if (!last)
+    pnglw__zlib_add(0, 3);
   while (bitcount)
     pnglw__zlib_add(0, 1);
-  for (i = 0; i < pnglw__ZHASH; ++i)
-    (void)pnglw__sbfree(hash_table[i]);
-  PNGLW_FREE(hash_table);
-  if (pnglw__sbn(out) > data_len + 2 + ((data_len + 32766) / 32767) * 5) {
-    pnglw__sbn(out) = 2;
-    for (j = 0; j < data_len;) {
+  if (!last) {
+    pnglw__sbpush(out, 0x00);
+    pnglw__sbpush(out, 0x00);
+    pnglw__sbpush(out, 0xff);
+    pnglw__sbpush(out, 0xff);
+  }
+  PNGLW_FREE(head);
+  if (pnglw__sbn(out) - base > raw_len + ((raw_len + 32766) / 32767) * 5) {
+    pnglw__sbn(out) = base;
+    for (j = start; j < data_len;) {
       int blocklen = data_len - j;
       if (blocklen > 32767)
         blocklen = 32767;
-      pnglw__sbpush(out, data_len - j == blocklen);
+      pnglw__sbpush(out, last && data_len - j == blocklen);
       pnglw__sbpush(out, PNGLW_UCHAR(blocklen));
       pnglw__sbpush(out, PNGLW_UCHAR(blocklen >> 8));
       pnglw__sbpush(out, PNGLW_UCHAR(~blocklen));
       pnglw__sbpush(out, PNGLW_UCHAR(~blocklen >> 8));
+      pnglw__sbmaybegrow(out, blocklen);
       memcpy(out + pnglw__sbn(out), data + j, blocklen);
       pnglw__sbn(out) += blocklen;
       j += blocklen;
     }
   }
-  {
-    unsigned int s1 = 1, s2 = 0;
-    int blocklen = (int)(data_len % 5552);
-    j = 0;
-    while (j < data_len) {
-      for (i = 0; i < blocklen; ++i) {
-        s1 += data[j + i];
-        s2 += s1;
-      }
-      s1 %= 65521;
-      s2 %= 65521;
-      j += blocklen;
-      blocklen = 5552;
-    }
-    pnglw__sbpush(out, PNGLW_UCHAR(s2 >> 8));
-    pnglw__sbpush(out, PNGLW_UCHAR(s2));
-    pnglw__sbpush(out, PNGLW_UCHAR(s1 >> 8));
-    pnglw__sbpush(out, PNGLW_UCHAR(s1));
+  *outp = out;
+  return 1;
+}
+#endif
+PNGLWDEF unsigned char *pngl_zlib_compress(unsigned char *data, int data_len,
+                                           int *out_len, int quality) {
+#ifdef PNGLW_ZLIB_COMPRESS
+  return PNGLW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else
+  unsigned int adler;
+  unsigned char *out = NULL;
+  pnglw__sbpush(out, 0x78);
+  pnglw__sbpush(out, 0x5e);
+  if (!pnglw__zlib_deflate(&out, data, 0, data_len, quality, 1)) {
+    (void)pnglw__sbfree(out);
+    return NULL;
   }
+  adler = pnglw__adler32(1, data, data_len);
+  pnglw__sbpush(out, PNGLW_UCHAR(adler >> 24));
+  pnglw__sbpush(out, PNGLW_UCHAR(adler >> 16));
+  pnglw__sbpush(out, PNGLW_UCHAR(adler >> 8));
+  pnglw__sbpush(out, PNGLW_UCHAR(adler));
   *out_len = pnglw__sbn(out);
   PNGLW_MEMMOVE(pnglw__sbraw(out), out, *out_len);
   return (unsigned char *)pnglw__sbraw(out);
@@ -1894,39 +2958,39 @@ static void pnglw__encode_png_line(unsigned char *pixels, int stride_bytes,
     break;
   }
 }
-PNGLWDEF unsigned char *pngl_write_png_to_mem(const unsigned char *pixels,
-                                              int stride_bytes, int x, int y,
-                                              int n, int *out_len) {
-  int force_filter = pngl_write_force_png_filter;
-  int ctype[5] = {-1, 0, 4, 2, 6};
-  unsigned char sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
-  unsigned char *out, *o, *filt, *zlib;
-  signed char *line_buffer;
-  int j, zlen;
-  if (stride_bytes == 0)
-    stride_bytes = x * n;
-  if (force_filter >= 5) {
-    force_filter = -1;
-  }
-  filt = (unsigned char *)PNGLW_MALLOC((x * n + 1) * y);
-  if (!filt)
-    return 0;
-  line_buffer = (signed char *)PNGLW_MALLOC(x * n);
+#define pnglw__BAND_MIN (256 * 1024)
+typedef struct {
+  unsigned char *z;
+  int zlen;
+  unsigned int adler;
+} pnglw__zband;
+typedef struct {
+  const unsigned char *pixels;
+  int stride_bytes, x, y, n, force_filter;
+  int bands, band_rows, failed;
+  unsigned char *filt;
+  pnglw__zband *zbands;
+} pnglw__png_bands;
+static void pnglw__filter_band(void *data, int b0, int b1) {
+  pnglw__png_bands *pb = (pnglw__png_bands *)data;
+  int x = pb->x, n = pb->n, j = b0 * pb->band_rows;
+  int j1 = b1 * pb->band_rows < pb->y ? b1 * pb->band_rows : pb->y;
+  signed char *line_buffer = (signed char *)PNGLW_MALLOC(x * n);
   if (!line_buffer) {
-    PNGLW_FREE(filt);
-    return 0;
+    pb->failed = 1;
+    return;
   }
-  for (j = 0; j < y; ++j) {
+  for (; j < j1; ++j) {
     int filter_type;
-    if (force_filter > -1) {
-      filter_type = force_filter;
-      pnglw__encode_png_line((unsigned char *)(pixels), stride_bytes, x, y, j,
-                             n, force_filter, line_buffer);
+    if (pb->force_filter > -1) {
+      filter_type = pb->force_filter;
+      pnglw__encode_png_line((unsigned char *)(pb->pixels), pb->stride_bytes,
+                             x, pb->y, j, n, pb->force_filter, line_buffer);
     } else {
       int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
       for (filter_type = 0; filter_type < 5; filter_type++) {
-        pnglw__encode_png_line((unsigned char *)(pixels), stride_bytes, x, y, j,
-                               n, filter_type, line_buffer);
+        pnglw__encode_png_line((unsigned char *)(pb->pixels), pb->stride_bytes,
+                               x, pb->y, j, n, filter_type, line_buffer);
         est = 0;
         for (i = 0; i < x * n; ++i) {
           est += abs((signed char)line_buffer[i]);
@@ -1937,18 +3001,146 @@ PNGLWDEF unsigned char *pngl_write_png_to_mem(const unsigned char *pixels,
         }
       }
       if (filter_type != best_filter) {
-        pnglw__encode_png_line((unsigned char *)(pixels), stride_bytes, x, y, j,
-                               n, best_filter, line_buffer);
+        pnglw__encode_png_line((unsigned char *)(pb->pixels), pb->stride_bytes,
+                               x, pb->y, j, n, best_filter, line_buffer);
         filter_type = best_filter;
       }
     }
-    filt[j * (x * n + 1)] = (unsigned char)filter_type;
-    PNGLW_MEMMOVE(filt + j * (x * n + 1) + 1, line_buffer, x * n);
+    pb->filt[j * (x * n + 1)] = (unsigned char)filter_type;
+    PNGLW_MEMMOVE(pb->filt + j * (x * n + 1) + 1, line_buffer, x * n);
   }
   PNGLW_FREE(line_buffer);
-  zlib = pngl_zlib_compress(filt, y * (x * n + 1), &zlen,
+}
+#ifndef PNGLW_ZLIB_COMPRESS
+static void pnglw__deflate_band(void *data, int b0, int b1) {
+  pnglw__png_bands *pb = (pnglw__png_bands *)data;
+  int band, row = pb->x * pb->n + 1;
+  for (band = b0; band < b1; ++band) {
+    pnglw__zband *zb = &pb->zbands[band];
+    int j0 = band * pb->band_rows;
+    int j1 = j0 + pb->band_rows < pb->y ? j0 + pb->band_rows : pb->y;
+    int dict = j0 * row < 32768 ? j0 * row : 32768;
+    unsigned char *p = pb->filt + j0 * row;
+    zb->z = NULL;
+    if (!pnglw__zlib_deflate(&zb->z, p - dict, dict, dict + (j1 - j0) * row,
+                             pngl_write_png_compression_level,
+                             band == pb->bands - 1)) {
+      (void)pnglw__sbfree(zb->z);
+      zb->z = NULL;
+      continue;
+    }
+    zb->zlen = pnglw__sbn(zb->z);
+    zb->adler = pnglw__adler32(1, p, (j1 - j0) * row);
+  }
+}
+static unsigned int pnglw__adler32_combine(unsigned int a1, unsigned int a2,
+                                           int len2) {
+  unsigned int rem = (unsigned int)(len2 % 65521);
+  unsigned int s1 = a1 & 0xffff, s2 = (rem * s1) % 65521;
+  s1 += (a2 & 0xffff) + 65521 - 1;
+  s2 += (a1 >> 16) + (a2 >> 16) + 65521 - rem;
+  if (s1 >= 65521)
+    s1 -= 65521;
+  if (s1 >= 65521)
+    s1 -= 65521;
+  if (s2 >= 65521 * 2)
+    s2 -= 65521 * 2;
+  if (s2 >= 65521)
+    s2 -= 65521;
+  return (s2 << 16) | s1;
+}
+#endif
+static unsigned char *pnglw__zlib_bands(pnglw__png_bands *pb, int *out_len) {
+#ifndef PNGLW_ZLIB_COMPRESS
+  if (pb->bands > 1) {
+    int b, row = pb->x * pb->n + 1, zlen = 2 + 4, ok = 1;
+    unsigned int adler = 1;
+    unsigned char *out, *o;
+    pb->zbands =
+        (pnglw__zband *)PNGLW_MALLOC(pb->bands * sizeof(pnglw__zband));
+    if (!pb->zbands)
+      return 0;
+    _pngl_write_parallel(pnglw__deflate_band, pb, pb->bands);
+    for (b = 0; b < pb->bands; ++b) {
+      int rows = pb->y - b * pb->band_rows;
+      if (rows > pb->band_rows)
+        rows = pb->band_rows;
+      if (!pb->zbands[b].z)
+        ok = 0;
+      else {
+        zlen += pb->zbands[b].zlen;
+        adler = pnglw__adler32_combine(adler, pb->zbands[b].adler, rows * row);
+      }
+    }
+    out = ok ? (unsigned char *)PNGLW_MALLOC(zlen) : 0;
+    if (out) {
+      o = out;
+      *o++ = 0x78;
+      *o++ = 0x5e;
+      for (b = 0; b < pb->bands; ++b) {
+        PNGLW_MEMMOVE(o, pb->zbands[b].z, pb->zbands[b].zlen);
+        o += pb->zbands[b].zlen;
+      }
+      pnglw__wp32(o, adler);
+      *out_len = zlen;
+    }
+    for (b = 0; b < pb->bands; ++b)
+      (void)pnglw__sbfree(pb->zbands[b].z);
+    PNGLW_FREE(pb->zbands);
+    return out;
+  }
+#endif
+  return pngl_zlib_compress(pb->filt, pb->y * (pb->x * pb->n + 1), out_len,
                             pngl_write_png_compression_level);
-  PNGLW_FREE(filt);
+}
+PNGLWDEF unsigned char *pngl_write_png_to_mem(const unsigned char *pixels,
+                                              int stride_bytes, int x, int y,
+                                              int n, int *out_len) {
+  int force_filter = pngl_write_force_png_filter;
+  int ctype[5] = {-1, 0, 4, 2, 6};
+  unsigned char sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  unsigned char *out, *o, *zlib;
+  pnglw__png_bands pb;
+  int zlen, bands = 1;
+  if (stride_bytes == 0)
+    stride_bytes = x * n;
+  if (force_filter >= 5) {
+    force_filter = -1;
+  }
+  if (force_filter < 0 && pngl_write_png_compression_level <= 1)
+    force_filter = 2;
+  if (_pngl_write_parallel) {
+    bands = (x * n + 1) * y / pnglw__BAND_MIN;
+    if (bands > _pngl_write_max_bands)
+      bands = _pngl_write_max_bands;
+    if (bands > y)
+      bands = y;
+    if (bands < 1)
+      bands = 1;
+  }
+  pb.pixels = pixels;
+  pb.stride_bytes = stride_bytes;
+  pb.x = x;
+  pb.y = y;
+  pb.n = n;
+  pb.force_filter = force_filter;
+  pb.band_rows = (y + bands - 1) / bands;
+  pb.bands = (y + pb.band_rows - 1) / pb.band_rows;
+  pb.zbands = 0;
+  pb.failed = 0;
+  pb.filt = (unsigned char *)PNGLW_MALLOC((x * n + 1) * y);
+  if (!pb.filt)
+    return 0;
+  if (pb.bands > 1)
+    _pngl_write_parallel(pnglw__filter_band, &pb, pb.bands);
+  else
+    pnglw__filter_band(&pb, 0, 1);
+  if (pb.failed) {
+    PNGLW_FREE(pb.filt);
+    return 0;
+  }
+  zlib = pnglw__zlib_bands(&pb, &zlen);
+  PNGLW_FREE(pb.filt);
   if (!zlib)
     return 0;
   out = (unsigned char *)PNGLW_MALLOC(8 + 12 + 13 + 12 + zlen + 12);
@@ -2012,7 +3204,6 @@ PNGLWDEF int pngl_write_png(char const *filename, int x, int y, int comp,
   PNGLW_FREE(png);
   return 1;
 }
-
 #endif
 PNGLWDEF int pngl_write_png_to_func(pngl_write_func *func, void *context, int x,
                                     int y, int comp, const void *data,
@@ -148,10 +148,8 @@ extern SavedDrawingObject g_clipboard_object;
 
 int allocate_framebuffer(int w, int h);
 int handle_image_path(ArgParseState *state, char **argv, int argc, int *i_ptr);
-int file_read_clbk(void *user, char *data, int size);
-void file_skip_clbk(void *user, int n);
-int file_eof_clbk(void *user);
 void process_image_data(pngl_uc *data, int w, int h);
+pngl_uc *load_png_data(const char *path, int *w, int *h, int *comp);
 pngl_uc *load_bmp_data(const char *path, int *w, int *h);
 int add_new_object(pngl_uc *data, int w, int h, int type, const char *path);
 void reset_view(HWND hWnd);
@@ -221,21 +219,6 @@ inline int handle_image_path(ArgParseState *state, char **argv, int argc, int *i
     return argparse_parse_string(argv, argc, i_ptr, &app->image_path, "input-image");
 }
 
-inline int file_read_clbk(void *user, char *data, int size) {
-    FILE *f = (FILE *)user;
-    return (int)fread(data, 1, (size_t)size, f);
-}
-
-inline void file_skip_clbk(void *user, int n) {
-    FILE *f = (FILE *)user;
-    fseek(f, (long)n, SEEK_CUR);
-}
-
-inline int file_eof_clbk(void *user) {
-    FILE *f = (FILE *)user;
-    return feof(f);
-}
-
 void process_image_data(pngl_uc *data, int w, int h) {
     int i;
     int pixel_count = w * h;
@@ -260,6 +243,20 @@ void process_image_data(pngl_uc *data, int w, int h) {
     }
 }
 
+pngl_uc *load_png_data(const char *path, int *w, int *h, int *comp) {
+    PlatformFileMap map;
+    pngl_uc *pixels;
+
+    if (!platform_file_map(path, &map)) return NULL;
+    if (map.size > 0x7fffffff) {
+        platform_file_unmap(&map);
+        return NULL;
+    }
+    pixels = pngl_load_from_memory(map.data, (int)map.size, w, h, comp, PNGL_rgb_alpha);
+    platform_file_unmap(&map);
+    return pixels;
+}
+
 pngl_uc *load_bmp_data(const char *path, int *w, int *h) {
     HBITMAP hBitmap;
     HDC hdc = NULL;
@@ -513,16 +510,7 @@ int load_image_from_path(HWND hWnd, const char *path) {
     }
     
     if (type == 1) {
-        FILE *f = fopen(path, "rb");
-        if (f == NULL) {
-            return 0;
-        }
-        pngl_io_callbacks callbacks;
-        callbacks.read = file_read_clbk;
-        callbacks.skip = file_skip_clbk;
-        callbacks.eof = file_eof_clbk;
-        new_image_data = pngl_load_from_callbacks(&callbacks, f, &new_width, &new_height, &new_comp, PNGL_rgb_alpha);
-        fclose(f);
+        new_image_data = load_png_data(path, &new_width, &new_height, &new_comp);
         if (new_image_data != NULL) success = 1;
         
     } else if (type == 2) {
@@ -560,23 +548,10 @@ int reload_image_data(HWND hWnd) {
     if (g_object_count == 0 || g_objects[0].data == NULL || g_objects[0].path[0] == '\0' || g_objects[0].type != 1) return 0;
     
     const char *path = g_objects[0].path;
-    FILE *f;
     pngl_uc *new_image_data;
-    pngl_io_callbacks callbacks;
     int new_width, new_height, new_comp;
     
-    f = fopen(path, "rb");
-    if (f == NULL) {
-        return 0;
-    }
-
-    callbacks.read = file_read_clbk;
-    callbacks.skip = file_skip_clbk;
-    callbacks.eof = file_eof_clbk;
-
-    new_image_data = pngl_load_from_callbacks(&callbacks, f, &new_width, &new_height, &new_comp, PNGL_rgb_alpha);
-
-    fclose(f);
+    new_image_data = load_png_data(path, &new_width, &new_height, &new_comp);
 
     if (new_image_data == NULL) {
         return 0;
@@ -601,23 +576,13 @@ int reload_drawing_object_data(HWND hWnd, int index) {
     if (index < 0 || index >= g_object_count || g_objects[index].data == NULL || g_objects[index].path[0] == '\0') return 0;
     
     const char *path = g_objects[index].path;
-    FILE *f;
     pngl_uc *new_image_data = NULL;
-    pngl_io_callbacks callbacks;
     int new_width, new_height, new_comp;
     int type = g_objects[index].type;
     int success = 0;
     
     if (type == 1) {
-        f = fopen(path, "rb");
-        if (f == NULL) return 0;
-
-        callbacks.read = file_read_clbk;
-        callbacks.skip = file_skip_clbk;
-        callbacks.eof = file_eof_clbk;
-
-        new_image_data = pngl_load_from_callbacks(&callbacks, f, &new_width, &new_height, &new_comp, PNGL_rgb_alpha);
-        fclose(f);
+        new_image_data = load_png_data(path, &new_width, &new_height, &new_comp);
         if (new_image_data != NULL) success = 1;
         
     } else if (type == 2) {
@@ -1486,21 +1451,13 @@ void paste_image_from_clipboard(HWND hWnd) {
                     CloseClipboard();
                     
                     pngl_uc *file_data = NULL;
-                    int w=0, h=0, t=0;
+                    int w=0, h=0, t=0, c=0;
                     
                     const char *ext = strrchr(path, '.');
                     if (ext != NULL) {
                         if (_stricmp(ext, ".png") == 0) {
                             t = 1; 
-                            FILE *f = fopen(path, "rb");
-                            if (f != NULL) {
-                                pngl_io_callbacks callbacks;
-                                callbacks.read = file_read_clbk;
-                                callbacks.skip = file_skip_clbk;
-                                callbacks.eof = file_eof_clbk;
-                                file_data = pngl_load_from_callbacks(&callbacks, f, &w, &h, &t, PNGL_rgb_alpha);
-                                fclose(f);
-                            }
+                            file_data = load_png_data(path, &w, &h, &c);
                         } else if (_stricmp(ext, ".bmp") == 0) {
                             t = 2; 
                             file_data = load_bmp_data(path, &w, &h);
@@ -2315,16 +2272,8 @@ int load_file_as_new_object(HWND hWnd, const char *path) {
     }
     
     if (type == 1) {
-        FILE *f = fopen(path, "rb");
-        if (f != NULL) {
-            pngl_io_callbacks callbacks;
-            callbacks.read = file_read_clbk;
-            callbacks.skip = file_skip_clbk;
-            callbacks.eof = file_eof_clbk;
-            new_image_data = pngl_load_from_callbacks(&callbacks, f, &new_width, &new_height, &new_comp, PNGL_rgb_alpha);
-            fclose(f);
-            if (new_image_data != NULL) success = 1;
-        }
+        new_image_data = load_png_data(path, &new_width, &new_height, &new_comp);
+        if (new_image_data != NULL) success = 1;
     } else if (type == 2) {
         new_image_data = load_bmp_data(path, &new_width, &new_height);
         if (new_image_data != NULL) success = 1;
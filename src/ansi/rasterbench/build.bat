@@ -0,0 +1 @@
+gcc main.c -o rasterbench.exe -I..\unilibs -O2 -lm -lwinmm -lole32 -lgdi32
@@ -0,0 +1,290 @@
+#define MIO_PNGL
+#define ARG_PARSE_IMPLEMENTATION
+#include "mio.h"
+#include "args.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_MESHES 64
+#define BENCH_NAME_MAX 64
+#define BENCH_PATH_MAX 512
+#define BENCH_WARMUP_FRAMES 4
+
+#define BENCH_BASE_FLAGS                                                      \
+  (MIO_3D_DEPTH_TEST | MIO_3D_CULL_BEHIND | MIO_3D_CULL_FRUSTUM |             \
+   MIO_3D_CLIP_FRUSTUM)
+
+typedef struct {
+  const char *name;
+  uint32 flags;
+} benchMode;
+
+typedef struct {
+  int32 width;
+  int32 height;
+} benchResolution;
+
+typedef struct {
+  char name[BENCH_NAME_MAX];
+  mioMesh mesh;
+  mioVec3 center;
+  real32 radius;
+} benchScene;
+
+struct State_t {
+  const char *resDir;
+  const char *jsonPath;
+  real32 frames;
+  int32 quick;
+};
+
+static const benchMode G_BENCH_MODES[] = {
+    {"solid_flat",
+     BENCH_BASE_FLAGS | MIO_3D_SOLID | MIO_3D_SHADE_FLAT |
+         MIO_3D_CULL_BACKFACE},
+    {"solid_nocull", BENCH_BASE_FLAGS | MIO_3D_SOLID | MIO_3D_SHADE_FLAT},
+    {"texture",
+     BENCH_BASE_FLAGS | MIO_3D_TEXTURE | MIO_3D_SHADE_FLAT |
+         MIO_3D_CULL_BACKFACE},
+    {"texture_affine",
+     BENCH_BASE_FLAGS | MIO_3D_TEXTURE | MIO_3D_AFFINE_MAP |
+         MIO_3D_SHADE_FLAT | MIO_3D_CULL_BACKFACE},
+    {"wireframe",
+     BENCH_BASE_FLAGS | MIO_3D_WIREFRAME | MIO_3D_CULL_BACKFACE},
+};
+
+static const benchResolution G_BENCH_RESOLUTIONS[] = {
+    {320, 180}, {640, 360}, {1280, 720}, {1920, 1080}};
+
+static int handle_res_dir(
+    ArgParseState *state, char **argv, int argc, int *i_ptr) {
+  return argparse_parse_string(
+      argv, argc, i_ptr, &((struct State_t *)state)->resDir, "res dir");
+}
+
+static int handle_json(
+    ArgParseState *state, char **argv, int argc, int *i_ptr) {
+  return argparse_parse_string(
+      argv, argc, i_ptr, &((struct State_t *)state)->jsonPath, "json");
+}
+
+static int handle_frames(
+    ArgParseState *state, char **argv, int argc, int *i_ptr) {
+  return argparse_parse_float(
+      argv, argc, i_ptr, &((struct State_t *)state)->frames, "frames");
+}
+
+static int handle_quick(
+    ArgParseState *state, char **argv, int argc, int *i_ptr) {
+  ((struct State_t *)state)->quick = 1;
+  return 1;
+}
+
+static int handle_help(
+    ArgParseState *state, char **argv, int argc, int *i_ptr) {
+  return -1;
+}
+
+ArgOption option_table[] = {
+    {"-r", "--res", handle_res_dir, "Resource directory <val>", 0, 0},
+    {"-j", "--json", handle_json, "Write JSON report to file <val>", 0, 0},
+    {"-f", "--frames", handle_frames, "Frames per camera path <val>", 0, 0},
+    {"-q", "--quick", handle_quick, "Only run the 640x360 resolution", 0, 0},
+    {"-h", "--help", handle_help, "Display this help message", 0, 0},
+    {NULL, NULL, NULL, NULL, 0, 0}};
+
+int32 mio_user_init(void *state) { return TRUE; }
+int32 mio_user_update(void *state, real64 dt) { return TRUE; }
+int32 mio_user_draw(void *state) { return TRUE; }
+int32 mio_user_exit(void *state) { return TRUE; }
+
+static int bench_compare_scenes(const void *a, const void *b) {
+  return strcmp(((const benchScene *)a)->name, ((const benchScene *)b)->name);
+}
+
+static int32 bench_load_scenes(const char *resDir, benchScene *scenes) {
+  WIN32_FIND_DATAA fd;
+  HANDLE find;
+  char path[BENCH_PATH_MAX];
+  mioVec3 bmin, bmax, ext;
+  int32 count = 0;
+  int32 i;
+  sprintf(path, "%s/meshes/*.obj", resDir);
+  find = FindFirstFileA(path, &fd);
+  if (find == INVALID_HANDLE_VALUE) { return 0; }
+  do {
+    if (count >= BENCH_MAX_MESHES) { break; }
+    strncpy(scenes[count].name, fd.cFileName, BENCH_NAME_MAX - 1);
+    scenes[count].name[BENCH_NAME_MAX - 1] = '\0';
+    count++;
+  } while (FindNextFileA(find, &fd));
+  FindClose(find);
+  qsort(scenes, count, sizeof(benchScene), bench_compare_scenes);
+  for (i = 0; i < count; i++) {
+    sprintf(path, "%s/meshes/%s", resDir, scenes[i].name);
+    scenes[i].mesh = mio_load_obj(path);
+    if (!scenes[i].mesh.vertexCount) { continue; }
+    mio_3d_get_bounds(&scenes[i].mesh, &bmin, &bmax);
+    scenes[i].center = mio_vec3_scale(mio_vec3_add(bmin, bmax), 0.5f);
+    ext = mio_vec3_sub(bmax, bmin);
+    scenes[i].radius =
+        MIO_MAX(0.5f * (real32)sqrt(mio_vec3_dot(ext, ext)), 0.01f);
+  }
+  return count;
+}
+
+static mioTexture bench_load_texture(const char *resDir) {
+  char path[BENCH_PATH_MAX];
+  sprintf(path, "%s/images/skybox.png", resDir);
+  return mio_load_texture(path, 0);
+}
+
+static void bench_camera(
+    mioCamera *cam, const benchScene *scene, int32 frame, int32 frames,
+    int32 width, int32 height) {
+  real32 a = 2.0f * (real32)MIO_PI * (real32)frame / (real32)frames;
+  real32 p = 0.35f * (real32)sin(2.0f * a);
+  real32 d = scene->radius * 2.2f;
+  *cam = mio_3d_camera(
+      TRUE, 0.8f, scene->radius * 0.01f, scene->radius * 10.0f, 0.0f, 0.0f);
+  cam->pos.x = scene->center.x + (real32)(sin(a) * cos(p)) * d;
+  cam->pos.y = scene->center.y + (real32)sin(p) * d;
+  cam->pos.z = scene->center.z + (real32)(cos(a) * cos(p)) * d;
+  cam->yaw = a;
+  cam->pitch = -p;
+  mio_3d_camera_update(cam, width, height, TRUE, 0.0f);
+}
+
+static uint32 bench_hash_frame(void) {
+  int32 i;
+  uint32 hash = 2166136261u;
+  int32 count = G_APP.render.width * G_APP.render.height;
+  for (i = 0; i < count; i++) {
+    hash ^= G_APP.render.colourData[i] & 0x00FFFFFF;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static real64 bench_run(
+    const benchScene *scene, const mioTexture *tex, uint32 flags,
+    int32 width, int32 height, int32 frames, uint32 *hash) {
+  int32 i;
+  LARGE_INTEGER freq, t0, t1;
+  mioCamera cam;
+  mio_render_context_resize(width, height);
+  G_APP.render.flags3D = flags;
+  QueryPerformanceFrequency(&freq);
+  for (i = -BENCH_WARMUP_FRAMES; i < frames; i++) {
+    if (i == 0) { QueryPerformanceCounter(&t0); }
+    bench_camera(&cam, scene, MIO_MAX(i, 0), frames, width, height);
+    mio_set_colour(0xFF101018);
+    mio_draw_clear();
+    mio_3d_clear_depth();
+    mio_set_colour(0xFFC0A080);
+    mio_3d_draw_mesh(
+        &cam, (mioMesh *)&scene->mesh, mio_mat4_identity(), tex->data,
+        tex->width, tex->height, FALSE);
+  }
+  QueryPerformanceCounter(&t1);
+  *hash = bench_hash_frame();
+  return (real64)(t1.QuadPart - t0.QuadPart) / (real64)freq.QuadPart;
+}
+
+int main(int argc, char **argv) {
+  struct State_t opts;
+  benchScene *scenes;
+  mioTexture tex;
+  FILE *json = NULL;
+  int32 sceneCount, s, m, r, frames, tris, first = 1;
+  int32 modeCount = sizeof(G_BENCH_MODES) / sizeof(G_BENCH_MODES[0]);
+  int32 resCount =
+      sizeof(G_BENCH_RESOLUTIONS) / sizeof(G_BENCH_RESOLUTIONS[0]);
+  const benchResolution *res;
+  real64 seconds, ms, mtris, mpix;
+  uint32 hash;
+  memset(&opts, 0, sizeof(opts));
+  opts.resDir = "../../../res";
+  opts.frames = 120.0f;
+  if (argparse_process_args((ArgParseState *)&opts, argv, argc, option_table)) {
+    return 1;
+  }
+  frames = MIO_MAX((int32)opts.frames, 1);
+  G_VERBOSE_MODE = FALSE;
+  if (!mio_headless_init(1920, 1080)) {
+    fprintf(stderr, "ERROR: Failed to initialize headless renderer.\n");
+    return 1;
+  }
+  scenes = (benchScene *)sys_alloc(sizeof(benchScene) * BENCH_MAX_MESHES);
+  if (!scenes) { return 1; }
+  memset(scenes, 0, sizeof(benchScene) * BENCH_MAX_MESHES);
+  sceneCount = bench_load_scenes(opts.resDir, scenes);
+  tex = bench_load_texture(opts.resDir);
+  if (!sceneCount || !tex.data) {
+    fprintf(stderr, "ERROR: Missing meshes or skybox.png in %s.\n", opts.resDir);
+    return 1;
+  }
+  if (opts.jsonPath) {
+    json = fopen(opts.jsonPath, "wb");
+    if (!json) {
+      fprintf(stderr, "ERROR: Cannot open %s.\n", opts.jsonPath);
+      return 1;
+    }
+    fprintf(
+        json, "{\n\"benchmark\":\"rasterbench\",\n\"frames\":%d,\n"
+              "\"results\":[\n",
+        frames);
+  }
+  printf(
+      "%-16s %-15s %10s %9s %10s %10s %10s\n", "mesh", "mode", "resolution",
+      "tris", "ms/frame", "Mtris/s", "Mpix/s");
+  for (s = 0; s < sceneCount; s++) {
+    if (!scenes[s].mesh.vertexCount) { continue; }
+    tris = scenes[s].mesh.indexCount / 3;
+    for (r = 0; r < resCount; r++) {
+      res = &G_BENCH_RESOLUTIONS[r];
+      if (opts.quick && res->width != 640) { continue; }
+      for (m = 0; m < modeCount; m++) {
+        seconds = bench_run(
+            &scenes[s], &tex, G_BENCH_MODES[m].flags, res->width,
+            res->height, frames, &hash);
+        seconds = MIO_MAX(seconds, 1e-9);
+        ms = seconds * 1000.0 / (real64)frames;
+        mtris = (real64)tris * (real64)frames / seconds / 1000000.0;
+        mpix = (real64)res->width * (real64)res->height * (real64)frames /
+               seconds / 1000000.0;
+        printf(
+            "%-16s %-15s %4dx%-5d %9d %10.3f %10.2f %10.2f\n", scenes[s].name,
+            G_BENCH_MODES[m].name, res->width, res->height, tris, ms, mtris,
+            mpix);
+        if (json) {
+          fprintf(
+              json,
+              "%s{\"mesh\":\"%s\",\"mode\":\"%s\",\"flags\":%u,"
+              "\"width\":%d,\"height\":%d,\"triangles\":%d,"
+              "\"ms_per_frame\":%.4f,\"mtris_per_sec\":%.4f,"
+              "\"mpix_per_sec\":%.4f,\"hash\":\"%08x\"}",
+              first ? "" : ",\n", scenes[s].name, G_BENCH_MODES[m].name,
+              G_BENCH_MODES[m].flags, res->width, res->height, tris, ms,
+              mtris, mpix, hash);
+          first = 0;
+        }
+      }
+    }
+  }
+  if (json) {
+    fprintf(json, "\n]\n}\n");
+    fclose(json);
+  }
+  for (s = 0; s < sceneCount; s++) {
+    if (scenes[s].mesh.vertices) { sys_free(scenes[s].mesh.vertices); }
+    if (scenes[s].mesh.indices) { sys_free(scenes[s].mesh.indices); }
+  }
+  sys_free(scenes);
+  mio_texture_free(&tex);
+  mio_headless_shutdown();
+  return 0;
+}
@@ -8,8 +8,12 @@
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#define PNGL_WRITE_IMPLEMENTATION
+#include "libs/pngl.h"
+#define PLATFORM_IMPLEMENTATION
+#include "libs/plat.h"
 #define MAX_RECTS 1024
-#define MAX_PATH 512
+#define MAX_WRITE_THREADS 64
 #define MAX_EXT_LEN 256
 #define MAX_FILENAME 256
 #ifndef M_PI
@@ -17,7 +21,7 @@
 #endif
 typedef struct {
   int w, h, x, y, area;
-  char path[MAX_PATH];
+  char path[MAX_PATH_CUSTOM];
   unsigned char *data;
   unsigned char *rotated_data;
   int channels;
@@ -63,6 +67,59 @@ typedef struct {
 } State;
 FreeRect *free_rects;
 int free_count, free_cap;
+typedef struct {
+  pngl_write_band_func *func;
+  void *data;
+  int b0, b1;
+} WriteBand;
+#ifdef _WIN32
+static DWORD WINAPI write_band_entry(LPVOID arg) {
+#else
+static void *write_band_entry(void *arg) {
+#endif
+  WriteBand *band = (WriteBand *)arg;
+  band->func(band->data, band->b0, band->b1);
+  return 0;
+}
+/* Runs the PNG writer's filter/deflate bands on short-lived threads. Band 0
+ * stays on the calling thread, as does any band whose thread fails to
+ * start. */
+void write_png_parallel(pngl_write_band_func *func, void *data, int count) {
+  WriteBand bands[MAX_WRITE_THREADS];
+#ifdef _WIN32
+  HANDLE threads[MAX_WRITE_THREADS];
+#else
+  pthread_t threads[MAX_WRITE_THREADS];
+#endif
+  int started[MAX_WRITE_THREADS];
+  int i, n = count < MAX_WRITE_THREADS ? count : MAX_WRITE_THREADS;
+  for (i = 0; i < n; i++) {
+    bands[i].func = func;
+    bands[i].data = data;
+    bands[i].b0 = count * i / n;
+    bands[i].b1 = count * (i + 1) / n;
+  }
+  for (i = 1; i < n; i++) {
+#ifdef _WIN32
+    threads[i] = CreateThread(NULL, 0, write_band_entry, &bands[i], 0, NULL);
+    started[i] = threads[i] != NULL;
+#else
+    started[i] =
+        pthread_create(&threads[i], NULL, write_band_entry, &bands[i]) == 0;
+#endif
+    if (!started[i]) { write_band_entry(&bands[i]); }
+  }
+  if (n > 0) { write_band_entry(&bands[0]); }
+  for (i = 1; i < n; i++) {
+    if (!started[i]) { continue; }
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
+}
 int cmp_area_desc(const void *a, const void *b) {
   return ((Rect *)b)->area - ((Rect *)a)->area;
 }
@@ -864,7 +921,7 @@ void save_packed_image(State *s, const char *output_full_path) {
         fclose(f);
       }
     } else if (strcmp(s->output_format, "png") == 0) {
-      save_success = stbi_write_png(
+      save_success = pngl_write_png(
           output_full_path, final_w, final_h, actual_channels_out, output_data,
           final_w * actual_channels_out * (s->bits_per_channel > 8 ? 2 : 1));
     } else if (
@@ -993,11 +1050,12 @@ int check_extension(
 int load_images(const char *dir, State *s) {
   DIR *d;
   struct dirent *ent;
-  char path[MAX_PATH];
+  char path[MAX_PATH_CUSTOM];
   int file_count = 0;
   int processed = 0;
   int w, h, ch;
   unsigned char *data;
+  PlatformFileMap map;
   s->count = 0;
   s->rects = (Rect *)malloc(MAX_RECTS * sizeof(Rect));
   d = opendir(dir);
@@ -1018,8 +1076,14 @@ int load_images(const char *dir, State *s) {
             ent->d_name, s->allowed_exts_positive, s->allowed_exts_negative)) {
       continue;
     }
-    snprintf(path, MAX_PATH, "%s/%s", dir, ent->d_name);
-    data = stbi_load(path, &w, &h, &ch, 0);
+    snprintf(path, MAX_PATH_CUSTOM, "%s/%s", dir, ent->d_name);
+    data = NULL;
+    if (platform_file_map(path, &map)) {
+      if (map.size <= 0x7fffffff) {
+        data = stbi_load_from_memory(map.data, (int)map.size, &w, &h, &ch, 0);
+      }
+      platform_file_unmap(&map);
+    }
     processed++;
     printf(
         "\rLoading Images: %d/%d (%.1f%%)", processed, file_count,
@@ -1056,8 +1120,8 @@ int load_images(const char *dir, State *s) {
       if (s->allow_rotation && r->current_w != r->current_h) {
         r->rotated_data = rotate_rect_data(data, w, h, ch);
       }
-      strncpy(r->path, ent->d_name, MAX_PATH - 1);
-      r->path[MAX_PATH - 1] = '\0';
+      strncpy(r->path, ent->d_name, MAX_PATH_CUSTOM - 1);
+      r->path[MAX_PATH_CUSTOM - 1] = '\0';
       s->count++;
     }
   }
@@ -1080,7 +1144,7 @@ int main(int argc, char **argv) {
   char output_base_name[MAX_FILENAME] = "packed";
   int sort_by_area = 1;
   int i;
-  char final_output_path[MAX_PATH];
+  char final_output_path[MAX_PATH_CUSTOM];
   const char *ext;
   char base_name_buffer[MAX_FILENAME];
   char *final_name;
@@ -1098,6 +1162,9 @@ int main(int argc, char **argv) {
   s.fill_color[0] = s.fill_color[1] = s.fill_color[2] = s.fill_color[3] = 0;
   s.mono_tint[0] = s.mono_tint[1] = s.mono_tint[2] = 255;
   s.mono_tint[3] = 255;
+  if (platform_get_num_cpu_cores() > 1) {
+    pngl_write_set_parallel(write_png_parallel, platform_get_num_cpu_cores());
+  }
   for (i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
       s.debug = 1;
@@ -9,6 +9,24 @@
 #include <stdio.h>
 #include <string.h>
 
+#ifdef MIO_PNGL
+#ifndef PNGL_IMPLEMENTATION
+#define PNGL_STATIC
+#define PNGL_IMPLEMENTATION
+#endif
+#include "pngl.h"
+#endif
+
+/* MIO_TRUETYPE needs stb_truetype.h on the include path; the tree keeps one
+   copy in src/ansi/rectpack/libs/stb. */
+#ifdef MIO_TRUETYPE
+#ifndef STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#endif
+#include "stb_truetype.h"
+#endif
+
 #ifdef MIO_NO_DEBUG
 #define MIO_ASSERT(expr) ((void)0)
 #else
@@ -37,6 +55,14 @@ typedef double real64;
 #define SYS_AUDIO_DEFAULT_SAMPLE_RATE 44100
 #define SYS_AUDIO_DEFAULT_CHANNELS 2
 #define SYS_AUDIO_DEFAULT_BITS_PER_SAMPLE 16
+#define SYS_AUDIO_RING_FRAMES 2048
+#define SYS_AUDIO_MIX_FRAMES 256
+
+#define SYS_AUDIO_BACKEND_AUTO 0
+#define SYS_AUDIO_BACKEND_WASAPI 1
+#define SYS_AUDIO_BACKEND_WAVEOUT 2
+#define SYS_AUDIO_BACKEND_NULL 3
+#define SYS_AUDIO_BACKEND_WAV 4
 
 typedef uint8 SYSRET;
 
@@ -56,10 +82,32 @@ typedef struct {
   int32 bufferFrames;
 } mioSystemAudioFormat;
 
+typedef struct {
+  int32 backend;
+  uint32 underruns;
+  uint32 underrunFrames;
+  uint64 framesMixed;
+  uint64 framesPlayed;
+  int32 ringFrames;
+  int32 ringCapacity;
+  real64 mixTimeAvg;
+  real64 mixTimeMax;
+  real64 headroom;
+} mioSystemAudioStats;
+
+typedef struct {
+  const uint8 *data;
+  int32 size;
+  SYSRET terminated;
+  void *file;
+  void *mapping;
+} mioFileMap;
+
 typedef void (*PFSYSTEMAUDIOCB)(void *ud, float *out, int32 frames);
 
 SYSRET
 sys_init(const char *title, int32 width, int32 height, SYSRET borderless);
+SYSRET sys_init_headless(int32 width, int32 height);
 SYSRET sys_process_messages(void);
 void sys_present(void);
 void sys_shutdown(void);
@@ -87,13 +135,19 @@ mioSystemPoint sys_mouse_position(void);
 int32 sys_mouse_wheel(void);
 
 SYSRET sys_init_audio(int32 sr, int32 ch, PFSYSTEMAUDIOCB cb, void *ud);
+SYSRET sys_init_audio_ex(
+    int32 sr, int32 ch, PFSYSTEMAUDIOCB cb, void *ud, int32 backend,
+    const char *wavPath);
 void sys_shutdown_audio(void);
 SYSRET sys_is_audio_playing(void);
 mioSystemAudioFormat sys_get_audio_format(void);
+mioSystemAudioStats sys_get_audio_stats(void);
 void sys_beep(int32 freq, int32 dur);
 
 SYSRET sys_file_exists(const char *fp);
 uint8 *sys_load_file(const char *fp, int32 *sz);
+SYSRET sys_map_file(const char *fp, mioFileMap *map);
+void sys_unmap_file(mioFileMap *map);
 SYSRET sys_save_file(const char *fp, uint8 *data, int32 sz);
 void sys_free_file(uint8 *data);
 
@@ -409,6 +463,8 @@ typedef enum mioVirtualKeys {
 #define MIO_SCREEN_TO_WORLD_Y(sy, sh, camy, scale)                            \
   (((sy) - (sh / 2.0)) / (scale) + (camy))
 
+#define MIO_2D_ANTIALIAS 0x0001
+
 #define MIO_3D_DEPTH_TEST 0x0001
 #define MIO_3D_AFFINE_MAP 0x0002
 #define MIO_3D_VERTEX_SNAP 0x0004
@@ -422,14 +478,36 @@ typedef enum mioVirtualKeys {
 #define MIO_3D_CLIP_FRUSTUM 0x0400
 #define MIO_3D_CENTER_POINTS 0x0800
 #define MIO_3D_NORMALS 0x1000
+#define MIO_3D_COARSE_SHADE 0x2000
+#define MIO_3D_FOG 0x4000
+#define MIO_3D_CULL_OCCLUSION 0x8000
+
+#define MIO_FOG_LINEAR 0
+#define MIO_FOG_EXP 1
+#define MIO_FOG_EXP2 2
+#define MIO_FOG_LUT_SIZE 1024
+#define MIO_FOG_SPAN_STEP 16
+
+#define MIO_UPSCALE_NEAREST 0
+#define MIO_UPSCALE_BILINEAR 1
+#define MIO_UPSCALE_SHARP 2
 
 typedef struct {
   int32 x, y, width, height;
 } mioSystemRect;
 
+typedef struct {
+  real32 *data;
+  int32 capacity;
+  int32 ch;
+  volatile LONG head;
+  volatile LONG tail;
+} mioSystemAudioRing;
+
 typedef struct {
   SYSRET init;
   SYSRET wasapi;
+  int32 backend;
   IMMDeviceEnumerator *de;
   IMMDevice *dev;
   IAudioClient *ac;
@@ -446,6 +524,25 @@ typedef struct {
   void *ud;
   SYSRET stop;
   void *audioBuffer;
+  mioSystemAudioRing ring;
+  int32 ringTarget;
+  volatile LONG mixing;
+  HANDLE mixTh;
+  HANDLE mixEv;
+  real32 *mixBuffer;
+  HANDLE sinkTh;
+  HANDLE sinkFile;
+  real32 *sinkBuffer;
+  uint32 sinkBytes;
+  /* Written by the mixer and device threads; sys_get_audio_stats reads them
+     with Interlocked* only. Mix times are QPC ticks. */
+  volatile LONG underruns;
+  volatile LONG underrunFrames;
+  volatile LONG64 framesMixed;
+  volatile LONG64 framesPlayed;
+  volatile LONG mixCount;
+  volatile LONG64 mixTicks;
+  volatile LONG64 mixTicksMax;
 } mioSystemAudioState;
 
 typedef struct {
@@ -527,10 +624,34 @@ typedef struct {
   mioVec3 boundsMax;
 } mioMesh;
 
+typedef struct {
+  uint16 pos[3];
+  uint16 pad;
+  uint32 normal;
+  uint16 uv[2];
+} mioPackedVertex;
+
+typedef struct {
+  mioPackedVertex *vertices;
+  int32 *indices;
+  int32 vertexCount;
+  int32 indexCount;
+  mioVec3 boundsMin;
+  mioVec3 boundsMax;
+  mioVec2 uvMin;
+  mioVec2 uvMax;
+} mioPackedMesh;
+
+#define MIO_TEXTURE_PREMULTIPLY 0x0001
+#define MIO_TEXTURE_MIPS 0x0002
+#define MIO_TEXTURE_NO_CACHE 0x0004
+#define MIO_TEXTURE_MIP_MAX 16
+
 typedef struct {
   uint32 *data;
   uint32 width;
   uint32 height;
+  int32 mipCount;
 } mioTexture;
 
 typedef struct {
@@ -563,10 +684,67 @@ typedef struct {
   real32 sunZ;
   real32 sunFactor;
   real32 ambient;
+  real32 aaWidth;
+  int32 fogMode;
+  real32 fogStart;
+  real32 fogEnd;
+  real32 fogDensity;
+  real32 fogLutScale;
+  uint32 fogColour;
+  int32 fogCustom;
+  uint16 fogLut[MIO_FOG_LUT_SIZE];
 	int32 resolution;
 	mioCamera camera;
 } mioRenderContext;
 
+typedef struct {
+  int32 enabled;
+  int32 upscale;
+  int32 coarse;
+  int32 coarseActive;
+  real32 budget;
+  real32 scale;
+  real32 minScale;
+  real32 maxScale;
+  real32 frameTime;
+  uint32 *output;
+  int32 outputSize;
+  uint32 *tileOwner;
+  int32 tileOwnerSize;
+  uint32 tileTriangle;
+} mioDynamicRes;
+
+typedef struct {
+  HANDLE thread;
+  HANDLE kick;
+  HANDLE done;
+  uint32 *colour[2];
+  int32 width[2];
+  int32 height[2];
+  int32 front;
+  int32 back;
+  int32 inFlight;
+  int32 enabled;
+  mioSystemSize size;
+  void *drawState;
+  int32 drawStateSize;
+  volatile LONG busy;
+  volatile LONG quit;
+} mioPipeline;
+
+#define MIO_OCCLUSION_WIDTH 256
+#define MIO_OCCLUSION_HEIGHT 128
+
+typedef struct {
+  real32 *depth;
+  mioMat4 viewProj;
+  real32 nearPlane;
+  int32 active;
+  int32 occluderTris;
+  int32 tested;
+  int32 culled;
+} mioOcclusion;
+
 typedef struct {
   void *state;
   int32 (*init)(void *);
@@ -574,6 +752,9 @@ typedef struct {
   int32 (*draw)(void *);
   int32 (*shutdown)(void *);
   mioRenderContext render;
+  mioDynamicRes dynres;
+  mioPipeline pipeline;
+  mioOcclusion occlusion;
   uint32 colour;
 } mioApp;
 
@@ -582,8 +763,360 @@ MIO_GLOBAL mioSystemState G_SYS = {0};
 MIO_GLOBAL SYSRET G_VERBOSE_MODE = 1;
 MIO_GLOBAL real64 G_LAST_DEBUG_TIME = 0.0;
 
+#define MIO_PROFILE_NONE -1
+#define MIO_PROFILE_CULL 0
+#define MIO_PROFILE_TRANSFORM 1
+#define MIO_PROFILE_CLIP 2
+#define MIO_PROFILE_RASTER 3
+#define MIO_PROFILE_PRESENT 4
+#define MIO_PROFILE_STAGE_COUNT 5
+
+#define MIO_PROFILE_TRIS_IN 0
+#define MIO_PROFILE_TRIS_OUT 1
+#define MIO_PROFILE_PIXELS_WRITTEN 2
+#define MIO_PROFILE_PIXELS_REJECTED 3
+#define MIO_PROFILE_COUNTER_COUNT 4
+
+#ifdef MIO_PROFILE
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MIO_THREAD_LOCAL __declspec(thread)
+#else
+#include <x86intrin.h>
+#define MIO_THREAD_LOCAL __thread
+#endif
+
+#define MIO_PROFILE_MAX_THREADS 64
+#define MIO_PROFILE_MAX_EVENTS 65536
+#define MIO_PROFILE_MAX_DEPTH 64
+#define MIO_PROFILE_MAX_FRAMES 1024
+
+typedef struct {
+  const char *name;
+  uint64 begin;
+  uint64 end;
+  int32 depth;
+} mioProfileEvent;
+
+typedef struct {
+  mioProfileEvent *events;
+  volatile int32 count;
+  int32 stack[MIO_PROFILE_MAX_DEPTH];
+  int32 open[MIO_PROFILE_MAX_DEPTH];
+  int32 depth;
+  int32 stage;
+  uint64 stageStart;
+  volatile LONG64 stageTicks[MIO_PROFILE_STAGE_COUNT];
+  volatile LONG64 counters[MIO_PROFILE_COUNTER_COUNT];
+  LONG64 stageSeen[MIO_PROFILE_STAGE_COUNT];
+  LONG64 counterSeen[MIO_PROFILE_COUNTER_COUNT];
+  int32 id;
+} mioProfileThread;
+
+typedef struct {
+  uint64 begin;
+  uint64 ticks;
+  uint64 stageTicks[MIO_PROFILE_STAGE_COUNT];
+  int64 counters[MIO_PROFILE_COUNTER_COUNT];
+} mioProfileFrame;
+
+typedef struct {
+  mioProfileThread *threads[MIO_PROFILE_MAX_THREADS];
+  volatile LONG threadCount;
+  volatile LONG enabled;
+  uint64 tscBase;
+  LARGE_INTEGER qpcBase;
+  LARGE_INTEGER qpcFreq;
+  real64 ticksPerSecond;
+  uint64 frameBegin;
+  mioProfileFrame frames[MIO_PROFILE_MAX_FRAMES];
+  uint32 frameCount;
+} mioProfiler;
+
+MIO_GLOBAL mioProfiler G_PROFILER = {0};
+MIO_GLOBAL MIO_THREAD_LOCAL mioProfileThread *G_PROFILE_THREAD = NULL;
+
+MIO_GLOBAL void mio_profile_init(void) {
+  if (G_PROFILER.tscBase) { return; }
+  QueryPerformanceFrequency(&G_PROFILER.qpcFreq);
+  QueryPerformanceCounter(&G_PROFILER.qpcBase);
+  G_PROFILER.tscBase = __rdtsc();
+  G_PROFILER.ticksPerSecond = (real64)G_PROFILER.qpcFreq.QuadPart;
+  G_PROFILER.enabled = TRUE;
+}
+
+void mio_profile_enable(SYSRET enabled) {
+  mio_profile_init();
+  InterlockedExchange(&G_PROFILER.enabled, enabled ? TRUE : FALSE);
+}
+
+MIO_GLOBAL mioProfileThread *mio_profile_thread(void) {
+  mioProfileThread *t = G_PROFILE_THREAD;
+  LONG slot;
+  if (t) { return t; }
+  mio_profile_init();
+  t = (mioProfileThread *)sys_alloc(sizeof(mioProfileThread));
+  if (!t) { return NULL; }
+  memset(t, 0, sizeof(mioProfileThread));
+  t->stage = MIO_PROFILE_NONE;
+  slot = InterlockedIncrement(&G_PROFILER.threadCount) - 1;
+  if (slot < MIO_PROFILE_MAX_THREADS) {
+    t->events = (mioProfileEvent *)sys_alloc(
+        sizeof(mioProfileEvent) * MIO_PROFILE_MAX_EVENTS);
+    t->id = (int32)slot;
+    G_PROFILER.threads[slot] = t;
+  }
+  G_PROFILE_THREAD = t;
+  return t;
+}
+
+void mio_profile_begin(const char *name) {
+  mioProfileThread *t = mio_profile_thread();
+  mioProfileEvent *e;
+  int32 idx = -1;
+  if (!t || t->depth >= MIO_PROFILE_MAX_DEPTH) { return; }
+  if (G_PROFILER.enabled && t->events && t->count < MIO_PROFILE_MAX_EVENTS) {
+    idx = t->count;
+    e = &t->events[idx];
+    e->name = name;
+    e->depth = t->depth;
+    e->begin = __rdtsc();
+    e->end = e->begin;
+    t->count = idx + 1;
+  }
+  t->stack[t->depth] = idx;
+  t->open[t->depth] = FALSE;
+  t->depth++;
+}
+
+void mio_profile_end(void) {
+  mioProfileThread *t = G_PROFILE_THREAD;
+  int32 idx;
+  if (!t || t->depth <= 0) { return; }
+  t->depth--;
+  idx = t->stack[t->depth];
+  if (idx >= 0) { t->events[idx].end = __rdtsc(); }
+}
+
+SYSRET mio_profile_scope_open(void) {
+  mioProfileThread *t = G_PROFILE_THREAD;
+  if (!t || t->depth <= 0) { return FALSE; }
+  if (!t->open[t->depth - 1]) {
+    t->open[t->depth - 1] = TRUE;
+    return TRUE;
+  }
+  mio_profile_end();
+  return FALSE;
+}
+
+void mio_profile_stage(int32 stage) {
+  mioProfileThread *t;
+  uint64 now;
+  if (!G_PROFILER.enabled) {
+    if (G_PROFILE_THREAD) { G_PROFILE_THREAD->stage = MIO_PROFILE_NONE; }
+    return;
+  }
+  t = mio_profile_thread();
+  if (!t) { return; }
+  now = __rdtsc();
+  if (t->stage >= 0) {
+    t->stageTicks[t->stage] += (LONG64)(now - t->stageStart);
+  }
+  t->stage = stage;
+  t->stageStart = now;
+}
+
+void mio_profile_count(int32 counter, int64 n) {
+  mioProfileThread *t;
+  if (!G_PROFILER.enabled) { return; }
+  t = mio_profile_thread();
+  if (t) { t->counters[counter] += (LONG64)n; }
+}
+
+real64 mio_profile_ms(uint64 ticks) {
+  if (G_PROFILER.ticksPerSecond <= 0.0) { return 0.0; }
+  return (real64)ticks * 1000.0 / G_PROFILER.ticksPerSecond;
+}
+
+void mio_profile_frame_begin(void) {
+  mio_profile_thread();
+  G_PROFILER.frameBegin = __rdtsc();
+}
+
+/* Frame totals are the difference of each thread's running sums since the
+   previous frame_end. Only the owning thread writes its sums, with plain
+   stores; an aligned 64-bit volatile read here sees either the old or the
+   new value. Other threads' sums are never reset, so frame_begin/frame_end
+   must stay on one thread. */
+void mio_profile_frame_end(void) {
+  int32 i, j, count;
+  LONG64 v;
+  uint64 now = __rdtsc();
+  LARGE_INTEGER qpc;
+  mioProfileThread *t;
+  mioProfileFrame *f;
+  if (!G_PROFILER.tscBase) { return; }
+  QueryPerformanceCounter(&qpc);
+  if (qpc.QuadPart > G_PROFILER.qpcBase.QuadPart) {
+    G_PROFILER.ticksPerSecond =
+        (real64)(now - G_PROFILER.tscBase) *
+        (real64)G_PROFILER.qpcFreq.QuadPart /
+        (real64)(qpc.QuadPart - G_PROFILER.qpcBase.QuadPart);
+  }
+  f = &G_PROFILER.frames[G_PROFILER.frameCount % MIO_PROFILE_MAX_FRAMES];
+  memset(f, 0, sizeof(mioProfileFrame));
+  f->begin = G_PROFILER.frameBegin;
+  f->ticks = now - G_PROFILER.frameBegin;
+  count = MIO_MIN((int32)G_PROFILER.threadCount, MIO_PROFILE_MAX_THREADS);
+  for (i = 0; i < count; i++) {
+    t = G_PROFILER.threads[i];
+    if (!t) { continue; }
+    for (j = 0; j < MIO_PROFILE_STAGE_COUNT; j++) {
+      v = t->stageTicks[j];
+      f->stageTicks[j] += (uint64)(v - t->stageSeen[j]);
+      t->stageSeen[j] = v;
+    }
+    for (j = 0; j < MIO_PROFILE_COUNTER_COUNT; j++) {
+      v = t->counters[j];
+      f->counters[j] += (int64)(v - t->counterSeen[j]);
+      t->counterSeen[j] = v;
+    }
+  }
+  G_PROFILER.frameCount++;
+}
+
+mioProfileFrame mio_profile_last_frame(void) {
+  mioProfileFrame f;
+  memset(&f, 0, sizeof(f));
+  if (G_PROFILER.frameCount) {
+    f = G_PROFILER.frames
+            [(G_PROFILER.frameCount - 1) % MIO_PROFILE_MAX_FRAMES];
+  }
+  return f;
+}
+
+void mio_profile_reset(void) {
+  int32 i;
+  int32 count = MIO_MIN((int32)G_PROFILER.threadCount, MIO_PROFILE_MAX_THREADS);
+  for (i = 0; i < count; i++) {
+    if (G_PROFILER.threads[i]) { G_PROFILER.threads[i]->count = 0; }
+  }
+  G_PROFILER.frameCount = 0;
+}
+
+MIO_GLOBAL real64 mio_profile_us(uint64 tsc) {
+  if (G_PROFILER.ticksPerSecond <= 0.0 || tsc < G_PROFILER.tscBase) {
+    return 0.0;
+  }
+  return (real64)(tsc - G_PROFILER.tscBase) * 1000000.0 /
+         G_PROFILER.ticksPerSecond;
+}
+
+MIO_GLOBAL void mio_profile_write_name(FILE *fp, const char *name) {
+  const char *c;
+  for (c = name; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', fp);
+      fputc(*c, fp);
+    } else if ((uint8)*c < 0x20) {
+      fprintf(fp, "\\u%04x", (uint32)(uint8)*c);
+    } else {
+      fputc(*c, fp);
+    }
+  }
+}
+
+SYSRET mio_profile_export(const char *path) {
+  static const char *stageNames[MIO_PROFILE_STAGE_COUNT] = {
+      "cull", "transform", "clip", "raster", "present"};
+  static const char *counterNames[MIO_PROFILE_COUNTER_COUNT] = {
+      "trisIn", "trisOut", "pixelsWritten", "pixelsRejected"};
+  int32 i, j, count, frames;
+  uint32 first;
+  const char *sep = "";
+  mioProfileThread *t;
+  mioProfileEvent *e;
+  mioProfileFrame *f;
+  FILE *fp = fopen(path, "wb");
+  if (!fp) { return FALSE; }
+  fprintf(fp, "{\"traceEvents\":[\n");
+  count = MIO_MIN((int32)G_PROFILER.threadCount, MIO_PROFILE_MAX_THREADS);
+  for (i = 0; i < count; i++) {
+    t = G_PROFILER.threads[i];
+    if (!t || !t->events) { continue; }
+    for (j = 0; j < t->count; j++) {
+      e = &t->events[j];
+      fprintf(fp, "%s{\"name\":\"", sep);
+      mio_profile_write_name(fp, e->name);
+      fprintf(
+          fp,
+          "\",\"cat\":\"mio\",\"ph\":\"X\",\"pid\":1,"
+          "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+          t->id, mio_profile_us(e->begin),
+          mio_profile_us(e->end) - mio_profile_us(e->begin));
+      sep = ",\n";
+    }
+  }
+  frames = (int32)MIO_MIN(G_PROFILER.frameCount, MIO_PROFILE_MAX_FRAMES);
+  first = G_PROFILER.frameCount - (uint32)frames;
+  for (i = 0; i < frames; i++) {
+    f = &G_PROFILER.frames[(first + i) % MIO_PROFILE_MAX_FRAMES];
+    fprintf(
+        fp,
+        "%s{\"name\":\"stages\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+        "\"args\":{",
+        sep, mio_profile_us(f->begin));
+    for (j = 0; j < MIO_PROFILE_STAGE_COUNT; j++) {
+      fprintf(
+          fp, "%s\"%s\":%.4f", j ? "," : "", stageNames[j],
+          mio_profile_ms(f->stageTicks[j]));
+    }
+    fprintf(
+        fp,
+        "}},\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+        "\"args\":{",
+        mio_profile_us(f->begin));
+    for (j = 0; j < MIO_PROFILE_COUNTER_COUNT; j++) {
+      fprintf(
+          fp, "%s\"%s\":%lld", j ? "," : "", counterNames[j],
+          (long long)f->counters[j]);
+    }
+    fprintf(fp, "}}");
+    sep = ",\n";
+  }
+  fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(fp);
+  return TRUE;
+}
+
+/* The scope body runs inside a for loop: a break or return in it skips the
+   closing mio_profile_end. Use MIO_PROFILE_BEGIN/END around such code. */
+#define MIO_PROFILE_SCOPE(name)                                               \
+  for (mio_profile_begin(name); mio_profile_scope_open();)
+#define MIO_PROFILE_BEGIN(name) mio_profile_begin(name)
+#define MIO_PROFILE_END() mio_profile_end()
+#define MIO_PROFILE_STAGE(stage) mio_profile_stage(stage)
+#define MIO_PROFILE_COUNT(counter, n) mio_profile_count(counter, (int64)(n))
+#define MIO_PROFILE_FRAME_BEGIN() mio_profile_frame_begin()
+#define MIO_PROFILE_FRAME_END() mio_profile_frame_end()
+#else
+#define MIO_PROFILE_SCOPE(name)
+#define MIO_PROFILE_BEGIN(name) ((void)0)
+#define MIO_PROFILE_END() ((void)0)
+#define MIO_PROFILE_STAGE(stage) ((void)0)
+#define MIO_PROFILE_COUNT(counter, n) ((void)0)
+#define MIO_PROFILE_FRAME_BEGIN() ((void)0)
+#define MIO_PROFILE_FRAME_END() ((void)0)
+#endif
+
 MIO_GLOBAL LRESULT CALLBACK
 sys_wnd_proc(HWND hw, UINT msg, WPARAM wp, LPARAM lp);
+MIO_GLOBAL void mio_render_frame(int32 ww, int32 wh);
+MIO_GLOBAL const uint32 *mio_dynres_resolve(
+    const uint32 *src, int32 ww, int32 wh, int32 threaded, int32 *w,
+    int32 *h);
+MIO_GLOBAL const uint32 *mio_pipeline_front(int32 *w, int32 *h);
 
 mioRect mio_rect(real32 x1, real32 y1, real32 x2, real32 y2) {
   mioRect ret;
@@ -631,6 +1164,7 @@ mioRenderContext mio_render_context(void *memory, size_t size, int32 depth, int3
   ctx.sunZ = -0.2;
   ctx.sunFactor = 1.0f;
   ctx.ambient = 0.04;
+  ctx.aaWidth = 1.0f;
   ctx.flags3D = MIO_3D_SOLID | MIO_3D_TEXTURE | MIO_3D_SHADE_FLAT |
                 MIO_3D_CULL_BACKFACE | MIO_3D_CULL_BEHIND |
                 MIO_3D_CULL_FRUSTUM | MIO_3D_CLIP_FRUSTUM | MIO_3D_DEPTH_TEST;
@@ -670,12 +1204,158 @@ MIO_GLOBAL void sys_clear_input(void) {
   G_SYS.mwd = 0;
 }
 
+MIO_GLOBAL int32 sys_audio_ring_count(mioSystemAudioRing *r) {
+  return (int32)((uint32)InterlockedCompareExchange(&r->head, 0, 0) -
+                 (uint32)InterlockedCompareExchange(&r->tail, 0, 0));
+}
+
+MIO_GLOBAL int32
+sys_audio_ring_write(mioSystemAudioRing *r, const real32 *src, int32 frames) {
+  uint32 head = (uint32)InterlockedCompareExchange(&r->head, 0, 0);
+  uint32 tail = (uint32)InterlockedCompareExchange(&r->tail, 0, 0);
+  int32 space = r->capacity - (int32)(head - tail);
+  int32 at, first;
+  if (frames > space) { frames = space; }
+  if (frames <= 0) { return 0; }
+  at = (int32)(head & (uint32)(r->capacity - 1));
+  first = MIO_MIN(frames, r->capacity - at);
+  memcpy(r->data + at * r->ch, src, first * r->ch * sizeof(real32));
+  memcpy(
+      r->data, src + first * r->ch, (frames - first) * r->ch * sizeof(real32));
+  InterlockedExchange(&r->head, (LONG)(head + (uint32)frames));
+  return frames;
+}
+
+MIO_GLOBAL int32
+sys_audio_ring_read(mioSystemAudioRing *r, real32 *dst, int32 frames) {
+  uint32 tail = (uint32)InterlockedCompareExchange(&r->tail, 0, 0);
+  uint32 head = (uint32)InterlockedCompareExchange(&r->head, 0, 0);
+  int32 count = (int32)(head - tail);
+  int32 at, first;
+  if (frames > count) { frames = count; }
+  if (frames <= 0) { return 0; }
+  at = (int32)(tail & (uint32)(r->capacity - 1));
+  first = MIO_MIN(frames, r->capacity - at);
+  memcpy(dst, r->data + at * r->ch, first * r->ch * sizeof(real32));
+  memcpy(
+      dst + first * r->ch, r->data, (frames - first) * r->ch * sizeof(real32));
+  InterlockedExchange(&r->tail, (LONG)(tail + (uint32)frames));
+  return frames;
+}
+
+MIO_GLOBAL void sys_audio_pull(real32 *dst, int32 frames) {
+  int32 ch = G_SYS.audio.afmt.ch;
+  int32 got;
+  if (!InterlockedCompareExchange(&G_SYS.audio.mixing, 0, 0)) {
+    memset(dst, 0, frames * ch * sizeof(real32));
+    return;
+  }
+  got = sys_audio_ring_read(&G_SYS.audio.ring, dst, frames);
+  if (got < frames) {
+    memset(dst + got * ch, 0, (frames - got) * ch * sizeof(real32));
+    InterlockedIncrement(&G_SYS.audio.underruns);
+    InterlockedExchangeAdd(&G_SYS.audio.underrunFrames, (LONG)(frames - got));
+  }
+  InterlockedExchangeAdd64(&G_SYS.audio.framesPlayed, (LONG64)frames);
+  SetEvent(G_SYS.audio.mixEv);
+}
+
+MIO_GLOBAL void sys_audio_to_int16(int16 *dst, const real32 *src, int32 n) {
+  int32 i;
+  for (i = 0; i < n; i++) {
+    real32 s = src[i];
+    if (s > 1.0f) { s = 1.0f; }
+    if (s < -1.0f) { s = -1.0f; }
+    dst[i] = (int16)(s * 32767.0f);
+  }
+}
+
+MIO_GLOBAL SYSRET sys_audio_mix_block(void) {
+  mioSystemAudioState *a = &G_SYS.audio;
+  LARGE_INTEGER t0, t1;
+  LONG64 dt;
+  if (sys_audio_ring_count(&a->ring) >= a->ringTarget) { return FALSE; }
+  if (a->cb) {
+    QueryPerformanceCounter(&t0);
+    a->cb(a->ud, a->mixBuffer, SYS_AUDIO_MIX_FRAMES);
+    QueryPerformanceCounter(&t1);
+    dt = (LONG64)(t1.QuadPart - t0.QuadPart);
+    InterlockedExchangeAdd64(&a->mixTicks, dt);
+    if (dt > InterlockedCompareExchange64(&a->mixTicksMax, 0, 0)) {
+      InterlockedExchange64(&a->mixTicksMax, dt);
+    }
+    InterlockedIncrement(&a->mixCount);
+  } else {
+    memset(
+        a->mixBuffer, 0, SYS_AUDIO_MIX_FRAMES * a->afmt.ch * sizeof(real32));
+  }
+  sys_audio_ring_write(&a->ring, a->mixBuffer, SYS_AUDIO_MIX_FRAMES);
+  InterlockedExchangeAdd64(&a->framesMixed, SYS_AUDIO_MIX_FRAMES);
+  return TRUE;
+}
+
+MIO_GLOBAL DWORD WINAPI sys_audio_mix_thread(LPVOID p) {
+  (void)p;
+  while (!G_SYS.audio.stop) {
+    while (!G_SYS.audio.stop && sys_audio_mix_block()) {}
+    WaitForSingleObject(G_SYS.audio.mixEv, 5);
+  }
+  return 0;
+}
+
+MIO_GLOBAL SYSRET sys_audio_start_mixer(void) {
+  mioSystemAudioState *a = &G_SYS.audio;
+  int32 cap = SYS_AUDIO_RING_FRAMES;
+  a->ringTarget = a->afmt.bufferFrames + SYS_AUDIO_MIX_FRAMES * 2;
+  while (cap < a->ringTarget + SYS_AUDIO_MIX_FRAMES) { cap <<= 1; }
+  a->ring.data = (real32 *)sys_alloc(cap * a->afmt.ch * sizeof(real32));
+  a->mixBuffer =
+      (real32 *)sys_alloc(SYS_AUDIO_MIX_FRAMES * a->afmt.ch * sizeof(real32));
+  a->mixEv = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!a->ring.data || !a->mixBuffer || !a->mixEv) {
+    sys_log("Failed to allocate audio mixer.\n");
+    return FALSE;
+  }
+  a->ring.capacity = cap;
+  a->ring.ch = a->afmt.ch;
+  a->ring.head = 0;
+  a->ring.tail = 0;
+  while (sys_audio_mix_block()) {}
+  a->mixTh = CreateThread(NULL, 0, sys_audio_mix_thread, NULL, 0, NULL);
+  if (!a->mixTh) {
+    sys_log("Failed to create audio mixer thread.\n");
+    return FALSE;
+  }
+  SetThreadPriority(a->mixTh, THREAD_PRIORITY_TIME_CRITICAL);
+  InterlockedExchange(&a->mixing, 1);
+  return TRUE;
+}
+
+MIO_GLOBAL void sys_audio_stop_mixer(void) {
+  mioSystemAudioState *a = &G_SYS.audio;
+  InterlockedExchange(&a->mixing, 0);
+  a->stop = 1;
+  if (a->mixTh) {
+    SetEvent(a->mixEv);
+    WaitForSingleObject(a->mixTh, 5000);
+    CloseHandle(a->mixTh);
+    a->mixTh = NULL;
+  }
+  if (a->mixEv) {
+    CloseHandle(a->mixEv);
+    a->mixEv = NULL;
+  }
+  sys_free(a->ring.data);
+  sys_free(a->mixBuffer);
+  a->ring.data = NULL;
+  a->mixBuffer = NULL;
+}
+
 MIO_GLOBAL DWORD WINAPI sys_wasapi_thread(LPVOID p) {
   HRESULT hr;
   uint32 bfc, pad, avail;
   uint8 *data;
   real32 *fb;
-  int32 i;
   (void)p;
   hr = G_SYS.audio.ac->lpVtbl->GetBufferSize(G_SYS.audio.ac, &bfc);
   if (FAILED(hr)) { return 1; }
@@ -690,20 +1370,12 @@ MIO_GLOBAL DWORD WINAPI sys_wasapi_thread(LPVOID p) {
     if (avail > 0) {
       hr = G_SYS.audio.rc->lpVtbl->GetBuffer(G_SYS.audio.rc, avail, &data);
       if (FAILED(hr)) { break; }
-      if (G_SYS.audio.cb) {
-        G_SYS.audio.cb(G_SYS.audio.ud, fb, (int32)avail);
-        if (G_SYS.audio.fmt->wBitsPerSample == 16) {
-          int16 *sd = (int16 *)data;
-          for (i = 0; i < (int32)(avail * G_SYS.audio.afmt.ch); i++) {
-            real32 s = fb[i];
-            if (s > 1.0f) { s = 1.0f; }
-            if (s < -1.0f) { s = -1.0f; }
-            sd[i] = (int16)(s * 32767.0f);
-          }
-        } else if (G_SYS.audio.fmt->wBitsPerSample == 32) {
-          real32 *fd = (real32 *)data;
-          memcpy(fd, fb, avail * G_SYS.audio.afmt.ch * sizeof(real32));
-        }
+      if (G_SYS.audio.fmt->wBitsPerSample == 32) {
+        sys_audio_pull((real32 *)data, (int32)avail);
+      } else if (G_SYS.audio.fmt->wBitsPerSample == 16) {
+        sys_audio_pull(fb, (int32)avail);
+        sys_audio_to_int16(
+            (int16 *)data, fb, (int32)avail * G_SYS.audio.afmt.ch);
       } else {
         memset(data, 0, avail * G_SYS.audio.afmt.bpf);
       }
@@ -721,7 +1393,6 @@ MIO_GLOBAL void CALLBACK sys_waveout_cb(
   int32 index;
   WAVEHDR *h;
   real32 *fb;
-  int32 i;
   (void)hwo;
   (void)dp2;
   if (msg != WOM_DONE || G_SYS.audio.stop) { return; }
@@ -729,18 +1400,9 @@ MIO_GLOBAL void CALLBACK sys_waveout_cb(
   audio = (mioSystemAudioState *)di;
   index = h - audio->wh;
   fb = audio->wb_f[index];
-
-  if (audio->cb) {
-    audio->cb(audio->ud, fb, audio->afmt.bufferFrames);
-  } else {
-    memset(fb, 0, audio->afmt.bufferFrames * audio->afmt.ch * sizeof(real32));
-  }
-  for (i = 0; i < audio->afmt.bufferFrames * audio->afmt.ch; i++) {
-    real32 s = fb[i];
-    if (s > 1.0f) { s = 1.0f; }
-    if (s < -1.0f) { s = -1.0f; }
-    ((int16 *)h->lpData)[i] = (int16)(s * 32767.0f);
-  }
+  sys_audio_pull(fb, audio->afmt.bufferFrames);
+  sys_audio_to_int16(
+      (int16 *)h->lpData, fb, audio->afmt.bufferFrames * audio->afmt.ch);
   waveOutWrite(G_SYS.audio.wo, h, sizeof(WAVEHDR));
 }
 
@@ -795,6 +1457,7 @@ MIO_GLOBAL SYSRET sys_init_wasapi(mioSystemAudioFormat *fmt) {
     return 0;
   }
   fmt->bufferFrames = bfc;
+  G_SYS.audio.afmt = *fmt;
   sys_log("WASAPI buffer size: %d frames.\n", fmt->bufferFrames);
   G_SYS.audio.ev = CreateEvent(NULL, FALSE, FALSE, NULL);
   if (!G_SYS.audio.ev) {
@@ -865,7 +1528,7 @@ MIO_GLOBAL void sys_shutdown_wasapi(void) {
 MIO_GLOBAL SYSRET sys_init_waveout(mioSystemAudioFormat *fmt) {
   WAVEFORMATEX wfx;
   MMRESULT r;
-  int32 i, j;
+  int32 i;
   sys_log("Attempting WaveOut initialization...\n");
   wfx.wFormatTag = WAVE_FORMAT_PCM;
   wfx.nChannels = (WORD)fmt->ch;
@@ -876,6 +1539,7 @@ MIO_GLOBAL SYSRET sys_init_waveout(mioSystemAudioFormat *fmt) {
   wfx.cbSize = 0;
   fmt->bpf = wfx.nBlockAlign;
   fmt->bufferFrames = fmt->sr / 10;
+  G_SYS.audio.afmt = *fmt;
   sys_log(
       "WaveOut format: sample rate=%d, channels=%d, "
       "bits per sample=%d, buffer frames=%d.\n",
@@ -912,19 +1576,10 @@ MIO_GLOBAL SYSRET sys_init_waveout(mioSystemAudioFormat *fmt) {
   }
 
   for (i = 0; i < SYS_AUDIO_BUFFER_COUNT; i++) {
-    if (G_SYS.audio.cb) {
-      G_SYS.audio.cb(G_SYS.audio.ud, G_SYS.audio.wb_f[i], fmt->bufferFrames);
-    } else {
-      memset(
-          G_SYS.audio.wb_f[i], 0,
-          fmt->bufferFrames * fmt->ch * sizeof(real32));
-    }
-    for (j = 0; j < fmt->bufferFrames * fmt->ch; j++) {
-      real32 s = G_SYS.audio.wb_f[i][j];
-      if (s > 1.0f) { s = 1.0f; }
-      if (s < -1.0f) { s = -1.0f; }
-      ((int16 *)G_SYS.audio.wh[i].lpData)[j] = (int16)(s * 32767.0f);
-    }
+    sys_audio_pull(G_SYS.audio.wb_f[i], fmt->bufferFrames);
+    sys_audio_to_int16(
+        (int16 *)G_SYS.audio.wh[i].lpData, G_SYS.audio.wb_f[i],
+        fmt->bufferFrames * fmt->ch);
     waveOutWrite(G_SYS.audio.wo, &G_SYS.audio.wh[i], sizeof(WAVEHDR));
   }
   return 1;
@@ -951,6 +1606,115 @@ MIO_GLOBAL void sys_shutdown_waveout(void) {
   sys_log("WaveOut shutdown complete.\n");
 }
 
+MIO_GLOBAL void sys_audio_wav_header(uint8 *h, mioSystemAudioFormat *fmt,
+                                     uint32 bytes) {
+  uint32 v[6];
+  int32 i;
+  v[0] = bytes + 36;
+  v[1] = 16;
+  v[2] = 1 | ((uint32)fmt->ch << 16);
+  v[3] = (uint32)fmt->sr;
+  v[4] = (uint32)(fmt->sr * fmt->bpf);
+  v[5] = (uint32)fmt->bpf | ((uint32)fmt->bps << 16);
+  memcpy(h, "RIFF....WAVEfmt ", 16);
+  memcpy(h + 36, "data", 4);
+  for (i = 0; i < 4; i++) {
+    h[4 + i] = (uint8)(v[0] >> (i * 8));
+    h[16 + i] = (uint8)(v[1] >> (i * 8));
+    h[20 + i] = (uint8)(v[2] >> (i * 8));
+    h[24 + i] = (uint8)(v[3] >> (i * 8));
+    h[28 + i] = (uint8)(v[4] >> (i * 8));
+    h[32 + i] = (uint8)(v[5] >> (i * 8));
+    h[40 + i] = (uint8)(bytes >> (i * 8));
+  }
+}
+
+MIO_GLOBAL DWORD WINAPI sys_audio_sink_thread(LPVOID p) {
+  mioSystemAudioState *a = &G_SYS.audio;
+  int32 frames = a->afmt.bufferFrames;
+  int32 n = frames * a->afmt.ch;
+  LARGE_INTEGER freq, now;
+  real64 next, wait;
+  DWORD bw;
+  (void)p;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  next = (real64)now.QuadPart / (real64)freq.QuadPart;
+  while (!a->stop) {
+    next += (real64)frames / (real64)a->afmt.sr;
+    QueryPerformanceCounter(&now);
+    wait = next - (real64)now.QuadPart / (real64)freq.QuadPart;
+    if (wait > 0.0) { Sleep((DWORD)(wait * 1000.0)); }
+    sys_audio_pull(a->sinkBuffer, frames);
+    if (a->sinkFile != INVALID_HANDLE_VALUE) {
+      sys_audio_to_int16((int16 *)(a->sinkBuffer + n), a->sinkBuffer, n);
+      if (WriteFile(
+              a->sinkFile, a->sinkBuffer + n, (DWORD)(frames * a->afmt.bpf),
+              &bw, NULL)) {
+        a->sinkBytes += bw;
+      }
+    }
+  }
+  return 0;
+}
+
+MIO_GLOBAL SYSRET sys_init_sink(mioSystemAudioFormat *fmt, const char *path) {
+  uint8 header[44];
+  DWORD bw;
+  fmt->bufferFrames = fmt->sr / 100;
+  G_SYS.audio.afmt = *fmt;
+  G_SYS.audio.sinkFile = INVALID_HANDLE_VALUE;
+  G_SYS.audio.sinkBytes = 0;
+  if (path) {
+    G_SYS.audio.sinkFile = CreateFileA(
+        path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (G_SYS.audio.sinkFile == INVALID_HANDLE_VALUE) {
+      sys_log("Failed to create audio sink file: %s\n", path);
+      return 0;
+    }
+    sys_audio_wav_header(header, fmt, 0);
+    WriteFile(G_SYS.audio.sinkFile, header, sizeof(header), &bw, NULL);
+  }
+  G_SYS.audio.sinkBuffer = (real32 *)sys_alloc(
+      fmt->bufferFrames * fmt->ch * sizeof(real32) +
+      fmt->bufferFrames * fmt->bpf);
+  if (!G_SYS.audio.sinkBuffer) {
+    sys_log("Failed to allocate audio sink buffer.\n");
+    return 0;
+  }
+  G_SYS.audio.sinkTh =
+      CreateThread(NULL, 0, sys_audio_sink_thread, NULL, 0, NULL);
+  if (!G_SYS.audio.sinkTh) {
+    sys_log("Failed to create audio sink thread.\n");
+    return 0;
+  }
+  sys_log(
+      "Audio sink: %s, sample rate=%d, channels=%d, buffer frames=%d.\n",
+      path ? path : "null", fmt->sr, fmt->ch, fmt->bufferFrames);
+  return 1;
+}
+
+MIO_GLOBAL void sys_shutdown_sink(void) {
+  uint8 header[44];
+  DWORD bw;
+  G_SYS.audio.stop = 1;
+  if (G_SYS.audio.sinkTh) {
+    WaitForSingleObject(G_SYS.audio.sinkTh, 5000);
+    CloseHandle(G_SYS.audio.sinkTh);
+    G_SYS.audio.sinkTh = NULL;
+  }
+  if (G_SYS.audio.sinkFile && G_SYS.audio.sinkFile != INVALID_HANDLE_VALUE) {
+    sys_audio_wav_header(header, &G_SYS.audio.afmt, G_SYS.audio.sinkBytes);
+    SetFilePointer(G_SYS.audio.sinkFile, 0, NULL, FILE_BEGIN);
+    WriteFile(G_SYS.audio.sinkFile, header, sizeof(header), &bw, NULL);
+    CloseHandle(G_SYS.audio.sinkFile);
+  }
+  G_SYS.audio.sinkFile = NULL;
+  sys_free(G_SYS.audio.sinkBuffer);
+  G_SYS.audio.sinkBuffer = NULL;
+}
+
 MIO_GLOBAL int32 sys_set_timer(uint32 milis) {
   SetTimer(G_SYS.hwnd, 1, milis, NULL);
   return TRUE;
@@ -1000,26 +1764,39 @@ sys_wnd_proc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
     BITMAPINFO bmi;
     mioSystemSize wndSz = sys_get_window_size();
     HDC hdc = GetDC(hwnd);
+    const uint32 *fb = NULL;
+    int32 fbW = 0, fbH = 0;
     memset(&bmi, 0, sizeof(BITMAPINFO));
-    if (G_APP.render.colourData) {
-      G_APP.render.width = wndSz.width/G_APP.render.resolution;
-      G_APP.render.height = wndSz.height/G_APP.render.resolution;
-      G_SYS.fb_w = G_APP.render.width;
-      G_SYS.fb_h = G_APP.render.height;
-      if (G_APP.draw) { G_APP.draw(G_APP.state); }
-    }
-    if (G_SYS.fb) {
+    MIO_PROFILE_FRAME_BEGIN();
+    if (G_APP.pipeline.thread) {
+      fb = mio_pipeline_front(&fbW, &fbH);
+    } else if (G_APP.render.colourData) {
+      mio_render_frame(wndSz.width, wndSz.height);
+      fb = G_APP.render.colourData;
+      fbW = G_APP.render.width;
+      fbH = G_APP.render.height;
+    }
+    if (fb) {
+      fb = mio_dynres_resolve(
+          fb, wndSz.width, wndSz.height, !G_APP.pipeline.thread, &fbW, &fbH);
+    }
+    MIO_PROFILE_STAGE(MIO_PROFILE_PRESENT);
+    MIO_PROFILE_BEGIN("present");
+    if (fb) {
       bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-      bmi.bmiHeader.biWidth = G_SYS.fb_w;
-      bmi.bmiHeader.biHeight = -G_SYS.fb_h;
+      bmi.bmiHeader.biWidth = fbW;
+      bmi.bmiHeader.biHeight = -fbH;
       bmi.bmiHeader.biPlanes = 1;
       bmi.bmiHeader.biBitCount = 32;
       bmi.bmiHeader.biCompression = BI_RGB;
       StretchDIBits(
-          hdc, 0, 0, G_SYS.cs.width, G_SYS.cs.height, 0, 0, G_SYS.fb_w,
-          G_SYS.fb_h, G_SYS.fb, &bmi, DIB_RGB_COLORS, SRCCOPY);
+          hdc, 0, 0, G_SYS.cs.width, G_SYS.cs.height, 0, 0, fbW, fbH, fb,
+          &bmi, DIB_RGB_COLORS, SRCCOPY);
     }
     ReleaseDC(hwnd, hdc);
+    MIO_PROFILE_END();
+    MIO_PROFILE_STAGE(MIO_PROFILE_NONE);
+    MIO_PROFILE_FRAME_END();
   } break;
   case WM_SIZE:
     if (wp == SIZE_MINIMIZED) {
@@ -1029,7 +1806,9 @@ sys_wnd_proc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
       G_SYS.cs.width = LOWORD(lp);
       G_SYS.cs.height = HIWORD(lp);
     }
-    mio_render_context_resize(G_SYS.cs.width, G_SYS.cs.height);
+    if (!G_APP.pipeline.thread) {
+      mio_render_context_resize(G_SYS.cs.width, G_SYS.cs.height);
+    }
     break;
   case WM_SIZING:
     break;
@@ -1172,6 +1951,21 @@ sys_init(const char *title, int32 width, int32 height, SYSRET borderless) {
   return 1;
 }
 
+SYSRET sys_init_headless(int32 width, int32 height) {
+  memset(&G_SYS, 0, sizeof(G_SYS));
+  QueryPerformanceFrequency(&G_SYS.freq);
+  QueryPerformanceCounter(&G_SYS.st);
+  G_SYS.lt = G_SYS.st;
+  G_LAST_DEBUG_TIME = sys_get_time();
+  G_SYS.ws.width = width;
+  G_SYS.ws.height = height;
+  G_SYS.cs.width = width;
+  G_SYS.cs.height = height;
+  G_SYS.running = 1;
+  sys_log("Headless system initialized (%dx%d).\n", width, height);
+  return 1;
+}
+
 SYSRET sys_process_messages(void) {
   MSG msg;
   sys_clear_input();
@@ -1201,12 +1995,31 @@ void sys_shutdown(void) {
 
 void sys_log_perf(void) {
   real64 current_time = sys_get_time();
+#ifdef MIO_PROFILE
+  mioProfileFrame pf;
+#endif
   G_SYS.fpsCount++;
   if (current_time - G_LAST_DEBUG_TIME >= 1.0) {
     sys_log(
         "FPS (U): %d FPS (R): %d | Window Size: %dx%d | Mouse Pos: %d, %d\n",
         G_SYS.fpsUpdateCount, (uint32)G_SYS.fpsCount, G_SYS.cs.width,
         G_SYS.cs.height, G_SYS.mpos.x, G_SYS.mpos.y);
+#ifdef MIO_PROFILE
+    pf = mio_profile_last_frame();
+    sys_log(
+        "Frame: %.2fms | cull %.2f transform %.2f clip %.2f raster %.2f "
+        "present %.2f | tris %lld/%lld | px %lld written %lld rejected\n",
+        mio_profile_ms(pf.ticks),
+        mio_profile_ms(pf.stageTicks[MIO_PROFILE_CULL]),
+        mio_profile_ms(pf.stageTicks[MIO_PROFILE_TRANSFORM]),
+        mio_profile_ms(pf.stageTicks[MIO_PROFILE_CLIP]),
+        mio_profile_ms(pf.stageTicks[MIO_PROFILE_RASTER]),
+        mio_profile_ms(pf.stageTicks[MIO_PROFILE_PRESENT]),
+        (long long)pf.counters[MIO_PROFILE_TRIS_OUT],
+        (long long)pf.counters[MIO_PROFILE_TRIS_IN],
+        (long long)pf.counters[MIO_PROFILE_PIXELS_WRITTEN],
+        (long long)pf.counters[MIO_PROFILE_PIXELS_REJECTED]);
+#endif
     G_LAST_DEBUG_TIME = current_time;
     G_SYS.fpsCount = 0;
     G_SYS.fpsUpdateCount = 0;
@@ -1301,8 +2114,15 @@ mioSystemPoint sys_mouse_position(void) { return G_SYS.mpos; }
 int32 sys_mouse_wheel(void) { return G_SYS.mwd; }
 
 SYSRET sys_init_audio(int32 sr, int32 ch, PFSYSTEMAUDIOCB cb, void *ud) {
+  return sys_init_audio_ex(sr, ch, cb, ud, SYS_AUDIO_BACKEND_AUTO, NULL);
+}
+
+SYSRET sys_init_audio_ex(
+    int32 sr, int32 ch, PFSYSTEMAUDIOCB cb, void *ud, int32 backend,
+    const char *wavPath) {
   mioSystemAudioFormat fmt;
   HRESULT hr;
+  SYSRET com, ok = 0;
   if (G_SYS.audio.init) {
     sys_log("Audio already initialized, shutting down first.\n");
     sys_shutdown_audio();
@@ -1312,43 +2132,69 @@ SYSRET sys_init_audio(int32 sr, int32 ch, PFSYSTEMAUDIOCB cb, void *ud) {
   fmt.ch = ch > 0 ? ch : SYS_AUDIO_DEFAULT_CHANNELS;
   fmt.bps = SYS_AUDIO_DEFAULT_BITS_PER_SAMPLE;
   fmt.bpf = fmt.ch * (fmt.bps / 8);
+  fmt.bufferFrames = 0;
   G_SYS.audio.cb = cb;
   G_SYS.audio.ud = ud;
   G_SYS.audio.afmt = fmt;
   G_SYS.audio.stop = 0;
-  hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
-  if (SUCCEEDED(hr) || hr == RPC_E_CHANGED_MODE) {
-    sys_log("Attempting WASAPI initialization...\n");
-    if (sys_init_wasapi(&fmt)) {
-      G_SYS.audio.wasapi = 1;
-      G_SYS.audio.init = 1;
-      sys_log("WASAPI initialization successful.\n");
-      return 1;
+  if (backend == SYS_AUDIO_BACKEND_NULL || backend == SYS_AUDIO_BACKEND_WAV) {
+    ok = sys_init_sink(
+        &fmt, backend == SYS_AUDIO_BACKEND_WAV ? wavPath : NULL);
+    if (!ok) { sys_shutdown_sink(); }
+  } else {
+    hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    com = SUCCEEDED(hr) || hr == RPC_E_CHANGED_MODE;
+    if (com && backend != SYS_AUDIO_BACKEND_WAVEOUT) {
+      sys_log("Attempting WASAPI initialization...\n");
+      if (sys_init_wasapi(&fmt)) {
+        G_SYS.audio.wasapi = 1;
+        backend = SYS_AUDIO_BACKEND_WASAPI;
+        ok = 1;
+        sys_log("WASAPI initialization successful.\n");
+      } else {
+        sys_log("WASAPI initialization failed.\n");
+        sys_shutdown_wasapi();
+        G_SYS.audio.stop = 0;
+        G_SYS.audio.afmt = fmt;
+      }
+    }
+    if (!ok && backend != SYS_AUDIO_BACKEND_WASAPI) {
+      sys_log("Attempting WaveOut initialization...\n");
+      if (sys_init_waveout(&fmt)) {
+        G_SYS.audio.wasapi = 0;
+        backend = SYS_AUDIO_BACKEND_WAVEOUT;
+        ok = 1;
+        sys_log("WaveOut initialization successful.\n");
+      }
     }
-    sys_log("WASAPI initialization failed.\n");
   }
-  sys_log("Attempting WaveOut initialization...\n");
-  if (sys_init_waveout(&fmt)) {
-    G_SYS.audio.wasapi = 0;
-    G_SYS.audio.init = 1;
-    sys_log("WaveOut initialization successful.\n");
-    return 1;
+  G_SYS.audio.init = 1;
+  G_SYS.audio.backend = backend;
+  if (!ok || !sys_audio_start_mixer()) {
+    sys_log("Audio initialization failed.\n");
+    sys_shutdown_audio();
+    return 0;
   }
-  sys_log("Audio initialization failed.\n");
-  return 0;
+  return 1;
 }
 
 void sys_shutdown_audio(void) {
   if (!G_SYS.audio.init) { return; }
   sys_log("Shutting down audio system...\n");
   G_SYS.audio.stop = 1;
-  if (G_SYS.audio.wasapi) {
-    sys_shutdown_wasapi();
+  if (G_SYS.audio.backend == SYS_AUDIO_BACKEND_NULL ||
+      G_SYS.audio.backend == SYS_AUDIO_BACKEND_WAV) {
+    sys_shutdown_sink();
   } else {
-    sys_shutdown_waveout();
+    if (G_SYS.audio.wasapi) {
+      sys_shutdown_wasapi();
+    } else {
+      sys_shutdown_waveout();
+    }
+    CoUninitialize();
   }
+  sys_audio_stop_mixer();
   memset(&G_SYS.audio, 0, sizeof(mioSystemAudioState));
-  CoUninitialize();
   sys_log("Audio shutdown complete.\n");
 }
 
@@ -1358,6 +2204,34 @@ SYSRET sys_is_audio_playing(void) {
 
 mioSystemAudioFormat sys_get_audio_format(void) { return G_SYS.audio.afmt; }
 
+mioSystemAudioStats sys_get_audio_stats(void) {
+  mioSystemAudioStats st;
+  mioSystemAudioState *a = &G_SYS.audio;
+  real64 block = (real64)SYS_AUDIO_MIX_FRAMES / (real64)MIO_MAX(a->afmt.sr, 1);
+  LONG mixCount = InterlockedCompareExchange(&a->mixCount, 0, 0);
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  memset(&st, 0, sizeof(st));
+  st.backend = a->backend;
+  st.underruns = (uint32)InterlockedCompareExchange(&a->underruns, 0, 0);
+  st.underrunFrames =
+      (uint32)InterlockedCompareExchange(&a->underrunFrames, 0, 0);
+  st.framesMixed = (uint64)InterlockedCompareExchange64(&a->framesMixed, 0, 0);
+  st.framesPlayed =
+      (uint64)InterlockedCompareExchange64(&a->framesPlayed, 0, 0);
+  st.ringCapacity = a->ring.capacity;
+  if (a->ring.data) { st.ringFrames = sys_audio_ring_count(&a->ring); }
+  st.mixTimeAvg =
+      mixCount ? (real64)InterlockedCompareExchange64(&a->mixTicks, 0, 0) /
+                     (real64)freq.QuadPart / (real64)mixCount
+               : 0.0;
+  st.mixTimeMax =
+      (real64)InterlockedCompareExchange64(&a->mixTicksMax, 0, 0) /
+      (real64)freq.QuadPart;
+  st.headroom = 1.0 - st.mixTimeAvg / block;
+  return st;
+}
+
 void sys_beep(int32 freq, int32 dur) { Beep((DWORD)freq, (DWORD)dur); }
 
 SYSRET sys_file_exists(const char *fp) {
@@ -1443,6 +2317,53 @@ void sys_free_file(uint8 *data) {
   }
 }
 
+SYSRET sys_map_file(const char *fp, mioFileMap *map) {
+  LARGE_INTEGER fsz;
+  SYSTEM_INFO info;
+  HANDLE f, m;
+  memset(map, 0, sizeof(*map));
+  f = CreateFileA(
+      fp, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (f == INVALID_HANDLE_VALUE) {
+    sys_log("Failed to open file: %s\n", fp);
+    return FALSE;
+  }
+  if (!GetFileSizeEx(f, &fsz) || fsz.QuadPart <= 0 ||
+      fsz.QuadPart > 0x7FFFFFFF) {
+    sys_log("Cannot map file: %s\n", fp);
+    CloseHandle(f);
+    return FALSE;
+  }
+  m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!m) {
+    sys_log("Failed to create file mapping: %s\n", fp);
+    CloseHandle(f);
+    return FALSE;
+  }
+  map->data = (const uint8 *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  if (!map->data) {
+    sys_log("Failed to map view of file: %s\n", fp);
+    CloseHandle(m);
+    CloseHandle(f);
+    return FALSE;
+  }
+  GetSystemInfo(&info);
+  map->size = (int32)fsz.QuadPart;
+  map->terminated = (map->size % (int32)info.dwPageSize) != 0 ||
+                    map->data[map->size - 1] == '\n';
+  map->file = f;
+  map->mapping = m;
+  return TRUE;
+}
+
+void sys_unmap_file(mioFileMap *map) {
+  if (map->data) { UnmapViewOfFile((LPCVOID)map->data); }
+  if (map->mapping) { CloseHandle((HANDLE)map->mapping); }
+  if (map->file) { CloseHandle((HANDLE)map->file); }
+  memset(map, 0, sizeof(*map));
+}
+
 void *sys_alloc(int32 sz) {
   size_t total_size = (size_t)sz + sizeof(int32);
   void *ptr =
@@ -1605,6 +2526,14 @@ uint32 mio_alpha_blend_simd(uint32 fg, uint32 bg) {
   return (outA << 24) | (outR << 16) | (outG << 8) | outB;
 }
 
+/* Fixed-point mio_rgba_lerp: f in [0, 256], all four channels at once. */
+MIO_GLOBAL uint32 mio_colour_lerp(uint32 a, uint32 b, uint32 f) {
+  uint32 nf = 256 - f;
+  uint32 rb = ((a & 0x00FF00FF) * nf + (b & 0x00FF00FF) * f) >> 8;
+  uint32 ag = ((a >> 8) & 0x00FF00FF) * nf + ((b >> 8) & 0x00FF00FF) * f;
+  return (rb & 0x00FF00FF) | (ag & 0xFF00FF00);
+}
+
 uint32 mio_rgba_lerp(uint32 c1, uint32 c2, real32 t) {
   uint32 r1, g1, b1, a1;
   uint32 r2, g2, b2, a2;
@@ -1649,8 +2578,8 @@ int32 mio_draw_clear(void) {
   int32 i;
   mioRenderContext *ctx = &G_APP.render;
   uint32 *p = ctx->colourData;
-  if (G_SYS.fb && G_SYS.fb_w > 0 && G_SYS.fb_h > 0) {
-    for (i = 0; i < G_SYS.fb_w * G_SYS.fb_h; i++) {
+  if (p && ctx->width > 0 && ctx->height > 0) {
+    for (i = 0; i < ctx->width * ctx->height; i++) {
       *p = G_APP.colour;
       p++;
     }
@@ -1658,59 +2587,409 @@ int32 mio_draw_clear(void) {
   return TRUE;
 }
 
-int32 mio_line_clip(
-    mioRect clip, real32 *x0, real32 *y0, real32 *x1, real32 *y1) {
-  int32 i;
-  real32 t;
-  real32 p[4], q[4];
-  real32 xmin = (real32)clip.x1;
-  real32 ymin = (real32)clip.y1;
-  real32 xmax = (real32)clip.x2;
-  real32 ymax = (real32)clip.y2;
-  real32 dx = *x1 - *x0;
-  real32 dy = *y1 - *y0;
-  real32 u1 = 0.0f;
-  real32 u2 = 1.0f;
-  real32 origX0 = *x0;
-  real32 origY0 = *y0;
-  p[0] = -dx;
-  q[0] = origX0 - xmin;
-  p[1] = dx;
-  q[1] = xmax - origX0;
-  p[2] = -dy;
-  q[2] = origY0 - ymin;
-  p[3] = dy;
-  q[3] = ymax - origY0;
-  for (i = 0; i < 4; ++i) {
-    if (MIO_FABS(p[i]) < MIO_LINE_CLIP_EPSILON) {
-      if (q[i] < 0.0f) { return FALSE; }
-    } else {
-      t = q[i] / p[i];
-      if (p[i] < 0.0f) {
-        if (t > u2) { return FALSE; }
-        if (t > u1) { u1 = t; }
-      } else {
-        if (t < u1) { return FALSE; }
-        if (t < u2) { u2 = t; }
-      }
-    }
+#define MIO_AA_SPAN_MAX 256
+
+#define MIO_AA_CAPSULE 0
+#define MIO_AA_SEGMENT 1
+#define MIO_AA_RING 2
+#define MIO_AA_ROUND_BOX 3
+#define MIO_AA_ELLIPSE 4
+#define MIO_AA_DISC 5
+
+typedef struct {
+  int32 kind;
+  real32 ax, ay;
+  real32 bx, by;
+  real32 ux, uy;
+  real32 len;
+  real32 r;
+  real32 hw;
+} mioAAShape;
+
+uint32 mio_2d_set_flag(uint32 flag, SYSRET enable) {
+  if (enable) {
+    G_APP.render.flags2D = MIO_SET_BITS(G_APP.render.flags2D, flag);
+  } else {
+    G_APP.render.flags2D = MIO_CLEAR_BITS(G_APP.render.flags2D, flag);
   }
-  *x0 = origX0 + u1 * dx;
-  *y0 = origY0 + u1 * dy;
-  *x1 = origX0 + u2 * dx;
-  *y1 = origY0 + u2 * dy;
-  return TRUE;
+  return G_APP.render.flags2D;
 }
 
-int32 mio_draw_line(real32 x1, real32 y1, real32 x2, real32 y2) {
-  int32 i, xi, yi;
-  real32 dx, dy, steps, xInc, yInc, x, y;
-  int32 width = G_APP.render.width;
-  uint32 colour = G_APP.colour;
-  uint32 *pixels = G_APP.render.colourData;
-  mioRect clip = mio_rect(0, 0, G_APP.render.width, G_APP.render.height);
-  if (!mio_line_clip(clip, &x1, &y1, &x2, &y2)) { return FALSE; }
-  dx = x2 - x1;
+uint32 mio_2d_toggle_flag(uint32 flag) {
+  G_APP.render.flags2D ^= flag;
+  return G_APP.render.flags2D;
+}
+
+SYSRET mio_2d_is_flag_set(uint32 flag) {
+  return (G_APP.render.flags2D & flag) != 0;
+}
+
+SYSRET mio_2d_toggle_antialias(SYSRET enable) {
+  return (mio_2d_set_flag(MIO_2D_ANTIALIAS, enable) & MIO_2D_ANTIALIAS) != 0;
+}
+
+real32 mio_2d_set_aa_width(real32 width) {
+  G_APP.render.aaWidth = MIO_CLAMP(width, 0.25f, 8.0f);
+  return G_APP.render.aaWidth;
+}
+
+MIO_GLOBAL uint32 mio_aa_blend(uint32 fg, uint32 bg, uint32 a) {
+  uint32 an = a + (a >> 7);
+  uint32 inv = 256 - an;
+  uint32 rb, g;
+  rb = (((fg & 0x00FF00FF) * an + (bg & 0x00FF00FF) * inv) >> 8) & 0x00FF00FF;
+  g = (((fg & 0x0000FF00) * an + (bg & 0x0000FF00) * inv) >> 8) & 0x0000FF00;
+  return 0xFF000000 | rb | g;
+}
+
+MIO_GLOBAL void mio_aa_fill_span(int32 x0, int32 x1, int32 y) {
+  int32 i;
+  uint32 *dst = G_APP.render.colourData + y * G_APP.render.width;
+  uint32 col = G_APP.colour;
+  uint32 a = MIO_COL_GET_A(col);
+  if (a == 255) {
+    for (i = x0; i <= x1; i++) { dst[i] = col; }
+  } else if (a) {
+    for (i = x0; i <= x1; i++) { dst[i] = mio_aa_blend(col, dst[i], a); }
+  }
+}
+
+MIO_GLOBAL void mio_aa_blend_span(int32 x, int32 y, const uint8 *cov, int32 n) {
+  int32 i;
+  uint32 c;
+  uint32 *dst = G_APP.render.colourData + x + y * G_APP.render.width;
+  uint32 col = G_APP.colour;
+  uint32 a = MIO_COL_GET_A(col);
+  if (a == 255) {
+    for (i = 0; i < n; i++) {
+      c = cov[i];
+      if (c == 255) {
+        dst[i] = col;
+      } else if (c) {
+        dst[i] = mio_aa_blend(col, dst[i], c);
+      }
+    }
+  } else {
+    for (i = 0; i < n; i++) {
+      c = (cov[i] * a + 127) / 255;
+      if (c) { dst[i] = mio_aa_blend(col, dst[i], c); }
+    }
+  }
+}
+
+MIO_GLOBAL real32 mio_aa_sdf(const mioAAShape *s, real32 px, real32 py) {
+  real32 dx, dy, qx, qy, h, k0, k1;
+  switch (s->kind) {
+  case MIO_AA_CAPSULE:
+    dx = px - s->ax;
+    dy = py - s->ay;
+    h = dx * s->ux + dy * s->uy;
+    h = MIO_CLAMP(h, 0.0f, s->len);
+    dx -= s->ux * h;
+    dy -= s->uy * h;
+    return (real32)sqrt(dx * dx + dy * dy) - s->r;
+  case MIO_AA_SEGMENT:
+    dx = px - s->ax;
+    dy = py - s->ay;
+    qx = MIO_FABS(dx * s->ux + dy * s->uy - s->len * 0.5f) - s->len * 0.5f;
+    qy = MIO_FABS(dy * s->ux - dx * s->uy) - s->r;
+    break;
+  case MIO_AA_RING:
+    dx = px - s->ax;
+    dy = py - s->ay;
+    h = (real32)sqrt(dx * dx + dy * dy) - s->r;
+    return MIO_FABS(h) - s->hw;
+  case MIO_AA_DISC:
+    dx = px - s->ax;
+    dy = py - s->ay;
+    return (real32)sqrt(dx * dx + dy * dy) - s->r;
+  case MIO_AA_ROUND_BOX:
+    qx = MIO_FABS(px - s->ax) - (s->bx - s->r);
+    qy = MIO_FABS(py - s->ay) - (s->by - s->r);
+    if (qx > 0.0f && qy > 0.0f) {
+      return (real32)sqrt(qx * qx + qy * qy) - s->r;
+    }
+    return MIO_MAX(qx, qy) - s->r;
+  case MIO_AA_ELLIPSE:
+    dx = (px - s->ax) / s->bx;
+    dy = (py - s->ay) / s->by;
+    k0 = (real32)sqrt(dx * dx + dy * dy);
+    dx /= s->bx;
+    dy /= s->by;
+    k1 = (real32)sqrt(dx * dx + dy * dy);
+    if (k1 < MIO_LINE_CLIP_EPSILON) { return -MIO_MIN(s->bx, s->by); }
+    return k0 * (k0 - 1.0f) / k1;
+  default:
+    return 1.0f;
+  }
+  if (qx > 0.0f && qy > 0.0f) { return (real32)sqrt(qx * qx + qy * qy); }
+  return MIO_MAX(qx, qy);
+}
+
+MIO_GLOBAL void mio_aa_shape_edges(
+    const mioAAShape *s, int32 x0, int32 x1, int32 y, real32 invWidth) {
+  int32 x, n;
+  real32 c;
+  uint8 cov[MIO_AA_SPAN_MAX];
+  while (x0 <= x1) {
+    n = MIO_MIN(x1 - x0 + 1, MIO_AA_SPAN_MAX);
+    for (x = 0; x < n; x++) {
+      c = 0.5f - mio_aa_sdf(s, (real32)(x0 + x), (real32)y) * invWidth;
+      c = MIO_CLAMP(c, 0.0f, 1.0f);
+      cov[x] = (uint8)(c * 255.0f + 0.5f);
+    }
+    mio_aa_blend_span(x0, y, cov, n);
+    x0 += n;
+  }
+}
+
+/* Narrows [*a, *b] to the x where lo <= f0 + f1 * x <= hi. */
+MIO_GLOBAL void mio_aa_clip_linear(
+    real32 f0, real32 f1, real32 lo, real32 hi, real32 *a, real32 *b) {
+  real32 t0, t1;
+  if (MIO_FABS(f1) < 0.001f) {
+    if (f0 < lo || f0 > hi) { *b = *a - 1.0f; }
+    return;
+  }
+  t0 = (lo - f0) / f1;
+  t1 = (hi - f0) / f1;
+  *a = MIO_MAX(*a, MIO_MIN(t0, t1));
+  *b = MIO_MIN(*b, MIO_MAX(t0, t1));
+}
+
+/* Widens the run [*ia, *ib] by the chord of a circle on row py. */
+MIO_GLOBAL void mio_aa_chord_union(
+    real32 cx, real32 cy, real32 r, real32 py, real32 *ia, real32 *ib) {
+  real32 dy = py - cy, t;
+  if (r <= 0.0f || MIO_FABS(dy) >= r) { return; }
+  t = (real32)sqrt(r * r - dy * dy);
+  if (*ia > *ib) {
+    *ia = cx - t;
+    *ib = cx + t;
+  } else {
+    *ia = MIO_MIN(*ia, cx - t);
+    *ib = MIO_MAX(*ib, cx + t);
+  }
+}
+
+MIO_GLOBAL int32 mio_aa_shape_row(
+    const mioAAShape *s, real32 py, real32 pad, real32 *xa, real32 *xb,
+    real32 *ia, real32 *ib) {
+  real32 dy, rx, ry, t, cx;
+  *ia = 1.0f;
+  *ib = 0.0f;
+  switch (s->kind) {
+  case MIO_AA_CAPSULE:
+  case MIO_AA_SEGMENT:
+    *xa = MIO_MIN(s->ax, s->bx) - s->r - pad;
+    *xb = MIO_MAX(s->ax, s->bx) + s->r + pad;
+    if (MIO_FABS(s->uy) > 0.001f) {
+      t = (s->r + pad) / MIO_FABS(s->uy);
+      cx = s->ax + (py - s->ay) * s->ux / s->uy;
+      *xa = MIO_MAX(*xa, cx - t);
+      *xb = MIO_MIN(*xb, cx + t);
+    }
+    /* interior: the body strip, plus the end discs for round caps */
+    rx = s->r - pad;
+    if (rx <= 0.0f) { return FALSE; }
+    dy = py - s->ay;
+    *ia = *xa;
+    *ib = *xb;
+    mio_aa_clip_linear(
+        dy * s->ux + s->ax * s->uy, -s->uy, -rx, rx, ia, ib);
+    t = s->kind == MIO_AA_CAPSULE ? 0.0f : pad;
+    mio_aa_clip_linear(
+        dy * s->uy - s->ax * s->ux, s->ux, t, s->len - t, ia, ib);
+    if (s->kind == MIO_AA_CAPSULE) {
+      mio_aa_chord_union(s->ax, s->ay, rx, py, ia, ib);
+      mio_aa_chord_union(s->bx, s->by, rx, py, ia, ib);
+    }
+    return TRUE;
+  case MIO_AA_DISC:
+    dy = py - s->ay;
+    rx = s->r + pad;
+    if (MIO_FABS(dy) > rx) { return FALSE; }
+    t = (real32)sqrt(rx * rx - dy * dy);
+    *xa = s->ax - t;
+    *xb = s->ax + t;
+    mio_aa_chord_union(s->ax, s->ay, s->r - pad, py, ia, ib);
+    return TRUE;
+  case MIO_AA_RING:
+    dy = py - s->ay;
+    rx = s->r + s->hw + pad;
+    if (MIO_FABS(dy) > rx) { return FALSE; }
+    t = (real32)sqrt(rx * rx - dy * dy);
+    *xa = s->ax - t;
+    *xb = s->ax + t;
+    rx = s->r - s->hw - pad;
+    if (rx > 0.0f && MIO_FABS(dy) < rx) {
+      t = (real32)sqrt(rx * rx - dy * dy);
+      *ia = s->ax - t;
+      *ib = s->ax + t;
+    }
+    return FALSE;
+  case MIO_AA_ROUND_BOX:
+    dy = MIO_FABS(py - s->ay);
+    if (dy > s->by + pad) { return FALSE; }
+    *xa = s->ax - s->bx - pad;
+    *xb = s->ax + s->bx + pad;
+    if (dy <= s->by - pad) {
+      t = dy <= s->by - s->r ? s->bx - pad : s->bx - MIO_MAX(s->r, pad);
+      *ia = s->ax - t;
+      *ib = s->ax + t;
+    }
+    return TRUE;
+  case MIO_AA_ELLIPSE:
+    dy = py - s->ay;
+    rx = s->bx + pad;
+    ry = s->by + pad;
+    if (MIO_FABS(dy) >= ry) { return FALSE; }
+    t = rx * (real32)sqrt(1.0f - (dy * dy) / (ry * ry));
+    *xa = s->ax - t;
+    *xb = s->ax + t;
+    rx = s->bx - 2.0f * pad;
+    ry = s->by - 2.0f * pad;
+    if (rx > 0.0f && ry > 0.0f && MIO_FABS(dy) < ry) {
+      t = rx * (real32)sqrt(1.0f - (dy * dy) / (ry * ry));
+      *ia = s->ax - t;
+      *ib = s->ax + t;
+    }
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+MIO_GLOBAL int32 mio_aa_draw_shape(
+    const mioAAShape *s, real32 minY, real32 maxY) {
+  int32 y, y0, y1, x0, x1, i0, i1, full;
+  real32 xa, xb, ia, ib;
+  real32 width = MIO_MAX(G_APP.render.aaWidth, 0.25f);
+  real32 invWidth = 1.0f / width;
+  real32 pad = width * 0.5f + 0.5f;
+  mioRect clip = G_APP.render.clip;
+  if (!G_APP.render.colourData) { return FALSE; }
+  y0 = (int32)MIO_MAX(floor(minY - pad), clip.y1);
+  y1 = (int32)MIO_MIN(ceil(maxY + pad), clip.y2 - 1);
+  for (y = y0; y <= y1; y++) {
+    xa = 1.0f;
+    xb = 0.0f;
+    full = mio_aa_shape_row(s, (real32)y, pad, &xa, &xb, &ia, &ib);
+    if (xa > xb) { continue; }
+    x0 = (int32)MIO_MAX(floor(xa), clip.x1);
+    x1 = (int32)MIO_MIN(ceil(xb), clip.x2 - 1);
+    if (x0 > x1) { continue; }
+    if (ia > ib) {
+      mio_aa_shape_edges(s, x0, x1, y, invWidth);
+      continue;
+    }
+    i0 = (int32)ceil(ia);
+    i1 = (int32)floor(ib);
+    mio_aa_shape_edges(s, x0, MIO_MIN(x1, i0 - 1), y, invWidth);
+    if (full) { mio_aa_fill_span(MIO_MAX(x0, i0), MIO_MIN(x1, i1), y); }
+    mio_aa_shape_edges(s, MIO_MAX(x0, i1 + 1), x1, y, invWidth);
+  }
+  return TRUE;
+}
+
+MIO_GLOBAL int32 mio_aa_draw_line(
+    real32 x1, real32 y1, real32 x2, real32 y2, real32 t, int32 capped) {
+  mioAAShape s;
+  real32 dx = x2 - x1;
+  real32 dy = y2 - y1;
+  memset(&s, 0, sizeof(s));
+  s.kind = capped ? MIO_AA_CAPSULE : MIO_AA_SEGMENT;
+  s.ax = x1;
+  s.ay = y1;
+  s.bx = x2;
+  s.by = y2;
+  s.len = (real32)sqrt(dx * dx + dy * dy);
+  s.r = t * 0.5f;
+  if (s.len > MIO_LINE_CLIP_EPSILON) {
+    s.ux = dx / s.len;
+    s.uy = dy / s.len;
+  } else {
+    s.kind = MIO_AA_CAPSULE;
+    s.ux = 1.0f;
+  }
+  return mio_aa_draw_shape(
+      &s, MIO_MIN(y1, y2) - s.r, MIO_MAX(y1, y2) + s.r);
+}
+
+MIO_GLOBAL int32 mio_aa_draw_ring(
+    real32 xc, real32 yc, real32 r, real32 hw) {
+  mioAAShape s;
+  memset(&s, 0, sizeof(s));
+  s.kind = MIO_AA_RING;
+  s.ax = xc;
+  s.ay = yc;
+  s.r = r;
+  s.hw = hw;
+  if (hw >= r) {
+    /* no hole left, draw it as a solid disc */
+    s.kind = MIO_AA_DISC;
+    s.r = r + hw;
+    s.hw = 0.0f;
+  }
+  return mio_aa_draw_shape(&s, yc - r - hw, yc + r + hw);
+}
+
+int32 mio_line_clip(
+    mioRect clip, real32 *x0, real32 *y0, real32 *x1, real32 *y1) {
+  int32 i;
+  real32 t;
+  real32 p[4], q[4];
+  real32 xmin = (real32)clip.x1;
+  real32 ymin = (real32)clip.y1;
+  real32 xmax = (real32)clip.x2;
+  real32 ymax = (real32)clip.y2;
+  real32 dx = *x1 - *x0;
+  real32 dy = *y1 - *y0;
+  real32 u1 = 0.0f;
+  real32 u2 = 1.0f;
+  real32 origX0 = *x0;
+  real32 origY0 = *y0;
+  p[0] = -dx;
+  q[0] = origX0 - xmin;
+  p[1] = dx;
+  q[1] = xmax - origX0;
+  p[2] = -dy;
+  q[2] = origY0 - ymin;
+  p[3] = dy;
+  q[3] = ymax - origY0;
+  for (i = 0; i < 4; ++i) {
+    if (MIO_FABS(p[i]) < MIO_LINE_CLIP_EPSILON) {
+      if (q[i] < 0.0f) { return FALSE; }
+    } else {
+      t = q[i] / p[i];
+      if (p[i] < 0.0f) {
+        if (t > u2) { return FALSE; }
+        if (t > u1) { u1 = t; }
+      } else {
+        if (t < u1) { return FALSE; }
+        if (t < u2) { u2 = t; }
+      }
+    }
+  }
+  *x0 = origX0 + u1 * dx;
+  *y0 = origY0 + u1 * dy;
+  *x1 = origX0 + u2 * dx;
+  *y1 = origY0 + u2 * dy;
+  return TRUE;
+}
+
+int32 mio_draw_line(real32 x1, real32 y1, real32 x2, real32 y2) {
+  int32 i, xi, yi;
+  real32 dx, dy, steps, xInc, yInc, x, y;
+  int32 width = G_APP.render.width;
+  uint32 colour = G_APP.colour;
+  uint32 *pixels = G_APP.render.colourData;
+  mioRect clip = mio_rect(0, 0, G_APP.render.width, G_APP.render.height);
+  if (G_APP.render.flags2D & MIO_2D_ANTIALIAS) {
+    return mio_aa_draw_line(x1, y1, x2, y2, 1.0f, TRUE);
+  }
+  if (!mio_line_clip(clip, &x1, &y1, &x2, &y2)) { return FALSE; }
+  dx = x2 - x1;
   dy = y2 - y1;
   steps = MIO_FABS(dx) > MIO_FABS(dy) ? MIO_FABS(dx) : MIO_FABS(dy);
   if (steps < 1.0f) { steps = 1.0f; }
@@ -1835,6 +3114,9 @@ int32 mio_draw_circle(int32 xc, int32 yc, real32 r) {
   uint32 col = G_APP.colour;
   mioRect clip = G_APP.render.clip;
   if (r < 0.0f) { return FALSE; }
+  if (G_APP.render.flags2D & MIO_2D_ANTIALIAS) {
+    return mio_aa_draw_ring((real32)xc, (real32)yc, r, 0.5f);
+  }
   if (r < 0.5f && xc >= 0 && xc < width && yc >= 0 && yc < height) {
     if (MIO_COL_GET_A(col) < 255) {
       mio_blend_pixel(xc, yc);
@@ -1927,6 +3209,11 @@ int32 mio_draw_circle_thick(int32 xc, int32 yc, real32 r, real32 thickness) {
   mioRect clip = G_APP.render.clip;
   if (thickness <= 0.0f || r < 0.0f) { return FALSE; }
   if (innerRadius < 0) { innerRadius = 0; }
+  if (G_APP.render.flags2D & MIO_2D_ANTIALIAS) {
+    return mio_aa_draw_ring(
+        (real32)xc, (real32)yc, (outerRadius + innerRadius) * 0.5f,
+        (outerRadius - innerRadius) * 0.5f);
+  }
   outerR2 = outerRadius * outerRadius;
   innerR2 = innerRadius * innerRadius;
   y0 = (int32)(ceil((real32)yc - outerRadius));
@@ -1978,6 +3265,9 @@ int32 mio_draw_circle_fill(int32 xc, int32 yc, real32 r) {
   uint32 col = G_APP.colour;
   mioRect clip = G_APP.render.clip;
   if (r < 0.0f) { return FALSE; }
+  if (G_APP.render.flags2D & MIO_2D_ANTIALIAS) {
+    return mio_aa_draw_ring((real32)xc, (real32)yc, r * 0.5f, r * 0.5f);
+  }
   if (r < 0.5f && xc >= 0 && xc < width && yc >= 0 && yc < height) {
     data[xc + yc * width] = col;
     return TRUE;
@@ -2045,6 +3335,9 @@ int32 mio_draw_line_thick(
   real32 dx, dy, length, half, nx, ny, ox, oy;
   real32 fx0, fy0, fx1, fy1, fx2, fy2, fx3, fy3;
   real32 thickness = t;
+  if (G_APP.render.flags2D & MIO_2D_ANTIALIAS) {
+    return mio_aa_draw_line(x1, y1, x2, y2, MIO_MAX(thickness, 1.0f), capped);
+  }
   if (thickness < 2.0f) {
     mio_draw_line(x1, y1, x2, y2);
   } else {
@@ -2243,6 +3536,7 @@ int32 mio_draw_rounded_rect(int32 x, int32 y, int32 w, int32 h, real32 r) {
   int32 minX, minY, maxX, maxY;
   real32 dx, dy;
   int32 i, j;
+  mioAAShape aa;
   real32 r2 = r * r;
   uint32 *data = G_APP.render.colourData;
   int32 width = G_APP.render.width;
@@ -2253,6 +3547,16 @@ int32 mio_draw_rounded_rect(int32 x, int32 y, int32 w, int32 h, real32 r) {
   maxX = MIO_MAX(x, x + w);
   minY = MIO_MIN(y, y + h);
   maxY = MIO_MAX(y, y + h);
+  if (G_APP.render.flags2D & MIO_2D_ANTIALIAS) {
+    memset(&aa, 0, sizeof(aa));
+    aa.kind = MIO_AA_ROUND_BOX;
+    aa.ax = (real32)(minX + maxX - 1) * 0.5f;
+    aa.ay = (real32)(minY + maxY - 1) * 0.5f;
+    aa.bx = (real32)(maxX - minX) * 0.5f;
+    aa.by = (real32)(maxY - minY) * 0.5f;
+    aa.r = MIO_CLAMP(r, 0.0f, MIO_MIN(aa.bx, aa.by));
+    return mio_aa_draw_shape(&aa, aa.ay - aa.by, aa.ay + aa.by);
+  }
   for (i = minY; i < maxY; i++) {
     for (j = minX; j < maxX; j++) {
       if (j < clip.x1 || j >= clip.x2 || i < clip.y1 || i >= clip.y2) {
@@ -2386,7 +3690,17 @@ int32 mio_draw_ellipse_fill(int32 xc, int32 yc, real32 rx, real32 ry) {
   int32 width = G_APP.render.width;
   uint32 col = G_APP.colour;
   mioRect clip = G_APP.render.clip;
+  mioAAShape aa;
   if (rx < 0.0f || ry < 0.0f) { return FALSE; }
+  if ((G_APP.render.flags2D & MIO_2D_ANTIALIAS) && rx > 0.0f && ry > 0.0f) {
+    memset(&aa, 0, sizeof(aa));
+    aa.kind = MIO_AA_ELLIPSE;
+    aa.ax = (real32)xc;
+    aa.ay = (real32)yc;
+    aa.bx = rx;
+    aa.by = ry;
+    return mio_aa_draw_shape(&aa, yc - ry, yc + ry);
+  }
   if (MIO_COL_GET_A(col) < 255) {
     for (y = (int32)(yc - ry); y <= (int32)(yc + ry); y++) {
       if (y < clip.y1 || y >= clip.y2) { continue; }
@@ -2433,7 +3747,7 @@ void mio_draw_checkerboard(
   if (draw_x1 >= draw_x2 || draw_y1 >= draw_y2) { return; }
   for (cy = draw_y1; cy < draw_y2; cy++) {
     for (cx = draw_x1; cx < draw_x2; cx++) {
-      pixel = G_APP.render.colourData + (cy * G_SYS.fb_w) + cx;
+      pixel = G_APP.render.colourData + (cy * G_APP.render.width) + cx;
       cell_row = (cy - y) / cell_size;
       cell_col = (cx - x) / cell_size;
       if ((cell_row + cell_col) % 2 == 0) {
@@ -2488,101 +3802,1143 @@ int32 mio_draw_gradient(
   return 1;
 }
 
-void mio_draw_quantize(int32 x1, int32 y1, int32 x2, int32 y2, int32 levels) {
-  int32 x, y;
-  uint32 col;
-  uint8 r, g, b;
-  for (y = y1; y < y2; y++) {
-    for (x = x1; x < x2; x++) {
-      col = G_APP.render.colourData[x + y * G_APP.render.width];
-      r = (MIO_COL_GET_R(col) / levels) * levels;
-      g = (MIO_COL_GET_G(col) / levels) * levels;
-      b = (MIO_COL_GET_B(col) / levels) * levels;
-      G_APP.render.colourData[x + y * G_APP.render.width] =
-          MIO_RGBA(r, g, b, 255);
+#define MIO_POST_QUANTIZE 0
+#define MIO_POST_DITHER 1
+#define MIO_POST_DITHER_PERCEPTUAL 2
+
+typedef struct {
+  const uint32 *src;
+  uint32 *dst;
+  int32 srcStride;
+  int32 dstStride;
+  int32 x0, x1;
+  int32 levels;
+  int32 mode;
+} mioPostProcess;
+
+MIO_GLOBAL __m128i mio_post_quantize_4(__m128i px, __m128i mul, __m128i step) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(px, zero);
+  __m128i hi = _mm_unpackhi_epi8(px, zero);
+  lo = _mm_mullo_epi16(_mm_mulhi_epu16(lo, mul), step);
+  hi = _mm_mullo_epi16(_mm_mulhi_epu16(hi, mul), step);
+  return _mm_or_si128(
+      _mm_packus_epi16(lo, hi), _mm_set1_epi32((int32)0xFF000000));
+}
+
+MIO_GLOBAL __m128 mio_post_round_level(__m128 v, __m128 step, __m128 invStep) {
+  v = _mm_add_ps(_mm_mul_ps(v, invStep), _mm_set1_ps(0.5f));
+  v = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_max_ps(v, _mm_setzero_ps())));
+  return _mm_min_ps(_mm_mul_ps(v, step), _mm_set1_ps(255.0f));
+}
+
+MIO_GLOBAL __m128i mio_post_pack_4(__m128 r, __m128 g, __m128 b) {
+  __m128i ri = _mm_slli_epi32(_mm_cvttps_epi32(r), 16);
+  __m128i gi = _mm_slli_epi32(_mm_cvttps_epi32(g), 8);
+  __m128i bi = _mm_cvttps_epi32(b);
+  return _mm_or_si128(
+      _mm_or_si128(ri, gi),
+      _mm_or_si128(bi, _mm_set1_epi32((int32)0xFF000000)));
+}
+
+MIO_GLOBAL __m128i
+mio_post_dither_4(__m128i px, __m128 thr, __m128 step, __m128 invStep) {
+  __m128i mask = _mm_set1_epi32(0xFF);
+  __m128 zero = _mm_setzero_ps();
+  __m128 c255 = _mm_set1_ps(255.0f);
+  __m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+  __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+  __m128 b = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+  __m128 lum, q, ratio, scaled, sel;
+  lum = _mm_add_ps(
+      _mm_add_ps(
+          _mm_mul_ps(r, _mm_set1_ps(0.299f)),
+          _mm_mul_ps(g, _mm_set1_ps(0.587f))),
+      _mm_mul_ps(b, _mm_set1_ps(0.114f)));
+  q = mio_post_round_level(_mm_add_ps(lum, thr), step, invStep);
+  sel = _mm_cmpgt_ps(lum, _mm_set1_ps(1.0f));
+  ratio = _mm_div_ps(q, _mm_max_ps(lum, _mm_set1_ps(1.0f)));
+  scaled = _mm_mul_ps(_mm_max_ps(_mm_max_ps(r, g), b), ratio);
+  ratio = _mm_mul_ps(
+      ratio,
+      _mm_min_ps(
+          _mm_set1_ps(1.0f), _mm_div_ps(c255, _mm_max_ps(scaled, c255))));
+  r = _mm_min_ps(_mm_max_ps(_mm_mul_ps(r, ratio), zero), c255);
+  g = _mm_min_ps(_mm_max_ps(_mm_mul_ps(g, ratio), zero), c255);
+  b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(b, ratio), zero), c255);
+  r = _mm_or_ps(_mm_and_ps(sel, r), _mm_andnot_ps(sel, q));
+  g = _mm_or_ps(_mm_and_ps(sel, g), _mm_andnot_ps(sel, q));
+  b = _mm_or_ps(_mm_and_ps(sel, b), _mm_andnot_ps(sel, q));
+  return mio_post_pack_4(r, g, b);
+}
+
+MIO_GLOBAL __m128i mio_post_dither_perceptual_4(
+    __m128i px, __m128 thr, __m128 step, __m128 invStep) {
+  __m128i mask = _mm_set1_epi32(0xFF);
+  __m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+  __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+  __m128 b = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+  r = mio_post_round_level(_mm_add_ps(r, thr), step, invStep);
+  g = mio_post_round_level(
+      _mm_add_ps(g, _mm_mul_ps(thr, _mm_set1_ps(0.7f))), step, invStep);
+  b = mio_post_round_level(
+      _mm_add_ps(b, _mm_mul_ps(thr, _mm_set1_ps(1.2f))), step, invStep);
+  return mio_post_pack_4(r, g, b);
+}
+
+MIO_GLOBAL void mio_post_process_span(
+    const mioPostProcess *pp, const uint32 *src, uint32 *dst, int32 n,
+    const real32 *thrRow) {
+  int32 x;
+  __m128i a, b;
+  __m128 thrLo = _mm_loadu_ps(thrRow);
+  __m128 thrHi = _mm_loadu_ps(thrRow + 4);
+  real32 fstep = 255.0f / (real32)(pp->levels - 1);
+  __m128 step = _mm_set1_ps(fstep);
+  __m128 invStep = _mm_set1_ps(1.0f / fstep);
+  int32 qs = MIO_CLAMP(pp->levels, 1, 256);
+  __m128i qstep = _mm_set1_epi16((int16)qs);
+  __m128i qmul = _mm_set1_epi16((int16)((65536 + qs - 1) / qs));
+  for (x = 0; x + 8 <= n; x += 8) {
+    a = _mm_loadu_si128((const __m128i *)(src + x));
+    b = _mm_loadu_si128((const __m128i *)(src + x + 4));
+    switch (pp->mode) {
+    case MIO_POST_QUANTIZE:
+      a = mio_post_quantize_4(a, qmul, qstep);
+      b = mio_post_quantize_4(b, qmul, qstep);
+      break;
+    case MIO_POST_DITHER:
+      a = mio_post_dither_4(a, thrLo, step, invStep);
+      b = mio_post_dither_4(b, thrHi, step, invStep);
+      break;
+    default:
+      a = mio_post_dither_perceptual_4(a, thrLo, step, invStep);
+      b = mio_post_dither_perceptual_4(b, thrHi, step, invStep);
+      break;
+    }
+    _mm_storeu_si128((__m128i *)(dst + x), a);
+    _mm_storeu_si128((__m128i *)(dst + x + 4), b);
+  }
+}
+
+void mio_post_process_rows(void *data, int32 y0, int32 y1) {
+  int32 x, y, n, body;
+  mioPostProcess *pp = (mioPostProcess *)data;
+  const uint32 *src;
+  uint32 *dst;
+  real32 thrRow[8];
+  uint32 tmp[8];
+  real32 fstep;
+  if (pp->levels < 1 || (pp->mode != MIO_POST_QUANTIZE && pp->levels < 2)) {
+    return;
+  }
+  if (pp->mode == MIO_POST_QUANTIZE && pp->levels == 1) {
+    for (y = y0; y < y1; y++) {
+      src = pp->src + y * pp->srcStride;
+      dst = pp->dst + y * pp->dstStride;
+      for (x = pp->x0; x < pp->x1; x++) { dst[x] = src[x] | 0xFF000000; }
+    }
+    return;
+  }
+  fstep = 255.0f / (real32)(pp->levels - 1);
+  n = pp->x1 - pp->x0;
+  body = n & ~7;
+  for (y = y0; y < y1; y++) {
+    for (x = 0; x < 8; x++) {
+      thrRow[x] =
+          ((real32)G_BAYER_MATRIX_8[y & 7][(pp->x0 + x) & 7] / 64.0f - 0.5f) *
+          fstep;
+    }
+    src = pp->src + y * pp->srcStride + pp->x0;
+    dst = pp->dst + y * pp->dstStride + pp->x0;
+    mio_post_process_span(pp, src, dst, body, thrRow);
+    if (body < n) {
+      memset(tmp, 0, sizeof(tmp));
+      memcpy(tmp, src + body, (n - body) * sizeof(uint32));
+      mio_post_process_span(pp, tmp, tmp, 8, thrRow);
+      memcpy(dst + body, tmp, (n - body) * sizeof(uint32));
     }
   }
-  return;
+}
+
+void mio_draw_quantize(int32 x1, int32 y1, int32 x2, int32 y2, int32 levels) {
+  mioPostProcess pp;
+  mioRect r = mio_rect_clip(
+      mio_rect(0, 0, G_APP.render.width, G_APP.render.height),
+      mio_rect(x1, y1, x2, y2));
+  if (!G_APP.render.colourData || r.x1 >= r.x2 || r.y1 >= r.y2) { return; }
+  pp.src = G_APP.render.colourData;
+  pp.dst = G_APP.render.colourData;
+  pp.srcStride = G_APP.render.width;
+  pp.dstStride = G_APP.render.width;
+  pp.x0 = (int32)r.x1;
+  pp.x1 = (int32)r.x2;
+  pp.levels = levels;
+  pp.mode = MIO_POST_QUANTIZE;
+  mio_post_process_rows(&pp, (int32)r.y1, (int32)r.y2);
 }
 
 void mio_draw_dither(uint32 *pixels, int32 w, int32 h, int32 levels) {
-  int32 x, y;
-  real32 step;
-  real32 threshNorm;
-  uint32 col;
-  real32 r, g, b;
-  real32 lum, dithLum, newLum;
-  real32 ratio, maxOrig, maxScaled;
-  uint8 newR, newG, newB, lumVal;
-  step = 255.0f / (real32)(levels - 1);
-  for (y = 0; y < h; y++) {
-    for (x = 0; x < w; x++) {
-      threshNorm = (real32)G_BAYER_MATRIX_8[y & 7][x & 7] / 64.0f;
-      col = pixels[x + y * w];
-      r = (real32)((col >> 16) & 0xFF);
-      g = (real32)((col >> 8) & 0xFF);
-      b = (real32)((col >> 0) & 0xFF);
-      lum = r * 0.299f + g * 0.587f + b * 0.114f;
-      dithLum = lum + (threshNorm - 0.5f) * step;
-      newLum =
-          MIO_CLAMP(MIO_FLOOR(dithLum / step + 0.5f) * step, 0.0f, 255.0f);
-      if (lum > 1.0f) {
-        ratio = newLum / lum;
-        maxOrig = MIO_MAX(MIO_MAX(r, g), b);
-        maxScaled = maxOrig * ratio;
-        if (maxScaled > 255.0f) { ratio *= 255.0f / maxScaled; }
-        newR = (uint8)MIO_CLAMP(r * ratio, 0.0f, 255.0f);
-        newG = (uint8)MIO_CLAMP(g * ratio, 0.0f, 255.0f);
-        newB = (uint8)MIO_CLAMP(b * ratio, 0.0f, 255.0f);
-        pixels[x + y * w] = 0xFF000000 | (newR << 16) | (newG << 8) | newB;
+  mioPostProcess pp;
+  pp.src = pixels;
+  pp.dst = pixels;
+  pp.srcStride = w;
+  pp.dstStride = w;
+  pp.x0 = 0;
+  pp.x1 = w;
+  pp.levels = levels;
+  pp.mode = MIO_POST_DITHER;
+  mio_post_process_rows(&pp, 0, h);
+}
+
+void mio_draw_dither_perceptual(
+    uint32 *pixels, int32 w, int32 h, int32 levels) {
+  mioPostProcess pp;
+  pp.src = pixels;
+  pp.dst = pixels;
+  pp.srcStride = w;
+  pp.dstStride = w;
+  pp.x0 = 0;
+  pp.x1 = w;
+  pp.levels = levels;
+  pp.mode = MIO_POST_DITHER_PERCEPTUAL;
+  mio_post_process_rows(&pp, 0, h);
+}
+
+typedef struct {
+  const uint32 *src;
+  uint32 *dst;
+  int32 sw, sh;
+  int32 dw, dh;
+  int32 mode;
+} mioUpscale;
+
+MIO_GLOBAL uint32 mio_upscale_weight(int32 fixed, int32 sharp) {
+  int32 f = (fixed >> 8) & 0xFF;
+  if (sharp) { f = (f * f * (768 - 2 * f)) >> 16; }
+  return (uint32)f;
+}
+
+void mio_upscale_rows(void *data, int32 y0, int32 y1) {
+  mioUpscale *up = (mioUpscale *)data;
+  int32 x, y, sx, sy, ix, iy, nx;
+  uint32 fx, fy, a, b;
+  int32 sharp = up->mode == MIO_UPSCALE_SHARP;
+  int32 stepX = (int32)(((int64)up->sw << 16) / up->dw);
+  int32 stepY = (int32)(((int64)up->sh << 16) / up->dh);
+  int32 startX = stepX / 2 - 0x8000;
+  const uint32 *r0, *r1;
+  uint32 *out;
+  for (y = y0; y < y1; y++) {
+    out = up->dst + y * up->dw;
+    if (up->mode == MIO_UPSCALE_NEAREST) {
+      r0 = up->src + ((y * stepY + stepY / 2) >> 16) * up->sw;
+      for (x = 0, sx = stepX / 2; x < up->dw; x++, sx += stepX) {
+        out[x] = r0[sx >> 16];
+      }
+      continue;
+    }
+    sy = MIO_MAX(y * stepY + stepY / 2 - 0x8000, 0);
+    iy = sy >> 16;
+    fy = mio_upscale_weight(sy, sharp);
+    r0 = up->src + iy * up->sw;
+    r1 = up->src + MIO_MIN(iy + 1, up->sh - 1) * up->sw;
+    for (x = 0, sx = startX; x < up->dw; x++, sx += stepX) {
+      ix = MIO_MAX(sx, 0) >> 16;
+      nx = MIO_MIN(ix + 1, up->sw - 1);
+      fx = mio_upscale_weight(MIO_MAX(sx, 0), sharp);
+      a = mio_colour_lerp(r0[ix], r0[nx], fx);
+      b = mio_colour_lerp(r1[ix], r1[nx], fx);
+      out[x] = mio_colour_lerp(a, b, fy);
+    }
+  }
+}
+
+void mio_draw_upscale(
+    const uint32 *src, int32 sw, int32 sh, uint32 *dst, int32 dw, int32 dh,
+    int32 mode) {
+  mioUpscale up;
+  if (!src || !dst || sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) { return; }
+  up.src = src;
+  up.dst = dst;
+  up.sw = sw;
+  up.sh = sh;
+  up.dw = dw;
+  up.dh = dh;
+  up.mode = mode;
+  mio_upscale_rows(&up, 0, dh);
+}
+
+#define MIO_SPRITE_BILINEAR 0x0001
+#define MIO_SPRITE_FLIP_X 0x0002
+#define MIO_SPRITE_FLIP_Y 0x0004
+#define MIO_SPRITE_OPAQUE 0x0008
+#define MIO_SPRITE_PREMULTIPLIED 0x0010
+#define MIO_SPRITE_UNTINTED 0x8000
+
+#define MIO_SPRITE_SPAN 64
+
+typedef struct {
+  const mioTexture *texture;
+  int32 sx, sy, sw, sh;
+  real32 x, y;
+  real32 originX, originY;
+  real32 scaleX, scaleY;
+  real32 angle;
+  uint32 tint;
+  uint32 flags;
+  int32 layer;
+} mioSprite;
+
+typedef struct {
+  const uint32 *texels;
+  int32 stride;
+  int32 sw, sh;
+  int32 x1, y1, x2, y2;
+  real32 u0, v0;
+  real32 dudx, dvdx;
+  real32 dudy, dvdy;
+  uint32 tint;
+  uint32 flags;
+} mioSpriteSetup;
+
+typedef struct {
+  int32 layer;
+  int32 index;
+  const uint32 *texels;
+} mioSpriteKey;
+
+typedef struct {
+  mioSprite *sprites;
+  mioSpriteSetup *setups;
+  mioSpriteKey *keys;
+  int32 count;
+  int32 capacity;
+  int32 drawn;
+} mioSpriteBatch;
+
+mioSprite mio_sprite(const mioTexture *texture, real32 x, real32 y) {
+  mioSprite s;
+  memset(&s, 0, sizeof(s));
+  s.texture = texture;
+  s.sw = texture ? (int32)texture->width : 0;
+  s.sh = texture ? (int32)texture->height : 0;
+  s.x = x;
+  s.y = y;
+  s.scaleX = 1.0f;
+  s.scaleY = 1.0f;
+  s.tint = 0xFFFFFFFF;
+  return s;
+}
+
+MIO_GLOBAL __m128i mio_sprite_div255_16(__m128i v) {
+  v = _mm_add_epi16(v, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+MIO_GLOBAL __m128i mio_sprite_alpha_16(__m128i v) {
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+  return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+/* Blends two pixels held as 16-bit channels. Straight alpha computes
+ * s*a + d*(255-a); premultiplied texels already carry s*a. */
+MIO_GLOBAL __m128i
+mio_sprite_blend_16(__m128i s, __m128i d, __m128i tint, uint32 flags) {
+  __m128i a, ia, full = _mm_set1_epi16(255);
+  if (!(flags & MIO_SPRITE_UNTINTED)) {
+    s = mio_sprite_div255_16(_mm_mullo_epi16(s, tint));
+  }
+  a = mio_sprite_alpha_16(s);
+  ia = _mm_sub_epi16(full, a);
+  if (flags & MIO_SPRITE_PREMULTIPLIED) {
+    return _mm_adds_epu16(s, mio_sprite_div255_16(_mm_mullo_epi16(d, ia)));
+  }
+  return mio_sprite_div255_16(
+      _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, ia)));
+}
+
+/* Composites a span of tinted texels over the framebuffer four pixels at a
+ * time, skipping fully transparent quads and copying fully opaque ones. */
+MIO_GLOBAL void mio_sprite_blend_span(
+    uint32 *dst, const uint32 *src, int32 n, uint32 tint, uint32 flags) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i amask = _mm_set1_epi32((int32)0xFF000000);
+  __m128i t16, s, d, lo, hi, a;
+  int32 i = 0, plain = tint == 0xFFFFFFFF, mask;
+  if ((flags & MIO_SPRITE_OPAQUE) && plain) {
+    memcpy(dst, src, n * sizeof(uint32));
+    return;
+  }
+  t16 = _mm_unpacklo_epi8(_mm_set1_epi32((int32)tint), zero);
+  if (plain) { flags |= MIO_SPRITE_UNTINTED; }
+  if (flags & MIO_SPRITE_OPAQUE) {
+    t16 = _mm_or_si128(t16, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s = _mm_loadu_si128((const __m128i *)(src + i));
+    if (flags & MIO_SPRITE_OPAQUE) { s = _mm_or_si128(s, amask); }
+    a = _mm_and_si128(s, amask);
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi32(a, zero));
+    if (mask == 0xFFFF) { continue; }
+    if (plain && _mm_movemask_epi8(_mm_cmpeq_epi32(a, amask)) == 0xFFFF) {
+      _mm_storeu_si128((__m128i *)(dst + i), s);
+      continue;
+    }
+    d = _mm_loadu_si128((const __m128i *)(dst + i));
+    lo = mio_sprite_blend_16(
+        _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), t16, flags);
+    hi = mio_sprite_blend_16(
+        _mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), t16, flags);
+    _mm_storeu_si128(
+        (__m128i *)(dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), amask));
+  }
+  for (; i < n; i++) {
+    s = _mm_cvtsi32_si128((int32)src[i]);
+    if (flags & MIO_SPRITE_OPAQUE) { s = _mm_or_si128(s, amask); }
+    if (!((uint32)_mm_cvtsi128_si32(s) >> 24)) { continue; }
+    d = _mm_cvtsi32_si128((int32)dst[i]);
+    lo = mio_sprite_blend_16(
+        _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), t16, flags);
+    dst[i] = (uint32)_mm_cvtsi128_si32(_mm_packus_epi16(lo, lo)) | 0xFF000000;
+  }
+}
+
+MIO_GLOBAL uint32 mio_sprite_bilinear(
+    const uint32 *r0, const uint32 *r1, int32 iu, int32 nu, uint32 fx,
+    uint32 fy) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i top = _mm_unpacklo_epi8(
+      _mm_unpacklo_epi32(
+          _mm_cvtsi32_si128((int32)r0[iu]), _mm_cvtsi32_si128((int32)r0[nu])),
+      zero);
+  __m128i bot = _mm_unpacklo_epi8(
+      _mm_unpacklo_epi32(
+          _mm_cvtsi32_si128((int32)r1[iu]), _mm_cvtsi32_si128((int32)r1[nu])),
+      zero);
+  __m128i col = _mm_srli_epi16(
+      _mm_add_epi16(
+          _mm_mullo_epi16(top, _mm_set1_epi16((int16)(256 - fy))),
+          _mm_mullo_epi16(bot, _mm_set1_epi16((int16)fy))),
+      8);
+  col = _mm_srli_epi16(
+      _mm_add_epi16(
+          _mm_mullo_epi16(col, _mm_set1_epi16((int16)(256 - fx))),
+          _mm_mullo_epi16(_mm_srli_si128(col, 8), _mm_set1_epi16((int16)fx))),
+      8);
+  return (uint32)_mm_cvtsi128_si32(_mm_packus_epi16(col, col));
+}
+
+/* Builds the inverse affine mapping from framebuffer pixel centres back into
+ * the source rectangle and the clipped screen bounds of the transformed
+ * quad. Returns FALSE when nothing is visible. */
+MIO_GLOBAL SYSRET
+mio_sprite_setup(const mioSprite *sp, mioRect clip, mioSpriteSetup *st) {
+  real32 c, s, sx, sy, px[4], py[4], minX, minY, maxX, maxY, dx, dy;
+  const mioTexture *tex = sp->texture;
+  int32 i;
+  if (!tex || !tex->data || sp->sw <= 0 || sp->sh <= 0 || sp->sx < 0 ||
+      sp->sy < 0 || sp->sx + sp->sw > (int32)tex->width ||
+      sp->sy + sp->sh > (int32)tex->height ||
+      MIO_ABS(sp->scaleX) < 1e-6f || MIO_ABS(sp->scaleY) < 1e-6f ||
+      !(sp->tint >> 24)) {
+    return FALSE;
+  }
+  c = sp->angle != 0.0f ? (real32)cos(sp->angle) : 1.0f;
+  s = sp->angle != 0.0f ? (real32)sin(sp->angle) : 0.0f;
+  sx = sp->scaleX;
+  sy = sp->scaleY;
+  for (i = 0; i < 4; i++) {
+    dx = ((i & 1) ? (real32)sp->sw : 0.0f) - sp->originX;
+    dy = ((i & 2) ? (real32)sp->sh : 0.0f) - sp->originY;
+    px[i] = sp->x + c * dx * sx - s * dy * sy;
+    py[i] = sp->y + s * dx * sx + c * dy * sy;
+  }
+  minX = MIO_MIN(MIO_MIN(px[0], px[1]), MIO_MIN(px[2], px[3]));
+  maxX = MIO_MAX(MIO_MAX(px[0], px[1]), MIO_MAX(px[2], px[3]));
+  minY = MIO_MIN(MIO_MIN(py[0], py[1]), MIO_MIN(py[2], py[3]));
+  maxY = MIO_MAX(MIO_MAX(py[0], py[1]), MIO_MAX(py[2], py[3]));
+  st->x1 = (int32)MIO_MAX(floor(minX), clip.x1);
+  st->y1 = (int32)MIO_MAX(floor(minY), clip.y1);
+  st->x2 = (int32)MIO_MIN(ceil(maxX), clip.x2);
+  st->y2 = (int32)MIO_MIN(ceil(maxY), clip.y2);
+  if (st->x1 >= st->x2 || st->y1 >= st->y2) { return FALSE; }
+  st->dudx = c / sx;
+  st->dudy = s / sx;
+  st->dvdx = -s / sy;
+  st->dvdy = c / sy;
+  dx = (real32)st->x1 + 0.5f - sp->x;
+  dy = (real32)st->y1 + 0.5f - sp->y;
+  st->u0 = st->dudx * dx + st->dudy * dy + sp->originX;
+  st->v0 = st->dvdx * dx + st->dvdy * dy + sp->originY;
+  if (sp->flags & MIO_SPRITE_FLIP_X) {
+    st->u0 = (real32)sp->sw - st->u0;
+    st->dudx = -st->dudx;
+    st->dudy = -st->dudy;
+  }
+  if (sp->flags & MIO_SPRITE_FLIP_Y) {
+    st->v0 = (real32)sp->sh - st->v0;
+    st->dvdx = -st->dvdx;
+    st->dvdy = -st->dvdy;
+  }
+  st->texels = tex->data + sp->sy * tex->width + sp->sx;
+  st->stride = (int32)tex->width;
+  st->sw = sp->sw;
+  st->sh = sp->sh;
+  st->tint = sp->tint;
+  st->flags = sp->flags;
+  return TRUE;
+}
+
+/* Narrows [t0, t1) to the offsets along a row where val + d * t stays
+ * inside [0, size). */
+MIO_GLOBAL SYSRET mio_sprite_row_range(
+    real32 val, real32 d, real32 size, real32 *t0, real32 *t1) {
+  real32 a, b;
+  if (MIO_ABS(d) < 1e-8f) { return val >= 0.0f && val < size; }
+  a = -val / d;
+  b = (size - val) / d;
+  if (a > b) {
+    real32 t = a;
+    a = b;
+    b = t;
+  }
+  *t0 = MIO_MAX(*t0, a);
+  *t1 = MIO_MIN(*t1, b);
+  return *t0 < *t1;
+}
+
+/* Walks the rows [y0, y1) of a set-up sprite. Each row is reduced to the
+ * span whose centres map inside the source rectangle, then stepped in
+ * 16.16 fixed point and blended in chunks. */
+MIO_GLOBAL void
+mio_sprite_raster(const mioSpriteSetup *st, int32 y0, int32 y1) {
+  uint32 span[MIO_SPRITE_SPAN];
+  uint32 *row;
+  const uint32 *r0, *r1;
+  real32 t0, t1, u, v, bu, bv;
+  int32 y, x, xs, xe, n, k, fu, fv, stepU, stepV, iu, iv, nu, nv;
+  int32 bilinear = (st->flags & MIO_SPRITE_BILINEAR) != 0;
+  int32 direct = !bilinear && st->dudx == 1.0f && st->dvdx == 0.0f;
+  y0 = MIO_MAX(y0, st->y1);
+  y1 = MIO_MIN(y1, st->y2);
+  stepU = (int32)(st->dudx * 65536.0f);
+  stepV = (int32)(st->dvdx * 65536.0f);
+  bu = bilinear ? 0.5f : 0.0f;
+  bv = bilinear ? 0.5f : 0.0f;
+  for (y = y0; y < y1; y++) {
+    u = st->u0 + st->dudy * (real32)(y - st->y1);
+    v = st->v0 + st->dvdy * (real32)(y - st->y1);
+    t0 = 0.0f;
+    t1 = (real32)(st->x2 - st->x1);
+    if (!mio_sprite_row_range(u, st->dudx, (real32)st->sw, &t0, &t1) ||
+        !mio_sprite_row_range(v, st->dvdx, (real32)st->sh, &t0, &t1)) {
+      continue;
+    }
+    xs = st->x1 + (int32)ceil(t0);
+    xe = st->x1 + (int32)ceil(t1);
+    xe = MIO_MIN(xe, st->x2);
+    if (xs >= xe) { continue; }
+    row = G_APP.render.colourData + y * G_APP.render.width;
+    u += st->dudx * (real32)(xs - st->x1);
+    v += st->dvdx * (real32)(xs - st->x1);
+    if (direct) {
+      iu = MIO_CLAMP((int32)floor(u), 0, st->sw - (xe - xs));
+      iv = MIO_CLAMP((int32)floor(v), 0, st->sh - 1);
+      mio_sprite_blend_span(
+          row + xs, st->texels + iv * st->stride + iu, xe - xs, st->tint,
+          st->flags);
+      continue;
+    }
+    fu = (int32)((u - bu) * 65536.0f);
+    fv = (int32)((v - bv) * 65536.0f);
+    for (x = xs; x < xe; x += n) {
+      n = MIO_MIN(xe - x, MIO_SPRITE_SPAN);
+      if (!bilinear) {
+        for (k = 0; k < n; k++, fu += stepU, fv += stepV) {
+          iu = MIO_CLAMP(fu >> 16, 0, st->sw - 1);
+          iv = MIO_CLAMP(fv >> 16, 0, st->sh - 1);
+          span[k] = st->texels[iv * st->stride + iu];
+        }
       } else {
-        lumVal = (uint8)newLum;
-        pixels[x + y * w] =
-            0xFF000000 | (lumVal << 16) | (lumVal << 8) | lumVal;
+        for (k = 0; k < n; k++, fu += stepU, fv += stepV) {
+          iu = MIO_CLAMP(fu >> 16, 0, st->sw - 1);
+          iv = MIO_CLAMP(fv >> 16, 0, st->sh - 1);
+          nu = MIO_MIN(iu + 1, st->sw - 1);
+          nv = MIO_MIN(iv + 1, st->sh - 1);
+          if (fu < 0) { nu = iu; }
+          if (fv < 0) { nv = iv; }
+          r0 = st->texels + iv * st->stride;
+          r1 = st->texels + nv * st->stride;
+          span[k] = mio_sprite_bilinear(
+              r0, r1, iu, nu, (uint32)(fu >> 8) & 0xFF,
+              (uint32)(fv >> 8) & 0xFF);
+        }
       }
+      mio_sprite_blend_span(row + x, span, n, st->tint, st->flags);
     }
   }
 }
 
-void mio_draw_dither_perceptual(
-    uint32 *pixels, int32 w, int32 h, int32 levels) {
-  real32 step;
+int32 mio_draw_sprite_ex(const mioSprite *sprite) {
+  mioSpriteSetup st;
+  if (!G_APP.render.colourData || !sprite ||
+      !mio_sprite_setup(sprite, G_APP.render.clip, &st)) {
+    return FALSE;
+  }
+  mio_sprite_raster(&st, st.y1, st.y2);
+  return TRUE;
+}
+
+int32 mio_draw_sprite(const mioTexture *texture, int32 x, int32 y) {
+  mioSprite sprite = mio_sprite(texture, (real32)x, (real32)y);
+  return mio_draw_sprite_ex(&sprite);
+}
+
+void mio_sprite_batch_begin(mioSpriteBatch *batch) {
+  batch->count = 0;
+  batch->drawn = 0;
+}
+
+SYSRET mio_sprite_batch_add(mioSpriteBatch *batch, const mioSprite *sprite) {
+  int32 cap;
+  mioSprite *sprites;
+  mioSpriteSetup *setups;
+  mioSpriteKey *keys;
+  if (batch->count == batch->capacity) {
+    /* grow everything before touching the batch, so a failed add leaves the
+       old buffers and capacity usable */
+    cap = MIO_MAX(batch->capacity * 2, 256);
+    setups = (mioSpriteSetup *)sys_alloc(cap * sizeof(mioSpriteSetup));
+    keys = (mioSpriteKey *)sys_alloc(cap * sizeof(mioSpriteKey));
+    sprites = (setups && keys) ? (mioSprite *)sys_realloc(
+                                     batch->sprites, cap * sizeof(mioSprite))
+                               : NULL;
+    if (!sprites) {
+      sys_free(setups);
+      sys_free(keys);
+      return FALSE;
+    }
+    sys_free(batch->setups);
+    sys_free(batch->keys);
+    batch->sprites = sprites;
+    batch->setups = setups;
+    batch->keys = keys;
+    batch->capacity = cap;
+  }
+  batch->sprites[batch->count++] = *sprite;
+  return TRUE;
+}
+
+void mio_sprite_batch_free(mioSpriteBatch *batch) {
+  sys_free(batch->sprites);
+  sys_free(batch->setups);
+  sys_free(batch->keys);
+  memset(batch, 0, sizeof(*batch));
+}
+
+MIO_GLOBAL int mio_sprite_key_compare(const void *a, const void *b) {
+  const mioSpriteKey *ka = (const mioSpriteKey *)a;
+  const mioSpriteKey *kb = (const mioSpriteKey *)b;
+  if (ka->layer != kb->layer) { return ka->layer < kb->layer ? -1 : 1; }
+  if (ka->texels != kb->texels) {
+    return (size_t)ka->texels < (size_t)kb->texels ? -1 : 1;
+  }
+  return ka->index < kb->index ? -1 : ka->index > kb->index ? 1 : 0;
+}
+
+/* Orders the batch by layer and then by texture, keeping submission order
+ * within a texture, and sets up every visible sprite. Sprites on the same
+ * layer are assumed not to depend on each other's draw order. */
+MIO_GLOBAL int32 mio_sprite_batch_prepare(mioSpriteBatch *batch) {
+  mioSpriteKey *keys = batch->keys;
+  mioSpriteSetup *setups = batch->setups;
+  mioSprite *s;
+  int32 i, n = 0;
+  for (i = 0; i < batch->count; i++) {
+    s = &batch->sprites[i];
+    keys[i].layer = s->layer;
+    keys[i].index = i;
+    keys[i].texels = s->texture ? s->texture->data : NULL;
+  }
+  qsort(keys, batch->count, sizeof(mioSpriteKey), mio_sprite_key_compare);
+  for (i = 0; i < batch->count; i++) {
+    if (mio_sprite_setup(
+            &batch->sprites[keys[i].index], G_APP.render.clip, &setups[n])) {
+      n++;
+    }
+  }
+  batch->drawn = n;
+  return n;
+}
+
+void mio_sprite_batch_rows(void *data, int32 y0, int32 y1) {
+  mioSpriteBatch *batch = (mioSpriteBatch *)data;
+  int32 i;
+  for (i = 0; i < batch->drawn; i++) {
+    if (batch->setups[i].y2 > y0 && batch->setups[i].y1 < y1) {
+      mio_sprite_raster(&batch->setups[i], y0, y1);
+    }
+  }
+}
+
+int32 mio_sprite_batch_flush(mioSpriteBatch *batch) {
+  if (!G_APP.render.colourData || !batch->count) { return 0; }
+  mio_sprite_batch_prepare(batch);
+  mio_sprite_batch_rows(batch, 0, G_APP.render.height);
+  batch->count = 0;
+  return batch->drawn;
+}
+
+/* @TEXT *********************************************************************/
+
+#ifdef __STB_INCLUDE_STB_TRUETYPE_H__
+#define MIO_TEXT_ATLAS_SIZE 512
+#define MIO_TEXT_CELLS_MAX 1024
+#define MIO_TEXT_SHELVES_MAX 128
+#define MIO_TEXT_HASH_SIZE 1024
+#define MIO_TEXT_RUNS_MAX 256
+#define MIO_TEXT_RUN_LENGTH 128
+#define MIO_TEXT_CELL_ROUND 4
+
+typedef struct {
+  stbtt_fontinfo info;
+  mioFileMap map;
+  int32 id;
+  real32 scale;
+  int32 ascent;
+  int32 descent;
+  int32 lineHeight;
+  int32 ascii[128];
+} mioFont;
+
+typedef struct {
+  int32 font;
+  int32 glyph;
+  int32 shelf;
   int32 x, y;
-  real32 rWeight, gWeight, bWeight;
-  real32 baseThresh;
-  uint32 col;
-  real32 r, g, b;
-  real32 rThresh, gThresh, bThresh;
-  real32 dithR, dithG, dithB;
-  uint8 newR, newG, newB;
-  step = 255.0f / (real32)(levels - 1);
-  rWeight = 1.0f;
-  gWeight = 0.7f;
-  bWeight = 1.2f;
-  for (y = 0; y < h; y++) {
-    for (x = 0; x < w; x++) {
-      baseThresh = (real32)G_BAYER_MATRIX_8[y & 7][x & 7] / 64.0f - 0.5f;
-      col = pixels[x + y * w];
-      r = (real32)((col >> 16) & 0xFF);
-      g = (real32)((col >> 8) & 0xFF);
-      b = (real32)((col >> 0) & 0xFF);
-      rThresh = baseThresh * step * rWeight;
-      gThresh = baseThresh * step * gWeight;
-      bThresh = baseThresh * step * bWeight;
-      dithR = r + rThresh;
-      dithG = g + gThresh;
-      dithB = b + bThresh;
-      newR = (uint8)MIO_CLAMP(
-          MIO_FLOOR(dithR / step + 0.5f) * step, 0.0f, 255.0f);
-      newG = (uint8)MIO_CLAMP(
-          MIO_FLOOR(dithG / step + 0.5f) * step, 0.0f, 255.0f);
-      newB = (uint8)MIO_CLAMP(
-          MIO_FLOOR(dithB / step + 0.5f) * step, 0.0f, 255.0f);
-      pixels[x + y * w] = 0xFF000000 | (newR << 16) | (newG << 8) | newB;
+  int32 w, h;
+  int32 xoff, yoff;
+  uint32 lastUsed;
+  int32 next;
+} mioGlyphCell;
+
+typedef struct {
+  int32 y, h;
+  int32 cellW, cellH;
+  int32 used;
+} mioGlyphShelf;
+
+typedef struct {
+  uint32 hash;
+  int32 font;
+  int32 length;
+  int32 count;
+  real32 width;
+  char text[MIO_TEXT_RUN_LENGTH];
+  int32 glyphs[MIO_TEXT_RUN_LENGTH];
+  real32 pens[MIO_TEXT_RUN_LENGTH];
+} mioTextRun;
+
+typedef struct {
+  uint32 glyphHits;
+  uint32 glyphMisses;
+  uint32 evictions;
+  uint32 runHits;
+  uint32 runMisses;
+} mioTextStats;
+
+typedef struct {
+  uint8 atlas[MIO_TEXT_ATLAS_SIZE * MIO_TEXT_ATLAS_SIZE];
+  mioGlyphCell cells[MIO_TEXT_CELLS_MAX];
+  mioGlyphShelf shelves[MIO_TEXT_SHELVES_MAX];
+  int32 hash[MIO_TEXT_HASH_SIZE];
+  mioTextRun runs[MIO_TEXT_RUNS_MAX];
+  int32 cellCount;
+  int32 shelfCount;
+  int32 shelfTop;
+  int32 nextFont;
+  uint32 clock;
+  int32 init;
+  mioTextStats stats;
+} mioTextCache;
+
+MIO_GLOBAL mioTextCache G_TEXT = {0};
+
+MIO_GLOBAL void mio_text_init(void) {
+  memset(G_TEXT.hash, 0xFF, sizeof(G_TEXT.hash));
+  G_TEXT.init = TRUE;
+}
+
+SYSRET mio_font_load(mioFont *font, const char *filepath, real32 pixelHeight) {
+  int32 i, ascent, descent, lineGap;
+  memset(font, 0, sizeof(*font));
+  if (!G_TEXT.init) { mio_text_init(); }
+  if (!sys_map_file(filepath, &font->map)) {
+    sys_log("Failed to load file %s\n", filepath);
+    return FALSE;
+  }
+  if (!stbtt_InitFont(
+          &font->info, font->map.data,
+          stbtt_GetFontOffsetForIndex(font->map.data, 0))) {
+    sys_log("Failed to parse font: %s\n", filepath);
+    sys_unmap_file(&font->map);
+    return FALSE;
+  }
+  font->id = ++G_TEXT.nextFont;
+  font->scale = stbtt_ScaleForPixelHeight(&font->info, pixelHeight);
+  stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &lineGap);
+  font->ascent = (int32)ceil(ascent * font->scale);
+  font->descent = (int32)floor(descent * font->scale);
+  font->lineHeight =
+      (int32)ceil((ascent - descent + lineGap) * font->scale);
+  for (i = 0; i < 128; i++) {
+    font->ascii[i] = stbtt_FindGlyphIndex(&font->info, i);
+  }
+  sys_log("Loaded font: %s %.1fpx\n", filepath, pixelHeight);
+  return TRUE;
+}
+
+void mio_font_free(mioFont *font) {
+  if (!font || !font->id) { return; }
+  sys_unmap_file(&font->map);
+  memset(font, 0, sizeof(*font));
+}
+
+MIO_GLOBAL uint32 mio_utf8_next(const char **s, const char *end) {
+  const uint8 *p = (const uint8 *)*s;
+  uint32 c = *p++, n = 0, i;
+  if (c >= 0xF8) {
+    c = 0xFFFD;
+  } else if (c >= 0xF0) {
+    n = 3;
+    c &= 0x07;
+  } else if (c >= 0xE0) {
+    n = 2;
+    c &= 0x0F;
+  } else if (c >= 0xC0) {
+    n = 1;
+    c &= 0x1F;
+  } else if (c >= 0x80) {
+    c = 0xFFFD;
+  }
+  for (i = 0; i < n; i++) {
+    if ((const char *)p >= end || (*p & 0xC0) != 0x80) {
+      c = 0xFFFD;
+      break;
     }
+    c = (c << 6) | (*p++ & 0x3F);
   }
+  *s = (const char *)p;
+  return c;
 }
 
+MIO_GLOBAL uint32 mio_text_hash(int32 font, const char *s, int32 n) {
+  uint32 h = 2166136261u ^ (uint32)font;
+  int32 i;
+  for (i = 0; i < n; i++) { h = (h ^ (uint8)s[i]) * 16777619u; }
+  return h;
+}
+
+/* Shapes a segment into glyph indices and kerned pen positions, reusing the
+ * cached run when the same text was laid out before. */
+MIO_GLOBAL const mioTextRun *
+mio_text_shape(mioFont *font, const char *s, int32 n) {
+  uint32 hash = mio_text_hash(font->id, s, n), cp;
+  mioTextRun *run = &G_TEXT.runs[hash & (MIO_TEXT_RUNS_MAX - 1)];
+  const char *end = s + n;
+  real32 pen = 0.0f;
+  int32 glyph, prev = 0, advance, lsb;
+  if (run->hash == hash && run->font == font->id && run->length == n &&
+      !memcmp(run->text, s, n)) {
+    G_TEXT.stats.runHits++;
+    return run;
+  }
+  G_TEXT.stats.runMisses++;
+  run->count = 0;
+  while (s < end && run->count < MIO_TEXT_RUN_LENGTH) {
+    cp = mio_utf8_next(&s, end);
+    glyph = cp < 128 ? font->ascii[cp]
+                     : stbtt_FindGlyphIndex(&font->info, (int32)cp);
+    if (prev) {
+      pen += font->scale *
+             (real32)stbtt_GetGlyphKernAdvance(&font->info, prev, glyph);
+    }
+    stbtt_GetGlyphHMetrics(&font->info, glyph, &advance, &lsb);
+    run->glyphs[run->count] = glyph;
+    run->pens[run->count++] = pen;
+    pen += font->scale * (real32)advance;
+    prev = glyph;
+  }
+  run->width = pen;
+  run->hash = hash;
+  run->font = font->id;
+  run->length = n;
+  memcpy(run->text, end - n, n);
+  return run;
+}
+
+MIO_GLOBAL void mio_glyph_unlink(int32 index) {
+  mioGlyphCell *cell = &G_TEXT.cells[index];
+  int32 *link;
+  if (!cell->font) { return; }
+  link = &G_TEXT.hash[((uint32)cell->font * 31u + (uint32)cell->glyph) &
+                      (MIO_TEXT_HASH_SIZE - 1)];
+  while (*link >= 0 && *link != index) { link = &G_TEXT.cells[*link].next; }
+  if (*link == index) { *link = cell->next; }
+  cell->font = 0;
+  G_TEXT.stats.evictions++;
+}
+
+MIO_GLOBAL int32 mio_glyph_new_cell(void) {
+  int32 i;
+  for (i = 0; i < G_TEXT.cellCount; i++) {
+    if (G_TEXT.cells[i].shelf < 0) { return i; }
+  }
+  return G_TEXT.cellCount < MIO_TEXT_CELLS_MAX ? G_TEXT.cellCount : -1;
+}
+
+/* Finds an atlas cell for a w x h glyph. Shelves hold uniform cells of one
+ * size class; a new cell or shelf is used while space remains, otherwise
+ * the least recently used cell of the class is recycled, and failing that
+ * the least recently used shelf that is tall enough is cleared for it. */
+MIO_GLOBAL int32 mio_glyph_alloc(int32 w, int32 h) {
+  int32 cw = (w + MIO_TEXT_CELL_ROUND - 1) & ~(MIO_TEXT_CELL_ROUND - 1);
+  int32 ch = (h + MIO_TEXT_CELL_ROUND - 1) & ~(MIO_TEXT_CELL_ROUND - 1);
+  int32 i, best = -1, shelf = -1;
+  uint32 oldest = 0xFFFFFFFF, age[MIO_TEXT_SHELVES_MAX];
+  mioGlyphShelf *sh;
+  mioGlyphCell *cell;
+  cw = MIO_MAX(cw, MIO_TEXT_CELL_ROUND);
+  ch = MIO_MAX(ch, MIO_TEXT_CELL_ROUND);
+  if (cw > MIO_TEXT_ATLAS_SIZE || ch > MIO_TEXT_ATLAS_SIZE) { return -1; }
+  for (i = 0; i < G_TEXT.cellCount; i++) {
+    cell = &G_TEXT.cells[i];
+    if (cell->shelf < 0) { continue; }
+    sh = &G_TEXT.shelves[cell->shelf];
+    if (sh->cellW != cw || sh->cellH != ch) { continue; }
+    if (!cell->font) { return i; }
+    if (cell->lastUsed < oldest) {
+      oldest = cell->lastUsed;
+      best = i;
+    }
+  }
+  for (i = 0; i < G_TEXT.shelfCount && shelf < 0; i++) {
+    sh = &G_TEXT.shelves[i];
+    if (sh->cellW == cw && sh->cellH == ch &&
+        sh->used + cw <= MIO_TEXT_ATLAS_SIZE) {
+      shelf = i;
+    }
+  }
+  i = mio_glyph_new_cell();
+  if (i >= 0 && shelf < 0 && G_TEXT.shelfCount < MIO_TEXT_SHELVES_MAX &&
+      G_TEXT.shelfTop + ch <= MIO_TEXT_ATLAS_SIZE) {
+    shelf = G_TEXT.shelfCount++;
+    sh = &G_TEXT.shelves[shelf];
+    sh->y = G_TEXT.shelfTop;
+    sh->h = ch;
+    sh->cellW = cw;
+    sh->cellH = ch;
+    sh->used = 0;
+    G_TEXT.shelfTop += ch;
+  }
+  if (i >= 0 && shelf >= 0) {
+    if (i == G_TEXT.cellCount) { G_TEXT.cellCount++; }
+    sh = &G_TEXT.shelves[shelf];
+    cell = &G_TEXT.cells[i];
+    cell->shelf = shelf;
+    cell->x = sh->used;
+    cell->y = sh->y;
+    cell->font = 0;
+    sh->used += cw;
+    return i;
+  }
+  if (best >= 0) {
+    mio_glyph_unlink(best);
+    return best;
+  }
+  memset(age, 0, sizeof(age));
+  for (i = 0; i < G_TEXT.cellCount; i++) {
+    cell = &G_TEXT.cells[i];
+    if (cell->shelf >= 0 && cell->font) {
+      age[cell->shelf] = MIO_MAX(age[cell->shelf], cell->lastUsed);
+    }
+  }
+  shelf = -1;
+  oldest = 0xFFFFFFFF;
+  for (i = 0; i < G_TEXT.shelfCount; i++) {
+    if (G_TEXT.shelves[i].h >= ch && age[i] < oldest) {
+      oldest = age[i];
+      shelf = i;
+    }
+  }
+  if (shelf < 0) { return -1; }
+  sh = &G_TEXT.shelves[shelf];
+  sh->cellW = cw;
+  sh->cellH = ch;
+  sh->used = 0;
+  for (i = 0; i < G_TEXT.cellCount; i++) {
+    cell = &G_TEXT.cells[i];
+    if (cell->shelf != shelf) { continue; }
+    if (cell->font) { mio_glyph_unlink(i); }
+    if (sh->used + cw > MIO_TEXT_ATLAS_SIZE) {
+      cell->shelf = -1;
+      continue;
+    }
+    cell->x = sh->used;
+    sh->used += cw;
+    if (best < 0) { best = i; }
+  }
+  return best;
+}
+
+MIO_GLOBAL mioGlyphCell *mio_glyph_get(mioFont *font, int32 glyph) {
+  uint32 slot =
+      ((uint32)font->id * 31u + (uint32)glyph) & (MIO_TEXT_HASH_SIZE - 1);
+  int32 i, x0, y0, x1, y1, r;
+  mioGlyphCell *cell;
+  for (i = G_TEXT.hash[slot]; i >= 0; i = G_TEXT.cells[i].next) {
+    cell = &G_TEXT.cells[i];
+    if (cell->font == font->id && cell->glyph == glyph) {
+      cell->lastUsed = G_TEXT.clock;
+      G_TEXT.stats.glyphHits++;
+      return cell;
+    }
+  }
+  G_TEXT.stats.glyphMisses++;
+  stbtt_GetGlyphBitmapBox(
+      &font->info, glyph, font->scale, font->scale, &x0, &y0, &x1, &y1);
+  i = mio_glyph_alloc(x1 - x0, y1 - y0);
+  if (i < 0) { return NULL; }
+  cell = &G_TEXT.cells[i];
+  cell->font = font->id;
+  cell->glyph = glyph;
+  cell->w = x1 - x0;
+  cell->h = y1 - y0;
+  cell->xoff = x0;
+  cell->yoff = y0;
+  cell->lastUsed = G_TEXT.clock;
+  for (r = 0; r < G_TEXT.shelves[cell->shelf].cellH; r++) {
+    memset(
+        G_TEXT.atlas + (cell->y + r) * MIO_TEXT_ATLAS_SIZE + cell->x, 0,
+        G_TEXT.shelves[cell->shelf].cellW);
+  }
+  if (cell->w > 0 && cell->h > 0) {
+    stbtt_MakeGlyphBitmap(
+        &font->info, G_TEXT.atlas + cell->y * MIO_TEXT_ATLAS_SIZE + cell->x,
+        cell->w, cell->h, MIO_TEXT_ATLAS_SIZE, font->scale, font->scale,
+        glyph);
+  }
+  cell->next = G_TEXT.hash[slot];
+  G_TEXT.hash[slot] = i;
+  return cell;
+}
+
+/* Expands coverage into straight-alpha texels of the draw colour and hands
+ * them to the sprite compositor. */
+MIO_GLOBAL void
+mio_glyph_blit(const mioGlyphCell *cell, int32 x, int32 y, uint32 colour) {
+  uint32 span[MIO_SPRITE_SPAN];
+  const uint8 *cov;
+  mioRect clip = G_APP.render.clip;
+  int32 x0 = MIO_MAX(x, (int32)clip.x1);
+  int32 x1 = MIO_MIN(x + cell->w, (int32)clip.x2);
+  int32 y0 = MIO_MAX(y, (int32)clip.y1);
+  int32 y1 = MIO_MIN(y + cell->h, (int32)clip.y2);
+  int32 row, sx, i, n, quad;
+  uint32 tint = (colour & 0xFF000000) | 0x00FFFFFF;
+  __m128i rgb = _mm_set1_epi32((int32)(colour & 0x00FFFFFF));
+  __m128i zero = _mm_setzero_si128(), c;
+  for (row = y0; row < y1; row++) {
+    cov = G_TEXT.atlas + (cell->y + row - y) * MIO_TEXT_ATLAS_SIZE + cell->x -
+          x;
+    for (sx = x0; sx < x1; sx += n) {
+      n = MIO_MIN(x1 - sx, MIO_SPRITE_SPAN);
+      for (i = 0; i + 4 <= n; i += 4) {
+        memcpy(&quad, cov + sx + i, sizeof(quad));
+        c = _mm_unpacklo_epi8(zero, _mm_cvtsi32_si128(quad));
+        c = _mm_unpacklo_epi16(zero, c);
+        _mm_storeu_si128((__m128i *)(span + i), _mm_or_si128(c, rgb));
+      }
+      for (; i < n; i++) {
+        span[i] = ((uint32)cov[sx + i] << 24) | (colour & 0x00FFFFFF);
+      }
+      mio_sprite_blend_span(
+          G_APP.render.colourData + row * G_APP.render.width + sx, span, n,
+          tint, 0);
+    }
+  }
+}
+
+/* Lays out one line in cached runs of at most MIO_TEXT_RUN_LENGTH bytes,
+ * split on character boundaries, optionally drawing it. Returns the pen
+ * advance. */
+MIO_GLOBAL real32 mio_text_line(
+    mioFont *font, const char *s, const char *end, int32 x, int32 baseline,
+    SYSRET draw) {
+  const mioTextRun *run;
+  const mioGlyphCell *cell;
+  const char *seg;
+  real32 pen = 0.0f;
+  int32 i, prev = 0;
+  while (s < end) {
+    seg = end - s > MIO_TEXT_RUN_LENGTH ? s + MIO_TEXT_RUN_LENGTH : end;
+    while (seg < end && seg > s + 1 && ((uint8)*seg & 0xC0) == 0x80) {
+      seg--;
+    }
+    run = mio_text_shape(font, s, (int32)(seg - s));
+    if (prev && run->count) {
+      /* runs are cached without context, so kern across the seam here */
+      pen += font->scale * (real32)stbtt_GetGlyphKernAdvance(
+                               &font->info, prev, run->glyphs[0]);
+    }
+    for (i = 0; draw && i < run->count; i++) {
+      cell = mio_glyph_get(font, run->glyphs[i]);
+      if (!cell || cell->w <= 0) { continue; }
+      mio_glyph_blit(
+          cell, x + (int32)floor(pen + run->pens[i] + 0.5f) + cell->xoff,
+          baseline + cell->yoff, G_APP.colour);
+    }
+    pen += run->width;
+    if (run->count) { prev = run->glyphs[run->count - 1]; }
+    s = seg;
+  }
+  return pen;
+}
+
+/* Draws UTF-8 text with its top-left corner at (x, y). Newlines start a new
+ * line. Returns the width of the widest line in pixels. */
+int32 mio_draw_text(mioFont *font, int32 x, int32 y, const char *text) {
+  const char *line, *end;
+  real32 width = 0.0f, w;
+  int32 baseline;
+  if (!font || !font->id || !text || !G_APP.render.colourData) { return 0; }
+  G_TEXT.clock++;
+  baseline = y + font->ascent;
+  for (line = text; *line; line = *end ? end + 1 : end) {
+    for (end = line; *end && *end != '\n'; end++) {}
+    w = mio_text_line(font, line, end, x, baseline, TRUE);
+    width = MIO_MAX(width, w);
+    baseline += font->lineHeight;
+  }
+  return (int32)ceil(width);
+}
+
+int32 mio_text_width(mioFont *font, const char *text) {
+  const char *line, *end;
+  real32 width = 0.0f, w;
+  if (!font || !font->id || !text) { return 0; }
+  for (line = text; *line; line = *end ? end + 1 : end) {
+    for (end = line; *end && *end != '\n'; end++) {}
+    w = mio_text_line(font, line, end, 0, 0, FALSE);
+    width = MIO_MAX(width, w);
+  }
+  return (int32)ceil(width);
+}
+
+mioTextStats mio_text_get_stats(void) { return G_TEXT.stats; }
+#endif
+
 /* @VECTOR MATH **************************************************************/
 
 #define MIO_DEG2RAD (real32)(M_PI / 180.0)
@@ -4436,8 +6792,21 @@ mio_vec3_hermite(mioVec3 p0, mioVec3 t0, mioVec3 p1, mioVec3 t1, real32 t) {
 
 #define MAX_CLIPPED_VERTS 16
 
+#define MIO_CLIP_LEFT 0x01
+#define MIO_CLIP_RIGHT 0x02
+#define MIO_CLIP_TOP 0x04
+#define MIO_CLIP_BOTTOM 0x08
+#define MIO_CLIP_NEAR 0x10
+#define MIO_CLIP_FAR 0x20
+#define MIO_CLIP_FRUSTUM 0x3f
+#define MIO_CLIP_GUARD 0x40
+
+#ifndef MIO_CLIP_GUARD_BAND
+#define MIO_CLIP_GUARD_BAND 8.0f
+#endif
+
 typedef struct {
-  mioVec4 vertices[MAX_CLIPPED_VERTS];
+  mioVertex vertices[MAX_CLIPPED_VERTS];
   int32 count;
 } mioClippedFace;
 
@@ -4633,18 +7002,20 @@ mioVertex mio_vertex_lerp(mioVertex v1, mioVertex v2, real32 t) {
   return res;
 }
 
-int32 mio_clip_polygon(mioVertex *in, int32 inCount, mioVertex *out) {
+MIO_GLOBAL int32 mio_clip_polygon_planes(
+    mioVertex *in, int32 inCount, mioVertex *out, uint32 planes) {
   mioVertex s;
   mioVertex p;
   mioVertex tempVerts[MAX_CLIPPED_VERTS];
   mioVertex *inPtr = in;
   mioVertex *outPtr = out;
-  int32 outCount;
+  int32 outCount = inCount;
   int32 planeIdx, j;
   real32 sVal, pVal, t;
   inPtr = in;
   outPtr = out;
   for (planeIdx = 0; planeIdx < 6; planeIdx++) {
+    if (!(planes & (1u << planeIdx))) { continue; }
     outCount = 0;
     s = inPtr[inCount - 1];
     for (j = 0; j < inCount; j++) {
@@ -4684,6 +7055,73 @@ int32 mio_clip_polygon(mioVertex *in, int32 inCount, mioVertex *out) {
   return outCount;
 }
 
+int32 mio_clip_polygon(mioVertex *in, int32 inCount, mioVertex *out) {
+  return mio_clip_polygon_planes(in, inCount, out, MIO_CLIP_FRUSTUM);
+}
+
+void mio_clip_outcodes(const mioVertex *v, int32 count, uint32 *codes) {
+  __m128 x, y, z, w, nw, g, ng;
+  __m128i code;
+  int32 i, a, b, c, d;
+  for (i = 0; i < count; i += 4) {
+    a = i;
+    b = MIO_MIN(i + 1, count - 1);
+    c = MIO_MIN(i + 2, count - 1);
+    d = MIO_MIN(i + 3, count - 1);
+    x = _mm_setr_ps(v[a].pos.x, v[b].pos.x, v[c].pos.x, v[d].pos.x);
+    y = _mm_setr_ps(v[a].pos.y, v[b].pos.y, v[c].pos.y, v[d].pos.y);
+    z = _mm_setr_ps(v[a].pos.z, v[b].pos.z, v[c].pos.z, v[d].pos.z);
+    w = _mm_setr_ps(v[a].pos.w, v[b].pos.w, v[c].pos.w, v[d].pos.w);
+    nw = _mm_sub_ps(_mm_setzero_ps(), w);
+    g = _mm_mul_ps(w, _mm_set1_ps(MIO_CLIP_GUARD_BAND));
+    ng = _mm_sub_ps(_mm_setzero_ps(), g);
+    code = _mm_and_si128(
+        _mm_castps_si128(_mm_cmplt_ps(x, nw)), _mm_set1_epi32(MIO_CLIP_LEFT));
+    code = _mm_or_si128(code, _mm_and_si128(
+        _mm_castps_si128(_mm_cmpgt_ps(x, w)), _mm_set1_epi32(MIO_CLIP_RIGHT)));
+    code = _mm_or_si128(code, _mm_and_si128(
+        _mm_castps_si128(_mm_cmpgt_ps(y, w)), _mm_set1_epi32(MIO_CLIP_TOP)));
+    code = _mm_or_si128(code, _mm_and_si128(
+        _mm_castps_si128(_mm_cmplt_ps(y, nw)),
+        _mm_set1_epi32(MIO_CLIP_BOTTOM)));
+    code = _mm_or_si128(code, _mm_and_si128(
+        _mm_castps_si128(_mm_cmplt_ps(z, nw)), _mm_set1_epi32(MIO_CLIP_NEAR)));
+    code = _mm_or_si128(code, _mm_and_si128(
+        _mm_castps_si128(_mm_cmpgt_ps(z, w)), _mm_set1_epi32(MIO_CLIP_FAR)));
+    code = _mm_or_si128(code, _mm_and_si128(
+        _mm_castps_si128(_mm_or_ps(
+            _mm_or_ps(_mm_cmplt_ps(x, ng), _mm_cmpgt_ps(x, g)),
+            _mm_or_ps(_mm_cmplt_ps(y, ng), _mm_cmpgt_ps(y, g)))),
+        _mm_set1_epi32(MIO_CLIP_GUARD)));
+    if (count - i >= 4) {
+      _mm_storeu_si128((__m128i *)(codes + i), code);
+    } else {
+      uint32 tmp[4];
+      _mm_storeu_si128((__m128i *)tmp, code);
+      for (a = i; a < count; a++) { codes[a] = tmp[a - i]; }
+    }
+  }
+}
+
+int32 mio_3d_clip_triangle(mioVertex *in, mioVertex *out) {
+  uint32 codes[3];
+  uint32 allOut, anyOut;
+  mio_clip_outcodes(in, 3, codes);
+  allOut = codes[0] & codes[1] & codes[2];
+  anyOut = codes[0] | codes[1] | codes[2];
+  if (allOut & MIO_CLIP_FRUSTUM) { return 0; }
+  /* Side planes are left to the rasterizer's scissor while the triangle stays
+   * inside the guard band; near/far still need real clipping for depth. */
+  if (!(anyOut & (MIO_CLIP_NEAR | MIO_CLIP_FAR | MIO_CLIP_GUARD)) &&
+      !(G_APP.render.flags3D & MIO_3D_WIREFRAME)) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    return 3;
+  }
+  return mio_clip_polygon_planes(in, 3, out, anyOut & MIO_CLIP_FRUSTUM);
+}
+
 MIO_GLOBAL SYSRET mio_cull_mesh(mioMesh *mesh, mioMat4 mvp) {
   int32 outsideCount;
   int32 i;
@@ -5214,35 +7652,133 @@ void mio_3d_get_bounds(mioMesh *mesh, mioVec3 *min, mioVec3 *max) {
   }
 }
 
+MIO_GLOBAL void mio_3d_fog_build(
+    int32 mode, real32 start, real32 end, real32 density) {
+  mioRenderContext *ctx = &G_APP.render;
+  int32 i;
+  real32 d, f, range;
+  ctx->fogMode = mode;
+  ctx->fogStart = start;
+  ctx->fogEnd = MIO_MAX(end, start + MIO_EPSILON);
+  ctx->fogDensity = MIO_MAX(density, MIO_EPSILON);
+  if (mode == MIO_FOG_EXP) {
+    range = start + 6.9f / ctx->fogDensity;
+  } else if (mode == MIO_FOG_EXP2) {
+    range = start + 2.63f / ctx->fogDensity;
+  } else {
+    range = ctx->fogEnd;
+  }
+  ctx->fogLutScale = (real32)(MIO_FOG_LUT_SIZE - 1) / range;
+  for (i = 0; i < MIO_FOG_LUT_SIZE; i++) {
+    d = (real32)i / ctx->fogLutScale - start;
+    if (d <= 0.0f) {
+      f = 0.0f;
+    } else if (mode == MIO_FOG_EXP) {
+      f = 1.0f - (real32)exp(-ctx->fogDensity * d);
+    } else if (mode == MIO_FOG_EXP2) {
+      f = 1.0f - (real32)exp(-(ctx->fogDensity * d) * (ctx->fogDensity * d));
+    } else {
+      f = d / (ctx->fogEnd - start);
+    }
+    ctx->fogLut[i] = (uint16)(MIO_CLAMP(f, 0.0f, 1.0f) * 256.0f + 0.5f);
+  }
+  ctx->fogLut[MIO_FOG_LUT_SIZE - 1] = 256;
+}
+
+void mio_3d_fog_set(
+    int32 mode, real32 start, real32 end, real32 density, uint32 colour) {
+  G_APP.render.fogCustom = TRUE;
+  G_APP.render.fogColour = colour;
+  mio_3d_fog_build(mode, start, end, density);
+}
+
+MIO_GLOBAL uint32 mio_3d_fog_pixel(uint32 col, real32 dist) {
+  real32 i = MIO_CLAMP(
+      dist * G_APP.render.fogLutScale, 0.0f, (real32)(MIO_FOG_LUT_SIZE - 1));
+  return mio_colour_lerp(
+      col, G_APP.render.fogColour, G_APP.render.fogLut[(int32)i]);
+}
+
 int32 mio_3d_draw_triangle_span_solid(
     int32 row, real32 sx, real32 ex, real32 texSW, real32 texEW) {
   int32 i;
   int32 indexStart = (int32)sx;
-  int32 indexEnd = (int32)ex;
+  int32 indexEnd = MIO_MIN((int32)ex, G_APP.render.width);
   real32 delta = (ex - sx);
   real32 texStepW = (texEW - texSW) / delta;
   real32 texW = texSW;
-  uint32 index = indexStart + row * G_APP.render.width;
-  uint32 *pixel = G_APP.render.colourData + index;
-  real32 *depth = G_APP.render.depthData + index;
+  uint32 index;
+  uint32 *pixel;
+  real32 *depth;
   uint32 col = G_APP.colour;
   real32 invW = 1.0f - texW;
+  real32 fogD = 0.0f, fogStep = 0.0f;
+  int32 fogLeft = 0;
+  int32 written = 0;
+  int32 fog = G_APP.render.flags3D & MIO_3D_FOG;
+  if (row < 0 || row >= G_APP.render.height) { return TRUE; }
+  if (indexStart < 0) {
+    texW += texStepW * (real32)(-indexStart);
+    indexStart = 0;
+  }
+  if (indexStart >= indexEnd) { return TRUE; }
+  index = indexStart + row * G_APP.render.width;
+  pixel = G_APP.render.colourData + index;
+  depth = G_APP.render.depthData + index;
   for (i = indexStart; i < indexEnd; i++) {
     invW = 1.0f - texW;
+    if (fog && fogLeft-- == 0) {
+      fogLeft = MIO_MIN(MIO_FOG_SPAN_STEP, indexEnd - i);
+      fogD = 1.0f / texW;
+      fogStep = (1.0f / (texW + texStepW * (real32)fogLeft) - fogD) /
+                (real32)fogLeft;
+      fogLeft--;
+    }
     if (invW < *depth) {
-      *pixel = col;
+      *pixel = fog ? mio_3d_fog_pixel(col, fogD) : col;
       *depth = invW;
+      written++;
     }
     depth++;
     pixel++;
     texW += texStepW;
+    fogD += fogStep;
   }
+  MIO_PROFILE_COUNT(MIO_PROFILE_PIXELS_WRITTEN, written);
+  MIO_PROFILE_COUNT(
+      MIO_PROFILE_PIXELS_REJECTED, (indexEnd - indexStart) - written);
   return TRUE;
 }
 
-int32 mio_3d_draw_triangle_span_texture(
-    int32 row, real32 sx, real32 ex, real32 texSU, real32 texSV, real32 texSW,
-    real32 texEU, real32 texEV, real32 texEW, real32 lightValue,
+MIO_GLOBAL real32
+mio_3d_span_footprint(real32 t, real32 w, real32 dt, real32 dw, real32 size) {
+  if (w < MIO_EPSILON) { return 1.0f; }
+  return MIO_FABS(dt * w - t * dw) / (w * w) * size;
+}
+
+/* Coarse shading works on 2x2 tiles anchored at even pixels. tileOwner
+   records which triangle last coarse-shaded each pixel, so a tile only
+   copies colour from pixels the same triangle wrote. */
+MIO_GLOBAL uint32 mio_3d_coarse_triangle(void) {
+  mioDynamicRes *dr = &G_APP.dynres;
+  int32 size = G_APP.render.width * G_APP.render.height;
+  if (size > dr->tileOwnerSize) {
+    if (dr->tileOwner) { sys_free(dr->tileOwner); }
+    dr->tileOwner = (uint32 *)sys_alloc(sizeof(uint32) * size);
+    dr->tileOwnerSize = dr->tileOwner ? size : 0;
+    if (dr->tileOwner) { memset(dr->tileOwner, 0, sizeof(uint32) * size); }
+  }
+  if (!dr->tileOwner) { return 0; }
+  if (++dr->tileTriangle == 0) {
+    memset(dr->tileOwner, 0, sizeof(uint32) * dr->tileOwnerSize);
+    dr->tileTriangle = 1;
+  }
+  return dr->tileTriangle;
+}
+
+int32 mio_3d_draw_triangle_span_texture(
+    int32 row, real32 sx, real32 ex, real32 texSU, real32 texSV, real32 texSW,
+    real32 texEU, real32 texEV, real32 texEW, real32 lightValue,
     uint32 *texture, uint32 tW, uint32 tH) {
   int32 i;
   int32 tx, ty;
@@ -5250,8 +7786,8 @@ int32 mio_3d_draw_triangle_span_texture(
   int32 dw = G_APP.render.width;
   int32 dh = G_APP.render.height;
   int32 indexStart = (int32)sx;
-  int32 indexEnd = (int32)ex;
-  uint32 index = indexStart + row * G_APP.render.width;
+  int32 indexEnd = MIO_MIN((int32)ex, dw);
+  uint32 index;
   real32 delta = 1.0f / (ex - sx);
   real32 texStepW = (texEW - texSW) * delta;
   real32 texStepX = (texEU - texSU) * delta;
@@ -5267,13 +7803,34 @@ int32 mio_3d_draw_triangle_span_texture(
   real32 *depth = NULL;
   real32 dval = 1.0f - texW;
   real32 invW = 0.0f;
+  real32 fogD = 0.0f, fogStep = 0.0f;
+  int32 fogLeft = 0;
   uint8 r, g, b;
+  int32 written = 0;
+  int32 coarse = FALSE;
+  int32 shadedAt = -2;
+  uint32 *owner = NULL;
+  uint32 tri = G_APP.dynres.tileTriangle;
+  int32 fog = G_APP.render.flags3D & MIO_3D_FOG;
   if (row < 0 || row >= dh) { return TRUE; }
-  if (indexStart < 0 && indexEnd < 0) { return TRUE; }
-  if (indexStart >= dw && indexEnd >= dw) { return TRUE; }
+  if (indexStart < 0) {
+    texU += texStepX * (real32)(-indexStart);
+    texV += texStepY * (real32)(-indexStart);
+    texW += texStepW * (real32)(-indexStart);
+    indexStart = 0;
+  }
+  if (indexStart >= indexEnd) { return TRUE; }
+  index = indexStart + row * dw;
   if (G_APP.render.flags3D & MIO_3D_AFFINE_MAP) {
     for (i = indexStart; i < indexEnd; i++) {
       dval = 1.0f - texW;
+      if (fog && fogLeft-- == 0) {
+        fogLeft = MIO_MIN(MIO_FOG_SPAN_STEP, indexEnd - i);
+        fogD = 1.0f / texW;
+        fogStep = (1.0f / (texW + texStepW * (real32)fogLeft) - fogD) /
+                  (real32)fogLeft;
+        fogLeft--;
+      }
       if (dval < G_APP.render.depthData[i + row * G_APP.render.width]) {
         tx = (int32)(texU * texWidth);
         ty = (int32)(texV * texHeight);
@@ -5282,19 +7839,48 @@ int32 mio_3d_draw_triangle_span_texture(
         g = (uint8)((real32) * (texBytes + 1) * lightValue);
         b = (uint8)((real32) * (texBytes + 0)) * lightValue;
         G_APP.render.colourData[i + row * G_APP.render.width] =
-            MIO_RGBA(r, g, b, 255);
+            fog ? mio_3d_fog_pixel(MIO_RGBA(r, g, b, 255), fogD)
+                : MIO_RGBA(r, g, b, 255);
         G_APP.render.depthData[i + row * G_APP.render.width] = dval;
+        written++;
       }
       texU += texStepX;
       texV += texStepY;
       texW += texStepW;
+      fogD += fogStep;
     }
   } else {
     pixel = G_APP.render.colourData + index;
     depth = G_APP.render.depthData + index;
+    if ((G_APP.render.flags3D & MIO_3D_COARSE_SHADE) && tri &&
+        G_APP.dynres.tileOwner) {
+      owner = G_APP.dynres.tileOwner + index;
+      coarse =
+          mio_3d_span_footprint(texSU, texSW, texStepX, texStepW, texWidth) <
+              0.5f &&
+          mio_3d_span_footprint(texSV, texSW, texStepY, texStepW, texHeight) <
+              0.5f &&
+          mio_3d_span_footprint(texEU, texEW, texStepX, texStepW, texWidth) <
+              0.5f &&
+          mio_3d_span_footprint(texEV, texEW, texStepY, texStepW, texHeight) <
+              0.5f;
+    }
     for (i = indexStart; i < indexEnd; i++) {
       dval = 1.0f - texW;
-      if (dval < *depth) {
+      if (dval < *depth && coarse && (i & 1) && shadedAt == i - 1) {
+        *pixel = pixel[-1];
+        *depth = dval;
+        owner[i - indexStart] = tri;
+        written++;
+      } else if (
+          dval < *depth && coarse && (row & 1) &&
+          owner[i - indexStart - dw] == tri) {
+        *pixel = pixel[-dw];
+        *depth = dval;
+        owner[i - indexStart] = tri;
+        written++;
+      } else if (dval < *depth) {
+        shadedAt = i;
         invW = 1.0 / texW;
         corrU = texU * invW;
         corrV = texV * invW;
@@ -5305,7 +7891,10 @@ int32 mio_3d_draw_triangle_span_texture(
         *(pixelBytes++) = (uint8)(((real32) * (texBytes + 0)) * lightValue);
         *(pixelBytes++) = (uint8)(((real32) * (texBytes + 1)) * lightValue);
         *(pixelBytes++) = (uint8)(((real32) * (texBytes + 2)) * lightValue);
+        if (fog) { *pixel = mio_3d_fog_pixel(*pixel, invW); }
         *depth = dval;
+        if (coarse) { owner[i - indexStart] = tri; }
+        written++;
       }
       depth++;
       pixel++;
@@ -5314,6 +7903,9 @@ int32 mio_3d_draw_triangle_span_texture(
       texW += texStepW;
     }
   }
+  MIO_PROFILE_COUNT(MIO_PROFILE_PIXELS_WRITTEN, written);
+  MIO_PROFILE_COUNT(
+      MIO_PROFILE_PIXELS_REJECTED, (indexEnd - indexStart) - written);
   return TRUE;
 }
 
@@ -5329,6 +7921,7 @@ int32 mio_3d_draw_triangle_solid(
   real32 imy1;
   real32 imy2;
   int32 iy1, iy2, iy3;
+  int32 rowEnd = G_APP.render.height;
   real32 texSU = 0.0f, texSV = 0.0f, texSW = 0.0f;
   real32 texEU = 0.0f, texEV = 0.0f, texEW = 0.0f;
   real32 stepDAX = 0, stepDBX = 0;
@@ -5374,7 +7967,7 @@ int32 mio_3d_draw_triangle_solid(
     stepDW2 = dw2 * absDy2;
   }
   if (dy1) {
-    for (i = iy1 + 1; i <= y2; i++) {
+    for (i = MIO_MAX(iy1 + 1, 1); i <= y2 && i <= rowEnd; i++) {
       imy1 = (real32)(i)-y1;
       sx = (x1 + imy1 * stepDAX);
       ex = (x1 + imy1 * stepDBX);
@@ -5400,7 +7993,7 @@ int32 mio_3d_draw_triangle_solid(
   }
   if (dy2) { stepDBX = dx2 * absDy2; }
   if (dy1) {
-    for (i = iy2 + 1; i <= iy3; i++) {
+    for (i = MIO_MAX(iy2 + 1, 1); i <= iy3 && i <= rowEnd; i++) {
       imy1 = (real32)(i)-y1;
       imy2 = (real32)(i)-y2;
       sx = (x2 + imy2 * stepDAX);
@@ -5433,10 +8026,12 @@ int32 mio_3d_draw_triangle_texture(
   real32 imy1;
   real32 imy2;
   int32 iy1, iy2, iy3;
+  int32 rowEnd = G_APP.render.height;
   real32 texSU = 0.0f, texSV = 0.0f, texSW = 0.0f;
   real32 texEU = 0.0f, texEV = 0.0f, texEW = 0.0f;
   real32 stepDAX = 0, stepDBX = 0, stepDU1 = 0;
   real32 stepDV1 = 0, stepDW1 = 0, stepDU2 = 0, stepDV2 = 0, stepDW2 = 0;
+  if (G_APP.render.flags3D & MIO_3D_COARSE_SHADE) { mio_3d_coarse_triangle(); }
   x1 += 0.5f;
   x2 += 0.5f;
   x3 += 0.5f;
@@ -5500,7 +8095,7 @@ int32 mio_3d_draw_triangle_texture(
     stepDW2 = dw2 * absDy2;
   }
   if (dy1) {
-    for (i = iy1 + 1; i <= y2; i++) {
+    for (i = MIO_MAX(iy1 + 1, 1); i <= y2 && i <= rowEnd; i++) {
       imy1 = (real32)(i)-y1;
       sx = (x1 + imy1 * stepDAX);
       ex = (x1 + imy1 * stepDBX);
@@ -5541,7 +8136,7 @@ int32 mio_3d_draw_triangle_texture(
   }
   if (dy2) { stepDBX = dx2 * absDy2; }
   if (dy1) {
-    for (i = iy2 + 1; i <= iy3; i++) {
+    for (i = MIO_MAX(iy2 + 1, 1); i <= iy3 && i <= rowEnd; i++) {
       imy1 = (real32)(i)-y1;
       imy2 = (real32)(i)-y2;
       sx = (x2 + imy2 * stepDAX);
@@ -5660,122 +8255,247 @@ void mio_3d_draw_vertex_triangle(
   }
 }
 
-void mio_3d_draw_mesh(
-    mioCamera *cam, mioMesh *mesh, mioMat4 modelWorldMatrix, uint32 *texture,
-    uint32 tW, uint32 tH, uint32 ortho) {
-  int32 i;
-  int32 j;
-  uint32 origCol;
-  mioVec3 sunDir;
-  mioMat4 projectionMatrix;
-  mioMat4 viewMatrix;
-  mioMat4 viewProjectionMatrix;
-  mioMat4 modelViewProjectionMatrix;
-  mioMat4 modelViewMatrix;
-  mioVertex transformedVerts[3];
-  mioClippedFace clippedFace;
-  mioVec3 v1;
-  mioVec3 v2;
-  mioVec3 v3;
-  mioVec3 normalVecFace;
-  mioVec3 viewVec;
-  mioVec4 p1_4;
-  mioVec4 p2_4;
-  mioVec4 p3_4;
-  mioVec4 normalVec4;
-  mioVec4 transformedNormal4;
-  mioVec3 p1;
-  mioVec3 p2;
-  mioVec3 p3;
-  mioVec3 faceNormal;
-  mioVec3 transformedNormal;
-  mioVec3 normalizedTransformedNormal;
-  int32 behind_near_plane_count = 0;
-  real32 lightIntensityFace = 1.0f;
+void mio_3d_occlusion_begin(mioCamera *cam) {
   mioMat4 camera_rot = mio_mat4_identity();
-  mioMat4 camera_pos = mio_mat4_identity();
-  origCol = G_APP.colour;
+  mioMat4 viewMatrix;
+  mioOcclusion *oc = &G_APP.occlusion;
+  if (!oc->depth) {
+    oc->depth = (real32 *)sys_alloc(
+        MIO_OCCLUSION_WIDTH * MIO_OCCLUSION_HEIGHT * sizeof(real32));
+    if (!oc->depth) { return; }
+  }
   camera_rot = mio_mat4_mul(mio_mat4_rotate_y(-cam->yaw), camera_rot);
   camera_rot = mio_mat4_mul(mio_mat4_rotate_x(-cam->pitch), camera_rot);
-  camera_pos = mio_mat4_translate(mio_vec3_scale(cam->pos, -1.0f));
-  viewMatrix = mio_mat4_mul(camera_rot, camera_pos);
-  mio_3d_get_bounds(mesh, &mesh->boundsMin, &mesh->boundsMax);
-  projectionMatrix = cam->projection;
-  modelViewMatrix = mio_mat4_mul(viewMatrix, modelWorldMatrix);
-  viewProjectionMatrix = mio_mat4_mul(projectionMatrix, viewMatrix);
-  modelViewProjectionMatrix =
-      mio_mat4_mul(viewProjectionMatrix, modelWorldMatrix);
-  if ((G_APP.render.flags3D & MIO_3D_CULL_FRUSTUM) &&
-      mio_cull_mesh(mesh, modelViewProjectionMatrix)) {
-    return;
+  viewMatrix = mio_mat4_mul(
+      camera_rot, mio_mat4_translate(mio_vec3_scale(cam->pos, -1.0f)));
+  oc->viewProj = mio_mat4_mul(cam->projection, viewMatrix);
+  oc->nearPlane = MIO_MAX(cam->nearPlane, MIO_EPSILON);
+  oc->occluderTris = 0;
+  oc->tested = 0;
+  oc->culled = 0;
+  oc->active = TRUE;
+  memset(
+      oc->depth, 0,
+      MIO_OCCLUSION_WIDTH * MIO_OCCLUSION_HEIGHT * sizeof(real32));
+}
+
+void mio_3d_occlusion_end(void) { G_APP.occlusion.active = FALSE; }
+
+MIO_GLOBAL void mio_3d_occlusion_raster(const mioVec4 *c) {
+  real32 *depth = G_APP.occlusion.depth;
+  real32 x[3], y[3], z[3], a[3], b[3], e[3], t[3];
+  real32 area, dzdx, dzdy, zBias, px, py;
+  int32 i, x0, x1, y0, y1, row, col;
+  __m128 va[3], vrow[3], vt[3], ve[3], vz, vdz, mask, lane;
+  for (i = 0; i < 3; i++) {
+    x[i] = (c[i].x / c[i].w + 1.0f) * 0.5f * MIO_OCCLUSION_WIDTH;
+    y[i] = (1.0f - c[i].y / c[i].w) * 0.5f * MIO_OCCLUSION_HEIGHT;
+    z[i] = 1.0f / c[i].w;
+  }
+  area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (MIO_ABS(area) < 1.0f) { return; }
+  x0 = MIO_MAX((int32)MIO_MIN(x[0], MIO_MIN(x[1], x[2])), 0) & ~3;
+  y0 = MIO_MAX((int32)MIO_MIN(y[0], MIO_MIN(y[1], y[2])), 0);
+  x1 = MIO_MIN((int32)MIO_MAX(x[0], MIO_MAX(x[1], x[2])) + 1,
+               MIO_OCCLUSION_WIDTH);
+  y1 = MIO_MIN((int32)MIO_MAX(y[0], MIO_MAX(y[1], y[2])) + 1,
+               MIO_OCCLUSION_HEIGHT);
+  if (x0 >= x1 || y0 >= y1) { return; }
+  for (i = 0; i < 3; i++) {
+    int32 j = (i + 1) % 3;
+    real32 s = area > 0.0f ? 1.0f : -1.0f;
+    a[i] = (y[i] - y[j]) * s;
+    b[i] = (x[j] - x[i]) * s;
+    e[i] = -(a[i] * x[i] + b[i] * y[i]);
+    t[i] = 0.5f * (MIO_ABS(a[i]) + MIO_ABS(b[i]));
+  }
+  dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) /
+         area;
+  dzdy = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) /
+         area;
+  zBias = 0.5f * (MIO_ABS(dzdx) + MIO_ABS(dzdy));
+  lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  for (i = 0; i < 3; i++) {
+    va[i] = _mm_set1_ps(a[i] * 4.0f);
+    vt[i] = _mm_set1_ps(t[i]);
+  }
+  vdz = _mm_set1_ps(dzdx * 4.0f);
+  for (row = y0; row < y1; row++) {
+    py = (real32)row + 0.5f;
+    px = (real32)x0 + 0.5f;
+    for (i = 0; i < 3; i++) {
+      vrow[i] = _mm_add_ps(
+          _mm_set1_ps(a[i] * px + b[i] * py + e[i]),
+          _mm_mul_ps(lane, _mm_set1_ps(a[i])));
+    }
+    vz = _mm_add_ps(
+        _mm_set1_ps(
+            z[0] + dzdx * (px - x[0]) + dzdy * (py - y[0]) - zBias),
+        _mm_mul_ps(lane, _mm_set1_ps(dzdx)));
+    for (col = x0; col < x1; col += 4) {
+      for (i = 0; i < 3; i++) { ve[i] = _mm_cmpge_ps(vrow[i], vt[i]); }
+      mask = _mm_and_ps(ve[0], _mm_and_ps(ve[1], ve[2]));
+      if (_mm_movemask_ps(mask)) {
+        real32 *dst = depth + row * MIO_OCCLUSION_WIDTH + col;
+        _mm_storeu_ps(
+            dst, _mm_max_ps(_mm_loadu_ps(dst), _mm_and_ps(mask, vz)));
+      }
+      for (i = 0; i < 3; i++) { vrow[i] = _mm_add_ps(vrow[i], va[i]); }
+      vz = _mm_add_ps(vz, vdz);
+    }
   }
+}
+
+void mio_3d_occluder_add(mioMesh *mesh, mioMat4 model) {
+  mioOcclusion *oc = &G_APP.occlusion;
+  mioMat4 mvp;
+  mioVec4 in[3], poly[4], tri[3];
+  real32 d[3], t;
+  int32 i, j, k, n;
+  if (!oc->active || !mesh || !mesh->vertices) { return; }
+  mvp = mio_mat4_mul(oc->viewProj, model);
   for (i = 0; i < mesh->indexCount / 3; i++) {
-    behind_near_plane_count = 0;
     for (j = 0; j < 3; j++) {
-      transformedVerts[j] = mesh->vertices[mesh->indices[i * 3 + j]];
-      transformedVerts[j].pos =
-          mio_mat4_mul_vec4(modelViewMatrix, transformedVerts[j].pos);
-      if (transformedVerts[j].pos.z > 0.0f) { behind_near_plane_count++; }
+      in[j] = mio_mat4_mul_vec4(mvp, mesh->vertices[mesh->indices[i * 3 + j]].pos);
+      d[j] = in[j].w - oc->nearPlane;
     }
-    if ((G_APP.render.flags3D & MIO_3D_CULL_BEHIND) &&
-        behind_near_plane_count >= 3) {
-      continue;
+    n = 0;
+    for (j = 0; j < 3; j++) {
+      k = (j + 1) % 3;
+      if (d[j] >= 0.0f) { poly[n++] = in[j]; }
+      if ((d[j] >= 0.0f) != (d[k] >= 0.0f)) {
+        t = d[j] / (d[j] - d[k]);
+        poly[n++] = mio_vec4_lerp(in[j], in[k], t);
+      }
     }
-    v1.x = transformedVerts[0].pos.x;
-    v1.y = transformedVerts[0].pos.y;
-    v1.z = transformedVerts[0].pos.z;
-    v2.x = transformedVerts[1].pos.x;
-    v2.y = transformedVerts[1].pos.y;
-    v2.z = transformedVerts[1].pos.z;
-    v3.x = transformedVerts[2].pos.x;
-    v3.y = transformedVerts[2].pos.y;
-    v3.z = transformedVerts[2].pos.z;
-    normalVecFace = mio_vec3_cross(mio_vec3_sub(v2, v1), mio_vec3_sub(v3, v1));
-    viewVec = mio_vec3(0.0f, 0.0f, 0.0f);
-    if (ortho) {
-      viewVec = mio_vec3(0.0f, 0.0f, 1.0f);
-    } else {
-      viewVec = mio_vec3_scale(v1, -1.0f);
+    for (j = 1; j + 1 < n; j++) {
+      tri[0] = poly[0];
+      tri[1] = poly[j];
+      tri[2] = poly[j + 1];
+      mio_3d_occlusion_raster(tri);
+    }
+    oc->occluderTris++;
+  }
+}
+
+SYSRET mio_3d_occlusion_test(mioVec3 min, mioVec3 max, mioMat4 model) {
+  mioOcclusion *oc = &G_APP.occlusion;
+  mioMat4 mvp;
+  mioVec4 p;
+  real32 sx0 = MIO_REAL32_MAX, sy0 = MIO_REAL32_MAX;
+  real32 sx1 = -MIO_REAL32_MAX, sy1 = -MIO_REAL32_MAX;
+  real32 nearest = 0.0f, sx, sy;
+  int32 i, x0, x1, y0, y1, row, col;
+  __m128 vz;
+  if (!oc->active) { return FALSE; }
+  oc->tested++;
+  mvp = mio_mat4_mul(oc->viewProj, model);
+  for (i = 0; i < 8; i++) {
+    p = mio_mat4_mul_vec4(
+        mvp, mio_vec4(
+                 (i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y,
+                 (i & 4) ? max.z : min.z, 1.0f));
+    if (p.w < oc->nearPlane) { return FALSE; }
+    sx = (p.x / p.w + 1.0f) * 0.5f * MIO_OCCLUSION_WIDTH;
+    sy = (1.0f - p.y / p.w) * 0.5f * MIO_OCCLUSION_HEIGHT;
+    sx0 = MIO_MIN(sx0, sx);
+    sy0 = MIO_MIN(sy0, sy);
+    sx1 = MIO_MAX(sx1, sx);
+    sy1 = MIO_MAX(sy1, sy);
+    nearest = MIO_MAX(nearest, 1.0f / p.w);
+  }
+  x0 = MIO_MAX((int32)sx0, 0) & ~3;
+  y0 = MIO_MAX((int32)sy0, 0);
+  x1 = MIO_MIN((int32)sx1 + 1, MIO_OCCLUSION_WIDTH);
+  y1 = MIO_MIN((int32)sy1 + 1, MIO_OCCLUSION_HEIGHT);
+  if (x0 >= x1 || y0 >= y1) { return FALSE; }
+  vz = _mm_set1_ps(nearest);
+  for (row = y0; row < y1; row++) {
+    const real32 *src = oc->depth + row * MIO_OCCLUSION_WIDTH;
+    for (col = x0; col < x1; col += 4) {
+      if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(src + col), vz))) {
+        return FALSE;
+      }
     }
+  }
+  oc->culled++;
+  return TRUE;
+}
+
+typedef mioVertex (*PFMIOVERTEXFETCH)(const void *mesh, int32 index);
+
+MIO_GLOBAL mioVertex mio_3d_fetch_vertex(const void *mesh, int32 index) {
+  return ((const mioMesh *)mesh)->vertices[index];
+}
+
+MIO_GLOBAL mioMat4 mio_3d_view_matrix(mioCamera *cam) {
+  mioMat4 camera_rot = mio_mat4_identity();
+  camera_rot = mio_mat4_mul(mio_mat4_rotate_y(-cam->yaw), camera_rot);
+  camera_rot = mio_mat4_mul(mio_mat4_rotate_x(-cam->pitch), camera_rot);
+  return mio_mat4_mul(
+      camera_rot, mio_mat4_translate(mio_vec3_scale(cam->pos, -1.0f)));
+}
+
+/* Transform, cull, clip and raster loop shared by every mesh format. fetch
+   returns a vertex in the space modelViewMatrix expects; posScale maps
+   those positions back to object space for the flat-shading normal. */
+MIO_GLOBAL void mio_3d_draw_indexed(
+    mioCamera *cam, const void *mesh, PFMIOVERTEXFETCH fetch,
+    const int32 *indices, int32 indexCount, mioMat4 modelWorldMatrix,
+    mioMat4 modelViewMatrix, mioVec3 posScale, int32 cullBehind,
+    uint32 *texture, uint32 tW, uint32 tH, uint32 ortho) {
+  int32 i, j, behind;
+  uint32 origCol = G_APP.colour;
+  mioVertex src[3];
+  mioVertex transformedVerts[3];
+  mioClippedFace clippedFace;
+  mioVec3 v[3], p[3], normal, sunDir, viewVec;
+  mioVec4 n4;
+  real32 lightIntensityFace = 1.0f;
+  MIO_PROFILE_COUNT(MIO_PROFILE_TRIS_IN, indexCount / 3);
+  for (i = 0; i < indexCount / 3; i++) {
+    MIO_PROFILE_STAGE(MIO_PROFILE_TRANSFORM);
+    behind = 0;
+    for (j = 0; j < 3; j++) {
+      src[j] = fetch(mesh, indices[i * 3 + j]);
+      transformedVerts[j] = src[j];
+      transformedVerts[j].pos = mio_mat4_mul_vec4(modelViewMatrix, src[j].pos);
+      v[j] = mio_vec3(
+          transformedVerts[j].pos.x, transformedVerts[j].pos.y,
+          transformedVerts[j].pos.z);
+      if (v[j].z > 0.0f) { behind++; }
+    }
+    if (cullBehind && behind >= 3) { continue; }
+    MIO_PROFILE_STAGE(MIO_PROFILE_CULL);
+    viewVec = ortho ? mio_vec3(0.0f, 0.0f, 1.0f) : mio_vec3_scale(v[0], -1.0f);
     if ((G_APP.render.flags3D & MIO_3D_CULL_BACKFACE) &&
-        (mio_vec3_dot(normalVecFace, viewVec) < 0)) {
+        mio_vec3_dot(
+            mio_vec3_cross(
+                mio_vec3_sub(v[1], v[0]), mio_vec3_sub(v[2], v[0])),
+            viewVec) < 0) {
       continue;
     }
+    MIO_PROFILE_STAGE(MIO_PROFILE_TRANSFORM);
     if (G_APP.render.flags3D & MIO_3D_SHADE_FLAT) {
-      p1_4 = mesh->vertices[mesh->indices[i * 3 + 0]].pos;
-      p2_4 = mesh->vertices[mesh->indices[i * 3 + 1]].pos;
-      p3_4 = mesh->vertices[mesh->indices[i * 3 + 2]].pos;
-      p1.x = p1_4.x;
-      p1.y = p1_4.y;
-      p1.z = p1_4.z;
-      p2.x = p2_4.x;
-      p2.y = p2_4.y;
-      p2.z = p2_4.z;
-      p3.x = p3_4.x;
-      p3.y = p3_4.y;
-      p3.z = p3_4.z;
-      faceNormal = mio_vec3_normalize(
-          mio_vec3_cross(mio_vec3_sub(p2, p1), mio_vec3_sub(p3, p1)));
-      normalVec4.x = faceNormal.x;
-      normalVec4.y = faceNormal.y;
-      normalVec4.z = faceNormal.z;
-      normalVec4.w = 0.0f;
-      transformedNormal4 = mio_mat4_mul_vec4(modelWorldMatrix, normalVec4);
-      transformedNormal.x = transformedNormal4.x;
-      transformedNormal.y = transformedNormal4.y;
-      transformedNormal.z = transformedNormal4.z;
-      normalizedTransformedNormal = mio_vec3_normalize(transformedNormal);
+      for (j = 0; j < 3; j++) {
+        p[j] = mio_vec3(
+            src[j].pos.x * posScale.x, src[j].pos.y * posScale.y,
+            src[j].pos.z * posScale.z);
+      }
+      normal = mio_vec3_normalize(
+          mio_vec3_cross(mio_vec3_sub(p[1], p[0]), mio_vec3_sub(p[2], p[0])));
+      n4 = mio_mat4_mul_vec4(
+          modelWorldMatrix, mio_vec4(normal.x, normal.y, normal.z, 0.0f));
+      normal = mio_vec3_normalize(mio_vec3(n4.x, n4.y, n4.z));
       sunDir =
           mio_vec3(G_APP.render.sunX, G_APP.render.sunY, G_APP.render.sunZ);
-      lightIntensityFace = mio_vec3_dot(normalizedTransformedNormal, sunDir);
-      lightIntensityFace = lightIntensityFace * 0.5f + 0.5f;
+      lightIntensityFace = mio_vec3_dot(normal, sunDir) * 0.5f + 0.5f;
       lightIntensityFace = G_APP.render.ambient +
                            lightIntensityFace * (1.0f - G_APP.render.ambient);
       if (G_APP.render.flags3D & MIO_3D_NORMALS) {
         mio_set_colour(MIO_RGBA(
-            (uint8)(normalizedTransformedNormal.x * 128.0f + 128),
-            (uint8)(normalizedTransformedNormal.y * 128.0f + 128),
-            (uint8)(normalizedTransformedNormal.z * 128.0f + 128), 255));
+            (uint8)(normal.x * 128.0f + 128), (uint8)(normal.y * 128.0f + 128),
+            (uint8)(normal.z * 128.0f + 128), 255));
       } else {
         mio_set_colour(MIO_RGBA(
             (uint8)((real32)MIO_COL_GET_R(origCol) * lightIntensityFace),
@@ -5786,11 +8506,14 @@ void mio_3d_draw_mesh(
     }
     for (j = 0; j < 3; j++) {
       transformedVerts[j].pos =
-          mio_mat4_mul_vec4(projectionMatrix, transformedVerts[j].pos);
+          mio_mat4_mul_vec4(cam->projection, transformedVerts[j].pos);
     }
-    clippedFace.count = mio_clip_polygon(
-        transformedVerts, 3, (mioVertex *)clippedFace.vertices);
+    MIO_PROFILE_STAGE(MIO_PROFILE_CLIP);
+    clippedFace.count = mio_3d_clip_triangle(
+        transformedVerts, (mioVertex *)clippedFace.vertices);
     if (clippedFace.count < 3) { continue; }
+    MIO_PROFILE_STAGE(MIO_PROFILE_RASTER);
+    MIO_PROFILE_COUNT(MIO_PROFILE_TRIS_OUT, clippedFace.count - 2);
     if (G_APP.render.flags3D & MIO_3D_WIREFRAME) {
       for (j = 0; j < clippedFace.count; j++) {
         mio_3d_draw_vertex_line(
@@ -5809,188 +8532,156 @@ void mio_3d_draw_mesh(
       }
     }
   }
+  MIO_PROFILE_STAGE(MIO_PROFILE_NONE);
   mio_set_colour(origCol);
 }
 
+MIO_GLOBAL SYSRET mio_3d_cull_object(
+    mioMesh *bounds, mioMat4 mvp, mioMat4 modelWorldMatrix) {
+  SYSRET culled = FALSE;
+  MIO_PROFILE_STAGE(MIO_PROFILE_CULL);
+  if ((G_APP.render.flags3D & MIO_3D_CULL_FRUSTUM) &&
+      mio_cull_mesh(bounds, mvp)) {
+    culled = TRUE;
+  } else if (
+      (G_APP.render.flags3D & MIO_3D_CULL_OCCLUSION) &&
+      mio_3d_occlusion_test(
+          bounds->boundsMin, bounds->boundsMax, modelWorldMatrix)) {
+    culled = TRUE;
+  }
+  if (culled) { MIO_PROFILE_STAGE(MIO_PROFILE_NONE); }
+  return culled;
+}
+
+void mio_3d_draw_mesh(
+    mioCamera *cam, mioMesh *mesh, mioMat4 modelWorldMatrix, uint32 *texture,
+    uint32 tW, uint32 tH, uint32 ortho) {
+  mioMat4 viewMatrix = mio_3d_view_matrix(cam);
+  mioMat4 modelViewMatrix = mio_mat4_mul(viewMatrix, modelWorldMatrix);
+  mio_3d_get_bounds(mesh, &mesh->boundsMin, &mesh->boundsMax);
+  if (mio_3d_cull_object(
+          mesh, mio_mat4_mul(cam->projection, modelViewMatrix),
+          modelWorldMatrix)) {
+    return;
+  }
+  mio_3d_draw_indexed(
+      cam, mesh, mio_3d_fetch_vertex, mesh->indices, mesh->indexCount,
+      modelWorldMatrix, modelViewMatrix, mio_vec3(1.0f, 1.0f, 1.0f),
+      G_APP.render.flags3D & MIO_3D_CULL_BEHIND, texture, tW, tH, ortho);
+}
+
 void mio_3d_draw_mesh_ex(
     mioCamera *cam, mioMesh *mesh, mioVec3 pos, mioVec3 rot, uint32 *texture,
     uint32 tW, uint32 tH, uint32 ortho) {
-  int32 i, j;
-  uint32 origCol;
-  mioVec3 sunDir;
-  mioMat4 projectionMatrix, viewMatrix;
-  mioMat4 viewProjectionMatrix;
-  mioMat4 modelViewProjectionMatrix;
-  mioMat4 modelViewMatrix;
-  mioMat4 modelWorldMatrix;
-  mioVertex transformedVerts[3];
-  mioClippedFace clippedFace;
-  mioVec3 v1, v2, v3, normalVecFace, viewVec;
-  mioVec4 p1_4, p2_4, p3_4, normalVec4, transformedNormal4;
-  mioVec3 p1, p2, p3, faceNormal, transformedNormal;
-  mioVec3 normalizedTransformedNormal;
-  int32 behind_near_plane_count = 0;
-  real32 lightIntensityFace = 1.0f;
-  real32 posInv = ortho ? -1.0f : -1.0f;
-  mioMat4 camera_rot = mio_mat4_identity();
-  mioMat4 camera_pos = mio_mat4_identity();
-  origCol = G_APP.colour;
-  camera_rot = mio_mat4_mul(mio_mat4_rotate_y(-cam->yaw), camera_rot);
-  camera_rot = mio_mat4_mul(mio_mat4_rotate_x(-cam->pitch), camera_rot);
-  camera_pos = mio_mat4_translate(mio_vec3_scale(cam->pos, posInv));
-  viewMatrix = mio_mat4_mul(camera_rot, camera_pos);
+  mioMat4 viewMatrix = mio_3d_view_matrix(cam);
+  mioMat4 modelWorldMatrix, modelViewMatrix;
   modelWorldMatrix = mio_mat4_identity();
   modelWorldMatrix = mio_mat4_mul(modelWorldMatrix, mio_mat4_rotate_x(rot.x));
   modelWorldMatrix = mio_mat4_mul(modelWorldMatrix, mio_mat4_rotate_y(rot.y));
   modelWorldMatrix = mio_mat4_mul(modelWorldMatrix, mio_mat4_rotate_z(rot.z));
   modelWorldMatrix = mio_mat4_mul(modelWorldMatrix, mio_mat4_translate(pos));
-  mio_3d_get_bounds(mesh, &mesh->boundsMin, &mesh->boundsMax);
-  projectionMatrix = cam->projection;
   modelViewMatrix = mio_mat4_mul(viewMatrix, modelWorldMatrix);
-  viewProjectionMatrix = mio_mat4_mul(projectionMatrix, viewMatrix);
-  modelViewProjectionMatrix =
-      mio_mat4_mul(viewProjectionMatrix, modelWorldMatrix);
-  if ((G_APP.render.flags3D & MIO_3D_CULL_FRUSTUM) &&
-      mio_cull_mesh(mesh, modelViewProjectionMatrix)) {
+  mio_3d_get_bounds(mesh, &mesh->boundsMin, &mesh->boundsMax);
+  if (mio_3d_cull_object(
+          mesh, mio_mat4_mul(cam->projection, modelViewMatrix),
+          modelWorldMatrix)) {
     return;
   }
-  for (i = 0; i < mesh->indexCount / 3; i++) {
-    behind_near_plane_count = 0;
-    for (j = 0; j < 3; j++) {
-      transformedVerts[j] = mesh->vertices[mesh->indices[i * 3 + j]];
-      transformedVerts[j].pos =
-          mio_mat4_mul_vec4(modelViewMatrix, transformedVerts[j].pos);
-      if (transformedVerts[j].pos.z > 0.0f) { behind_near_plane_count++; }
-    }
-    if (!ortho && behind_near_plane_count >= 3) { continue; }
-    v1.x = transformedVerts[0].pos.x;
-    v1.y = transformedVerts[0].pos.y;
-    v1.z = transformedVerts[0].pos.z;
-    v2.x = transformedVerts[1].pos.x;
-    v2.y = transformedVerts[1].pos.y;
-    v2.z = transformedVerts[1].pos.z;
-    v3.x = transformedVerts[2].pos.x;
-    v3.y = transformedVerts[2].pos.y;
-    v3.z = transformedVerts[2].pos.z;
-    normalVecFace = mio_vec3_cross(mio_vec3_sub(v2, v1), mio_vec3_sub(v3, v1));
-    viewVec = mio_vec3(0.0f, 0.0f, 0.0f);
-    if (ortho) {
-      viewVec = mio_vec3(0.0f, 0.0f, 1.0f);
-    } else {
-      viewVec = mio_vec3_scale(v1, -1.0f);
-    }
-    if ((G_APP.render.flags3D & MIO_3D_CULL_BACKFACE) &&
-        (mio_vec3_dot(normalVecFace, viewVec) < 0)) {
-      continue;
-    }
-    if (G_APP.render.flags3D & MIO_3D_SHADE_FLAT) {
-      p1_4 = mesh->vertices[mesh->indices[i * 3 + 0]].pos;
-      p2_4 = mesh->vertices[mesh->indices[i * 3 + 1]].pos;
-      p3_4 = mesh->vertices[mesh->indices[i * 3 + 2]].pos;
-      p1.x = p1_4.x;
-      p1.y = p1_4.y;
-      p1.z = p1_4.z;
-      p2.x = p2_4.x;
-      p2.y = p2_4.y;
-      p2.z = p2_4.z;
-      p3.x = p3_4.x;
-      p3.y = p3_4.y;
-      p3.z = p3_4.z;
-      faceNormal = mio_vec3_normalize(
-          mio_vec3_cross(mio_vec3_sub(p2, p1), mio_vec3_sub(p3, p1)));
-      normalVec4.x = faceNormal.x;
-      normalVec4.y = faceNormal.y;
-      normalVec4.z = faceNormal.z;
-      normalVec4.w = 0.0f;
-      transformedNormal4 = mio_mat4_mul_vec4(modelWorldMatrix, normalVec4);
-      transformedNormal.x = transformedNormal4.x;
-      transformedNormal.y = transformedNormal4.y;
-      transformedNormal.z = transformedNormal4.z;
-      normalizedTransformedNormal = mio_vec3_normalize(transformedNormal);
-      sunDir =
-          mio_vec3(G_APP.render.sunX, G_APP.render.sunY, G_APP.render.sunZ);
-      lightIntensityFace = mio_vec3_dot(normalizedTransformedNormal, sunDir);
-      lightIntensityFace = lightIntensityFace * 0.5f + 0.5f;
-      lightIntensityFace = G_APP.render.ambient +
-                           lightIntensityFace * (1.0f - G_APP.render.ambient);
-      if (G_APP.render.flags3D & MIO_3D_NORMALS) {
-        mio_set_colour(MIO_RGBA(
-            (uint8)(normalizedTransformedNormal.x * 128.0f + 128),
-            (uint8)(normalizedTransformedNormal.y * 128.0f + 128),
-            (uint8)(normalizedTransformedNormal.z * 128.0f + 128), 255));
-      } else {
-        mio_set_colour(MIO_RGBA(
-            (uint8)((real32)MIO_COL_GET_R(origCol) * lightIntensityFace),
-            (uint8)((real32)MIO_COL_GET_G(origCol) * lightIntensityFace),
-            (uint8)((real32)MIO_COL_GET_B(origCol) * lightIntensityFace),
-            255));
-      }
-    }
-    for (j = 0; j < 3; j++) {
-      transformedVerts[j].pos =
-          mio_mat4_mul_vec4(projectionMatrix, transformedVerts[j].pos);
-    }
-    clippedFace.count = mio_clip_polygon(
-        transformedVerts, 3, (mioVertex *)clippedFace.vertices);
-    if (clippedFace.count < 3) { continue; }
-    if (G_APP.render.flags3D & MIO_3D_WIREFRAME) {
-      for (j = 0; j < clippedFace.count; j++) {
-        mio_3d_draw_vertex_line(
-            ((mioVertex *)clippedFace.vertices)[j],
-            ((mioVertex *)clippedFace.vertices)[(j + 1) % clippedFace.count]);
-      }
-    } else if (
-        G_APP.render.flags3D & MIO_3D_SOLID ||
-        G_APP.render.flags3D & MIO_3D_TEXTURE) {
-      for (j = 0; j < clippedFace.count - 2; j++) {
-        mio_3d_draw_vertex_triangle(
-            ((mioVertex *)clippedFace.vertices)[0],
-            ((mioVertex *)clippedFace.vertices)[j + 1],
-            ((mioVertex *)clippedFace.vertices)[j + 2], texture, tW, tH,
-            lightIntensityFace, ortho);
-      }
-    }
-  }
-  mio_set_colour(origCol);
+  mio_3d_draw_indexed(
+      cam, mesh, mio_3d_fetch_vertex, mesh->indices, mesh->indexCount,
+      modelWorldMatrix, modelViewMatrix, mio_vec3(1.0f, 1.0f, 1.0f), !ortho,
+      texture, tW, tH, ortho);
+}
+
+typedef struct {
+  uint32 *colour;
+  const real32 *depth;
+  int32 stride;
+  int32 width;
+} mioFogPass;
+
+MIO_GLOBAL void mio_3d_fog_span(uint32 *px, const real32 *depth, int32 n) {
+  int32 x, k;
+  int32 idx[4];
+  uint32 w[4];
+  const uint16 *lut = G_APP.render.fogLut;
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 two = _mm_set1_ps(2.0f);
+  __m128 scale = _mm_set1_ps(G_APP.render.fogLutScale);
+  __m128 maxIdx = _mm_set1_ps((real32)(MIO_FOG_LUT_SIZE - 1));
+  __m128i zero = _mm_setzero_si128();
+  __m128i fog = _mm_unpacklo_epi8(
+      _mm_set1_epi32((int32)G_APP.render.fogColour), zero);
+  __m128i c256 = _mm_set1_epi16(256);
+  __m128i lo, hi, wlo, whi;
+  __m128 d, inv, r;
+  int32 sky;
+  for (x = 0; x + 4 <= n; x += 4) {
+    d = _mm_loadu_ps(depth + x);
+    sky = _mm_movemask_ps(_mm_cmpge_ps(d, one));
+    if (sky == 0xF) { continue; }
+    inv = _mm_sub_ps(one, d);
+    r = _mm_rcp_ps(inv);
+    r = _mm_mul_ps(r, _mm_sub_ps(two, _mm_mul_ps(inv, r)));
+    r = _mm_min_ps(_mm_max_ps(_mm_mul_ps(r, scale), _mm_setzero_ps()), maxIdx);
+    _mm_storeu_si128((__m128i *)idx, _mm_cvttps_epi32(r));
+    for (k = 0; k < 4; k++) { w[k] = (sky >> k) & 1 ? 0 : lut[idx[k]]; }
+    if (!(w[0] | w[1] | w[2] | w[3])) { continue; }
+    wlo = _mm_set_epi16(
+        (short)w[1], (short)w[1], (short)w[1], (short)w[1], (short)w[0],
+        (short)w[0], (short)w[0], (short)w[0]);
+    whi = _mm_set_epi16(
+        (short)w[3], (short)w[3], (short)w[3], (short)w[3], (short)w[2],
+        (short)w[2], (short)w[2], (short)w[2]);
+    lo = _mm_loadu_si128((__m128i *)(px + x));
+    hi = _mm_unpackhi_epi8(lo, zero);
+    lo = _mm_unpacklo_epi8(lo, zero);
+    lo = _mm_srli_epi16(
+        _mm_add_epi16(
+            _mm_mullo_epi16(lo, _mm_sub_epi16(c256, wlo)),
+            _mm_mullo_epi16(fog, wlo)),
+        8);
+    hi = _mm_srli_epi16(
+        _mm_add_epi16(
+            _mm_mullo_epi16(hi, _mm_sub_epi16(c256, whi)),
+            _mm_mullo_epi16(fog, whi)),
+        8);
+    _mm_storeu_si128((__m128i *)(px + x), _mm_packus_epi16(lo, hi));
+  }
+  for (; x < n; x++) {
+    if (depth[x] < 1.0f) {
+      px[x] = mio_3d_fog_pixel(px[x], 1.0f / (1.0f - depth[x]));
+    }
+  }
+}
+
+void mio_3d_fog_rows(void *data, int32 y0, int32 y1) {
+  mioFogPass *fp = (mioFogPass *)data;
+  int32 y;
+  for (y = y0; y < y1; y++) {
+    mio_3d_fog_span(
+        fp->colour + y * fp->stride, fp->depth + y * fp->stride, fp->width);
+  }
+}
+
+void mio_3d_fog_apply(void) {
+  mioFogPass fp;
+  if (!G_APP.render.colourData || !G_APP.render.depthData) { return; }
+  fp.colour = G_APP.render.colourData;
+  fp.depth = G_APP.render.depthData;
+  fp.stride = G_APP.render.width;
+  fp.width = G_APP.render.width;
+  mio_3d_fog_rows(&fp, 0, G_APP.render.height);
 }
 
 int32 mio_3d_fog(real32 start, real32 end) {
-  int32 x, y;
-  real32 depth;
-  real32 distance;
-  real32 fog_factor;
-  real32 fog_r = (real32)MIO_COL_GET_R(G_APP.colour);
-  real32 fog_g = (real32)MIO_COL_GET_G(G_APP.colour);
-  real32 fog_b = (real32)MIO_COL_GET_B(G_APP.colour);
-  uint32 *pixels = G_APP.render.colourData;
-  real32 *depths = G_APP.render.depthData;
-  int32 width = G_APP.render.width;
-  int32 height = G_APP.render.height;
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      depth = depths[y * width + x];
-      if (depth == 1.0f) { continue; }
-      distance = 1.0f / (1.0f - depth);
-      if (distance > end) {
-        fog_factor = 1.0f;
-      } else if (distance < start) {
-        fog_factor = 0.0f;
-      } else {
-        fog_factor = (distance - start) / (end - start);
-      }
-      if (fog_factor > 0.0f) {
-        uint32 old_color = pixels[y * width + x];
-        real32 r = ((old_color >> 16) & 0xFF) / 255.0f;
-        real32 g = ((old_color >> 8) & 0xFF) / 255.0f;
-        real32 b = ((old_color >> 0) & 0xFF) / 255.0f;
-        real32 new_r = (1.0f - fog_factor) * r + fog_factor * (fog_r / 255.0f);
-        real32 new_g = (1.0f - fog_factor) * g + fog_factor * (fog_g / 255.0f);
-        real32 new_b = (1.0f - fog_factor) * b + fog_factor * (fog_b / 255.0f);
-        pixels[y * width + x] =
-            MIO_RGBA(new_r * 255.0f, new_g * 255.0f, new_b * 255.0f, 255);
-      }
-    }
+  mioRenderContext *ctx = &G_APP.render;
+  if (!ctx->fogCustom) { ctx->fogColour = G_APP.colour; }
+  if (ctx->fogLutScale <= 0.0f || ctx->fogStart != start ||
+      ctx->fogEnd != MIO_MAX(end, start + MIO_EPSILON)) {
+    mio_3d_fog_build(ctx->fogMode, start, end, ctx->fogDensity);
   }
+  mio_3d_fog_apply();
   return TRUE;
 }
 
@@ -6380,93 +9071,862 @@ int32 mio_3d_draw_vector(
   return TRUE;
 }
 
-/* @NOISE ********************************************************************/
+#define MIO_LOD_MAX 8
+#define MIO_LOD_SEAM_WEIGHT 10.0
+#define MIO_LOD_LINK_MAX 64
 
-MIO_GLOBAL int64 G_NOISE_PERM[512] = {
-    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,
-    225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190,
-    6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203, 117,
-    35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125, 136,
-    171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146, 158,
-    231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,  46,
-    245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,  209,
-    76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159, 86,
-    164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123, 5,
-    202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,  16,
-    58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,   44,
-    154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,  253,
-    19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246, 97,
-    228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,  51,
-    145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157, 184,
-    84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205, 93,
-    222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156,
-    180, 151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233,
-    7,   225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,
-    190, 6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203,
-    117, 35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125,
-    136, 171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146,
-    158, 231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,
-    46,  245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,
-    209, 76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159,
-    86,  164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123,
-    5,   202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,
-    16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,
-    44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,
-    253, 19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246,
-    97,  228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,
-    51,  145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157,
-    184, 84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205,
-    93,  222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,
-    156, 180};
+typedef struct {
+  mioMesh levels[MIO_LOD_MAX];
+  real32 errors[MIO_LOD_MAX];
+  int32 count;
+  mioVec3 center;
+  real32 radius;
+  real32 pixelError;
+} mioMeshLod;
 
-MIO_GLOBAL int64 G_NOISE_GRAD[12][3] = {
-    {1, 1, 0},  {-1, 1, 0},  {1, -1, 0}, {-1, -1, 0}, {1, 0, 1},  {-1, 0, 1},
-    {1, 0, -1}, {-1, 0, -1}, {0, 1, 1},  {0, -1, 1},  {0, 1, -1}, {0, -1, -1}};
+typedef struct {
+  real64 q[11];
+} mioQuadric;
 
-MIO_GLOBAL uint32 g_randCounter = 0;
+typedef struct {
+  int32 p0, p1;
+  int32 a0, a1;
+  int32 tri;
+} mioLodEdge;
 
-uint32 MIO_RAND16(uint32 range) {
-  uint32 ret = G_NOISE_PERM[g_randCounter % 512];
-  g_randCounter += G_NOISE_PERM[ret % 512];
-  ret += G_NOISE_PERM[g_randCounter % 512];
-  g_randCounter += G_NOISE_PERM[ret % 512];
-  ret = G_NOISE_PERM[g_randCounter % 512];
-  g_randCounter += G_NOISE_PERM[ret % 512];
-  ret += G_NOISE_PERM[g_randCounter % 512];
-  g_randCounter += G_NOISE_PERM[ret % 512];
-  return ret % range;
+typedef struct {
+  int32 from, to;
+  real64 cost;
+} mioLodCollapse;
+
+typedef struct {
+  int32 attrCount;
+  int32 posCount;
+  int32 triCount;
+  int32 *tris;
+  int32 *attrSrc;
+  int32 *posOf;
+  int32 *remap;
+  mioVec3 *pos;
+  mioQuadric *quadrics;
+  uint8 *locked;
+  uint8 *border;
+  uint8 *touched;
+  int32 *adjStart;
+  int32 *adjTris;
+  mioLodEdge *edges;
+  mioLodCollapse *collapses;
+} mioLodState;
+
+MIO_GLOBAL void
+mio_quadric_plane(mioQuadric *q, mioVec3 n, real64 d, real64 w) {
+  real64 a = n.x, b = n.y, c = n.z;
+  q->q[0] += w * a * a;
+  q->q[1] += w * a * b;
+  q->q[2] += w * a * c;
+  q->q[3] += w * a * d;
+  q->q[4] += w * b * b;
+  q->q[5] += w * b * c;
+  q->q[6] += w * b * d;
+  q->q[7] += w * c * c;
+  q->q[8] += w * c * d;
+  q->q[9] += w * d * d;
+}
+
+MIO_GLOBAL real64 mio_quadric_error(const mioQuadric *a, const mioQuadric *b,
+                                    mioVec3 v) {
+  real64 q[11];
+  real64 x = v.x, y = v.y, z = v.z, e;
+  int32 i;
+  for (i = 0; i < 11; i++) { q[i] = a->q[i] + b->q[i]; }
+  e = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z +
+      2.0 * q[3] * x + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+      q[7] * z * z + 2.0 * q[8] * z + q[9];
+  return q[10] > 0.0 ? MIO_MAX(e, 0.0) / q[10] : 0.0;
 }
 
-typedef real64 (*PFNOISEPROC2D)(real64 x, real64 y);
-typedef real64 (*PFNOISEPROC3D)(real64 x, real64 y, real64 z);
+MIO_GLOBAL uint32 mio_lod_hash(const real32 *v, int32 n) {
+  uint32 h = 2166136261u, bits;
+  int32 i;
+  real32 f;
+  for (i = 0; i < n; i++) {
+    f = v[i] == 0.0f ? 0.0f : v[i];
+    memcpy(&bits, &f, sizeof(bits));
+    h = (h ^ bits) * 16777619u;
+  }
+  return h;
+}
+
+MIO_GLOBAL int32 mio_lod_weld(
+    const real32 *keys, int32 stride, int32 n, int32 *ids, int32 *first) {
+  int32 size = 1, count = 0, i, slot;
+  int32 *table;
+  while (size < n * 2) { size <<= 1; }
+  table = (int32 *)sys_alloc(size * (int32)sizeof(int32));
+  if (!table) { return 0; }
+  for (i = 0; i < size; i++) { table[i] = -1; }
+  for (i = 0; i < n; i++) {
+    slot = (int32)(mio_lod_hash(keys + i * stride, stride) & (size - 1));
+    while (table[slot] >= 0 &&
+           memcmp(keys + table[slot] * stride, keys + i * stride,
+                  stride * sizeof(real32))) {
+      slot = (slot + 1) & (size - 1);
+    }
+    if (table[slot] < 0) {
+      table[slot] = i;
+      first[count] = i;
+      ids[i] = count++;
+    } else {
+      ids[i] = ids[table[slot]];
+    }
+  }
+  sys_free(table);
+  return count;
+}
 
-#define MIO_SQRT_3 1.732050807568877
-#define MIO_SIMPLEX_F2 (0.5 * (MIO_SQRT_3 - 1.0))
-#define MIO_SIMPLEX_G2 ((3.0 - MIO_SQRT_3) / 6.0)
-#define MIO_SIMPLEX_F3 (1.0 / 3.0)
-#define MIO_SIMPLEX_G3 (1.0 / 6.0)
-#define MIO_SIMPLEX_G2x2 (MIO_SIMPLEX_G2 * 2.0)
-#define MIO_SIMPLEX_G3x2 (MIO_SIMPLEX_G3 * 2.0)
-#define MIO_SIMPLEX_G3x3 (MIO_SIMPLEX_G3 * 3.0)
+MIO_GLOBAL int mio_lod_edge_compare(const void *a, const void *b) {
+  const mioLodEdge *ea = (const mioLodEdge *)a;
+  const mioLodEdge *eb = (const mioLodEdge *)b;
+  if (ea->p0 != eb->p0) { return ea->p0 < eb->p0 ? -1 : 1; }
+  if (ea->p1 != eb->p1) { return ea->p1 < eb->p1 ? -1 : 1; }
+  return 0;
+}
 
-real32 mio_noise_simplex_normalize(real64 n) {
-  return (real32)((n * (1.0f / 0.34543f)) * 0.5f + 0.5f);
+MIO_GLOBAL int mio_lod_collapse_compare(const void *a, const void *b) {
+  real64 ca = ((const mioLodCollapse *)a)->cost;
+  real64 cb = ((const mioLodCollapse *)b)->cost;
+  return ca < cb ? -1 : ca > cb ? 1 : 0;
 }
 
-real64 mio_noise_simplex_2d(real64 xin, real64 yin) {
-  real64 n0, n1, n2, x1, y1, x2, y2, t0, t1, t2;
-  int64 i1, j1, ii, jj, gi0, gi1, gi2;
-  real64 s = (xin + yin) * MIO_SIMPLEX_F2;
-  int64 i = MIO_FLOOR(xin + s);
-  int64 j = MIO_FLOOR(yin + s);
-  real64 t = (real64)(i + j) * MIO_SIMPLEX_G2;
-  real64 xd0 = (real64)i - t;
-  real64 yd0 = (real64)j - t;
-  real64 x0 = xin - xd0;
-  real64 y0 = yin - yd0;
-  if (x0 > y0) {
-    i1 = 1;
-    j1 = 0;
+MIO_GLOBAL int32 mio_lod_build_edges(mioLodState *st) {
+  int32 t, k, i, j, n = 0;
+  int32 *tri;
+  for (t = 0; t < st->triCount; t++) {
+    tri = st->tris + t * 3;
+    for (k = 0; k < 3; k++) {
+      int32 a0 = tri[k], a1 = tri[(k + 1) % 3];
+      int32 p0 = st->posOf[a0], p1 = st->posOf[a1];
+      mioLodEdge *e = &st->edges[n++];
+      e->p0 = MIO_MIN(p0, p1);
+      e->p1 = MIO_MAX(p0, p1);
+      e->a0 = p0 < p1 ? a0 : a1;
+      e->a1 = p0 < p1 ? a1 : a0;
+      e->tri = t;
+    }
+  }
+  qsort(st->edges, n, sizeof(mioLodEdge), mio_lod_edge_compare);
+  memset(st->border, 0, st->posCount);
+  for (i = 0; i < n; i = j) {
+    for (j = i + 1; j < n && !mio_lod_edge_compare(&st->edges[i], &st->edges[j]);
+         j++) {
+    }
+    if (j - i == 1) {
+      st->border[st->edges[i].p0] = 1;
+      st->border[st->edges[i].p1] = 1;
+    }
+  }
+  return n;
+}
+
+MIO_GLOBAL void mio_lod_build_adjacency(mioLodState *st) {
+  int32 t, k, p;
+  memset(st->adjStart, 0, (st->posCount + 1) * sizeof(int32));
+  for (t = 0; t < st->triCount * 3; t++) {
+    st->adjStart[st->posOf[st->tris[t]] + 1]++;
+  }
+  for (p = 0; p < st->posCount; p++) {
+    st->adjStart[p + 1] += st->adjStart[p];
+  }
+  for (t = 0; t < st->triCount; t++) {
+    for (k = 0; k < 3; k++) {
+      p = st->posOf[st->tris[t * 3 + k]];
+      st->adjTris[st->adjStart[p]++] = t;
+    }
+  }
+  for (p = st->posCount; p > 0; p--) { st->adjStart[p] = st->adjStart[p - 1]; }
+  st->adjStart[0] = 0;
+}
+
+MIO_GLOBAL int32 mio_lod_neighbours(mioLodState *st, int32 p, int32 *out) {
+  int32 i, k, n = 0, m, q;
+  int32 *tri;
+  for (i = st->adjStart[p]; i < st->adjStart[p + 1]; i++) {
+    tri = st->tris + st->adjTris[i] * 3;
+    for (k = 0; k < 3; k++) {
+      q = st->posOf[tri[k]];
+      if (q == p) { continue; }
+      for (m = 0; m < n && out[m] != q; m++) {
+      }
+      if (m == n && n < MIO_LOD_LINK_MAX) { out[n++] = q; }
+    }
+  }
+  return n;
+}
+
+MIO_GLOBAL int32 mio_lod_is_border_edge(mioLodState *st, int32 p, int32 q) {
+  int32 i, k, count = 0;
+  int32 *tri;
+  for (i = st->adjStart[p]; i < st->adjStart[p + 1]; i++) {
+    tri = st->tris + st->adjTris[i] * 3;
+    for (k = 0; k < 3; k++) {
+      if (st->posOf[tri[k]] == q) { count++; }
+    }
+  }
+  return count == 1;
+}
+
+MIO_GLOBAL int32
+mio_lod_try_collapse(mioLodState *st, int32 p, int32 q, int32 *removed) {
+  int32 i, k, m, pairs = 0, shared = 0, nP, nQ;
+  int32 fromAttr[16], toAttr[16];
+  int32 linkP[MIO_LOD_LINK_MAX], linkQ[MIO_LOD_LINK_MAX];
+  int32 *tri;
+  int32 hasQ, corner, attrP;
+  mioVec3 v[3], n0, n1;
+  *removed = 0;
+  for (i = st->adjStart[p]; i < st->adjStart[p + 1]; i++) {
+    tri = st->tris + st->adjTris[i] * 3;
+    hasQ = -1;
+    corner = -1;
+    for (k = 0; k < 3; k++) {
+      if (st->posOf[tri[k]] == q) { hasQ = k; }
+      if (st->posOf[tri[k]] == p) { corner = k; }
+    }
+    if (hasQ < 0) { continue; }
+    for (m = 0; m < pairs && fromAttr[m] != tri[corner]; m++) {
+    }
+    if (m == pairs && pairs < 16) {
+      fromAttr[pairs] = tri[corner];
+      toAttr[pairs++] = tri[hasQ];
+    }
+    (*removed)++;
+  }
+  if (!*removed) { return FALSE; }
+  for (i = st->adjStart[p]; i < st->adjStart[p + 1]; i++) {
+    tri = st->tris + st->adjTris[i] * 3;
+    hasQ = 0;
+    corner = 0;
+    for (k = 0; k < 3; k++) {
+      if (st->posOf[tri[k]] == q) { hasQ = 1; }
+      if (st->posOf[tri[k]] == p) { corner = k; }
+    }
+    attrP = tri[corner];
+    for (m = 0; m < pairs && fromAttr[m] != attrP; m++) {
+    }
+    if (m == pairs) { return FALSE; }
+    if (hasQ) { continue; }
+    for (k = 0; k < 3; k++) { v[k] = st->pos[st->posOf[tri[k]]]; }
+    n0 = mio_vec3_cross(mio_vec3_sub(v[1], v[0]), mio_vec3_sub(v[2], v[0]));
+    v[corner] = st->pos[q];
+    n1 = mio_vec3_cross(mio_vec3_sub(v[1], v[0]), mio_vec3_sub(v[2], v[0]));
+    if (mio_vec3_dot(n0, n1) <=
+        0.25f * mio_vec3_length(n0) * mio_vec3_length(n1)) {
+      return FALSE;
+    }
+  }
+  nP = mio_lod_neighbours(st, p, linkP);
+  nQ = mio_lod_neighbours(st, q, linkQ);
+  for (i = 0; i < nP; i++) {
+    for (k = 0; k < nQ; k++) {
+      if (linkP[i] == linkQ[k]) { shared++; }
+    }
+  }
+  if (shared > *removed) { return FALSE; }
+  for (m = 0; m < pairs; m++) { st->remap[fromAttr[m]] = toAttr[m]; }
+  for (k = 0; k < 11; k++) { st->quadrics[q].q[k] += st->quadrics[p].q[k]; }
+  st->touched[p] = 1;
+  st->touched[q] = 1;
+  for (i = 0; i < nP; i++) { st->touched[linkP[i]] = 1; }
+  return TRUE;
+}
+
+MIO_GLOBAL void mio_lod_seam_plane(mioLodState *st, const mioLodEdge *e) {
+  int32 *tri = st->tris + e->tri * 3;
+  mioVec3 a = st->pos[e->p0];
+  mioVec3 dir = mio_vec3_sub(st->pos[e->p1], a);
+  mioVec3 fn = mio_vec3_cross(
+      mio_vec3_sub(st->pos[st->posOf[tri[1]]], st->pos[st->posOf[tri[0]]]),
+      mio_vec3_sub(st->pos[st->posOf[tri[2]]], st->pos[st->posOf[tri[0]]]));
+  mioVec3 pn = mio_vec3_cross(dir, fn);
+  real32 len = mio_vec3_length(pn);
+  real64 w = MIO_LOD_SEAM_WEIGHT * 0.5 * mio_vec3_length(fn);
+  if (len <= MIO_EPSILON) { return; }
+  pn = mio_vec3_scale(pn, 1.0f / len);
+  mio_quadric_plane(&st->quadrics[e->p0], pn, -mio_vec3_dot(pn, a), w);
+  mio_quadric_plane(&st->quadrics[e->p1], pn, -mio_vec3_dot(pn, a), w);
+}
+
+MIO_GLOBAL void mio_lod_state_free(mioLodState *st) {
+  sys_free(st->tris);
+  sys_free(st->attrSrc);
+  sys_free(st->posOf);
+  sys_free(st->remap);
+  sys_free(st->pos);
+  sys_free(st->quadrics);
+  sys_free(st->locked);
+  sys_free(st->border);
+  sys_free(st->touched);
+  sys_free(st->adjStart);
+  sys_free(st->adjTris);
+  sys_free(st->edges);
+  sys_free(st->collapses);
+}
+
+MIO_GLOBAL int32 mio_lod_state_init(mioLodState *st, const mioMesh *mesh) {
+  int32 n = mesh->indexCount, i, j, k, t, count;
+  int32 *vertAttr = NULL, *attrPos = NULL, *first = NULL;
+  real32 *keys = NULL;
+  mioVertex *vx;
+  mioVec3 a, b, c, nrm;
+  real32 len;
+  memset(st, 0, sizeof(*st));
+  st->tris = (int32 *)sys_alloc(n * (int32)sizeof(int32));
+  vertAttr = (int32 *)sys_alloc(n * (int32)sizeof(int32));
+  first = (int32 *)sys_alloc(n * (int32)sizeof(int32));
+  keys = (real32 *)sys_alloc(n * 8 * (int32)sizeof(real32));
+  if (!st->tris || !vertAttr || !first || !keys) { goto fail; }
+  for (i = 0; i < n; i++) {
+    vx = &mesh->vertices[mesh->indices[i]];
+    keys[i * 8 + 0] = vx->pos.x;
+    keys[i * 8 + 1] = vx->pos.y;
+    keys[i * 8 + 2] = vx->pos.z;
+    keys[i * 8 + 3] = vx->uv.x;
+    keys[i * 8 + 4] = vx->uv.y;
+    keys[i * 8 + 5] = vx->normal.x;
+    keys[i * 8 + 6] = vx->normal.y;
+    keys[i * 8 + 7] = vx->normal.z;
+  }
+  st->attrCount = mio_lod_weld(keys, 8, n, vertAttr, first);
+  count = st->attrCount;
+  st->attrSrc = (int32 *)sys_alloc(count * (int32)sizeof(int32));
+  st->posOf = (int32 *)sys_alloc(count * (int32)sizeof(int32));
+  st->remap = (int32 *)sys_alloc(count * (int32)sizeof(int32));
+  attrPos = (int32 *)sys_alloc(count * (int32)sizeof(int32));
+  if (!count || !st->attrSrc || !st->posOf || !st->remap || !attrPos) {
+    goto fail;
+  }
+  for (i = 0; i < count; i++) {
+    st->attrSrc[i] = mesh->indices[first[i]];
+    for (k = 0; k < 3; k++) { keys[i * 3 + k] = keys[first[i] * 8 + k]; }
+  }
+  st->posCount = mio_lod_weld(keys, 3, count, st->posOf, attrPos);
+  st->pos = (mioVec3 *)sys_alloc(st->posCount * (int32)sizeof(mioVec3));
+  st->quadrics =
+      (mioQuadric *)sys_alloc(st->posCount * (int32)sizeof(mioQuadric));
+  st->locked = (uint8 *)sys_alloc(st->posCount);
+  st->border = (uint8 *)sys_alloc(st->posCount);
+  st->touched = (uint8 *)sys_alloc(st->posCount);
+  st->adjStart = (int32 *)sys_alloc((st->posCount + 1) * (int32)sizeof(int32));
+  st->adjTris = (int32 *)sys_alloc(n * (int32)sizeof(int32));
+  st->edges = (mioLodEdge *)sys_alloc(n * (int32)sizeof(mioLodEdge));
+  st->collapses =
+      (mioLodCollapse *)sys_alloc(n * (int32)sizeof(mioLodCollapse));
+  if (!st->pos || !st->quadrics || !st->locked || !st->border ||
+      !st->touched || !st->adjStart || !st->adjTris || !st->edges ||
+      !st->collapses) {
+    goto fail;
+  }
+  memset(st->quadrics, 0, st->posCount * sizeof(mioQuadric));
+  memset(st->locked, 0, st->posCount);
+  for (i = 0; i < st->posCount; i++) {
+    st->pos[i] = mio_vec3(
+        keys[attrPos[i] * 3 + 0], keys[attrPos[i] * 3 + 1],
+        keys[attrPos[i] * 3 + 2]);
+  }
+  for (t = 0; t < n / 3; t++) {
+    int32 *tri = st->tris + st->triCount * 3;
+    for (k = 0; k < 3; k++) { tri[k] = vertAttr[t * 3 + k]; }
+    if (st->posOf[tri[0]] == st->posOf[tri[1]] ||
+        st->posOf[tri[1]] == st->posOf[tri[2]] ||
+        st->posOf[tri[0]] == st->posOf[tri[2]]) {
+      continue;
+    }
+    a = st->pos[st->posOf[tri[0]]];
+    b = st->pos[st->posOf[tri[1]]];
+    c = st->pos[st->posOf[tri[2]]];
+    nrm = mio_vec3_cross(mio_vec3_sub(b, a), mio_vec3_sub(c, a));
+    len = mio_vec3_length(nrm);
+    if (len > MIO_EPSILON) {
+      nrm = mio_vec3_scale(nrm, 1.0f / len);
+      for (k = 0; k < 3; k++) {
+        mio_quadric_plane(
+            &st->quadrics[st->posOf[tri[k]]], nrm, -mio_vec3_dot(nrm, a),
+            0.5 * len);
+        st->quadrics[st->posOf[tri[k]]].q[10] += 0.5 * len;
+      }
+    }
+    st->triCount++;
+  }
+  count = mio_lod_build_edges(st);
+  for (i = 0; i < count; i = j) {
+    mioLodEdge *e = &st->edges[i];
+    for (j = i + 1; j < count && !mio_lod_edge_compare(e, &st->edges[j]); j++) {
+    }
+    if (j - i > 2) {
+      st->locked[e->p0] = 1;
+      st->locked[e->p1] = 1;
+    } else if (
+        j - i == 1 || e->a0 != st->edges[i + 1].a0 ||
+        e->a1 != st->edges[i + 1].a1) {
+      for (k = i; k < j; k++) { mio_lod_seam_plane(st, &st->edges[k]); }
+    }
+  }
+  sys_free(vertAttr);
+  sys_free(first);
+  sys_free(keys);
+  sys_free(attrPos);
+  return TRUE;
+fail:
+  sys_free(vertAttr);
+  sys_free(first);
+  sys_free(keys);
+  sys_free(attrPos);
+  mio_lod_state_free(st);
+  return FALSE;
+}
+
+mioMesh mio_3d_simplify(
+    const mioMesh *mesh, int32 targetTris, real32 maxError,
+    real32 *resultError) {
+  mioLodState st;
+  mioMesh out;
+  int32 edgeCount, collapseCount, i, k, p, q, removed, done, t, kept;
+  int32 *tri;
+  real64 costPQ, costQP, limit = (real64)maxError * (real64)maxError;
+  real64 worst = 0.0;
+  mioLodCollapse *c;
+  memset(&out, 0, sizeof(out));
+  if (resultError) { *resultError = 0.0f; }
+  if (!mesh || !mesh->vertices || !mesh->indices || mesh->indexCount < 3 ||
+      !mio_lod_state_init(&st, mesh)) {
+    return out;
+  }
+  targetTris = MIO_MAX(targetTris, 1);
+  while (st.triCount > targetTris) {
+    mio_lod_build_adjacency(&st);
+    edgeCount = mio_lod_build_edges(&st);
+    collapseCount = 0;
+    for (i = 0; i < edgeCount; i++) {
+      mioLodEdge *e = &st.edges[i];
+      if (i > 0 && !mio_lod_edge_compare(e, &st.edges[i - 1])) { continue; }
+      p = e->p0;
+      q = e->p1;
+      costPQ = mio_quadric_error(&st.quadrics[p], &st.quadrics[q], st.pos[q]);
+      costQP = mio_quadric_error(&st.quadrics[p], &st.quadrics[q], st.pos[p]);
+      if (st.locked[p] || (st.border[p] && !st.border[q])) {
+        costPQ = DBL_MAX;
+      }
+      if (st.locked[q] || (st.border[q] && !st.border[p])) {
+        costQP = DBL_MAX;
+      }
+      c = &st.collapses[collapseCount];
+      c->from = costPQ <= costQP ? p : q;
+      c->to = costPQ <= costQP ? q : p;
+      c->cost = MIO_MIN(costPQ, costQP);
+      if (c->cost <= limit) { collapseCount++; }
+    }
+    if (!collapseCount) { break; }
+    qsort(st.collapses, collapseCount, sizeof(mioLodCollapse),
+          mio_lod_collapse_compare);
+    memset(st.touched, 0, st.posCount);
+    for (i = 0; i < st.attrCount; i++) { st.remap[i] = i; }
+    done = 0;
+    removed = 0;
+    for (i = 0; i < collapseCount && st.triCount - removed > targetTris; i++) {
+      c = &st.collapses[i];
+      if (st.touched[c->from] || st.touched[c->to]) { continue; }
+      if (st.border[c->from] && !mio_lod_is_border_edge(&st, c->from, c->to)) {
+        continue;
+      }
+      if (mio_lod_try_collapse(&st, c->from, c->to, &k)) {
+        removed += k;
+        worst = MIO_MAX(worst, c->cost);
+        done++;
+      }
+    }
+    if (!done) { break; }
+    kept = 0;
+    for (t = 0; t < st.triCount; t++) {
+      tri = st.tris + t * 3;
+      for (k = 0; k < 3; k++) { tri[k] = st.remap[tri[k]]; }
+      if (st.posOf[tri[0]] == st.posOf[tri[1]] ||
+          st.posOf[tri[1]] == st.posOf[tri[2]] ||
+          st.posOf[tri[0]] == st.posOf[tri[2]]) {
+        continue;
+      }
+      memmove(st.tris + kept * 3, tri, 3 * sizeof(int32));
+      kept++;
+    }
+    st.triCount = kept;
+  }
+  for (i = 0; i < st.attrCount; i++) { st.remap[i] = -1; }
+  out.indices = (int32 *)sys_alloc(st.triCount * 3 * (int32)sizeof(int32));
+  out.vertices = (mioVertex *)sys_alloc(
+      MIO_MIN(st.attrCount, st.triCount * 3) * (int32)sizeof(mioVertex));
+  if (!out.indices || !out.vertices) {
+    sys_free(out.indices);
+    sys_free(out.vertices);
+    memset(&out, 0, sizeof(out));
+    mio_lod_state_free(&st);
+    return out;
+  }
+  for (i = 0; i < st.triCount * 3; i++) {
+    int32 a = st.tris[i];
+    if (st.remap[a] < 0) {
+      st.remap[a] = out.vertexCount;
+      out.vertices[out.vertexCount++] = mesh->vertices[st.attrSrc[a]];
+    }
+    out.indices[out.indexCount++] = st.remap[a];
+  }
+  mio_3d_get_bounds(&out, &out.boundsMin, &out.boundsMax);
+  if (resultError) { *resultError = (real32)sqrt(worst); }
+  mio_lod_state_free(&st);
+  return out;
+}
+
+void mio_3d_mesh_free(mioMesh *mesh) {
+  if (!mesh) { return; }
+  sys_free(mesh->vertices);
+  sys_free(mesh->indices);
+  memset(mesh, 0, sizeof(*mesh));
+}
+
+int32 mio_3d_lod_build(
+    mioMeshLod *lod, mioMesh *mesh, int32 levels, real32 ratio,
+    int32 minTris) {
+  int32 tris, target;
+  real32 err;
+  mioVec3 ext;
+  mioMesh next;
+  memset(lod, 0, sizeof(*lod));
+  if (!mesh || !mesh->indexCount) { return FALSE; }
+  levels = MIO_CLAMP(levels, 1, MIO_LOD_MAX);
+  ratio = MIO_CLAMP(ratio, 0.05f, 0.95f);
+  mio_3d_get_bounds(mesh, &mesh->boundsMin, &mesh->boundsMax);
+  ext = mio_vec3_sub(mesh->boundsMax, mesh->boundsMin);
+  lod->center =
+      mio_vec3_scale(mio_vec3_add(mesh->boundsMin, mesh->boundsMax), 0.5f);
+  lod->radius = 0.5f * mio_vec3_length(ext);
+  lod->pixelError = 1.0f;
+  lod->levels[0] = *mesh;
+  lod->errors[0] = 0.0f;
+  lod->count = 1;
+  tris = mesh->indexCount / 3;
+  while (lod->count < levels && tris > minTris) {
+    target = MIO_MAX((int32)(tris * ratio), minTris);
+    next = mio_3d_simplify(mesh, target, FLT_MAX, &err);
+    if (!next.indexCount || next.indexCount / 3 > tris * 9 / 10) {
+      mio_3d_mesh_free(&next);
+      break;
+    }
+    tris = next.indexCount / 3;
+    lod->levels[lod->count] = next;
+    lod->errors[lod->count] = MIO_MAX(err, lod->errors[lod->count - 1]);
+    lod->count++;
+  }
+  sys_log("Built %d LOD levels (%d -> %d tris).\n", lod->count,
+          mesh->indexCount / 3, tris);
+  return TRUE;
+}
+
+void mio_3d_lod_free(mioMeshLod *lod) {
+  int32 i;
+  for (i = 1; i < lod->count; i++) { mio_3d_mesh_free(&lod->levels[i]); }
+  memset(lod, 0, sizeof(*lod));
+}
+
+int32 mio_3d_lod_select(mioCamera *cam, mioMeshLod *lod, mioMat4 model) {
+  int32 i;
+  real32 scale, dist, pixelsPerUnit;
+  mioVec4 c;
+  mioVec3 center;
+  if (lod->count <= 1) { return 0; }
+  scale = MIO_MAX(
+      mio_vec3_length(mio_vec3(model.m[0], model.m[1], model.m[2])),
+      MIO_MAX(
+          mio_vec3_length(mio_vec3(model.m[4], model.m[5], model.m[6])),
+          mio_vec3_length(mio_vec3(model.m[8], model.m[9], model.m[10]))));
+  c = mio_mat4_mul_vec4(
+      model, mio_vec4(lod->center.x, lod->center.y, lod->center.z, 1.0f));
+  center = mio_vec3(c.x, c.y, c.z);
+  dist = mio_vec3_distance(cam->pos, center) - lod->radius * scale;
+  if (dist <= cam->nearPlane) { return 0; }
+  pixelsPerUnit = cam->projection.m[5] * cam->height * 0.5f / dist;
+  for (i = lod->count - 1; i > 0; i--) {
+    if (lod->errors[i] * scale * pixelsPerUnit <= lod->pixelError) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+void mio_3d_draw_mesh_lod(
+    mioCamera *cam, mioMeshLod *lod, mioMat4 model, uint32 *texture,
+    uint32 tW, uint32 tH, uint32 ortho) {
+  int32 level = ortho ? 0 : mio_3d_lod_select(cam, lod, model);
+  if (!lod->count) { return; }
+  mio_3d_draw_mesh(
+      cam, &lod->levels[level], model, texture, tW, tH, ortho);
+}
+
+uint32 mio_oct_encode(mioVec3 n) {
+  real32 l1 = MIO_ABS(n.x) + MIO_ABS(n.y) + MIO_ABS(n.z);
+  real32 x, y, t;
+  int32 qx, qy;
+  if (l1 <= MIO_EPSILON) { return 0; }
+  x = n.x / l1;
+  y = n.y / l1;
+  if (n.z < 0.0f) {
+    t = x;
+    x = (1.0f - MIO_ABS(y)) * (t >= 0.0f ? 1.0f : -1.0f);
+    y = (1.0f - MIO_ABS(t)) * (y >= 0.0f ? 1.0f : -1.0f);
+  }
+  x = MIO_CLAMP(x, -1.0f, 1.0f) * 32767.0f;
+  y = MIO_CLAMP(y, -1.0f, 1.0f) * 32767.0f;
+  qx = (int32)(x + (x >= 0.0f ? 0.5f : -0.5f));
+  qy = (int32)(y + (y >= 0.0f ? 0.5f : -0.5f));
+  return ((uint32)qx & 0xFFFF) | (((uint32)qy & 0xFFFF) << 16);
+}
+
+mioVec3 mio_oct_decode(uint32 oct) {
+  real32 x = (real32)(int16)(oct & 0xFFFF) * (1.0f / 32767.0f);
+  real32 y = (real32)(int16)(oct >> 16) * (1.0f / 32767.0f);
+  real32 z = 1.0f - MIO_ABS(x) - MIO_ABS(y);
+  real32 t = MIO_MAX(-z, 0.0f);
+  x += x >= 0.0f ? -t : t;
+  y += y >= 0.0f ? -t : t;
+  return mio_vec3_normalize(mio_vec3(x, y, z));
+}
+
+MIO_GLOBAL uint16 mio_quantize16(real32 v, real32 min, real32 range) {
+  real32 f = range > 0.0f ? (v - min) / range : 0.0f;
+  return (uint16)(MIO_CLAMP(f, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+mioPackedMesh mio_3d_mesh_pack(mioMesh *mesh) {
+  mioPackedMesh out;
+  mioPackedVertex *packed = NULL;
+  mioVertex *v;
+  real32 *keys = NULL;
+  int32 *ids = NULL, *first = NULL;
+  int32 i, n, count;
+  mioVec3 ext;
+  mioVec2 uvExt;
+  memset(&out, 0, sizeof(out));
+  if (!mesh || !mesh->vertices || !mesh->indices || !mesh->indexCount) {
+    return out;
+  }
+  n = mesh->vertexCount;
+  mio_3d_get_bounds(mesh, &mesh->boundsMin, &mesh->boundsMax);
+  out.boundsMin = mesh->boundsMin;
+  out.boundsMax = mesh->boundsMax;
+  out.uvMin = mio_vec2(MIO_REAL32_MAX, MIO_REAL32_MAX);
+  out.uvMax = mio_vec2(-MIO_REAL32_MAX, -MIO_REAL32_MAX);
+  for (i = 0; i < n; i++) {
+    out.uvMin.x = MIO_MIN(out.uvMin.x, mesh->vertices[i].uv.x);
+    out.uvMin.y = MIO_MIN(out.uvMin.y, mesh->vertices[i].uv.y);
+    out.uvMax.x = MIO_MAX(out.uvMax.x, mesh->vertices[i].uv.x);
+    out.uvMax.y = MIO_MAX(out.uvMax.y, mesh->vertices[i].uv.y);
+  }
+  ext = mio_vec3_sub(out.boundsMax, out.boundsMin);
+  uvExt = mio_vec2(out.uvMax.x - out.uvMin.x, out.uvMax.y - out.uvMin.y);
+  packed = (mioPackedVertex *)sys_alloc(n * (int32)sizeof(mioPackedVertex));
+  keys = (real32 *)sys_alloc(n * 7 * (int32)sizeof(real32));
+  ids = (int32 *)sys_alloc(n * (int32)sizeof(int32));
+  first = (int32 *)sys_alloc(n * (int32)sizeof(int32));
+  out.indices = (int32 *)sys_alloc(mesh->indexCount * (int32)sizeof(int32));
+  if (!packed || !keys || !ids || !first || !out.indices) { goto done; }
+  for (i = 0; i < n; i++) {
+    v = &mesh->vertices[i];
+    packed[i].pos[0] = mio_quantize16(v->pos.x, out.boundsMin.x, ext.x);
+    packed[i].pos[1] = mio_quantize16(v->pos.y, out.boundsMin.y, ext.y);
+    packed[i].pos[2] = mio_quantize16(v->pos.z, out.boundsMin.z, ext.z);
+    packed[i].pad = 0;
+    packed[i].normal = mio_oct_encode(v->normal);
+    packed[i].uv[0] = mio_quantize16(v->uv.x, out.uvMin.x, uvExt.x);
+    packed[i].uv[1] = mio_quantize16(v->uv.y, out.uvMin.y, uvExt.y);
+    keys[i * 7 + 0] = packed[i].pos[0];
+    keys[i * 7 + 1] = packed[i].pos[1];
+    keys[i * 7 + 2] = packed[i].pos[2];
+    keys[i * 7 + 3] = (real32)(packed[i].normal & 0xFFFF);
+    keys[i * 7 + 4] = (real32)(packed[i].normal >> 16);
+    keys[i * 7 + 5] = packed[i].uv[0];
+    keys[i * 7 + 6] = packed[i].uv[1];
+  }
+  count = mio_lod_weld(keys, 7, n, ids, first);
+  out.vertices =
+      (mioPackedVertex *)sys_alloc(count * (int32)sizeof(mioPackedVertex));
+  if (!count || !out.vertices) { goto done; }
+  for (i = 0; i < count; i++) { out.vertices[i] = packed[first[i]]; }
+  for (i = 0; i < mesh->indexCount; i++) {
+    out.indices[i] = ids[mesh->indices[i]];
+  }
+  out.vertexCount = count;
+  out.indexCount = mesh->indexCount;
+done:
+  if (!out.vertexCount) {
+    sys_free(out.indices);
+    sys_free(out.vertices);
+    out.indices = NULL;
+    out.vertices = NULL;
+  }
+  sys_free(packed);
+  sys_free(keys);
+  sys_free(ids);
+  sys_free(first);
+  return out;
+}
+
+void mio_3d_packed_mesh_free(mioPackedMesh *mesh) {
+  if (!mesh) { return; }
+  sys_free(mesh->vertices);
+  sys_free(mesh->indices);
+  memset(mesh, 0, sizeof(*mesh));
+}
+
+mioVertex mio_3d_unpack_vertex(const mioPackedMesh *mesh, int32 index) {
+  const mioPackedVertex *p = &mesh->vertices[index];
+  mioVec3 step = mio_vec3_scale(
+      mio_vec3_sub(mesh->boundsMax, mesh->boundsMin), 1.0f / 65535.0f);
+  mioVertex v;
+  v.pos = mio_vec4(
+      mesh->boundsMin.x + p->pos[0] * step.x,
+      mesh->boundsMin.y + p->pos[1] * step.y,
+      mesh->boundsMin.z + p->pos[2] * step.z, 1.0f);
+  v.normal = mio_oct_decode(p->normal);
+  v.uv = mio_vec2(
+      mesh->uvMin.x + p->uv[0] * (mesh->uvMax.x - mesh->uvMin.x) / 65535.0f,
+      mesh->uvMin.y + p->uv[1] * (mesh->uvMax.y - mesh->uvMin.y) / 65535.0f);
+  return v;
+}
+
+MIO_GLOBAL mioVertex mio_3d_fetch_packed(const void *mesh, int32 index) {
+  const mioPackedMesh *pm = (const mioPackedMesh *)mesh;
+  const mioPackedVertex *p = &pm->vertices[index];
+  mioVertex v;
+  v.pos = mio_vec4(p->pos[0], p->pos[1], p->pos[2], 1.0f);
+  v.uv = mio_vec2(
+      pm->uvMin.x + p->uv[0] * ((pm->uvMax.x - pm->uvMin.x) / 65535.0f),
+      pm->uvMin.y + p->uv[1] * ((pm->uvMax.y - pm->uvMin.y) / 65535.0f));
+  v.normal = mio_vec3(0.0f, 0.0f, 0.0f);
+  return v;
+}
+
+void mio_3d_draw_mesh_packed(
+    mioCamera *cam, mioPackedMesh *mesh, mioMat4 modelWorldMatrix,
+    uint32 *texture, uint32 tW, uint32 tH, uint32 ortho) {
+  mioMat4 viewMatrix = mio_3d_view_matrix(cam);
+  mioMat4 decodeMatrix, modelViewMatrix;
+  mioMesh bounds;
+  mioVec3 step = mio_vec3_scale(
+      mio_vec3_sub(mesh->boundsMax, mesh->boundsMin), 1.0f / 65535.0f);
+  decodeMatrix = mio_mat4_mul(
+      mio_mat4_translate(mesh->boundsMin), mio_mat4_scale(step));
+  modelViewMatrix =
+      mio_mat4_mul(viewMatrix, mio_mat4_mul(modelWorldMatrix, decodeMatrix));
+  memset(&bounds, 0, sizeof(bounds));
+  bounds.boundsMin = mesh->boundsMin;
+  bounds.boundsMax = mesh->boundsMax;
+  if (mio_3d_cull_object(
+          &bounds,
+          mio_mat4_mul(
+              mio_mat4_mul(cam->projection, viewMatrix), modelWorldMatrix),
+          modelWorldMatrix)) {
+    return;
+  }
+  mio_3d_draw_indexed(
+      cam, mesh, mio_3d_fetch_packed, mesh->indices, mesh->indexCount,
+      modelWorldMatrix, modelViewMatrix, step,
+      G_APP.render.flags3D & MIO_3D_CULL_BEHIND, texture, tW, tH, ortho);
+}
+
+/* @NOISE ********************************************************************/
+
+MIO_GLOBAL int64 G_NOISE_PERM[512] = {
+    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,
+    225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190,
+    6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203, 117,
+    35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125, 136,
+    171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146, 158,
+    231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,  46,
+    245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,  209,
+    76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159, 86,
+    164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123, 5,
+    202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,  16,
+    58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,   44,
+    154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,  253,
+    19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246, 97,
+    228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,  51,
+    145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157, 184,
+    84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205, 93,
+    222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156,
+    180, 151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233,
+    7,   225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,
+    190, 6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203,
+    117, 35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125,
+    136, 171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146,
+    158, 231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,
+    46,  245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,
+    209, 76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159,
+    86,  164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123,
+    5,   202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,
+    16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,
+    44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,
+    253, 19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246,
+    97,  228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,
+    51,  145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157,
+    184, 84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205,
+    93,  222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,
+    156, 180};
+
+MIO_GLOBAL int64 G_NOISE_GRAD[12][3] = {
+    {1, 1, 0},  {-1, 1, 0},  {1, -1, 0}, {-1, -1, 0}, {1, 0, 1},  {-1, 0, 1},
+    {1, 0, -1}, {-1, 0, -1}, {0, 1, 1},  {0, -1, 1},  {0, 1, -1}, {0, -1, -1}};
+
+MIO_GLOBAL uint32 g_randCounter = 0;
+
+uint32 MIO_RAND16(uint32 range) {
+  uint32 ret = G_NOISE_PERM[g_randCounter % 512];
+  g_randCounter += G_NOISE_PERM[ret % 512];
+  ret += G_NOISE_PERM[g_randCounter % 512];
+  g_randCounter += G_NOISE_PERM[ret % 512];
+  ret = G_NOISE_PERM[g_randCounter % 512];
+  g_randCounter += G_NOISE_PERM[ret % 512];
+  ret += G_NOISE_PERM[g_randCounter % 512];
+  g_randCounter += G_NOISE_PERM[ret % 512];
+  return ret % range;
+}
+
+typedef real64 (*PFNOISEPROC2D)(real64 x, real64 y);
+typedef real64 (*PFNOISEPROC3D)(real64 x, real64 y, real64 z);
+
+#define MIO_SQRT_3 1.732050807568877
+#define MIO_SIMPLEX_F2 (0.5 * (MIO_SQRT_3 - 1.0))
+#define MIO_SIMPLEX_G2 ((3.0 - MIO_SQRT_3) / 6.0)
+#define MIO_SIMPLEX_F3 (1.0 / 3.0)
+#define MIO_SIMPLEX_G3 (1.0 / 6.0)
+#define MIO_SIMPLEX_G2x2 (MIO_SIMPLEX_G2 * 2.0)
+#define MIO_SIMPLEX_G3x2 (MIO_SIMPLEX_G3 * 2.0)
+#define MIO_SIMPLEX_G3x3 (MIO_SIMPLEX_G3 * 3.0)
+
+real32 mio_noise_simplex_normalize(real64 n) {
+  return (real32)((n * (1.0f / 0.34543f)) * 0.5f + 0.5f);
+}
+
+real64 mio_noise_simplex_2d(real64 xin, real64 yin) {
+  real64 n0, n1, n2, x1, y1, x2, y2, t0, t1, t2;
+  int64 i1, j1, ii, jj, gi0, gi1, gi2;
+  real64 s = (xin + yin) * MIO_SIMPLEX_F2;
+  int64 i = MIO_FLOOR(xin + s);
+  int64 j = MIO_FLOOR(yin + s);
+  real64 t = (real64)(i + j) * MIO_SIMPLEX_G2;
+  real64 xd0 = (real64)i - t;
+  real64 yd0 = (real64)j - t;
+  real64 x0 = xin - xd0;
+  real64 y0 = yin - yd0;
+  if (x0 > y0) {
+    i1 = 1;
+    j1 = 0;
   } else {
     i1 = 0;
     j1 = 1;
@@ -6709,66 +10169,1371 @@ real32 mio_noise_domain_warp_3d(
 
 /* @PHYSICS ******************************************************************/
 
-/* @EXTRA ********************************************************************/
+#define MIO_BODY_SPHERE 0
+#define MIO_BODY_BOX 1
+#define MIO_PHYSICS_ITERATIONS 8
+#define MIO_PHYSICS_SLOP 0.01f
+#define MIO_PHYSICS_MARGIN 0.02f
+#define MIO_PHYSICS_BIAS 0.2f
+#define MIO_PHYSICS_BOUNCE 1.0f
+#define MIO_PHYSICS_TABLE_MIN 1024
 
-MIO_GLOBAL mioVec3 G_3D_START_HIT;
+typedef struct {
+  int32 a, b;
+  real32 nx, ny, nz;
+  real32 ux, uy, uz;
+  real32 depth;
+  real32 bias;
+  real32 mass;
+  real32 friction;
+  real32 jn, ju, jv;
+} mioContact;
 
-int32 mio_draw_heightmap(
-    int32 ix, int32 iy, int32 width, int32 height, real32 *values) {
-  int32 x, y;
-  int32 index;
-  real32 val;
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      index = (x) + (height - y) * width;
-      val = values[index] * 0.5f + 0.5f;
-      mio_set_colour(MIO_RGBA(val * 255, val * 255, val * 255, 255));
-      if (x + ix < G_APP.render.width && x + ix >= 0 &&
-          y + iy < G_APP.render.height && y + iy >= 0) {
-        MIO_DRAW_PIXEL(x + ix, y + iy);
-      }
+typedef struct {
+  real32 x, y, z;
+  real32 extent;
+  int32 cx, cy, cz;
+  int32 body;
+} mioBodyProxy;
+
+typedef struct {
+  real32 *px, *py, *pz;
+  real32 *vx, *vy, *vz;
+  real32 *hx, *hy, *hz;
+  real32 *invMass;
+  real32 *restitution;
+  real32 *friction;
+  int32 *shape;
+  int32 count;
+  int32 capacity;
+  real32 gravityX, gravityY, gravityZ;
+  real32 damping;
+  real32 cellSize;
+  int32 iterations;
+  real32 dt;
+  real32 grid;
+  int32 *cell;
+  int32 *hash;
+  int32 *slot;
+  int32 *large;
+  int32 *parent;
+  int32 *islandStart;
+  int32 *pairStart[2];
+  int32 *bucket;
+  int32 *order;
+  mioBodyProxy *proxies;
+  mioContact *contacts[2];
+  int32 contactCapacity[2];
+  int32 orderCapacity;
+  int32 tableSize;
+  int32 largeCount;
+  int32 contactCount;
+  int32 islandCount;
+  int32 current;
+  int32 warmCount;
+  int32 warmContacts;
+} mioPhysicsWorld;
+
+MIO_GLOBAL mioPhysicsWorld *G_PHYSICS = NULL;
+
+MIO_GLOBAL void *mio_physics_resize(
+    void *p, int32 used, int32 capacity, int32 size, SYSRET *ok) {
+  void *q;
+  if (!*ok) { return p; }
+  q = sys_alloc((capacity + 1) * size);
+  if (!q) {
+    *ok = FALSE;
+    return p;
+  }
+  if (p) {
+    memcpy(q, p, (size_t)used * size);
+    sys_free(p);
+  }
+  return q;
+}
+
+MIO_GLOBAL SYSRET mio_physics_reserve(mioPhysicsWorld *w, int32 capacity) {
+  SYSRET ok = TRUE;
+  int32 n = w->count, c = capacity;
+  int32 fs = (int32)sizeof(real32), is = (int32)sizeof(int32);
+  if (c <= w->capacity) { return TRUE; }
+  w->px = (real32 *)mio_physics_resize(w->px, n, c, fs, &ok);
+  w->py = (real32 *)mio_physics_resize(w->py, n, c, fs, &ok);
+  w->pz = (real32 *)mio_physics_resize(w->pz, n, c, fs, &ok);
+  w->vx = (real32 *)mio_physics_resize(w->vx, n, c, fs, &ok);
+  w->vy = (real32 *)mio_physics_resize(w->vy, n, c, fs, &ok);
+  w->vz = (real32 *)mio_physics_resize(w->vz, n, c, fs, &ok);
+  w->hx = (real32 *)mio_physics_resize(w->hx, n, c, fs, &ok);
+  w->hy = (real32 *)mio_physics_resize(w->hy, n, c, fs, &ok);
+  w->hz = (real32 *)mio_physics_resize(w->hz, n, c, fs, &ok);
+  w->invMass = (real32 *)mio_physics_resize(w->invMass, n, c, fs, &ok);
+  w->restitution = (real32 *)mio_physics_resize(w->restitution, n, c, fs, &ok);
+  w->friction = (real32 *)mio_physics_resize(w->friction, n, c, fs, &ok);
+  w->shape = (int32 *)mio_physics_resize(w->shape, n, c, is, &ok);
+  w->cell = (int32 *)mio_physics_resize(w->cell, 0, c * 3, is, &ok);
+  w->hash = (int32 *)mio_physics_resize(w->hash, 0, c, is, &ok);
+  w->slot = (int32 *)mio_physics_resize(w->slot, 0, c, is, &ok);
+  w->large = (int32 *)mio_physics_resize(w->large, 0, c, is, &ok);
+  w->parent = (int32 *)mio_physics_resize(w->parent, 0, c, is, &ok);
+  w->islandStart = (int32 *)mio_physics_resize(w->islandStart, 0, c, is, &ok);
+  w->pairStart[0] = (int32 *)mio_physics_resize(w->pairStart[0], 0, c, is, &ok);
+  w->pairStart[1] = (int32 *)mio_physics_resize(w->pairStart[1], 0, c, is, &ok);
+  w->proxies = (mioBodyProxy *)mio_physics_resize(
+      w->proxies, 0, c, (int32)sizeof(mioBodyProxy), &ok);
+  if (!ok) { return FALSE; }
+  w->capacity = c;
+  w->warmCount = 0;
+  return TRUE;
+}
+
+SYSRET mio_physics_init(mioPhysicsWorld *w, int32 capacity, real32 cellSize) {
+  memset(w, 0, sizeof(*w));
+  w->gravityY = -9.81f;
+  w->damping = 0.01f;
+  w->cellSize = cellSize;
+  w->iterations = MIO_PHYSICS_ITERATIONS;
+  return mio_physics_reserve(w, MIO_MAX(capacity, 64));
+}
+
+void mio_physics_free(mioPhysicsWorld *w) {
+  sys_free(w->px);
+  sys_free(w->py);
+  sys_free(w->pz);
+  sys_free(w->vx);
+  sys_free(w->vy);
+  sys_free(w->vz);
+  sys_free(w->hx);
+  sys_free(w->hy);
+  sys_free(w->hz);
+  sys_free(w->invMass);
+  sys_free(w->restitution);
+  sys_free(w->friction);
+  sys_free(w->shape);
+  sys_free(w->cell);
+  sys_free(w->hash);
+  sys_free(w->slot);
+  sys_free(w->large);
+  sys_free(w->parent);
+  sys_free(w->islandStart);
+  sys_free(w->pairStart[0]);
+  sys_free(w->pairStart[1]);
+  sys_free(w->bucket);
+  sys_free(w->order);
+  sys_free(w->proxies);
+  sys_free(w->contacts[0]);
+  sys_free(w->contacts[1]);
+  if (G_PHYSICS == w) { G_PHYSICS = NULL; }
+  memset(w, 0, sizeof(*w));
+}
+
+void mio_physics_attach(mioPhysicsWorld *w) { G_PHYSICS = w; }
+
+MIO_GLOBAL int32 mio_physics_add(
+    mioPhysicsWorld *w, int32 shape, real32 x, real32 y, real32 z, real32 hx,
+    real32 hy, real32 hz, real32 mass) {
+  int32 i = w->count;
+  if (i == w->capacity && !mio_physics_reserve(w, w->capacity * 2)) {
+    return -1;
+  }
+  w->px[i] = x;
+  w->py[i] = y;
+  w->pz[i] = z;
+  w->vx[i] = w->vy[i] = w->vz[i] = 0.0f;
+  w->hx[i] = hx;
+  w->hy[i] = hy;
+  w->hz[i] = hz;
+  w->invMass[i] = mass > 0.0f ? 1.0f / mass : 0.0f;
+  w->restitution[i] = 0.1f;
+  w->friction[i] = 0.5f;
+  w->shape[i] = shape;
+  w->count++;
+  return i;
+}
+
+int32 mio_physics_add_sphere(
+    mioPhysicsWorld *w, real32 x, real32 y, real32 z, real32 radius,
+    real32 mass) {
+  return mio_physics_add(
+      w, MIO_BODY_SPHERE, x, y, z, radius, radius, radius, mass);
+}
+
+int32 mio_physics_add_box(
+    mioPhysicsWorld *w, real32 x, real32 y, real32 z, real32 hx, real32 hy,
+    real32 hz, real32 mass) {
+  return mio_physics_add(w, MIO_BODY_BOX, x, y, z, hx, hy, hz, mass);
+}
+
+void mio_physics_remove(mioPhysicsWorld *w, int32 body) {
+  int32 last = w->count - 1;
+  if (body < 0 || body > last) { return; }
+  w->px[body] = w->px[last];
+  w->py[body] = w->py[last];
+  w->pz[body] = w->pz[last];
+  w->vx[body] = w->vx[last];
+  w->vy[body] = w->vy[last];
+  w->vz[body] = w->vz[last];
+  w->hx[body] = w->hx[last];
+  w->hy[body] = w->hy[last];
+  w->hz[body] = w->hz[last];
+  w->invMass[body] = w->invMass[last];
+  w->restitution[body] = w->restitution[last];
+  w->friction[body] = w->friction[last];
+  w->shape[body] = w->shape[last];
+  w->count--;
+  w->warmCount = 0;
+}
+
+MIO_GLOBAL SYSRET mio_physics_collide(
+    const mioPhysicsWorld *w, int32 a, int32 b, mioContact *c) {
+  real32 dx = w->px[b] - w->px[a];
+  real32 dy = w->py[b] - w->py[a];
+  real32 dz = w->pz[b] - w->pz[a];
+  real32 ox, oy, oz, r, d2, d, qx, qy, qz, sign = 1.0f;
+  int32 box, ball;
+  if (w->shape[a] == MIO_BODY_BOX && w->shape[b] == MIO_BODY_BOX) {
+    ox = w->hx[a] + w->hx[b] - (real32)fabs(dx);
+    oy = w->hy[a] + w->hy[b] - (real32)fabs(dy);
+    oz = w->hz[a] + w->hz[b] - (real32)fabs(dz);
+    if (ox <= -MIO_PHYSICS_MARGIN || oy <= -MIO_PHYSICS_MARGIN ||
+        oz <= -MIO_PHYSICS_MARGIN) {
+      return FALSE;
+    }
+    c->nx = c->ny = c->nz = 0.0f;
+    if (ox <= oy && ox <= oz) {
+      c->nx = dx < 0.0f ? -1.0f : 1.0f;
+      c->depth = ox;
+    } else if (oy <= oz) {
+      c->ny = dy < 0.0f ? -1.0f : 1.0f;
+      c->depth = oy;
+    } else {
+      c->nz = dz < 0.0f ? -1.0f : 1.0f;
+      c->depth = oz;
+    }
+    return TRUE;
+  }
+  if (w->shape[a] == MIO_BODY_SPHERE && w->shape[b] == MIO_BODY_SPHERE) {
+    r = w->hx[a] + w->hx[b];
+    d2 = dx * dx + dy * dy + dz * dz;
+    if (d2 >= (r + MIO_PHYSICS_MARGIN) * (r + MIO_PHYSICS_MARGIN)) {
+      return FALSE;
+    }
+    d = (real32)sqrt(d2);
+    if (d > 1e-6f) {
+      c->nx = dx / d;
+      c->ny = dy / d;
+      c->nz = dz / d;
+    } else {
+      c->nx = c->nz = 0.0f;
+      c->ny = 1.0f;
     }
+    c->depth = r - d;
+    return TRUE;
+  }
+  box = a;
+  ball = b;
+  if (w->shape[a] == MIO_BODY_SPHERE) {
+    box = b;
+    ball = a;
+    dx = -dx;
+    dy = -dy;
+    dz = -dz;
+    sign = -1.0f;
+  }
+  r = w->hx[ball];
+  qx = MIO_CLAMP(dx, -w->hx[box], w->hx[box]);
+  qy = MIO_CLAMP(dy, -w->hy[box], w->hy[box]);
+  qz = MIO_CLAMP(dz, -w->hz[box], w->hz[box]);
+  qx = dx - qx;
+  qy = dy - qy;
+  qz = dz - qz;
+  d2 = qx * qx + qy * qy + qz * qz;
+  if (d2 >= (r + MIO_PHYSICS_MARGIN) * (r + MIO_PHYSICS_MARGIN)) {
+    return FALSE;
+  }
+  if (d2 > 1e-12f) {
+    d = (real32)sqrt(d2);
+    c->nx = sign * qx / d;
+    c->ny = sign * qy / d;
+    c->nz = sign * qz / d;
+    c->depth = r - d;
+    return TRUE;
+  }
+  ox = w->hx[box] - (real32)fabs(dx);
+  oy = w->hy[box] - (real32)fabs(dy);
+  oz = w->hz[box] - (real32)fabs(dz);
+  c->nx = c->ny = c->nz = 0.0f;
+  if (ox <= oy && ox <= oz) {
+    c->nx = sign * (dx < 0.0f ? -1.0f : 1.0f);
+    c->depth = r + ox;
+  } else if (oy <= oz) {
+    c->ny = sign * (dy < 0.0f ? -1.0f : 1.0f);
+    c->depth = r + oy;
+  } else {
+    c->nz = sign * (dz < 0.0f ? -1.0f : 1.0f);
+    c->depth = r + oz;
   }
   return TRUE;
 }
 
-static mioVec3 mio_calculate_translation_hit(
-    mioCamera *cam, mioVec3 rayOrigin, mioVec3 rayDir, mioVec3 planeNormal,
-    mioVec3 planePoint) {
-  real32 t;
-  real32 denom = mio_vec3_dot(rayDir, planeNormal);
-  real32 planeD = -mio_vec3_dot(planeNormal, planePoint);
-  mioVec3 currentHitPosWorld = mio_vec3(0.0f, 0.0f, 0.0f);
+MIO_GLOBAL int32
+mio_physics_hash(const mioPhysicsWorld *w, int32 x, int32 y, int32 z) {
+  return (int32)(((uint32)x + ((uint32)y * 19349663u ^ (uint32)z * 83492791u)) &
+                 (uint32)(w->tableSize - 1));
+}
 
-  if (fabs(denom) > MIO_EPSILON_F) {
-    t = -(mio_vec3_dot(rayOrigin, planeNormal) + planeD) / denom;
+MIO_GLOBAL real32 mio_physics_extent(const mioPhysicsWorld *w, int32 i) {
+  real32 e = MIO_MAX(w->hx[i], w->hy[i]);
+  return MIO_MAX(e, w->hz[i]);
+}
 
-    if (t > 0.0f) {
-      currentHitPosWorld = mio_vec3_add(rayOrigin, mio_vec3_scale(rayDir, t));
+MIO_GLOBAL void mio_physics_prepare_rows(void *data, int32 i0, int32 i1) {
+  mioPhysicsWorld *w = (mioPhysicsWorld *)data;
+  real32 dt = w->dt, inv = 1.0f / w->grid;
+  real32 keep = MIO_MAX(1.0f - w->damping * dt, 0.0f);
+  int32 i, *cell;
+  for (i = i0; i < i1; i++) {
+    if (w->invMass[i] > 0.0f) {
+      w->vx[i] = (w->vx[i] + w->gravityX * dt) * keep;
+      w->vy[i] = (w->vy[i] + w->gravityY * dt) * keep;
+      w->vz[i] = (w->vz[i] + w->gravityZ * dt) * keep;
+    }
+    cell = &w->cell[i * 3];
+    if (mio_physics_extent(w, i) * 2.0f > w->grid) {
+      w->hash[i] = -1;
+      continue;
+    }
+    cell[0] = (int32)floor(w->px[i] * inv);
+    cell[1] = (int32)floor(w->py[i] * inv);
+    cell[2] = (int32)floor(w->pz[i] * inv);
+    w->hash[i] = mio_physics_hash(w, cell[0], cell[1], cell[2]);
+  }
+}
+
+MIO_GLOBAL SYSRET mio_physics_begin(mioPhysicsWorld *w, real32 dt) {
+  int32 i, size;
+  real32 grid = 0.0f;
+  w->dt = dt;
+  w->contactCount = 0;
+  w->islandCount = 0;
+  for (i = 0; i < w->count; i++) {
+    if (w->invMass[i] > 0.0f) {
+      grid = MIO_MAX(grid, mio_physics_extent(w, i));
+    }
+  }
+  w->grid = MIO_MAX(grid * 2.0f + MIO_PHYSICS_MARGIN, w->cellSize);
+  if (w->grid <= 0.0f) { return FALSE; }
+  size = MIO_PHYSICS_TABLE_MIN;
+  while (size < w->count * 2) { size *= 2; }
+  if (size != w->tableSize) {
+    sys_free(w->bucket);
+    w->bucket = (int32 *)sys_alloc((size + 1) * sizeof(int32));
+    w->tableSize = w->bucket ? size : 0;
+    if (!w->bucket) { return FALSE; }
+  }
+  return TRUE;
+}
+
+MIO_GLOBAL void mio_physics_grid(mioPhysicsWorld *w) {
+  mioBodyProxy *proxy;
+  int32 i, sum = 0, n;
+  memset(w->bucket, 0, (w->tableSize + 1) * sizeof(int32));
+  w->largeCount = 0;
+  for (i = 0; i < w->count; i++) {
+    if (w->hash[i] < 0) {
+      w->large[w->largeCount++] = i;
+    } else {
+      w->bucket[w->hash[i]]++;
+    }
+  }
+  for (i = 0; i <= w->tableSize; i++) {
+    n = w->bucket[i];
+    w->bucket[i] = sum;
+    sum += n;
+  }
+  for (i = 0; i < w->count; i++) {
+    if (w->hash[i] < 0) {
+      w->slot[i] = -1;
+      continue;
     }
+    w->slot[i] = w->bucket[w->hash[i]]++;
+    proxy = &w->proxies[w->slot[i]];
+    proxy->x = w->px[i];
+    proxy->y = w->py[i];
+    proxy->z = w->pz[i];
+    proxy->extent = mio_physics_extent(w, i);
+    proxy->cx = w->cell[i * 3];
+    proxy->cy = w->cell[i * 3 + 1];
+    proxy->cz = w->cell[i * 3 + 2];
+    proxy->body = i;
+  }
+  for (i = w->tableSize; i > 0; i--) { w->bucket[i] = w->bucket[i - 1]; }
+  w->bucket[0] = 0;
+}
+
+MIO_GLOBAL void mio_physics_contact(
+    const mioPhysicsWorld *w, int32 a, int32 b, mioContact *c) {
+  const mioContact *prev;
+  int32 k, end;
+  real32 len;
+  c->a = a;
+  c->b = b;
+  if ((real32)fabs(c->nx) > 0.57f) {
+    len = (real32)sqrt(c->nx * c->nx + c->ny * c->ny);
+    c->ux = c->ny / len;
+    c->uy = -c->nx / len;
+    c->uz = 0.0f;
   } else {
-    if (fabs(planeNormal.y) < 0.1f) {
-      mioVec3 fallbackNormal = mio_vec3(0.0f, 1.0f, 0.0f);
-      real32 fallbackD = -mio_vec3_dot(fallbackNormal, G_3D_START_HIT);
-      real32 fallbackDenom = mio_vec3_dot(rayDir, fallbackNormal);
+    len = (real32)sqrt(c->ny * c->ny + c->nz * c->nz);
+    c->ux = 0.0f;
+    c->uy = c->nz / len;
+    c->uz = -c->ny / len;
+  }
+  c->jn = c->ju = c->jv = 0.0f;
+  if (a >= w->warmCount) { return; }
+  prev = w->contacts[w->current ^ 1];
+  end = a + 1 < w->warmCount ? w->pairStart[w->current ^ 1][a + 1]
+                             : w->warmContacts;
+  for (k = w->pairStart[w->current ^ 1][a]; k < end; k++) {
+    if (prev[k].b == b) {
+      c->jn = prev[k].jn;
+      c->ju = prev[k].ju;
+      c->jv = prev[k].jv;
+      return;
+    }
+  }
+}
+
+MIO_GLOBAL int32 mio_physics_scan(
+    const mioPhysicsWorld *w, int32 i, int32 x0, int32 y, int32 z, int32 k,
+    int32 end, mioContact *out) {
+  mioContact c;
+  const mioBodyProxy *self = &w->proxies[w->slot[i]], *other;
+  int32 j, count = 0;
+  real32 dx, dy, dz, e;
+  for (; k < end; k++) {
+    other = &w->proxies[k];
+    j = other->body;
+    e = other->extent + self->extent + MIO_PHYSICS_MARGIN;
+    dx = other->x - self->x;
+    dy = other->y - self->y;
+    dz = other->z - self->z;
+    if (MIO_ABS(dx) >= e || MIO_ABS(dy) >= e || MIO_ABS(dz) >= e ||
+        other->cy != y || other->cz != z || other->cx < x0 ||
+        other->cx > self->cx + 1 ||
+        (j <= i && other->cx == self->cx && y == self->cy && z == self->cz) ||
+        (w->invMass[i] == 0.0f && w->invMass[j] == 0.0f) ||
+        !mio_physics_collide(w, i, j, &c)) {
+      continue;
+    }
+    if (out) {
+      out[count] = c;
+      mio_physics_contact(w, i, j, &out[count]);
+    }
+    count++;
+  }
+  return count;
+}
 
-      if (fabs(fallbackDenom) > MIO_EPSILON_F) {
-        t = -(mio_vec3_dot(rayOrigin, fallbackNormal) + fallbackD) /
-            fallbackDenom;
-        if (t > 0.0f) {
-          currentHitPosWorld =
-              mio_vec3_add(rayOrigin, mio_vec3_scale(rayDir, t));
+MIO_GLOBAL int32
+mio_physics_pairs(const mioPhysicsWorld *w, int32 i, mioContact *out) {
+  mioContact c;
+  const mioBodyProxy *self;
+  int32 x, y, z, k, j, h, n, count = 0;
+  if (w->slot[i] >= 0) {
+    self = &w->proxies[w->slot[i]];
+    for (z = self->cz; z <= self->cz + 1; z++) {
+      for (y = self->cy - (z > self->cz); y <= self->cy + 1; y++) {
+        x = self->cx - (z > self->cz || y > self->cy);
+        n = self->cx + 2 - x;
+        h = mio_physics_hash(w, x, y, z);
+        if (h + n <= w->tableSize) {
+          count += mio_physics_scan(
+              w, i, x, y, z, w->bucket[h], w->bucket[h + n],
+              out ? out + count : NULL);
+        } else {
+          count += mio_physics_scan(
+              w, i, x, y, z, w->bucket[h], w->bucket[w->tableSize],
+              out ? out + count : NULL);
+          count += mio_physics_scan(
+              w, i, x, y, z, 0, w->bucket[h + n - w->tableSize],
+              out ? out + count : NULL);
         }
       }
     }
   }
-  return currentHitPosWorld;
+  for (k = 0; k < w->largeCount; k++) {
+    j = w->large[k];
+    if (j == i || (w->slot[i] < 0 && j < i) ||
+        (w->invMass[i] == 0.0f && w->invMass[j] == 0.0f) ||
+        !mio_physics_collide(w, i, j, &c)) {
+      continue;
+    }
+    if (out) {
+      out[count] = c;
+      mio_physics_contact(w, i, j, &out[count]);
+    }
+    count++;
+  }
+  return count;
 }
 
-static void
-mio_get_mouse_ray(mioCamera *cam, mioVec3 *rayOrigin, mioVec3 *rayDir) {
-  mioMat4 camera_rot = mio_mat4_identity();
-  mioMat4 camera_pos = mio_mat4_identity();
+MIO_GLOBAL void mio_physics_count_rows(void *data, int32 i0, int32 i1) {
+  mioPhysicsWorld *w = (mioPhysicsWorld *)data;
+  int32 i;
+  for (i = i0; i < i1; i++) {
+    w->pairStart[w->current][i] = mio_physics_pairs(w, i, NULL);
+  }
+}
+
+MIO_GLOBAL void mio_physics_fill_rows(void *data, int32 i0, int32 i1) {
+  mioPhysicsWorld *w = (mioPhysicsWorld *)data;
+  mioContact *contacts = w->contacts[w->current];
+  int32 i;
+  for (i = i0; i < i1; i++) {
+    mio_physics_pairs(w, i, &contacts[w->pairStart[w->current][i]]);
+  }
+}
+
+MIO_GLOBAL SYSRET mio_physics_gather(mioPhysicsWorld *w) {
+  int32 i, n, sum = 0, cap, *start = w->pairStart[w->current];
+  for (i = 0; i < w->count; i++) {
+    n = start[i];
+    start[i] = sum;
+    sum += n;
+  }
+  w->contactCount = sum;
+  if (sum > w->contactCapacity[w->current]) {
+    cap = MIO_MAX(sum + sum / 2, 1024);
+    sys_free(w->contacts[w->current]);
+    w->contacts[w->current] = (mioContact *)sys_alloc(cap * sizeof(mioContact));
+    w->contactCapacity[w->current] = w->contacts[w->current] ? cap : 0;
+    if (cap > w->orderCapacity) {
+      sys_free(w->order);
+      w->order = (int32 *)sys_alloc(cap * sizeof(int32));
+      w->orderCapacity = w->order ? cap : 0;
+      if (!w->order) { w->contactCapacity[w->current] = 0; }
+    }
+    if (!w->contactCapacity[w->current]) {
+      w->contactCount = 0;
+      w->warmCount = 0;
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+MIO_GLOBAL int32 mio_physics_root(int32 *parent, int32 i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+MIO_GLOBAL void mio_physics_islands(mioPhysicsWorld *w) {
+  const mioContact *contacts = w->contacts[w->current];
+  int32 i, a, b, n, sum = 0, *island = w->hash;
+  for (i = 0; i < w->count; i++) {
+    w->parent[i] = i;
+    island[i] = -1;
+  }
+  for (i = 0; i < w->contactCount; i++) {
+    if (w->invMass[contacts[i].a] > 0.0f && w->invMass[contacts[i].b] > 0.0f) {
+      a = mio_physics_root(w->parent, contacts[i].a);
+      b = mio_physics_root(w->parent, contacts[i].b);
+      if (a != b) { w->parent[MIO_MAX(a, b)] = MIO_MIN(a, b); }
+    }
+  }
+  w->islandCount = 0;
+  for (i = 0; i < w->contactCount; i++) {
+    a = w->invMass[contacts[i].a] > 0.0f ? contacts[i].a : contacts[i].b;
+    a = mio_physics_root(w->parent, a);
+    if (island[a] < 0) {
+      island[a] = w->islandCount;
+      w->islandStart[w->islandCount++] = 0;
+    }
+    w->islandStart[island[a]]++;
+  }
+  for (i = 0; i <= w->islandCount; i++) {
+    n = i < w->islandCount ? w->islandStart[i] : 0;
+    w->islandStart[i] = sum;
+    sum += n;
+  }
+  for (i = 0; i < w->contactCount; i++) {
+    a = w->invMass[contacts[i].a] > 0.0f ? contacts[i].a : contacts[i].b;
+    a = island[mio_physics_root(w->parent, a)];
+    w->order[w->islandStart[a]++] = i;
+  }
+  for (i = w->islandCount; i > 0; i--) {
+    w->islandStart[i] = w->islandStart[i - 1];
+  }
+  w->islandStart[0] = 0;
+}
+
+MIO_GLOBAL void mio_physics_impulse(
+    mioPhysicsWorld *w, const mioContact *c, real32 x, real32 y, real32 z) {
+  real32 ia = w->invMass[c->a], ib = w->invMass[c->b];
+  if (ia > 0.0f) {
+    w->vx[c->a] -= x * ia;
+    w->vy[c->a] -= y * ia;
+    w->vz[c->a] -= z * ia;
+  }
+  if (ib > 0.0f) {
+    w->vx[c->b] += x * ib;
+    w->vy[c->b] += y * ib;
+    w->vz[c->b] += z * ib;
+  }
+}
+
+MIO_GLOBAL void mio_physics_solve_rows(void *data, int32 i0, int32 i1) {
+  mioPhysicsWorld *w = (mioPhysicsWorld *)data;
+  mioContact *contacts = w->contacts[w->current], *c;
+  int32 i, k, it, a, b;
+  real32 rx, ry, rz, vn, dj, j0, lim, e, bx, by, bz;
+  for (i = i0; i < i1; i++) {
+    for (k = w->islandStart[i]; k < w->islandStart[i + 1]; k++) {
+      c = &contacts[w->order[k]];
+      a = c->a;
+      b = c->b;
+      c->mass = 1.0f / (w->invMass[a] + w->invMass[b]);
+      c->friction = (real32)sqrt(w->friction[a] * w->friction[b]);
+      if (c->depth < 0.0f) {
+        c->bias = c->depth / w->dt;
+      } else {
+        c->bias = MIO_PHYSICS_BIAS / w->dt *
+                  MIO_MAX(c->depth - MIO_PHYSICS_SLOP, 0.0f);
+      }
+      vn = (w->vx[b] - w->vx[a]) * c->nx + (w->vy[b] - w->vy[a]) * c->ny +
+           (w->vz[b] - w->vz[a]) * c->nz;
+      e = MIO_MAX(w->restitution[a], w->restitution[b]);
+      if (vn < -MIO_PHYSICS_BOUNCE) { c->bias = MIO_MAX(c->bias, -e * vn); }
+    }
+    for (k = w->islandStart[i]; k < w->islandStart[i + 1]; k++) {
+      c = &contacts[w->order[k]];
+      bx = c->ny * c->uz - c->nz * c->uy;
+      by = c->nz * c->ux - c->nx * c->uz;
+      bz = c->nx * c->uy - c->ny * c->ux;
+      mio_physics_impulse(
+          w, c, c->nx * c->jn + c->ux * c->ju + bx * c->jv,
+          c->ny * c->jn + c->uy * c->ju + by * c->jv,
+          c->nz * c->jn + c->uz * c->ju + bz * c->jv);
+    }
+    for (it = 0; it < w->iterations; it++) {
+      for (k = w->islandStart[i]; k < w->islandStart[i + 1]; k++) {
+        c = &contacts[w->order[k]];
+        a = c->a;
+        b = c->b;
+        rx = w->vx[b] - w->vx[a];
+        ry = w->vy[b] - w->vy[a];
+        rz = w->vz[b] - w->vz[a];
+        vn = rx * c->nx + ry * c->ny + rz * c->nz;
+        j0 = c->jn;
+        c->jn = MIO_MAX(j0 + c->mass * (c->bias - vn), 0.0f);
+        dj = c->jn - j0;
+        mio_physics_impulse(w, c, c->nx * dj, c->ny * dj, c->nz * dj);
+        lim = c->friction * c->jn;
+        bx = c->ny * c->uz - c->nz * c->uy;
+        by = c->nz * c->ux - c->nx * c->uz;
+        bz = c->nx * c->uy - c->ny * c->ux;
+        j0 = c->ju;
+        dj = j0 - c->mass * (rx * c->ux + ry * c->uy + rz * c->uz);
+        c->ju = MIO_CLAMP(dj, -lim, lim);
+        dj = c->ju - j0;
+        mio_physics_impulse(w, c, c->ux * dj, c->uy * dj, c->uz * dj);
+        j0 = c->jv;
+        dj = j0 - c->mass * (rx * bx + ry * by + rz * bz);
+        c->jv = MIO_CLAMP(dj, -lim, lim);
+        dj = c->jv - j0;
+        mio_physics_impulse(w, c, bx * dj, by * dj, bz * dj);
+      }
+    }
+  }
+}
+
+MIO_GLOBAL void mio_physics_integrate_rows(void *data, int32 i0, int32 i1) {
+  mioPhysicsWorld *w = (mioPhysicsWorld *)data;
+  real32 dt = w->dt;
+  int32 i;
+  for (i = i0; i < i1; i++) {
+    w->px[i] += w->vx[i] * dt;
+    w->py[i] += w->vy[i] * dt;
+    w->pz[i] += w->vz[i] * dt;
+  }
+}
+
+MIO_GLOBAL void mio_physics_end(mioPhysicsWorld *w) {
+  w->warmCount = w->contactCount ? w->count : 0;
+  w->warmContacts = w->contactCount;
+  w->current ^= 1;
+}
+
+void mio_physics_step(mioPhysicsWorld *w, real32 dt) {
+  if (!w->count) { return; }
+  if (mio_physics_begin(w, dt)) {
+    mio_physics_prepare_rows(w, 0, w->count);
+    mio_physics_grid(w);
+    mio_physics_count_rows(w, 0, w->count);
+    if (mio_physics_gather(w)) {
+      mio_physics_fill_rows(w, 0, w->count);
+      mio_physics_islands(w);
+      mio_physics_solve_rows(w, 0, w->islandCount);
+    }
+  }
+  mio_physics_integrate_rows(w, 0, w->count);
+  mio_physics_end(w);
+}
+
+/* @PARTICLES ****************************************************************/
+
+#define MIO_PARTICLE_ALPHA 0
+#define MIO_PARTICLE_ADDITIVE 1
+#define MIO_PARTICLE_FIELD_SHIFT 6
+#define MIO_PARTICLE_FIELD (1 << MIO_PARTICLE_FIELD_SHIFT)
+#define MIO_PARTICLE_BLOCK 1024
+#define MIO_PARTICLE_BIN_SHIFT 5
+
+typedef struct {
+  real32 *x, *y;
+  real32 *vx, *vy;
+  real32 *life;
+  real32 *invLife;
+  real32 *size;
+  uint32 *colour;
+} mioParticleArrays;
+
+typedef struct {
+  mioParticleArrays buffers[2];
+  int32 front;
+  int32 count;
+  int32 capacity;
+  int32 *blocks;
+  /* draw_mt bins: per block per 32-row strip counts, then particle indices */
+  int32 *binCounts;
+  int32 *binStart;
+  int32 *binIndex;
+  int32 binCountsCapacity;
+  int32 binStartCapacity;
+  int32 binIndexCapacity;
+  int32 bins;
+  real32 gravityX, gravityY;
+  real32 drag;
+  real32 turbulence;
+  real32 turbulenceScale;
+  real32 turbulenceSpeed;
+  int32 blend;
+  uint32 seed;
+  real32 time;
+  real32 dt;
+  real32 potential[MIO_PARTICLE_FIELD * MIO_PARTICLE_FIELD];
+  real32 fieldX[MIO_PARTICLE_FIELD * MIO_PARTICLE_FIELD];
+  real32 fieldY[MIO_PARTICLE_FIELD * MIO_PARTICLE_FIELD];
+} mioParticles;
+
+typedef struct {
+  real32 x, y;
+  real32 radius;
+  real32 angle, spread;
+  real32 speed, speedJitter;
+  real32 life, lifeJitter;
+  real32 size;
+  uint32 colour;
+  real32 rate;
+  real32 pending;
+} mioEmitter;
+
+mioEmitter mio_emitter(real32 x, real32 y, real32 rate, uint32 colour) {
+  mioEmitter em;
+  memset(&em, 0, sizeof(em));
+  em.x = x;
+  em.y = y;
+  em.angle = (real32)(-MIO_PI / 2);
+  em.spread = (real32)(MIO_PI / 4);
+  em.speed = 100.0f;
+  em.speedJitter = 0.25f;
+  em.life = 2.0f;
+  em.lifeJitter = 0.25f;
+  em.size = 1.0f;
+  em.colour = colour;
+  em.rate = rate;
+  return em;
+}
+
+void mio_particles_free(mioParticles *ps) {
+  int32 b;
+  mioParticleArrays *a;
+  for (b = 0; b < 2; b++) {
+    a = &ps->buffers[b];
+    sys_free(a->x);
+    sys_free(a->y);
+    sys_free(a->vx);
+    sys_free(a->vy);
+    sys_free(a->life);
+    sys_free(a->invLife);
+    sys_free(a->size);
+    sys_free(a->colour);
+  }
+  sys_free(ps->blocks);
+  sys_free(ps->binCounts);
+  sys_free(ps->binStart);
+  sys_free(ps->binIndex);
+  memset(ps, 0, sizeof(*ps));
+}
+
+SYSRET mio_particles_init(mioParticles *ps, int32 capacity) {
+  int32 b, n, fs = (int32)sizeof(real32);
+  mioParticleArrays *a;
+  memset(ps, 0, sizeof(*ps));
+  n = (MIO_MAX(capacity, 64) + 3) & ~3;
+  for (b = 0; b < 2; b++) {
+    a = &ps->buffers[b];
+    a->x = (real32 *)sys_alloc((n + 4) * fs);
+    a->y = (real32 *)sys_alloc((n + 4) * fs);
+    a->vx = (real32 *)sys_alloc((n + 4) * fs);
+    a->vy = (real32 *)sys_alloc((n + 4) * fs);
+    a->life = (real32 *)sys_alloc((n + 4) * fs);
+    a->invLife = (real32 *)sys_alloc((n + 4) * fs);
+    a->size = (real32 *)sys_alloc((n + 4) * fs);
+    a->colour = (uint32 *)sys_alloc((n + 4) * sizeof(uint32));
+    if (!a->x || !a->y || !a->vx || !a->vy || !a->life || !a->invLife ||
+        !a->size || !a->colour) {
+      break;
+    }
+  }
+  ps->blocks = (int32 *)sys_alloc(
+      (n / MIO_PARTICLE_BLOCK + 2) * (int32)sizeof(int32));
+  ps->capacity = n;
+  ps->gravityY = 98.0f;
+  ps->drag = 0.5f;
+  ps->turbulenceScale = 32.0f;
+  ps->turbulenceSpeed = 0.25f;
+  ps->blend = MIO_PARTICLE_ADDITIVE;
+  ps->seed = 0x9E3779B9;
+  if (b < 2 || !ps->blocks) {
+    mio_particles_free(ps);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+MIO_GLOBAL real32 mio_particles_random(mioParticles *ps) {
+  uint32 s = ps->seed;
+  s ^= s << 13;
+  s ^= s >> 17;
+  s ^= s << 5;
+  ps->seed = s;
+  return (real32)(s >> 8) * (1.0f / 16777216.0f);
+}
+
+int32 mio_particles_burst(mioParticles *ps, const mioEmitter *em, int32 n) {
+  mioParticleArrays *a = &ps->buffers[ps->front];
+  real32 angle, speed, life, r;
+  int32 i, end;
+  end = ps->count + MIO_MIN(n, ps->capacity - ps->count);
+  for (i = ps->count; i < end; i++) {
+    angle = (real32)(MIO_PI * 2) * mio_particles_random(ps);
+    r = em->radius * (real32)sqrt(mio_particles_random(ps));
+    a->x[i] = em->x + (real32)cos(angle) * r;
+    a->y[i] = em->y + (real32)sin(angle) * r;
+    angle = em->angle + em->spread * (mio_particles_random(ps) - 0.5f);
+    speed = em->speed *
+        (1.0f + em->speedJitter * (mio_particles_random(ps) * 2.0f - 1.0f));
+    a->vx[i] = (real32)cos(angle) * speed;
+    a->vy[i] = (real32)sin(angle) * speed;
+    life = em->life *
+        (1.0f + em->lifeJitter * (mio_particles_random(ps) * 2.0f - 1.0f));
+    life = MIO_MAX(life, 0.001f);
+    a->life[i] = life;
+    a->invLife[i] = 1.0f / life;
+    a->size[i] = MIO_MAX(em->size, 1.0f);
+    a->colour[i] = em->colour;
+  }
+  n = end - ps->count;
+  ps->count = end;
+  return n;
+}
+
+int32 mio_particles_emit(mioParticles *ps, mioEmitter *em, real32 dt) {
+  int32 n;
+  em->pending += em->rate * dt;
+  n = (int32)em->pending;
+  em->pending -= (real32)n;
+  return mio_particles_burst(ps, em, n);
+}
+
+MIO_GLOBAL void mio_particles_field(mioParticles *ps) {
+  int32 x, y, l, r, u, d, n = MIO_PARTICLE_FIELD - 1;
+  real32 fx, fy, m = 0.0f, z = ps->time * ps->turbulenceSpeed;
+  for (y = 0; y <= n; y++) {
+    for (x = 0; x <= n; x++) {
+      ps->potential[y * MIO_PARTICLE_FIELD + x] =
+          (real32)mio_noise_simplex_3d(x * 0.15, y * 0.15, z);
+    }
+  }
+  /* curl of the potential, so the flow has no sinks to clump particles */
+  for (y = 0; y <= n; y++) {
+    u = ((y - 1) & n) * MIO_PARTICLE_FIELD;
+    d = ((y + 1) & n) * MIO_PARTICLE_FIELD;
+    for (x = 0; x <= n; x++) {
+      l = (x - 1) & n;
+      r = (x + 1) & n;
+      fx = ps->potential[d + x] - ps->potential[u + x];
+      fy = ps->potential[y * MIO_PARTICLE_FIELD + l] -
+           ps->potential[y * MIO_PARTICLE_FIELD + r];
+      ps->fieldX[y * MIO_PARTICLE_FIELD + x] = fx;
+      ps->fieldY[y * MIO_PARTICLE_FIELD + x] = fy;
+      m = MIO_MAX(m, fx * fx + fy * fy);
+    }
+  }
+  m = m > 0.0f ? 1.0f / (real32)sqrt(m) : 0.0f;
+  for (x = 0; x <= n * MIO_PARTICLE_FIELD + n; x++) {
+    ps->fieldX[x] *= m;
+    ps->fieldY[x] *= m;
+  }
+}
+
+MIO_GLOBAL void mio_particles_count_rows(void *data, int32 b0, int32 b1) {
+  mioParticles *ps = (mioParticles *)data;
+  const real32 *life = ps->buffers[ps->front].life;
+  __m128 dt = _mm_set1_ps(ps->dt);
+  int32 b, i, end, alive, mask;
+  for (b = b0; b < b1; b++) {
+    i = b * MIO_PARTICLE_BLOCK;
+    end = MIO_MIN(i + MIO_PARTICLE_BLOCK, ps->count);
+    alive = 0;
+    for (; i < end; i += 4) {
+      mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(life + i), dt));
+      if (end - i < 4) { mask &= (1 << (end - i)) - 1; }
+      alive += (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3);
+    }
+    ps->blocks[b] = alive;
+  }
+}
+
+MIO_GLOBAL void mio_particles_update_rows(void *data, int32 b0, int32 b1) {
+  mioParticles *ps = (mioParticles *)data;
+  const mioParticleArrays *a = &ps->buffers[ps->front];
+  const mioParticleArrays *o = &ps->buffers[ps->front ^ 1];
+  __m128 dt = _mm_set1_ps(ps->dt);
+  __m128 zero = _mm_setzero_ps();
+  __m128 damp = _mm_set1_ps(MIO_MAX(1.0f - ps->drag * ps->dt, 0.0f));
+  __m128 gx = _mm_set1_ps(ps->gravityX * ps->dt);
+  __m128 gy = _mm_set1_ps(ps->gravityY * ps->dt);
+  __m128 turb = _mm_set1_ps(ps->turbulence * ps->dt);
+  __m128 cell = _mm_set1_ps(1.0f / MIO_MAX(ps->turbulenceScale, 1.0f));
+  __m128i wrap = _mm_set1_epi32(MIO_PARTICLE_FIELD - 1);
+  __m128 x, y, vx, vy, life, fx, fy;
+  __m128i cx, cy;
+  real32 tx[4], ty[4], tvx[4], tvy[4], tlife[4];
+  int32 idx[4];
+  int32 b, i, j, k, end, mask, field = ps->turbulence != 0.0f;
+  for (b = b0; b < b1; b++) {
+    i = b * MIO_PARTICLE_BLOCK;
+    end = MIO_MIN(i + MIO_PARTICLE_BLOCK, ps->count);
+    k = ps->blocks[b];
+    for (; i < end; i += 4) {
+      x = _mm_loadu_ps(a->x + i);
+      y = _mm_loadu_ps(a->y + i);
+      vx = _mm_add_ps(_mm_loadu_ps(a->vx + i), gx);
+      vy = _mm_add_ps(_mm_loadu_ps(a->vy + i), gy);
+      life = _mm_sub_ps(_mm_loadu_ps(a->life + i), dt);
+      mask = _mm_movemask_ps(_mm_cmpgt_ps(life, zero));
+      if (end - i < 4) { mask &= (1 << (end - i)) - 1; }
+      if (!mask) { continue; }
+      if (field) {
+        cx = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(x, cell)), wrap);
+        cy = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(y, cell)), wrap);
+        _mm_storeu_si128((__m128i *)idx,
+            _mm_add_epi32(_mm_slli_epi32(cy, MIO_PARTICLE_FIELD_SHIFT), cx));
+        fx = _mm_set_ps(ps->fieldX[idx[3]], ps->fieldX[idx[2]],
+            ps->fieldX[idx[1]], ps->fieldX[idx[0]]);
+        fy = _mm_set_ps(ps->fieldY[idx[3]], ps->fieldY[idx[2]],
+            ps->fieldY[idx[1]], ps->fieldY[idx[0]]);
+        vx = _mm_add_ps(vx, _mm_mul_ps(fx, turb));
+        vy = _mm_add_ps(vy, _mm_mul_ps(fy, turb));
+      }
+      vx = _mm_mul_ps(vx, damp);
+      vy = _mm_mul_ps(vy, damp);
+      x = _mm_add_ps(x, _mm_mul_ps(vx, dt));
+      y = _mm_add_ps(y, _mm_mul_ps(vy, dt));
+      if (mask == 15) {
+        _mm_storeu_ps(o->x + k, x);
+        _mm_storeu_ps(o->y + k, y);
+        _mm_storeu_ps(o->vx + k, vx);
+        _mm_storeu_ps(o->vy + k, vy);
+        _mm_storeu_ps(o->life + k, life);
+        _mm_storeu_ps(o->invLife + k, _mm_loadu_ps(a->invLife + i));
+        _mm_storeu_ps(o->size + k, _mm_loadu_ps(a->size + i));
+        _mm_storeu_si128((__m128i *)(o->colour + k),
+            _mm_loadu_si128((const __m128i *)(a->colour + i)));
+        k += 4;
+        continue;
+      }
+      /* stream compaction: only surviving lanes are written, in order */
+      _mm_storeu_ps(tx, x);
+      _mm_storeu_ps(ty, y);
+      _mm_storeu_ps(tvx, vx);
+      _mm_storeu_ps(tvy, vy);
+      _mm_storeu_ps(tlife, life);
+      for (j = 0; j < 4; j++) {
+        if (!(mask >> j & 1)) { continue; }
+        o->x[k] = tx[j];
+        o->y[k] = ty[j];
+        o->vx[k] = tvx[j];
+        o->vy[k] = tvy[j];
+        o->life[k] = tlife[j];
+        o->invLife[k] = a->invLife[i + j];
+        o->size[k] = a->size[i + j];
+        o->colour[k] = a->colour[i + j];
+        k++;
+      }
+    }
+  }
+}
+
+MIO_GLOBAL int32 mio_particles_begin(mioParticles *ps, real32 dt) {
+  ps->dt = dt;
+  ps->time += dt;
+  if (ps->turbulence != 0.0f) { mio_particles_field(ps); }
+  return (ps->count + MIO_PARTICLE_BLOCK - 1) / MIO_PARTICLE_BLOCK;
+}
+
+MIO_GLOBAL void mio_particles_gather(mioParticles *ps, int32 blocks) {
+  int32 b, n, total = 0;
+  for (b = 0; b < blocks; b++) {
+    n = ps->blocks[b];
+    ps->blocks[b] = total;
+    total += n;
+  }
+  ps->blocks[blocks] = total;
+}
+
+MIO_GLOBAL void mio_particles_end(mioParticles *ps, int32 blocks) {
+  ps->count = ps->blocks[blocks];
+  ps->front ^= 1;
+}
+
+void mio_particles_update(mioParticles *ps, real32 dt) {
+  int32 blocks = mio_particles_begin(ps, dt);
+  mio_particles_count_rows(ps, 0, blocks);
+  mio_particles_gather(ps, blocks);
+  mio_particles_update_rows(ps, 0, blocks);
+  mio_particles_end(ps, blocks);
+}
+
+MIO_GLOBAL void mio_particles_span(
+    uint32 *dst, int32 n, uint32 premul, int32 inv, int32 additive) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i s = _mm_set1_epi32((int32)premul);
+  __m128i s16 = _mm_unpacklo_epi8(s, zero);
+  __m128i i16 = _mm_set1_epi16((int16)inv);
+  __m128i amask = _mm_set1_epi32((int32)0xFF000000);
+  __m128i d, lo, hi;
+  int32 i = 0;
+  if (additive) {
+    for (; i + 4 <= n; i += 4) {
+      d = _mm_loadu_si128((const __m128i *)(dst + i));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(d, s));
+    }
+    for (; i < n; i++) {
+      d = _mm_adds_epu8(_mm_cvtsi32_si128((int32)dst[i]), s);
+      dst[i] = (uint32)_mm_cvtsi128_si32(d);
+    }
+    return;
+  }
+  s16 = _mm_slli_epi16(s16, 8);
+  for (; i + 4 <= n; i += 4) {
+    d = _mm_loadu_si128((const __m128i *)(dst + i));
+    lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), i16), s16);
+    hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), i16), s16);
+    lo = _mm_srli_epi16(lo, 8);
+    hi = _mm_srli_epi16(hi, 8);
+    _mm_storeu_si128(
+        (__m128i *)(dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), amask));
+  }
+  for (; i < n; i++) {
+    d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int32)dst[i]), zero);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d, i16), s16), 8);
+    dst[i] = (uint32)_mm_cvtsi128_si32(_mm_packus_epi16(lo, lo)) | 0xFF000000;
+  }
+}
+
+MIO_GLOBAL SYSRET mio_particles_clip(int32 *clip, int32 y0, int32 y1) {
+  clip[0] = MIO_MAX((int32)G_APP.render.clip.x1, 0);
+  clip[1] = MIO_MIN((int32)G_APP.render.clip.x2, G_APP.render.width);
+  clip[2] = MIO_MAX((int32)G_APP.render.clip.y1, y0);
+  clip[3] = MIO_MIN((int32)G_APP.render.clip.y2, y1);
+  return clip[0] < clip[1] && clip[2] < clip[3];
+}
+
+/* Cull four particles against clip; lo/hi get each lane's first and last
+   32-row strip, using the same rows mio_particles_splat covers. Culled
+   lanes get hi == lo on a valid strip, so callers need not branch. */
+MIO_GLOBAL int32 mio_particles_cull(
+    const mioParticles *ps, int32 i, const int32 *clip, int32 *lo, int32 *hi) {
+  const mioParticleArrays *a = &ps->buffers[ps->front];
+  __m128 round = _mm_set1_ps(0.5f);
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 half = _mm_mul_ps(_mm_loadu_ps(a->size + i), round);
+  __m128 x = _mm_loadu_ps(a->x + i);
+  __m128 y = _mm_loadu_ps(a->y + i);
+  __m128 big = _mm_cmpgt_ps(half, round);
+  __m128 top, bottom, left, right, ylo, yhi, vis;
+  __m128i r0, r1;
+  int32 mask;
+  /* sub-pixel particles cover the single pixel at floor(x), floor(y) */
+  left = _mm_or_ps(
+      _mm_and_ps(big, _mm_add_ps(_mm_sub_ps(x, half), round)),
+      _mm_andnot_ps(big, x));
+  right = _mm_or_ps(
+      _mm_and_ps(big, _mm_add_ps(_mm_add_ps(x, half), round)),
+      _mm_andnot_ps(big, _mm_add_ps(x, one)));
+  top = _mm_or_ps(
+      _mm_and_ps(big, _mm_add_ps(_mm_sub_ps(y, half), round)),
+      _mm_andnot_ps(big, y));
+  bottom = _mm_or_ps(
+      _mm_and_ps(big, _mm_add_ps(_mm_add_ps(y, half), round)),
+      _mm_andnot_ps(big, _mm_add_ps(y, one)));
+  ylo = _mm_set1_ps((real32)clip[2]);
+  yhi = _mm_set1_ps((real32)clip[3]);
+  vis = _mm_and_ps(
+      _mm_and_ps(_mm_cmpgt_ps(bottom, ylo), _mm_cmplt_ps(top, yhi)),
+      _mm_and_ps(
+          _mm_cmpgt_ps(right, _mm_set1_ps((real32)clip[0])),
+          _mm_cmplt_ps(left, _mm_set1_ps((real32)clip[1]))));
+  mask = _mm_movemask_ps(vis);
+  if (ps->count - i < 4) { mask &= (1 << (ps->count - i)) - 1; }
+  top = _mm_min_ps(_mm_max_ps(top, ylo), _mm_set1_ps((real32)(clip[3] - 1)));
+  r0 = _mm_srai_epi32(_mm_cvttps_epi32(top), MIO_PARTICLE_BIN_SHIFT);
+  r1 = _mm_cvttps_epi32(_mm_min_ps(bottom, yhi));
+  r1 = _mm_sub_epi32(r1, _mm_set1_epi32(1));
+  r1 = _mm_srai_epi32(r1, MIO_PARTICLE_BIN_SHIFT);
+  r1 = _mm_or_si128(
+      _mm_and_si128(_mm_castps_si128(vis), r1),
+      _mm_andnot_si128(_mm_castps_si128(vis), r0));
+  _mm_storeu_si128((__m128i *)lo, r0);
+  _mm_storeu_si128((__m128i *)hi, r1);
+  return mask;
+}
+
+MIO_GLOBAL void mio_particles_splat(
+    const mioParticles *ps, int32 j, const int32 *clip) {
+  const mioParticleArrays *a = &ps->buffers[ps->front];
+  uint32 *colour = G_APP.render.colourData;
+  int32 stride = G_APP.render.width;
+  int32 x1, x2, yy1, yy2, alpha, inv;
+  int32 additive = ps->blend == MIO_PARTICLE_ADDITIVE;
+  real32 half, fade;
+  uint32 c = a->colour[j], premul;
+  fade = MIO_MIN(a->life[j] * a->invLife[j], 1.0f);
+  alpha = (int32)((real32)(c >> 24) * fade + 0.5f);
+  if (!alpha) { return; }
+  alpha += alpha >> 7;
+  inv = 256 - alpha;
+  premul = ((((c & 0xFF00FF) * alpha) >> 8) & 0xFF00FF) |
+           ((((c & 0xFF00) * alpha) >> 8) & 0xFF00);
+  half = a->size[j] * 0.5f;
+  if (half <= 0.5f) {
+    x1 = (int32)floor(a->x[j]);
+    yy1 = (int32)floor(a->y[j]);
+    if (x1 >= clip[0] && x1 < clip[1] && yy1 >= clip[2] && yy1 < clip[3]) {
+      mio_particles_span(colour + yy1 * stride + x1, 1, premul, inv, additive);
+    }
+    return;
+  }
+  x1 = MIO_MAX((int32)floor(a->x[j] - half + 0.5f), clip[0]);
+  x2 = MIO_MIN((int32)floor(a->x[j] + half + 0.5f), clip[1]);
+  yy1 = MIO_MAX((int32)floor(a->y[j] - half + 0.5f), clip[2]);
+  yy2 = MIO_MIN((int32)floor(a->y[j] + half + 0.5f), clip[3]);
+  for (; x1 < x2 && yy1 < yy2; yy1++) {
+    mio_particles_span(
+        colour + yy1 * stride + x1, x2 - x1, premul, inv, additive);
+  }
+}
+
+MIO_GLOBAL void mio_particles_draw_rows(void *data, int32 y0, int32 y1) {
+  mioParticles *ps = (mioParticles *)data;
+  int32 clip[4], lo[4], hi[4];
+  int32 i, j, mask;
+  if (!mio_particles_clip(clip, y0, y1)) { return; }
+  for (i = 0; i < ps->count; i += 4) {
+    mask = mio_particles_cull(ps, i, clip, lo, hi);
+    for (j = i; mask; j++, mask >>= 1) {
+      if (mask & 1) { mio_particles_splat(ps, j, clip); }
+    }
+  }
+}
+
+MIO_GLOBAL int32 mio_particles_bin_begin(mioParticles *ps) {
+  int32 blocks = (ps->count + MIO_PARTICLE_BLOCK - 1) / MIO_PARTICLE_BLOCK;
+  int32 cap, need;
+  ps->bins = (G_APP.render.height + (1 << MIO_PARTICLE_BIN_SHIFT) - 1) >>
+             MIO_PARTICLE_BIN_SHIFT;
+  need = blocks * ps->bins;
+  if (need > ps->binCountsCapacity) {
+    cap = need + need / 2;
+    sys_free(ps->binCounts);
+    ps->binCounts = (int32 *)sys_alloc(cap * (int32)sizeof(int32));
+    ps->binCountsCapacity = ps->binCounts ? cap : 0;
+    if (!ps->binCounts) { return 0; }
+  }
+  if (ps->bins + 1 > ps->binStartCapacity) {
+    cap = ps->bins + 1;
+    sys_free(ps->binStart);
+    ps->binStart = (int32 *)sys_alloc(cap * (int32)sizeof(int32));
+    ps->binStartCapacity = ps->binStart ? cap : 0;
+    if (!ps->binStart) { return 0; }
+  }
+  return blocks;
+}
+
+MIO_GLOBAL void mio_particles_bin_count_rows(void *data, int32 b0, int32 b1) {
+  mioParticles *ps = (mioParticles *)data;
+  int32 clip[4], lo[4], hi[4];
+  int32 b, i, j, k, end, mask, *counts;
+  mio_particles_clip(clip, 0, G_APP.render.height);
+  for (b = b0; b < b1; b++) {
+    counts = ps->binCounts + b * ps->bins;
+    memset(counts, 0, ps->bins * sizeof(int32));
+    end = MIO_MIN((b + 1) * MIO_PARTICLE_BLOCK, ps->count);
+    for (i = b * MIO_PARTICLE_BLOCK; i < end; i += 4) {
+      mask = mio_particles_cull(ps, i, clip, lo, hi);
+      for (j = 0; j < 4; j++) {
+        counts[lo[j]] += mask >> j & 1;
+        for (k = lo[j] + 1; k <= hi[j]; k++) { counts[k]++; }
+      }
+    }
+  }
+}
+
+/* Bin-major prefix sum, blocks in order within a bin, so each strip keeps
+   the particles' draw order. */
+MIO_GLOBAL SYSRET mio_particles_bin_gather(mioParticles *ps, int32 blocks) {
+  int32 b, k, n, cap, total = 0;
+  for (k = 0; k < ps->bins; k++) {
+    ps->binStart[k] = total;
+    for (b = 0; b < blocks; b++) {
+      n = ps->binCounts[b * ps->bins + k];
+      ps->binCounts[b * ps->bins + k] = total;
+      total += n;
+    }
+  }
+  ps->binStart[ps->bins] = total;
+  if (total > ps->binIndexCapacity) {
+    cap = MIO_MAX(total + total / 2, 1024);
+    sys_free(ps->binIndex);
+    ps->binIndex = (int32 *)sys_alloc(cap * (int32)sizeof(int32));
+    ps->binIndexCapacity = ps->binIndex ? cap : 0;
+    if (!ps->binIndex) { return FALSE; }
+  }
+  return TRUE;
+}
+
+MIO_GLOBAL void mio_particles_bin_fill_rows(void *data, int32 b0, int32 b1) {
+  mioParticles *ps = (mioParticles *)data;
+  int32 clip[4], lo[4], hi[4];
+  int32 b, i, j, k, end, mask, *cursor;
+  mio_particles_clip(clip, 0, G_APP.render.height);
+  for (b = b0; b < b1; b++) {
+    cursor = ps->binCounts + b * ps->bins;
+    end = MIO_MIN((b + 1) * MIO_PARTICLE_BLOCK, ps->count);
+    for (i = b * MIO_PARTICLE_BLOCK; i < end; i += 4) {
+      mask = mio_particles_cull(ps, i, clip, lo, hi);
+      for (j = 0; mask; j++, mask >>= 1) {
+        if (!(mask & 1)) { continue; }
+        for (k = lo[j]; k <= hi[j]; k++) {
+          ps->binIndex[cursor[k]++] = i + j;
+        }
+      }
+    }
+  }
+}
+
+/* Band worker for draw_mt: walks only the strips overlapping its rows, and
+   clips each strip's particles to the strip so none is drawn twice. */
+MIO_GLOBAL void mio_particles_draw_bins(void *data, int32 y0, int32 y1) {
+  mioParticles *ps = (mioParticles *)data;
+  int32 clip[4], strip[4];
+  int32 i, k, last;
+  if (!mio_particles_clip(clip, y0, y1)) { return; }
+  strip[0] = clip[0];
+  strip[1] = clip[1];
+  last = (clip[3] - 1) >> MIO_PARTICLE_BIN_SHIFT;
+  for (k = clip[2] >> MIO_PARTICLE_BIN_SHIFT; k <= last; k++) {
+    strip[2] = MIO_MAX(k << MIO_PARTICLE_BIN_SHIFT, clip[2]);
+    strip[3] = MIO_MIN((k + 1) << MIO_PARTICLE_BIN_SHIFT, clip[3]);
+    for (i = ps->binStart[k]; i < ps->binStart[k + 1]; i++) {
+      mio_particles_splat(ps, ps->binIndex[i], strip);
+    }
+  }
+}
+
+int32 mio_particles_draw(mioParticles *ps) {
+  if (!G_APP.render.colourData || !ps->count) { return 0; }
+  mio_particles_draw_rows(ps, 0, G_APP.render.height);
+  return ps->count;
+}
+
+
+/* @EXTRA ********************************************************************/
+
+MIO_GLOBAL mioVec3 G_3D_START_HIT;
+
+int32 mio_draw_heightmap(
+    int32 ix, int32 iy, int32 width, int32 height, real32 *values) {
+  int32 x, y;
+  int32 index;
+  real32 val;
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      index = (x) + (height - y) * width;
+      val = values[index] * 0.5f + 0.5f;
+      mio_set_colour(MIO_RGBA(val * 255, val * 255, val * 255, 255));
+      if (x + ix < G_APP.render.width && x + ix >= 0 &&
+          y + iy < G_APP.render.height && y + iy >= 0) {
+        MIO_DRAW_PIXEL(x + ix, y + iy);
+      }
+    }
+  }
+  return TRUE;
+}
+
+static mioVec3 mio_calculate_translation_hit(
+    mioCamera *cam, mioVec3 rayOrigin, mioVec3 rayDir, mioVec3 planeNormal,
+    mioVec3 planePoint) {
+  real32 t;
+  real32 denom = mio_vec3_dot(rayDir, planeNormal);
+  real32 planeD = -mio_vec3_dot(planeNormal, planePoint);
+  mioVec3 currentHitPosWorld = mio_vec3(0.0f, 0.0f, 0.0f);
+
+  if (fabs(denom) > MIO_EPSILON_F) {
+    t = -(mio_vec3_dot(rayOrigin, planeNormal) + planeD) / denom;
+
+    if (t > 0.0f) {
+      currentHitPosWorld = mio_vec3_add(rayOrigin, mio_vec3_scale(rayDir, t));
+    }
+  } else {
+    if (fabs(planeNormal.y) < 0.1f) {
+      mioVec3 fallbackNormal = mio_vec3(0.0f, 1.0f, 0.0f);
+      real32 fallbackD = -mio_vec3_dot(fallbackNormal, G_3D_START_HIT);
+      real32 fallbackDenom = mio_vec3_dot(rayDir, fallbackNormal);
+
+      if (fabs(fallbackDenom) > MIO_EPSILON_F) {
+        t = -(mio_vec3_dot(rayOrigin, fallbackNormal) + fallbackD) /
+            fallbackDenom;
+        if (t > 0.0f) {
+          currentHitPosWorld =
+              mio_vec3_add(rayOrigin, mio_vec3_scale(rayDir, t));
+        }
+      }
+    }
+  }
+  return currentHitPosWorld;
+}
+
+static void
+mio_get_mouse_ray(mioCamera *cam, mioVec3 *rayOrigin, mioVec3 *rayDir) {
+  mioMat4 camera_rot = mio_mat4_identity();
+  mioMat4 camera_pos = mio_mat4_identity();
   mioMat4 viewMatrix;
   mioMat4 projectionMatrix;
   mioSystemPoint mousePos;
@@ -7938,7 +12703,7 @@ void mio_3d_draw_triangle_immediate(
   verts[1].normal = mio_vec3(0, 1, 0);
   verts[2].normal = mio_vec3(0, 1, 0);
 
-  clipped_count = mio_clip_polygon(verts, 3, clipped_verts);
+  clipped_count = mio_3d_clip_triangle(verts, clipped_verts);
 
   if (clipped_count >= 3) {
     for (j = 0; j < clipped_count - 2; j++) {
@@ -8277,9 +13042,19 @@ typedef struct {
 
 typedef struct {
   mioWorker workers[MIO_THREAD_COUNT_MAX];
+  int32 workerCount;
   int32 terminate;
+  volatile LONG owner;
 } mioThreadPool;
 
+typedef void (*PFMIOROWPROC)(void *data, int32 y0, int32 y1);
+
+typedef struct {
+  PFMIOROWPROC rowProc;
+  void *data;
+  int32 y0, y1;
+} mioRowBand;
+
 MIO_GLOBAL mioThreadPool G_MIO_THREAD_POOL = {0};
 
 DWORD WINAPI mio_thread_worker(LPVOID lpParam) {
@@ -8299,7 +13074,11 @@ DWORD WINAPI mio_thread_worker(LPVOID lpParam) {
 
 void mio_thread_pool_init(void) {
   int32 i;
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
   G_MIO_THREAD_POOL.terminate = 0;
+  G_MIO_THREAD_POOL.workerCount =
+      MIO_CLAMP((int32)info.dwNumberOfProcessors, 1, MIO_THREAD_COUNT_MAX);
   for (i = 0; i < MIO_THREAD_COUNT_MAX; i++) {
     G_MIO_THREAD_POOL.workers[i].id = i;
     G_MIO_THREAD_POOL.workers[i].workAvailable =
@@ -8312,21 +13091,41 @@ void mio_thread_pool_init(void) {
   }
 }
 
+/* The pool runs one dispatch at a time. The main thread, the render thread
+   and the pngl band runner all share it, so whoever claims it first owns
+   it until its jobs finish. A dispatch that finds the pool owned, including
+   one made from inside a pool job, runs its items inline on the calling
+   thread instead of waiting. */
 void mio_thread_pool_dispatch(mioWorkItem *items, int32 count) {
   int32 i;
+  LONG self = (LONG)GetCurrentThreadId();
   HANDLE doneHandles[MIO_THREAD_COUNT_MAX];
-  for (i = 0; i < count && i < MIO_THREAD_COUNT_MAX; i++) {
+  count = MIO_MIN(count, MIO_THREAD_COUNT_MAX);
+  if (count > G_MIO_THREAD_POOL.workerCount ||
+      InterlockedCompareExchange(&G_MIO_THREAD_POOL.owner, self, 0) != 0) {
+    for (i = 0; i < count; i++) {
+      if (items[i].jobProc) { items[i].jobProc(items[i].data); }
+    }
+    return;
+  }
+  for (i = 0; i < count; i++) {
     G_MIO_THREAD_POOL.workers[i].work = &items[i];
     G_MIO_THREAD_POOL.workers[i].isWorking = 1;
     doneHandles[i] = G_MIO_THREAD_POOL.workers[i].workDone;
     SetEvent(G_MIO_THREAD_POOL.workers[i].workAvailable);
   }
   WaitForMultipleObjects(count, doneHandles, TRUE, INFINITE);
+  InterlockedExchange(&G_MIO_THREAD_POOL.owner, 0);
 }
 
+
 void mio_thread_pool_shutdown(void) {
   int32 i;
   G_MIO_THREAD_POOL.terminate = 1;
+  G_MIO_THREAD_POOL.workerCount = 0;
+#ifdef PNGL_WRITE_IMPLEMENTATION
+  pngl_write_set_parallel(NULL, 1);
+#endif
   for (i = 0; i < MIO_THREAD_COUNT_MAX; i++) {
     SetEvent(G_MIO_THREAD_POOL.workers[i].workAvailable);
   }
@@ -8337,6 +13136,341 @@ void mio_thread_pool_shutdown(void) {
     CloseHandle(G_MIO_THREAD_POOL.workers[i].workDone);
   }
 }
+
+MIO_GLOBAL void mio_thread_row_band(void *data) {
+  mioRowBand *band = (mioRowBand *)data;
+  band->rowProc(band->data, band->y0, band->y1);
+}
+
+void mio_thread_parallel_rows(
+    PFMIOROWPROC rowProc, void *data, int32 y0, int32 y1, int32 grain) {
+  int32 i, count, rows, per;
+  mioRowBand bands[MIO_THREAD_COUNT_MAX];
+  mioWorkItem items[MIO_THREAD_COUNT_MAX];
+  rows = y1 - y0;
+  if (rows <= 0) { return; }
+  grain = MIO_MAX(grain, 8);
+  count = MIO_MIN(G_MIO_THREAD_POOL.workerCount, rows / grain);
+  if (count <= 1) {
+    rowProc(data, y0, y1);
+    return;
+  }
+  per = ((rows + count - 1) / count + 7) & ~7;
+  for (i = 0; i < count && y0 < y1; i++) {
+    bands[i].rowProc = rowProc;
+    bands[i].data = data;
+    bands[i].y0 = y0;
+    bands[i].y1 = MIO_MIN(y0 + per, y1);
+    items[i].jobProc = mio_thread_row_band;
+    items[i].data = &bands[i];
+    y0 = bands[i].y1;
+  }
+  mio_thread_pool_dispatch(items, i);
+}
+
+#ifdef PNGL_WRITE_IMPLEMENTATION
+MIO_GLOBAL void mio_png_write_parallel(
+    pngl_write_band_func *func, void *data, int count) {
+  int32 i, n;
+  mioRowBand bands[MIO_THREAD_COUNT_MAX];
+  mioWorkItem items[MIO_THREAD_COUNT_MAX];
+  n = MIO_MIN(count, MIO_THREAD_COUNT_MAX);
+  for (i = 0; i < n; i++) {
+    bands[i].rowProc = func;
+    bands[i].data = data;
+    bands[i].y0 = count * i / n;
+    bands[i].y1 = count * (i + 1) / n;
+    items[i].jobProc = mio_thread_row_band;
+    items[i].data = &bands[i];
+  }
+  mio_thread_pool_dispatch(items, n);
+}
+
+void mio_png_write_threaded(int32 enabled) {
+  if (enabled && G_MIO_THREAD_POOL.workerCount > 1) {
+    pngl_write_set_parallel(
+        mio_png_write_parallel, G_MIO_THREAD_POOL.workerCount);
+  } else {
+    pngl_write_set_parallel(NULL, 1);
+  }
+}
+#endif
+
+MIO_GLOBAL void mio_post_process_mt(
+    const uint32 *src, uint32 *dst, int32 w, int32 h, int32 levels,
+    int32 mode) {
+  mioPostProcess pp;
+  if (!src || !dst || w <= 0 || h <= 0) { return; }
+  pp.src = src;
+  pp.dst = dst;
+  pp.srcStride = w;
+  pp.dstStride = w;
+  pp.x0 = 0;
+  pp.x1 = w;
+  pp.levels = levels;
+  pp.mode = mode;
+  mio_thread_parallel_rows(mio_post_process_rows, &pp, 0, h, 32);
+}
+
+void mio_draw_quantize_mt(
+    const uint32 *src, uint32 *dst, int32 w, int32 h, int32 levels) {
+  mio_post_process_mt(src, dst, w, h, levels, MIO_POST_QUANTIZE);
+}
+
+void mio_draw_dither_mt(
+    const uint32 *src, uint32 *dst, int32 w, int32 h, int32 levels) {
+  mio_post_process_mt(src, dst, w, h, levels, MIO_POST_DITHER);
+}
+
+void mio_draw_dither_perceptual_mt(
+    const uint32 *src, uint32 *dst, int32 w, int32 h, int32 levels) {
+  mio_post_process_mt(src, dst, w, h, levels, MIO_POST_DITHER_PERCEPTUAL);
+}
+
+void mio_draw_upscale_mt(
+    const uint32 *src, int32 sw, int32 sh, uint32 *dst, int32 dw, int32 dh,
+    int32 mode) {
+  mioUpscale up;
+  if (!src || !dst || sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) { return; }
+  up.src = src;
+  up.dst = dst;
+  up.sw = sw;
+  up.sh = sh;
+  up.dw = dw;
+  up.dh = dh;
+  up.mode = mode;
+  mio_thread_parallel_rows(mio_upscale_rows, &up, 0, dh, 32);
+}
+
+int32 mio_sprite_batch_flush_mt(mioSpriteBatch *batch) {
+  if (!G_APP.render.colourData || !batch->count) { return 0; }
+  mio_sprite_batch_prepare(batch);
+  mio_thread_parallel_rows(
+      mio_sprite_batch_rows, batch, 0, G_APP.render.height, 32);
+  batch->count = 0;
+  return batch->drawn;
+}
+
+MIO_GLOBAL void mio_physics_solve_mt(mioPhysicsWorld *w) {
+  int32 i, k = 0, count;
+  mioRowBand bands[MIO_THREAD_COUNT_MAX];
+  mioWorkItem items[MIO_THREAD_COUNT_MAX];
+  count = MIO_MIN(G_MIO_THREAD_POOL.workerCount, w->islandCount);
+  if (count <= 1) {
+    mio_physics_solve_rows(w, 0, w->islandCount);
+    return;
+  }
+  bands[0].y0 = 0;
+  for (i = 0; i < w->islandCount && k < count - 1; i++) {
+    if (w->islandStart[i + 1] >=
+        (int32)((real64)w->contactCount * (k + 1) / count)) {
+      bands[k].y1 = i + 1;
+      bands[++k].y0 = i + 1;
+    }
+  }
+  bands[k++].y1 = w->islandCount;
+  for (i = 0; i < k; i++) {
+    bands[i].rowProc = mio_physics_solve_rows;
+    bands[i].data = w;
+    items[i].jobProc = mio_thread_row_band;
+    items[i].data = &bands[i];
+  }
+  mio_thread_pool_dispatch(items, k);
+}
+
+void mio_physics_step_mt(mioPhysicsWorld *w, real32 dt) {
+  if (!w->count) { return; }
+  if (mio_physics_begin(w, dt)) {
+    mio_thread_parallel_rows(mio_physics_prepare_rows, w, 0, w->count, 512);
+    mio_physics_grid(w);
+    mio_thread_parallel_rows(mio_physics_count_rows, w, 0, w->count, 256);
+    if (mio_physics_gather(w)) {
+      mio_thread_parallel_rows(mio_physics_fill_rows, w, 0, w->count, 256);
+      mio_physics_islands(w);
+      mio_physics_solve_mt(w);
+    }
+  }
+  mio_thread_parallel_rows(mio_physics_integrate_rows, w, 0, w->count, 1024);
+  mio_physics_end(w);
+}
+
+void mio_particles_update_mt(mioParticles *ps, real32 dt) {
+  int32 blocks = mio_particles_begin(ps, dt);
+  mio_thread_parallel_rows(mio_particles_count_rows, ps, 0, blocks, 8);
+  mio_particles_gather(ps, blocks);
+  mio_thread_parallel_rows(mio_particles_update_rows, ps, 0, blocks, 8);
+  mio_particles_end(ps, blocks);
+}
+
+int32 mio_particles_draw_mt(mioParticles *ps) {
+  int32 clip[4], blocks;
+  if (!G_APP.render.colourData || !ps->count) { return 0; }
+  if (!mio_particles_clip(clip, 0, G_APP.render.height)) { return ps->count; }
+  /* with one worker, or only a few blocks, culling the whole array per band
+     is cheaper than binning it */
+  blocks = 0;
+  if (G_MIO_THREAD_POOL.workerCount > 1 &&
+      ps->count >= 16 * MIO_PARTICLE_BLOCK) {
+    blocks = mio_particles_bin_begin(ps);
+  }
+  if (blocks) {
+    mio_thread_parallel_rows(mio_particles_bin_count_rows, ps, 0, blocks, 8);
+    if (mio_particles_bin_gather(ps, blocks)) {
+      mio_thread_parallel_rows(mio_particles_bin_fill_rows, ps, 0, blocks, 8);
+      mio_thread_parallel_rows(
+          mio_particles_draw_bins, ps, 0, G_APP.render.height, 32);
+      return ps->count;
+    }
+  }
+  mio_thread_parallel_rows(
+      mio_particles_draw_rows, ps, 0, G_APP.render.height, 32);
+  return ps->count;
+}
+
+void mio_3d_fog_apply_mt(void) {
+  mioFogPass fp;
+  if (!G_APP.render.colourData || !G_APP.render.depthData) { return; }
+  fp.colour = G_APP.render.colourData;
+  fp.depth = G_APP.render.depthData;
+  fp.stride = G_APP.render.width;
+  fp.width = G_APP.render.width;
+  mio_thread_parallel_rows(mio_3d_fog_rows, &fp, 0, G_APP.render.height, 32);
+}
+
+MIO_GLOBAL DWORD WINAPI mio_pipeline_thread(LPVOID lpParam) {
+  mioPipeline *pl = &G_APP.pipeline;
+  (void)lpParam;
+  for (;;) {
+    WaitForSingleObject(pl->kick, INFINITE);
+    if (pl->quit) { break; }
+    mio_render_frame(pl->size.width, pl->size.height);
+    pl->width[pl->back] = G_APP.render.width;
+    pl->height[pl->back] = G_APP.render.height;
+    InterlockedExchange(&pl->busy, 0);
+    SetEvent(pl->done);
+  }
+  return 0;
+}
+
+/* Threading contract for mio_app_set_pipelined(TRUE):
+   - draw runs on the render thread while the main thread pumps messages,
+     presents the previous frame and sleeps until the next tick.
+   - By default the main thread waits for the frame in flight before it
+     runs update and physics, so update and draw never overlap.
+   - mio_app_set_draw_snapshot(sizeof(state)) lets update overlap draw.
+     The app state is copied when the frame is kicked, and draw receives
+     the copy. The copy is shallow, so anything that draw reads through
+     pointers in the state must not change during update.
+   - Both threads may call the *_mt helpers. The pool runs one dispatch at
+     a time and a competing dispatch falls back to serial on its caller. */
+void mio_app_set_pipelined(int32 enabled) {
+  G_APP.pipeline.enabled = enabled;
+}
+
+void mio_app_set_draw_snapshot(int32 stateSize) {
+  G_APP.pipeline.drawStateSize = MIO_MAX(stateSize, 0);
+}
+
+SYSRET mio_pipeline_start(void) {
+  mioPipeline *pl = &G_APP.pipeline;
+  if (pl->thread || !G_APP.render.colourData) { return FALSE; }
+  pl->colour[0] = G_APP.render.colourData;
+  pl->colour[1] = (uint32 *)sys_alloc((int32)G_APP.render.maxFramebufferSize);
+  if (!pl->colour[1]) { return FALSE; }
+  pl->drawState = NULL;
+  if (pl->drawStateSize > 0 && G_APP.state) {
+    pl->drawState = sys_alloc(pl->drawStateSize);
+    if (!pl->drawState) {
+      sys_free(pl->colour[1]);
+      pl->colour[1] = NULL;
+      return FALSE;
+    }
+  }
+  pl->front = -1;
+  pl->back = 0;
+  pl->inFlight = FALSE;
+  pl->busy = 0;
+  pl->quit = 0;
+  pl->kick = CreateEvent(NULL, FALSE, FALSE, NULL);
+  pl->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+  pl->thread = CreateThread(
+      NULL, 0, (LPTHREAD_START_ROUTINE)mio_pipeline_thread, NULL, 0, NULL);
+  if (!pl->thread) {
+    CloseHandle(pl->kick);
+    CloseHandle(pl->done);
+    sys_free(pl->colour[1]);
+    if (pl->drawState) { sys_free(pl->drawState); }
+    pl->colour[1] = NULL;
+    pl->drawState = NULL;
+    return FALSE;
+  }
+  sys_log("Render pipeline started.\n");
+  return TRUE;
+}
+
+MIO_GLOBAL void mio_pipeline_wait(void) {
+  MSG msg;
+  mioPipeline *pl = &G_APP.pipeline;
+  while (InterlockedCompareExchange(&pl->busy, 0, 0)) {
+    if (MsgWaitForMultipleObjects(
+            1, &pl->done, FALSE, INFINITE, QS_ALLINPUT) == WAIT_OBJECT_0 + 1) {
+      while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+      }
+    }
+  }
+}
+
+void mio_pipeline_stop(void) {
+  mioPipeline *pl = &G_APP.pipeline;
+  if (!pl->thread) { return; }
+  while (InterlockedCompareExchange(&pl->busy, 0, 0)) {
+    WaitForSingleObject(pl->done, 100);
+  }
+  InterlockedExchange(&pl->quit, 1);
+  SetEvent(pl->kick);
+  WaitForSingleObject(pl->thread, INFINITE);
+  CloseHandle(pl->thread);
+  CloseHandle(pl->kick);
+  CloseHandle(pl->done);
+  G_APP.render.colourData = pl->colour[0];
+  sys_free(pl->colour[1]);
+  if (pl->drawState) { sys_free(pl->drawState); }
+  pl->thread = NULL;
+  pl->colour[1] = NULL;
+  pl->drawState = NULL;
+  pl->front = -1;
+  pl->inFlight = FALSE;
+}
+
+MIO_GLOBAL const uint32 *mio_pipeline_front(int32 *w, int32 *h) {
+  mioPipeline *pl = &G_APP.pipeline;
+  if (pl->front < 0) { return NULL; }
+  *w = pl->width[pl->front];
+  *h = pl->height[pl->front];
+  return pl->colour[pl->front];
+}
+
+void mio_pipeline_frame(real64 dt) {
+  mioPipeline *pl = &G_APP.pipeline;
+  if (!pl->thread) { return; }
+  mio_pipeline_wait();
+  if (pl->inFlight) {
+    pl->front = pl->back;
+    pl->back ^= 1;
+  }
+  pl->size = sys_get_window_size();
+  if (pl->drawState) { memcpy(pl->drawState, G_APP.state, pl->drawStateSize); }
+  G_APP.render.colourData = pl->colour[pl->back];
+  mio_3d_camera_update(
+      &G_APP.render.camera, G_APP.render.width, G_APP.render.height, TRUE,
+      (real32)dt);
+  pl->inFlight = TRUE;
+  InterlockedExchange(&pl->busy, 1);
+  SetEvent(pl->kick);
+  sys_present();
+}
 #endif
 
 /* @LOADERS ******************************************************************/
@@ -8406,6 +13540,7 @@ int mio_strtoi(const char **str) {
 mioMesh mio_load_obj(const char *filepath) {
   uint8 *file_data;
   int32 file_size;
+  mioFileMap map;
   int32 f_count_actual;
   const char *current_line;
   const char *end_of_file;
@@ -8419,8 +13554,14 @@ mioMesh mio_load_obj(const char *filepath) {
   int32 f_count_target = 0;
   int32 i, len;
 
-  file_data = sys_load_file(filepath, &file_size);
-  if (!file_data) { return mesh; }
+  if (sys_map_file(filepath, &map) && map.terminated) {
+    file_data = (uint8 *)map.data;
+    file_size = map.size;
+  } else {
+    sys_unmap_file(&map);
+    file_data = sys_load_file(filepath, &file_size);
+    if (!file_data) { return mesh; }
+  }
 
   current_line = (const char *)file_data;
   end_of_file = current_line + file_size;
@@ -8464,7 +13605,11 @@ mioMesh mio_load_obj(const char *filepath) {
   mesh.indexCount = f_count_target;
 
   if (!temp_v || !temp_vt || !temp_vn || !mesh.vertices || !mesh.indices) {
-    sys_free(file_data);
+    if (map.data) {
+      sys_unmap_file(&map);
+    } else {
+      sys_free(file_data);
+    }
     sys_free(temp_v);
     sys_free(temp_vt);
     sys_free(temp_vn);
@@ -8592,7 +13737,11 @@ mioMesh mio_load_obj(const char *filepath) {
   mesh.vertexCount = f_count_actual;
   mesh.indexCount = f_count_actual;
 
-  sys_free(file_data);
+  if (map.data) {
+    sys_unmap_file(&map);
+  } else {
+    sys_free(file_data);
+  }
   sys_free(temp_v);
   sys_free(temp_vt);
   sys_free(temp_vn);
@@ -8608,89 +13757,1363 @@ uint32 mio_bmp_read_uint32(const uint8 *data) {
          ((uint32)data[3] << 24);
 }
 
-mioTexture mio_load_bmp(const char *filepath) {
-  uint8 *file_data;
-  int32 file_size;
-  mioTexture texture = {0};
-  uint32 data_offset;
-  uint32 header_size;
-  uint32 image_width;
-  uint32 image_height;
-  uint32 bits_per_pixel;
-  uint32 compression;
-  uint32 i, j;
-  uint32 row_padding;
-  uint32 row_size;
-  uint32 pixel_data_size;
-  uint32 temp_w;
-
-  file_data = sys_load_file(filepath, &file_size);
-  if (!file_data) {
-    sys_log("Failed to load file %s\n", filepath);
-    return texture;
+#define MIO_TEXTURE_CACHE_MAX 64
+
+typedef struct {
+  uint32 hash[2];
+  int32 size;
+  uint32 flags;
+  int32 refs;
+  mioTexture texture;
+} mioTextureCacheEntry;
+
+/* Shared by every thread that loads or frees textures; decoding happens
+   outside the lock, only lookups and inserts are serialised. */
+MIO_GLOBAL mioTextureCacheEntry G_TEXTURE_CACHE[MIO_TEXTURE_CACHE_MAX];
+MIO_GLOBAL int32 G_TEXTURE_CACHE_COUNT = 0;
+MIO_GLOBAL volatile LONG G_TEXTURE_CACHE_LOCK = 0;
+
+MIO_GLOBAL void mio_texture_cache_lock(void) {
+  while (InterlockedCompareExchange(&G_TEXTURE_CACHE_LOCK, 1, 0) != 0) {
+    Sleep(0);
   }
+}
 
-  if (file_size < 54 || mio_strncmp((const char *)file_data, "BM", 2) != 0) {
-    sys_log("Wrong file\n");
-    sys_free(file_data);
-    return texture;
+MIO_GLOBAL void mio_texture_cache_unlock(void) {
+  InterlockedExchange(&G_TEXTURE_CACHE_LOCK, 0);
+}
+
+MIO_GLOBAL mioTextureCacheEntry *
+mio_texture_cache_find(const uint32 *hash, int32 size, uint32 flags) {
+  mioTextureCacheEntry *entry;
+  int32 i;
+  for (i = 0; i < G_TEXTURE_CACHE_COUNT; i++) {
+    entry = &G_TEXTURE_CACHE[i];
+    if (entry->hash[0] == hash[0] && entry->hash[1] == hash[1] &&
+        entry->size == size && entry->flags == flags) {
+      return entry;
+    }
   }
+  return NULL;
+}
 
-  data_offset = mio_bmp_read_uint32(file_data + 10);
-  header_size = mio_bmp_read_uint32(file_data + 14);
-  image_width = mio_bmp_read_uint32(file_data + 18);
-  image_height = mio_bmp_read_uint32(file_data + 22);
-  bits_per_pixel = mio_bmp_read_uint16(file_data + 28);
-  compression = mio_bmp_read_uint32(file_data + 30);
+MIO_GLOBAL SYSRET
+mio_texture_alloc(mioTexture *tex, uint32 width, uint32 height, uint32 flags) {
+  uint32 w = width, h = height, total = width * height;
+  int32 levels = 1;
+  if (!width || !height || width > 32768 || height > 32768) { return FALSE; }
+  while ((flags & MIO_TEXTURE_MIPS) && (w > 1 || h > 1) &&
+         levels < MIO_TEXTURE_MIP_MAX) {
+    w = MIO_MAX(w >> 1, 1);
+    h = MIO_MAX(h >> 1, 1);
+    total += w * h;
+    levels++;
+  }
+  /* sys_alloc takes an int32 byte count; 32768^2 texels plus mips exceed it */
+  if (total > MIO_INT32_MAX / sizeof(uint32)) {
+    sys_log("Texture too large: %ux%u\n", width, height);
+    return FALSE;
+  }
+  tex->data = (uint32 *)sys_alloc((int32)(total * sizeof(uint32)));
+  if (!tex->data) {
+    sys_log("Failed to allocate texture memory: %dkb\n",
+            (int32)(total / 256));
+    return FALSE;
+  }
+  tex->width = width;
+  tex->height = height;
+  tex->mipCount = levels;
+  return TRUE;
+}
 
-  if (header_size < 40 || bits_per_pixel != 24 || compression != 0) {
+uint32 *mio_texture_mip(
+    const mioTexture *tex, int32 level, uint32 *width, uint32 *height) {
+  uint32 *data = tex->data;
+  uint32 w = tex->width, h = tex->height;
+  level = MIO_CLAMP(level, 0, MIO_MAX(tex->mipCount, 1) - 1);
+  while (level-- > 0) {
+    data += w * h;
+    w = MIO_MAX(w >> 1, 1);
+    h = MIO_MAX(h >> 1, 1);
+  }
+  if (width) { *width = w; }
+  if (height) { *height = h; }
+  return data;
+}
+
+MIO_GLOBAL uint32 mio_colour_premultiply(uint32 c) {
+  uint32 a = c >> 24;
+  uint32 rb = (c & 0x00FF00FF) * a + 0x00800080;
+  uint32 g = (c & 0x0000FF00) * a + 0x00008000;
+  rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+  g = ((g + ((g >> 8) & 0x0000FF00)) >> 8) & 0x0000FF00;
+  return (c & 0xFF000000) | rb | g;
+}
+
+MIO_GLOBAL void mio_texture_build_mips(mioTexture *tex) {
+  uint32 *src = tex->data, *dst;
+  uint32 sw = tex->width, sh = tex->height, dw, dh, x, y, x1, y1;
+  uint32 p0, p1, p2, p3, rb, ag;
+  int32 level;
+  for (level = 1; level < tex->mipCount; level++) {
+    dw = MIO_MAX(sw >> 1, 1);
+    dh = MIO_MAX(sh >> 1, 1);
+    dst = src + sw * sh;
+    for (y = 0; y < dh; y++) {
+      y1 = MIO_MIN(y * 2 + 1, sh - 1);
+      for (x = 0; x < dw; x++) {
+        x1 = MIO_MIN(x * 2 + 1, sw - 1);
+        p0 = src[y * 2 * sw + x * 2];
+        p1 = src[y * 2 * sw + x1];
+        p2 = src[y1 * sw + x * 2];
+        p3 = src[y1 * sw + x1];
+        rb = (p0 & 0x00FF00FF) + (p1 & 0x00FF00FF) + (p2 & 0x00FF00FF) +
+             (p3 & 0x00FF00FF) + 0x00020002;
+        ag = ((p0 >> 8) & 0x00FF00FF) + ((p1 >> 8) & 0x00FF00FF) +
+             ((p2 >> 8) & 0x00FF00FF) + ((p3 >> 8) & 0x00FF00FF) +
+             0x00020002;
+        dst[y * dw + x] =
+            ((rb >> 2) & 0x00FF00FF) | (((ag >> 2) & 0x00FF00FF) << 8);
+      }
+    }
+    src = dst;
+    sw = dw;
+    sh = dh;
+  }
+}
+
+MIO_GLOBAL SYSRET mio_texture_decode_bmp(
+    const uint8 *file, int32 size, uint32 flags, mioTexture *tex) {
+  uint32 data_offset, header_size, bits_per_pixel, compression;
+  uint32 row_size, x, y, alpha = 0;
+  int32 width, height, top_down;
+  const uint8 *src;
+  uint32 *dst;
+  if (size < 54 || mio_strncmp((const char *)file, "BM", 2) != 0) {
+    sys_log("Wrong file\n");
+    return FALSE;
+  }
+  data_offset = mio_bmp_read_uint32(file + 10);
+  header_size = mio_bmp_read_uint32(file + 14);
+  width = (int32)mio_bmp_read_uint32(file + 18);
+  height = (int32)mio_bmp_read_uint32(file + 22);
+  bits_per_pixel = mio_bmp_read_uint16(file + 28);
+  compression = mio_bmp_read_uint32(file + 30);
+  top_down = height < 0;
+  height = MIO_ABS(height);
+  if (compression == 3 && bits_per_pixel == 32 && size >= 66 &&
+      mio_bmp_read_uint32(file + 54) == 0x00FF0000 &&
+      mio_bmp_read_uint32(file + 58) == 0x0000FF00 &&
+      mio_bmp_read_uint32(file + 62) == 0x000000FF) {
+    compression = 0;
+  }
+  if (header_size < 40 || width <= 0 || height <= 0 || compression != 0 ||
+      (bits_per_pixel != 24 && bits_per_pixel != 32)) {
     sys_log(
-        "Wrong format: %d/40 %d/24 %d/0\n", header_size, bits_per_pixel,
+        "Wrong format: %d/40 %d/24,32 %d/0\n", header_size, bits_per_pixel,
         compression);
-    sys_free(file_data);
-    return texture;
+    return FALSE;
+  }
+  row_size = ((uint32)width * bits_per_pixel / 8 + 3) & ~3u;
+  if ((uint32)size < data_offset ||
+      ((uint32)size - data_offset) / row_size < (uint32)height) {
+    sys_log("Malformed file: %d/%d\n", size, data_offset + row_size * height);
+    return FALSE;
+  }
+  if (!mio_texture_alloc(tex, (uint32)width, (uint32)height, flags)) {
+    return FALSE;
+  }
+  for (y = 0; y < (uint32)height; y++) {
+    src = file + data_offset +
+          (top_down ? y : (uint32)height - 1 - y) * row_size;
+    dst = tex->data + y * (uint32)width;
+    if (bits_per_pixel == 32) {
+      memcpy(dst, src, (uint32)width * sizeof(uint32));
+      for (x = 0; x < (uint32)width; x++) { alpha |= dst[x]; }
+    } else {
+      for (x = 0; x < (uint32)width; x++, src += 3) {
+        dst[x] = 0xFF000000 | ((uint32)src[2] << 16) |
+                 ((uint32)src[1] << 8) | (uint32)src[0];
+      }
+    }
+  }
+  if (bits_per_pixel == 32 && !(alpha & 0xFF000000)) {
+    for (x = 0; x < (uint32)(width * height); x++) {
+      tex->data[x] |= 0xFF000000;
+    }
   }
+  return TRUE;
+}
 
-  row_size = (image_width * bits_per_pixel / 8);
-  row_padding = (4 - (row_size % 4)) % 4;
-  row_size += row_padding;
-  pixel_data_size = image_height * row_size;
-  if ((uint32)file_size < data_offset + pixel_data_size) {
-    sys_log(
-        "Malformed file: %d/%d\n", file_size, data_offset + pixel_data_size);
-    sys_free(file_data);
-    return texture;
+#ifdef INCLUDE_PNGL
+MIO_GLOBAL SYSRET mio_texture_decode_png(
+    const uint8 *file, int32 size, uint32 flags, mioTexture *tex) {
+  pngl_uc *rgba;
+  const uint32 *src;
+  uint32 i, p, count;
+  int32 w, h, n;
+  rgba = pngl_load_from_memory(file, size, &w, &h, &n, 4);
+  if (!rgba) {
+    sys_log("Failed to decode PNG: %s\n", pngl_failure_reason());
+    return FALSE;
+  }
+  if (!mio_texture_alloc(tex, (uint32)w, (uint32)h, flags)) {
+    pngl_image_free(rgba);
+    return FALSE;
+  }
+  src = (const uint32 *)rgba;
+  count = (uint32)w * (uint32)h;
+  for (i = 0; i < count; i++) {
+    p = src[i];
+    tex->data[i] =
+        (p & 0xFF00FF00) | ((p >> 16) & 0x000000FF) | ((p & 0x000000FF) << 16);
   }
+  pngl_image_free(rgba);
+  return TRUE;
+}
+#endif
 
-  texture.width = image_width;
-  texture.height = image_height;
-  temp_w = image_width;
-  texture.data = (uint32 *)sys_alloc(temp_w * image_height * sizeof(uint32));
-  if (!texture.data) {
-    sys_log(
-        "Failed to allocate texture memory: %dkb\n",
-        temp_w * image_height * sizeof(uint32) / 1024);
-    sys_free(file_data);
-    return texture;
+MIO_GLOBAL SYSRET mio_texture_decode(
+    const uint8 *file, int32 size, uint32 flags, mioTexture *tex) {
+  uint32 i, count;
+  SYSRET ok = FALSE;
+  memset(tex, 0, sizeof(*tex));
+  if (size >= 2 && file[0] == 'B' && file[1] == 'M') {
+    ok = mio_texture_decode_bmp(file, size, flags, tex);
+  } else if (size >= 8 && file[0] == 0x89 && file[1] == 'P' &&
+             file[2] == 'N' && file[3] == 'G') {
+#ifdef INCLUDE_PNGL
+    ok = mio_texture_decode_png(file, size, flags, tex);
+#else
+    sys_log("PNG support disabled (define MIO_PNGL)\n");
+#endif
+  } else {
+    sys_log("Unknown image format\n");
+  }
+  if (!ok) { return FALSE; }
+  if (flags & MIO_TEXTURE_PREMULTIPLY) {
+    count = tex->width * tex->height;
+    for (i = 0; i < count; i++) {
+      tex->data[i] = mio_colour_premultiply(tex->data[i]);
+    }
+  }
+  mio_texture_build_mips(tex);
+  return TRUE;
+}
+
+MIO_GLOBAL void mio_texture_hash(const uint8 *data, int32 size, uint32 *hash) {
+  uint32 h0 = 2166136261u, h1 = 5381u;
+  int32 i;
+  for (i = 0; i < size; i++) {
+    h0 = (h0 ^ data[i]) * 16777619u;
+    h1 = h1 * 33u + data[i];
   }
+  hash[0] = h0;
+  hash[1] = h1;
+}
 
-  for (i = 0; i < image_height; i++) {
-    for (j = 0; j < image_width; j++) {
-      uint32 pixel_index = (image_height - 1 - i) * image_width + j;
-      uint32 file_index = data_offset + i * row_size + j * 3;
-      uint8 b = file_data[file_index + 0];
-      uint8 g = file_data[file_index + 1];
-      uint8 r = file_data[file_index + 2];
-      texture.data[pixel_index] = MIO_RGBA(r, g, b, 0xFF);
+mioTexture mio_load_texture(const char *filepath, uint32 flags) {
+  mioTexture texture = {0};
+  mioTextureCacheEntry *entry;
+  mioFileMap map;
+  uint32 hash[2];
+  if (!sys_map_file(filepath, &map)) {
+    sys_log("Failed to load file %s\n", filepath);
+    return texture;
+  }
+  if (!(flags & MIO_TEXTURE_NO_CACHE)) {
+    mio_texture_hash(map.data, map.size, hash);
+    mio_texture_cache_lock();
+    entry = mio_texture_cache_find(hash, map.size, flags);
+    if (entry) {
+      entry->refs++;
+      texture = entry->texture;
     }
+    mio_texture_cache_unlock();
+    if (entry) {
+      sys_unmap_file(&map);
+      return texture;
+    }
+  }
+  if (!mio_texture_decode(map.data, map.size, flags, &texture)) {
+    sys_log("Failed to decode image: %s\n", filepath);
+    sys_unmap_file(&map);
+    return texture;
   }
+  if (!(flags & MIO_TEXTURE_NO_CACHE)) {
+    mio_texture_cache_lock();
+    entry = mio_texture_cache_find(hash, map.size, flags);
+    if (entry) {
+      /* another thread decoded the same image first */
+      entry->refs++;
+      sys_free(texture.data);
+      texture = entry->texture;
+    } else if (G_TEXTURE_CACHE_COUNT < MIO_TEXTURE_CACHE_MAX) {
+      entry = &G_TEXTURE_CACHE[G_TEXTURE_CACHE_COUNT++];
+      entry->hash[0] = hash[0];
+      entry->hash[1] = hash[1];
+      entry->size = map.size;
+      entry->flags = flags;
+      entry->refs = 1;
+      entry->texture = texture;
+    }
+    mio_texture_cache_unlock();
+  }
+  sys_unmap_file(&map);
   sys_log("Loaded image: %s %dx%d\n", filepath, texture.width, texture.height);
-  sys_free(file_data);
   return texture;
 }
 
+void mio_texture_free(mioTexture *texture) {
+  int32 i;
+  uint32 *data = NULL;
+  if (!texture || !texture->data) { return; }
+  mio_texture_cache_lock();
+  for (i = 0; i < G_TEXTURE_CACHE_COUNT; i++) {
+    if (G_TEXTURE_CACHE[i].texture.data == texture->data) { break; }
+  }
+  if (i == G_TEXTURE_CACHE_COUNT) {
+    data = texture->data;
+  } else if (--G_TEXTURE_CACHE[i].refs <= 0) {
+    data = texture->data;
+    G_TEXTURE_CACHE[i] = G_TEXTURE_CACHE[--G_TEXTURE_CACHE_COUNT];
+  }
+  mio_texture_cache_unlock();
+  if (data) { sys_free(data); }
+  memset(texture, 0, sizeof(*texture));
+}
+
+mioTexture mio_load_bmp(const char *filepath) {
+  return mio_load_texture(filepath, MIO_TEXTURE_NO_CACHE);
+}
+
+#if defined(_WIN32)
+#define MIO_ASSET_MAX 256
+#define MIO_ASSET_LOADERS_MAX 8
+#define MIO_ASSET_PATH_MAX 260
+
+#define MIO_ASSET_TEXTURE 0
+#define MIO_ASSET_MESH 1
+
+#define MIO_ASSET_EMPTY 0
+#define MIO_ASSET_QUEUED 1
+#define MIO_ASSET_LOADING 2
+#define MIO_ASSET_READY 3
+#define MIO_ASSET_FAILED 4
+#define MIO_ASSET_EVICTED 5
+
+typedef int32 mioAssetHandle;
+
+typedef struct {
+  char path[MIO_ASSET_PATH_MAX];
+  int32 type;
+  int32 priority;
+  uint32 flags;
+  int32 state;
+  int32 cancel;
+  int32 refs;
+  int32 generation;
+  int32 bytes;
+  uint32 lastUsed;
+  mioTexture texture;
+  mioMesh mesh;
+} mioAsset;
+
+typedef struct {
+  mioAsset assets[MIO_ASSET_MAX];
+  CRITICAL_SECTION lock;
+  HANDLE wake;
+  HANDLE threads[MIO_ASSET_LOADERS_MAX];
+  int32 threadCount;
+  volatile LONG quit;
+  int32 budget;
+  int32 resident;
+  uint32 frame;
+  uint32 placeholderPixels[64];
+  mioTexture placeholderTexture;
+  mioMesh placeholderMesh;
+} mioAssetStreamer;
+
+MIO_GLOBAL mioAssetStreamer G_ASSETS = {0};
+
+MIO_GLOBAL mioAsset *mio_asset_get(mioAssetHandle handle) {
+  int32 index = (handle & 0xFFFF) - 1;
+  mioAsset *asset;
+  if (!G_ASSETS.threadCount || index < 0 || index >= MIO_ASSET_MAX) {
+    return NULL;
+  }
+  asset = &G_ASSETS.assets[index];
+  if (asset->state == MIO_ASSET_EMPTY || asset->generation != (handle >> 16)) {
+    return NULL;
+  }
+  return asset;
+}
+
+MIO_GLOBAL void mio_asset_unload(mioAsset *asset) {
+  if (asset->type == MIO_ASSET_TEXTURE) {
+    sys_free(asset->texture.data);
+    memset(&asset->texture, 0, sizeof(asset->texture));
+  } else {
+    mio_3d_mesh_free(&asset->mesh);
+  }
+  G_ASSETS.resident -= asset->bytes;
+  asset->bytes = 0;
+}
+
+MIO_GLOBAL DWORD WINAPI mio_asset_thread(LPVOID param) {
+  mioAsset *asset, job;
+  mioFileMap map;
+  int32 i, best, ok;
+  (void)param;
+  while (!G_ASSETS.quit) {
+    WaitForSingleObject(G_ASSETS.wake, INFINITE);
+    if (G_ASSETS.quit) { break; }
+    EnterCriticalSection(&G_ASSETS.lock);
+    best = -1;
+    for (i = 0; i < MIO_ASSET_MAX; i++) {
+      asset = &G_ASSETS.assets[i];
+      if (asset->state == MIO_ASSET_QUEUED &&
+          (best < 0 || asset->priority > G_ASSETS.assets[best].priority)) {
+        best = i;
+      }
+    }
+    if (best < 0) {
+      LeaveCriticalSection(&G_ASSETS.lock);
+      continue;
+    }
+    asset = &G_ASSETS.assets[best];
+    asset->state = MIO_ASSET_LOADING;
+    job = *asset;
+    LeaveCriticalSection(&G_ASSETS.lock);
+    ok = FALSE;
+    if (job.type == MIO_ASSET_TEXTURE) {
+      if (sys_map_file(job.path, &map)) {
+        ok = mio_texture_decode(map.data, map.size, job.flags, &job.texture);
+        sys_unmap_file(&map);
+      }
+      if (ok) {
+        uint32 w, h;
+        uint32 *last = mio_texture_mip(
+            &job.texture, job.texture.mipCount - 1, &w, &h);
+        job.bytes = (int32)((last - job.texture.data) + w * h) * 4;
+      }
+    } else {
+      job.mesh = mio_load_obj(job.path);
+      ok = job.mesh.indexCount > 0;
+      job.bytes = job.mesh.vertexCount * (int32)sizeof(mioVertex) +
+                  job.mesh.indexCount * (int32)sizeof(int32);
+    }
+    EnterCriticalSection(&G_ASSETS.lock);
+    if (asset->cancel) {
+      if (ok && job.type == MIO_ASSET_TEXTURE) { sys_free(job.texture.data); }
+      if (ok && job.type == MIO_ASSET_MESH) { mio_3d_mesh_free(&job.mesh); }
+      asset->state = MIO_ASSET_EMPTY;
+    } else if (ok) {
+      asset->texture = job.texture;
+      asset->mesh = job.mesh;
+      asset->bytes = job.bytes;
+      asset->state = MIO_ASSET_READY;
+      G_ASSETS.resident += job.bytes;
+    } else {
+      asset->state = MIO_ASSET_FAILED;
+      sys_log("Failed to stream asset: %s\n", job.path);
+    }
+    LeaveCriticalSection(&G_ASSETS.lock);
+  }
+  return 0;
+}
+
+SYSRET mio_assets_init(int32 threads, int32 budgetBytes) {
+  int32 i;
+  if (G_ASSETS.threadCount) { return TRUE; }
+  memset(&G_ASSETS, 0, sizeof(G_ASSETS));
+  for (i = 0; i < 64; i++) {
+    G_ASSETS.placeholderPixels[i] =
+        ((i >> 3) + i) & 1 ? 0xFFFF00FF : 0xFF000000;
+  }
+  G_ASSETS.placeholderTexture.data = G_ASSETS.placeholderPixels;
+  G_ASSETS.placeholderTexture.width = 8;
+  G_ASSETS.placeholderTexture.height = 8;
+  G_ASSETS.placeholderTexture.mipCount = 1;
+  G_ASSETS.budget = budgetBytes > 0 ? budgetBytes : 256 * 1024 * 1024;
+  InitializeCriticalSection(&G_ASSETS.lock);
+  G_ASSETS.wake = CreateSemaphoreA(NULL, 0, 0x7FFFFFFF, NULL);
+  if (!G_ASSETS.wake) {
+    DeleteCriticalSection(&G_ASSETS.lock);
+    return FALSE;
+  }
+  threads = MIO_CLAMP(threads, 1, MIO_ASSET_LOADERS_MAX);
+  for (i = 0; i < threads; i++) {
+    G_ASSETS.threads[i] = CreateThread(
+        NULL, 0, (LPTHREAD_START_ROUTINE)mio_asset_thread, NULL, 0, NULL);
+    if (!G_ASSETS.threads[i]) { break; }
+    G_ASSETS.threadCount++;
+  }
+  sys_log("Asset streamer: %d threads, %dkb budget\n", G_ASSETS.threadCount,
+          G_ASSETS.budget / 1024);
+  return G_ASSETS.threadCount > 0;
+}
+
+void mio_assets_shutdown(void) {
+  int32 i;
+  if (!G_ASSETS.threadCount) { return; }
+  InterlockedExchange(&G_ASSETS.quit, 1);
+  ReleaseSemaphore(G_ASSETS.wake, G_ASSETS.threadCount, NULL);
+  for (i = 0; i < G_ASSETS.threadCount; i++) {
+    WaitForSingleObject(G_ASSETS.threads[i], INFINITE);
+    CloseHandle(G_ASSETS.threads[i]);
+  }
+  for (i = 0; i < MIO_ASSET_MAX; i++) {
+    if (G_ASSETS.assets[i].state == MIO_ASSET_READY) {
+      mio_asset_unload(&G_ASSETS.assets[i]);
+    }
+  }
+  CloseHandle(G_ASSETS.wake);
+  DeleteCriticalSection(&G_ASSETS.lock);
+  G_ASSETS.threadCount = 0;
+}
+
+MIO_GLOBAL mioAssetHandle
+mio_asset_request(const char *path, int32 type, uint32 flags, int32 priority) {
+  mioAsset *asset;
+  int32 i, slot = -1;
+  mioAssetHandle handle = 0;
+  if (!G_ASSETS.threadCount || !path ||
+      mio_strlen(path) >= MIO_ASSET_PATH_MAX) {
+    return 0;
+  }
+  EnterCriticalSection(&G_ASSETS.lock);
+  for (i = 0; i < MIO_ASSET_MAX; i++) {
+    asset = &G_ASSETS.assets[i];
+    if (asset->state == MIO_ASSET_EMPTY) {
+      if (slot < 0) { slot = i; }
+    } else if (
+        !asset->cancel && asset->type == type && asset->flags == flags &&
+        !strcmp(asset->path, path)) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot >= 0) {
+    asset = &G_ASSETS.assets[slot];
+    if (asset->state == MIO_ASSET_EMPTY) {
+      memset(asset->path, 0, sizeof(asset->path));
+      memcpy(asset->path, path, mio_strlen(path));
+      asset->type = type;
+      asset->flags = flags;
+      asset->priority = priority;
+      asset->refs = 0;
+      asset->cancel = FALSE;
+      asset->generation = (asset->generation + 1) & 0x7FFF;
+      asset->state = MIO_ASSET_QUEUED;
+      ReleaseSemaphore(G_ASSETS.wake, 1, NULL);
+    } else if (asset->state == MIO_ASSET_EVICTED) {
+      asset->state = MIO_ASSET_QUEUED;
+      ReleaseSemaphore(G_ASSETS.wake, 1, NULL);
+    }
+    asset->priority = MIO_MAX(asset->priority, priority);
+    asset->refs++;
+    asset->lastUsed = G_ASSETS.frame;
+    handle = (asset->generation << 16) | (slot + 1);
+  } else {
+    sys_log("Asset table full, cannot stream: %s\n", path);
+  }
+  LeaveCriticalSection(&G_ASSETS.lock);
+  return handle;
+}
+
+mioAssetHandle
+mio_asset_load_texture(const char *path, uint32 flags, int32 priority) {
+  return mio_asset_request(
+      path, MIO_ASSET_TEXTURE, flags & ~MIO_TEXTURE_NO_CACHE, priority);
+}
+
+mioAssetHandle mio_asset_load_mesh(const char *path, int32 priority) {
+  return mio_asset_request(path, MIO_ASSET_MESH, 0, priority);
+}
+
+void mio_asset_set_priority(mioAssetHandle handle, int32 priority) {
+  mioAsset *asset;
+  EnterCriticalSection(&G_ASSETS.lock);
+  asset = mio_asset_get(handle);
+  if (asset) { asset->priority = priority; }
+  LeaveCriticalSection(&G_ASSETS.lock);
+}
+
+void mio_asset_release(mioAssetHandle handle) {
+  mioAsset *asset;
+  if (!G_ASSETS.threadCount) { return; }
+  EnterCriticalSection(&G_ASSETS.lock);
+  asset = mio_asset_get(handle);
+  if (asset && asset->refs > 0 && --asset->refs == 0) {
+    if (asset->state == MIO_ASSET_LOADING) {
+      asset->cancel = TRUE;
+    } else if (
+        asset->state == MIO_ASSET_QUEUED || asset->state == MIO_ASSET_FAILED ||
+        asset->state == MIO_ASSET_EVICTED) {
+      asset->state = MIO_ASSET_EMPTY;
+    }
+  }
+  LeaveCriticalSection(&G_ASSETS.lock);
+}
+
+int32 mio_asset_state(mioAssetHandle handle) {
+  mioAsset *asset;
+  int32 state;
+  if (!G_ASSETS.threadCount) { return MIO_ASSET_EMPTY; }
+  EnterCriticalSection(&G_ASSETS.lock);
+  asset = mio_asset_get(handle);
+  state = asset ? asset->state : MIO_ASSET_EMPTY;
+  LeaveCriticalSection(&G_ASSETS.lock);
+  return state;
+}
+
+MIO_GLOBAL mioAsset *mio_asset_touch(mioAssetHandle handle) {
+  mioAsset *asset = mio_asset_get(handle);
+  if (!asset) { return NULL; }
+  asset->lastUsed = G_ASSETS.frame;
+  if (asset->state == MIO_ASSET_EVICTED) {
+    asset->state = MIO_ASSET_QUEUED;
+    ReleaseSemaphore(G_ASSETS.wake, 1, NULL);
+  }
+  return asset->state == MIO_ASSET_READY ? asset : NULL;
+}
+
+mioTexture *mio_asset_texture(mioAssetHandle handle) {
+  mioAsset *asset;
+  if (!G_ASSETS.threadCount) { return NULL; }
+  EnterCriticalSection(&G_ASSETS.lock);
+  asset = mio_asset_touch(handle);
+  LeaveCriticalSection(&G_ASSETS.lock);
+  return asset && asset->type == MIO_ASSET_TEXTURE
+             ? &asset->texture
+             : &G_ASSETS.placeholderTexture;
+}
+
+mioMesh *mio_asset_mesh(mioAssetHandle handle) {
+  mioAsset *asset;
+  if (!G_ASSETS.threadCount) { return NULL; }
+  EnterCriticalSection(&G_ASSETS.lock);
+  asset = mio_asset_touch(handle);
+  LeaveCriticalSection(&G_ASSETS.lock);
+  return asset && asset->type == MIO_ASSET_MESH ? &asset->mesh
+                                                : &G_ASSETS.placeholderMesh;
+}
+
+void mio_assets_update(void) {
+  mioAsset *asset, *victim;
+  int32 i;
+  if (!G_ASSETS.threadCount) { return; }
+  EnterCriticalSection(&G_ASSETS.lock);
+  while (G_ASSETS.resident > G_ASSETS.budget) {
+    victim = NULL;
+    for (i = 0; i < MIO_ASSET_MAX; i++) {
+      asset = &G_ASSETS.assets[i];
+      if (asset->state != MIO_ASSET_READY ||
+          asset->lastUsed == G_ASSETS.frame) {
+        continue;
+      }
+      if (!victim || (!asset->refs && victim->refs) ||
+          (!asset->refs == !victim->refs &&
+           asset->lastUsed < victim->lastUsed)) {
+        victim = asset;
+      }
+    }
+    if (!victim) { break; }
+    mio_asset_unload(victim);
+    victim->state = victim->refs ? MIO_ASSET_EVICTED : MIO_ASSET_EMPTY;
+  }
+  G_ASSETS.frame++;
+  LeaveCriticalSection(&G_ASSETS.lock);
+}
+#endif
+
+/* @AUDIO ********************************************************************/
+
+#if defined(_WIN32)
+#define MIO_MIXER_VOICES 256
+#define MIO_MIXER_CHUNK 256
+#ifndef MIO_MIXER_AUDIBLE
+#define MIO_MIXER_AUDIBLE 64
+#endif
+
+#define MIO_RESAMPLE_LINEAR 0
+#define MIO_RESAMPLE_CUBIC 1
+
+#define MIO_VOICE_FREE 0
+#define MIO_VOICE_CLAIMED 1
+#define MIO_VOICE_PLAYING 2
+
+#define MIO_VOICE_LOOP 0x01
+
+#define MIO_FIXED_ONE ((uint64)1 << 32)
+#define MIO_FIXED_FRAC (1.0f / 4294967296.0f)
+
+typedef int32 mioVoiceHandle;
+
+typedef struct {
+  real32 *data;
+  int32 frames;
+  int32 ch;
+  int32 sr;
+} mioSound;
+
+typedef struct {
+  volatile LONG state;
+  volatile LONG stop;
+  int32 generation;
+  const mioSound *sound;
+  uint32 flags;
+  volatile real32 gain;
+  volatile real32 pan;
+  volatile real32 pitch;
+  real32 left;
+  real32 right;
+  int32 fresh;
+  uint64 pos;
+} mioVoice;
+
+typedef struct {
+  int32 active;
+  int32 audible;
+  int32 virtualised;
+} mioMixerStats;
+
+typedef struct {
+  mioVoice voices[MIO_MIXER_VOICES];
+  mioVoice *list[MIO_MIXER_VOICES];
+  real32 loudness[MIO_MIXER_VOICES];
+  real32 sorted[MIO_MIXER_VOICES];
+  real32 scratch[MIO_MIXER_CHUNK * 2];
+  int32 init;
+  int32 quality;
+  int32 audible;
+  int32 cursor;
+  volatile real32 master;
+  mioMixerStats stats;
+} mioMixer;
+
+MIO_GLOBAL mioMixer G_MIXER = {0};
+
+MIO_GLOBAL SYSRET
+mio_sound_alloc(mioSound *sound, int32 frames, int32 ch, int32 sr) {
+  memset(sound, 0, sizeof(*sound));
+  if (frames <= 0 || ch < 1 || ch > 2 || sr <= 0) { return FALSE; }
+  sound->data = (real32 *)sys_alloc(frames * ch * (int32)sizeof(real32));
+  if (!sound->data) { return FALSE; }
+  sound->frames = frames;
+  sound->ch = ch;
+  sound->sr = sr;
+  return TRUE;
+}
+
+mioSound
+mio_sound_from_pcm16(const int16 *pcm, int32 frames, int32 ch, int32 sr) {
+  mioSound sound;
+  int32 i;
+  if (mio_sound_alloc(&sound, frames, ch, sr)) {
+    for (i = 0; i < frames * ch; i++) {
+      sound.data[i] = (real32)pcm[i] * (1.0f / 32768.0f);
+    }
+  }
+  return sound;
+}
+
+MIO_GLOBAL real32 mio_wav_sample(const uint8 *p, uint32 tag, uint32 bits) {
+  int32 v;
+  real32 f;
+  if (tag == 3) {
+    memcpy(&f, p, sizeof(f));
+    return f;
+  }
+  switch (bits) {
+  case 8: return (real32)((int32)p[0] - 128) * (1.0f / 128.0f);
+  case 16: return (real32)(int16)mio_bmp_read_uint16(p) * (1.0f / 32768.0f);
+  case 24:
+    v = (int32)(((uint32)p[0] << 8) | ((uint32)p[1] << 16) |
+                ((uint32)p[2] << 24)) >> 8;
+    return (real32)v * (1.0f / 8388608.0f);
+  default: return (real32)(int32)mio_bmp_read_uint32(p) * (1.0f / 2147483648.0f);
+  }
+}
+
+MIO_GLOBAL SYSRET
+mio_sound_decode_wav(const uint8 *data, int32 size, mioSound *sound) {
+  const uint8 *fmt = NULL, *pcm = NULL, *src;
+  int32 off = 12, len, fmtLen = 0, pcmLen = 0, frames, stride, i, c;
+  uint32 tag, ch, sr, bits;
+  memset(sound, 0, sizeof(*sound));
+  if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+    return FALSE;
+  }
+  while (size - off >= 8) {
+    len = (int32)MIO_MIN(mio_bmp_read_uint32(data + off + 4),
+                         (uint32)(size - off - 8));
+    if (!memcmp(data + off, "fmt ", 4)) {
+      fmt = data + off + 8;
+      fmtLen = len;
+    } else if (!memcmp(data + off, "data", 4)) {
+      pcm = data + off + 8;
+      pcmLen = len;
+    }
+    off += 8 + len + (len & 1);
+  }
+  if (!fmt || fmtLen < 16 || !pcm) { return FALSE; }
+  tag = mio_bmp_read_uint16(fmt);
+  ch = mio_bmp_read_uint16(fmt + 2);
+  sr = mio_bmp_read_uint32(fmt + 4);
+  bits = mio_bmp_read_uint16(fmt + 14);
+  if (tag == 0xFFFE && fmtLen >= 26) { tag = mio_bmp_read_uint16(fmt + 24); }
+  if (!ch || !sr || (tag != 1 && tag != 3) || (tag == 3 && bits != 32) ||
+      (bits != 8 && bits != 16 && bits != 24 && bits != 32)) {
+    return FALSE;
+  }
+  stride = (int32)(ch * (bits / 8));
+  frames = pcmLen / stride;
+  if (!mio_sound_alloc(sound, frames, (int32)MIO_MIN(ch, 2), (int32)sr)) {
+    return FALSE;
+  }
+  for (i = 0; i < frames; i++) {
+    src = pcm + i * stride;
+    for (c = 0; c < sound->ch; c++) {
+      sound->data[i * sound->ch + c] =
+          mio_wav_sample(src + c * (bits / 8), tag, bits);
+    }
+  }
+  return TRUE;
+}
+
+mioSound mio_load_wav(const char *filepath) {
+  mioSound sound = {0};
+  mioFileMap map;
+  if (!sys_map_file(filepath, &map)) {
+    sys_log("Failed to load file %s\n", filepath);
+    return sound;
+  }
+  if (!mio_sound_decode_wav(map.data, map.size, &sound)) {
+    sys_log("Failed to decode sound: %s\n", filepath);
+  } else {
+    sys_log("Loaded sound: %s %d frames, %d channels, %dhz\n", filepath,
+            sound.frames, sound.ch, sound.sr);
+  }
+  sys_unmap_file(&map);
+  return sound;
+}
+
+/* Voices still referencing the sound must be stopped and retired by the
+ * mixer before the samples are released. */
+void mio_sound_free(mioSound *sound) {
+  if (!sound) { return; }
+  sys_free(sound->data);
+  memset(sound, 0, sizeof(*sound));
+}
+
+MIO_GLOBAL real32
+mio_sound_sample(const mioSound *sound, int32 i, int32 c, uint32 loop) {
+  if (i < 0 || i >= sound->frames) {
+    if (!loop) { return 0.0f; }
+    i = ((i % sound->frames) + sound->frames) % sound->frames;
+  }
+  return sound->data[i * sound->ch + c];
+}
+
+MIO_GLOBAL real32
+mio_resample_tap(real32 p0, real32 p1, real32 p2, real32 p3, real32 f) {
+  if (G_MIXER.quality == MIO_RESAMPLE_LINEAR) { return p1 + (p2 - p1) * f; }
+  return p1 + 0.5f * f *
+                  (p2 - p0 +
+                   f * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3 +
+                        f * (3.0f * (p1 - p2) + p3 - p0)));
+}
+
+/* Interpolates frames whose taps all lie inside the sound, four output
+ * samples per iteration. Stereo lanes hold two frames of L/R pairs. */
+MIO_GLOBAL void mio_resample_run(
+    const real32 *d, int32 ch, uint64 pos, uint64 step, real32 *dst,
+    int32 frames) {
+  int32 o[4], i, k, total = frames * ch;
+  real32 f[4];
+  __m128 p0, p1, p2, p3, t, fr;
+  __m128 half = _mm_set1_ps(0.5f), two = _mm_set1_ps(2.0f);
+  __m128 three = _mm_set1_ps(3.0f), four = _mm_set1_ps(4.0f);
+  __m128 five = _mm_set1_ps(5.0f);
+  if (step == MIO_FIXED_ONE && !(pos & 0xFFFFFFFF)) {
+    memcpy(dst, d + (int32)(pos >> 32) * ch, total * sizeof(real32));
+    return;
+  }
+  for (i = 0; i + 4 <= total; i += 4) {
+    for (k = 0; k < 4; k++) {
+      o[k] = (int32)(pos >> 32) * ch + (k & (ch - 1));
+      f[k] = (real32)(uint32)pos * MIO_FIXED_FRAC;
+      if ((k & (ch - 1)) == ch - 1) { pos += step; }
+    }
+    fr = _mm_loadu_ps(f);
+    p1 = _mm_set_ps(d[o[3]], d[o[2]], d[o[1]], d[o[0]]);
+    p2 = _mm_set_ps(d[o[3] + ch], d[o[2] + ch], d[o[1] + ch], d[o[0] + ch]);
+    if (G_MIXER.quality == MIO_RESAMPLE_LINEAR) {
+      t = _mm_add_ps(p1, _mm_mul_ps(_mm_sub_ps(p2, p1), fr));
+    } else {
+      p0 = _mm_set_ps(
+          d[o[3] - ch], d[o[2] - ch], d[o[1] - ch], d[o[0] - ch]);
+      p3 = _mm_set_ps(
+          d[o[3] + 2 * ch], d[o[2] + 2 * ch], d[o[1] + 2 * ch],
+          d[o[0] + 2 * ch]);
+      t = _mm_add_ps(
+          _mm_mul_ps(three, _mm_sub_ps(p1, p2)), _mm_sub_ps(p3, p0));
+      t = _mm_add_ps(
+          _mm_sub_ps(
+              _mm_add_ps(_mm_mul_ps(two, p0), _mm_mul_ps(four, p2)),
+              _mm_add_ps(_mm_mul_ps(five, p1), p3)),
+          _mm_mul_ps(fr, t));
+      t = _mm_add_ps(_mm_sub_ps(p2, p0), _mm_mul_ps(fr, t));
+      t = _mm_add_ps(p1, _mm_mul_ps(_mm_mul_ps(half, fr), t));
+    }
+    _mm_storeu_ps(dst + i, t);
+  }
+  for (; i < total; i += ch) {
+    for (k = 0; k < ch; k++) {
+      o[0] = (int32)(pos >> 32) * ch + k;
+      dst[i + k] = mio_resample_tap(
+          d[o[0] - ch], d[o[0]], d[o[0] + ch], d[o[0] + 2 * ch],
+          (real32)(uint32)pos * MIO_FIXED_FRAC);
+    }
+    pos += step;
+  }
+}
+
+/* Fills one chunk of the voice at the source channel count. Frames near the
+ * ends go through the wrapping scalar path; everything else runs in bulk.
+ * Returns FALSE once a one-shot voice has played out. */
+MIO_GLOBAL SYSRET
+mio_voice_resample(mioVoice *v, real32 *dst, int32 n, uint64 step) {
+  const mioSound *s = v->sound;
+  uint64 end = (uint64)s->frames << 32;
+  uint64 safe = s->frames > 3 ? (uint64)(s->frames - 2) << 32 : 0;
+  uint32 loop = v->flags & MIO_VOICE_LOOP;
+  int32 done = 0, run, idx, c;
+  real32 f;
+  while (done < n) {
+    if (v->pos >= end) {
+      if (!loop) {
+        memset(dst + done * s->ch, 0, (n - done) * s->ch * sizeof(real32));
+        return FALSE;
+      }
+      v->pos %= end;
+    }
+    if (v->pos >= MIO_FIXED_ONE && v->pos < safe) {
+      run = (int32)MIO_MIN((uint64)(n - done), (safe - 1 - v->pos) / step + 1);
+      mio_resample_run(s->data, s->ch, v->pos, step, dst + done * s->ch, run);
+      v->pos += step * run;
+      done += run;
+    } else {
+      idx = (int32)(v->pos >> 32);
+      f = (real32)(uint32)v->pos * MIO_FIXED_FRAC;
+      for (c = 0; c < s->ch; c++) {
+        dst[done * s->ch + c] = mio_resample_tap(
+            mio_sound_sample(s, idx - 1, c, loop),
+            mio_sound_sample(s, idx, c, loop),
+            mio_sound_sample(s, idx + 1, c, loop),
+            mio_sound_sample(s, idx + 2, c, loop), f);
+      }
+      v->pos += step;
+      done++;
+    }
+  }
+  return loop || v->pos < end;
+}
+
+/* Adds a chunk into the output, ramping the per-channel gains from (l0, r0)
+ * to (l1, r1) across it so parameter changes never click. */
+MIO_GLOBAL void mio_mixer_accumulate(
+    real32 *out, int32 ch, const real32 *src, int32 srcCh, int32 n, real32 l0,
+    real32 r0, real32 l1, real32 r1) {
+  real32 dl = (l1 - l0) / (real32)n, dr = (r1 - r0) / (real32)n;
+  real32 gl, gr, s0, s1;
+  int32 i = 0;
+  __m128 g, inc, m, o;
+  if (ch == 2) {
+    g = _mm_set_ps(r0 + dr, l0 + dl, r0, l0);
+    inc = _mm_set_ps(2.0f * dr, 2.0f * dl, 2.0f * dr, 2.0f * dl);
+    if (srcCh == 1) {
+      for (; i + 4 <= n; i += 4) {
+        m = _mm_loadu_ps(src + i);
+        o = _mm_loadu_ps(out + i * 2);
+        _mm_storeu_ps(
+            out + i * 2, _mm_add_ps(o, _mm_mul_ps(_mm_unpacklo_ps(m, m), g)));
+        g = _mm_add_ps(g, inc);
+        o = _mm_loadu_ps(out + i * 2 + 4);
+        _mm_storeu_ps(
+            out + i * 2 + 4,
+            _mm_add_ps(o, _mm_mul_ps(_mm_unpackhi_ps(m, m), g)));
+        g = _mm_add_ps(g, inc);
+      }
+    } else {
+      for (; i + 2 <= n; i += 2) {
+        o = _mm_loadu_ps(out + i * 2);
+        _mm_storeu_ps(
+            out + i * 2,
+            _mm_add_ps(o, _mm_mul_ps(_mm_loadu_ps(src + i * 2), g)));
+        g = _mm_add_ps(g, inc);
+      }
+    }
+  }
+  for (; i < n; i++) {
+    gl = l0 + dl * (real32)i;
+    gr = r0 + dr * (real32)i;
+    s0 = src[i * srcCh];
+    s1 = src[i * srcCh + srcCh - 1];
+    if (ch == 1) {
+      out[i] += (s0 * gl + s1 * gr) * 0.70710678f;
+    } else {
+      out[i * ch] += s0 * gl;
+      out[i * ch + 1] += s1 * gr;
+    }
+  }
+}
+
+/* Partially orders v descending and returns its k-th largest value. */
+MIO_GLOBAL real32 mio_mixer_kth_loudest(real32 *v, int32 n, int32 k) {
+  int32 lo = 0, hi = n - 1, i, j;
+  real32 p, t;
+  while (lo < hi) {
+    p = v[(lo + hi) >> 1];
+    i = lo;
+    j = hi;
+    while (i <= j) {
+      while (v[i] > p) { i++; }
+      while (v[j] < p) { j--; }
+      if (i <= j) {
+        t = v[i];
+        v[i++] = v[j];
+        v[j--] = t;
+      }
+    }
+    if (k - 1 <= j) {
+      hi = j;
+    } else if (k - 1 >= i) {
+      lo = i;
+    } else {
+      break;
+    }
+  }
+  return v[k - 1];
+}
+
+MIO_GLOBAL void mio_mixer_chunk(real32 *out, int32 n, int32 sr, int32 ch) {
+  mioVoice *v;
+  const mioSound *s;
+  int32 i, count = 0, budget = G_MIXER.audible, ties = 0, alive;
+  real32 master = G_MIXER.master, threshold = 0.0f, gain, pan, l, r;
+  uint64 step;
+  for (i = 0; i < MIO_MIXER_VOICES; i++) {
+    v = &G_MIXER.voices[i];
+    if (InterlockedCompareExchange(&v->state, 0, 0) != MIO_VOICE_PLAYING) {
+      continue;
+    }
+    G_MIXER.list[count] = v;
+    G_MIXER.loudness[count] = v->stop ? 0.0f : MIO_ABS(v->gain) * master;
+    G_MIXER.sorted[count] = G_MIXER.loudness[count];
+    count++;
+  }
+  G_MIXER.stats.active = count;
+  G_MIXER.stats.audible = 0;
+  if (count > budget) {
+    /* everything strictly louder than the threshold is admitted, voices
+       tied with it share whatever budget is left */
+    threshold = mio_mixer_kth_loudest(G_MIXER.sorted, count, budget);
+    ties = budget;
+    for (i = 0; i < count; i++) {
+      if (G_MIXER.loudness[i] > threshold) { ties--; }
+    }
+  }
+  for (i = 0; i < count; i++) {
+    v = G_MIXER.list[i];
+    s = v->sound;
+    step = (uint64)((real64)s->sr / (real64)sr *
+                    MIO_CLAMP(v->pitch, 1.0f / 256.0f, 256.0f) *
+                    (real64)MIO_FIXED_ONE);
+    step = MIO_MAX(step, 1);
+    if (count > budget &&
+        (G_MIXER.loudness[i] < threshold || G_MIXER.loudness[i] <= 0.0f ||
+         (G_MIXER.loudness[i] == threshold && ties-- <= 0))) {
+      v->pos += step * (uint64)n;
+      if (v->pos >= ((uint64)s->frames << 32) && (v->flags & MIO_VOICE_LOOP)) {
+        v->pos %= (uint64)s->frames << 32;
+      }
+      alive = !v->stop && v->pos < ((uint64)s->frames << 32);
+      v->left = v->right = 0.0f;
+      v->fresh = FALSE;
+    } else {
+      G_MIXER.stats.audible++;
+      gain = v->stop ? 0.0f : v->gain * master;
+      pan = MIO_CLAMP(v->pan, -1.0f, 1.0f);
+      if (s->ch == 1) {
+        l = gain * (real32)cos((pan + 1.0f) * (real32)MIO_PI * 0.25f);
+        r = gain * (real32)sin((pan + 1.0f) * (real32)MIO_PI * 0.25f);
+      } else {
+        l = gain * MIO_MIN(1.0f, 1.0f - pan);
+        r = gain * MIO_MIN(1.0f, 1.0f + pan);
+      }
+      if (v->fresh) {
+        v->left = l;
+        v->right = r;
+        v->fresh = FALSE;
+      }
+      alive = mio_voice_resample(v, G_MIXER.scratch, n, step) && !v->stop;
+      mio_mixer_accumulate(
+          out, ch, G_MIXER.scratch, s->ch, n, v->left, v->right, l, r);
+      v->left = l;
+      v->right = r;
+    }
+    if (!alive) { InterlockedExchange(&v->state, MIO_VOICE_FREE); }
+  }
+  G_MIXER.stats.virtualised = count - G_MIXER.stats.audible;
+}
+
+void mio_mixer_init(int32 quality, int32 audible) {
+  int32 i;
+  for (i = 0; i < MIO_MIXER_VOICES; i++) {
+    InterlockedExchange(&G_MIXER.voices[i].state, MIO_VOICE_FREE);
+  }
+  G_MIXER.quality = quality;
+  G_MIXER.audible =
+      MIO_CLAMP(audible > 0 ? audible : MIO_MIXER_AUDIBLE, 1,
+                MIO_MIXER_VOICES);
+  G_MIXER.master = 1.0f;
+  G_MIXER.init = TRUE;
+}
+
+/* Adds every playing voice into an interleaved float buffer. Callers with
+ * their own audio callback can mix the voices on top of their output. */
+void mio_mixer_mix(real32 *out, int32 frames, int32 sr, int32 ch) {
+  int32 n;
+  if (!G_MIXER.init || sr <= 0 || ch <= 0) { return; }
+  while (frames > 0) {
+    n = MIO_MIN(frames, MIO_MIXER_CHUNK);
+    mio_mixer_chunk(out, n, sr, ch);
+    out += n * ch;
+    frames -= n;
+  }
+}
+
+void mio_mixer_callback(void *ud, float *out, int32 frames) {
+  mioSystemAudioFormat fmt = sys_get_audio_format();
+  (void)ud;
+  memset(out, 0, frames * fmt.ch * sizeof(real32));
+  mio_mixer_mix(out, frames, fmt.sr, fmt.ch);
+}
+
+SYSRET mio_mixer_start(int32 sr, int32 ch, int32 quality) {
+  mio_mixer_init(quality, MIO_MIXER_AUDIBLE);
+  return sys_init_audio(sr, ch, mio_mixer_callback, NULL);
+}
+
+void mio_mixer_set_master(real32 gain) { G_MIXER.master = gain; }
+
+mioMixerStats mio_mixer_get_stats(void) { return G_MIXER.stats; }
+
+MIO_GLOBAL mioVoice *mio_voice_get(mioVoiceHandle handle) {
+  int32 index = (handle & 0xFFFF) - 1;
+  mioVoice *v;
+  if (index < 0 || index >= MIO_MIXER_VOICES) { return NULL; }
+  v = &G_MIXER.voices[index];
+  if (v->generation != (handle >> 16) ||
+      InterlockedCompareExchange(&v->state, 0, 0) != MIO_VOICE_PLAYING) {
+    return NULL;
+  }
+  return v;
+}
+
+/* Claims a free voice without blocking the mixer. The voice is only visible
+ * to the mixer once it is published as playing. */
+mioVoiceHandle mio_sound_play(
+    const mioSound *sound, real32 gain, real32 pan, real32 pitch,
+    uint32 flags) {
+  mioVoice *v;
+  int32 i, index;
+  if (!G_MIXER.init || !sound || !sound->data || sound->frames <= 0) {
+    return 0;
+  }
+  for (i = 0; i < MIO_MIXER_VOICES; i++) {
+    index = (G_MIXER.cursor + i) % MIO_MIXER_VOICES;
+    v = &G_MIXER.voices[index];
+    if (InterlockedCompareExchange(
+            &v->state, MIO_VOICE_CLAIMED, MIO_VOICE_FREE) != MIO_VOICE_FREE) {
+      continue;
+    }
+    v->generation = (v->generation % 0x7FFF) + 1;
+    v->sound = sound;
+    v->flags = flags;
+    v->gain = gain;
+    v->pan = pan;
+    v->pitch = pitch;
+    v->left = v->right = 0.0f;
+    v->fresh = TRUE;
+    v->pos = 0;
+    v->stop = 0;
+    G_MIXER.cursor = index + 1;
+    InterlockedExchange(&v->state, MIO_VOICE_PLAYING);
+    return (v->generation << 16) | (index + 1);
+  }
+  return 0;
+}
+
+void mio_voice_set(
+    mioVoiceHandle handle, real32 gain, real32 pan, real32 pitch) {
+  mioVoice *v = mio_voice_get(handle);
+  if (!v) { return; }
+  v->gain = gain;
+  v->pan = pan;
+  v->pitch = pitch;
+}
+
+void mio_voice_stop(mioVoiceHandle handle) {
+  mioVoice *v = mio_voice_get(handle);
+  if (v) { InterlockedExchange(&v->stop, 1); }
+}
+
+SYSRET mio_voice_playing(mioVoiceHandle handle) {
+  return mio_voice_get(handle) != NULL;
+}
+
+void mio_mixer_stop_all(void) {
+  int32 i;
+  for (i = 0; i < MIO_MIXER_VOICES; i++) {
+    InterlockedExchange(&G_MIXER.voices[i].stop, 1);
+  }
+}
+#endif
+
 /* @SETUP ********************************************************************/
 
+void mio_dynres_enable(int32 enabled, real32 budgetMs, int32 upscale) {
+  mioDynamicRes *dr = &G_APP.dynres;
+  dr->enabled = enabled;
+  dr->upscale = upscale;
+  dr->budget = (budgetMs > 0.0f ? budgetMs : 12.5f) / 1000.0f;
+  dr->frameTime = 0.0f;
+  if (dr->scale <= 0.0f) { dr->scale = 1.0f; }
+  if (dr->maxScale <= 0.0f) {
+    dr->minScale = 0.5f;
+    dr->maxScale = 1.0f;
+  }
+  if (!enabled && dr->coarseActive) {
+    G_APP.render.flags3D &= ~MIO_3D_COARSE_SHADE;
+    dr->coarseActive = FALSE;
+  }
+}
+
+void mio_dynres_set_range(real32 minScale, real32 maxScale) {
+  mioDynamicRes *dr = &G_APP.dynres;
+  dr->minScale = MIO_CLAMP(minScale, 0.1f, 1.0f);
+  dr->maxScale = MIO_CLAMP(maxScale, dr->minScale, 1.0f);
+  dr->scale = MIO_CLAMP(dr->scale, dr->minScale, dr->maxScale);
+}
+
+void mio_dynres_set_coarse(int32 enabled) {
+  G_APP.dynres.coarse = enabled;
+  if (!enabled && G_APP.dynres.coarseActive) {
+    G_APP.render.flags3D &= ~MIO_3D_COARSE_SHADE;
+    G_APP.dynres.coarseActive = FALSE;
+  }
+}
+
+real32 mio_dynres_scale(void) {
+  return G_APP.dynres.enabled ? G_APP.dynres.scale : 1.0f;
+}
+
+mioSystemPoint mio_render_mouse_position(void) {
+  mioSystemPoint p = sys_mouse_position();
+  if (G_SYS.cs.width > 0 && G_SYS.cs.height > 0) {
+    p.x = p.x * G_APP.render.width / G_SYS.cs.width;
+    p.y = p.y * G_APP.render.height / G_SYS.cs.height;
+  }
+  return p;
+}
+
+MIO_GLOBAL void
+mio_dynres_render_size(int32 ww, int32 wh, int32 *w, int32 *h) {
+  int32 res = MIO_MAX(G_APP.render.resolution, 1);
+  size_t maxPixels = G_APP.render.maxFramebufferSize / sizeof(uint32);
+  *w = ww / res;
+  *h = wh / res;
+  if (G_APP.dynres.enabled) {
+    *w = MIO_MAX((int32)(*w * G_APP.dynres.scale + 0.5f), 2);
+    *h = MIO_MAX((int32)(*h * G_APP.dynres.scale + 0.5f), 2);
+  }
+  if (maxPixels && (size_t)*w * (size_t)*h > maxPixels) {
+    *h = (int32)(maxPixels / (size_t)*w);
+  }
+}
+
+MIO_GLOBAL void mio_dynres_update(real64 frameTime) {
+  mioDynamicRes *dr = &G_APP.dynres;
+  real32 ratio, target;
+  dr->frameTime = dr->frameTime > 0.0f
+                      ? dr->frameTime * 0.8f + (real32)frameTime * 0.2f
+                      : (real32)frameTime;
+  ratio = dr->budget / MIO_MAX(dr->frameTime, 1e-5f);
+  if (ratio > 0.95f && ratio < 1.1f) { return; }
+  target = dr->scale * (real32)sqrt(ratio);
+  target = MIO_CLAMP(target, dr->scale * 0.85f, dr->scale * 1.04f);
+  if (dr->coarse) {
+    if (target < dr->minScale && !dr->coarseActive) {
+      G_APP.render.flags3D |= MIO_3D_COARSE_SHADE;
+      dr->coarseActive = TRUE;
+    } else if (ratio > 1.4f && dr->coarseActive) {
+      G_APP.render.flags3D &= ~MIO_3D_COARSE_SHADE;
+      dr->coarseActive = FALSE;
+      return;
+    }
+  }
+  dr->scale = MIO_CLAMP(target, dr->minScale, dr->maxScale);
+}
+
+MIO_GLOBAL const uint32 *mio_dynres_resolve(
+    const uint32 *src, int32 ww, int32 wh, int32 threaded, int32 *w,
+    int32 *h) {
+  mioDynamicRes *dr = &G_APP.dynres;
+  int32 res = MIO_MAX(G_APP.render.resolution, 1);
+  int32 ow = ww / res;
+  int32 oh = wh / res;
+  int32 size = ow * oh * (int32)sizeof(uint32);
+  if (!dr->enabled || dr->upscale == MIO_UPSCALE_NEAREST || ow <= 0 ||
+      oh <= 0 || (ow == *w && oh == *h)) {
+    return src;
+  }
+  if (size > dr->outputSize) {
+    if (dr->output) { sys_free(dr->output); }
+    dr->output = (uint32 *)sys_alloc(size);
+    dr->outputSize = dr->output ? size : 0;
+  }
+  if (!dr->output) { return src; }
+  if (threaded) {
+    mio_draw_upscale_mt(src, *w, *h, dr->output, ow, oh, dr->upscale);
+  } else {
+    mio_draw_upscale(src, *w, *h, dr->output, ow, oh, dr->upscale);
+  }
+  *w = ow;
+  *h = oh;
+  return dr->output;
+}
+
+MIO_GLOBAL void mio_render_frame(int32 ww, int32 wh) {
+  real64 drawStart = sys_get_time();
+  int32 rw, rh;
+  mio_dynres_render_size(ww, wh, &rw, &rh);
+  mio_render_context_resize(rw, rh);
+  MIO_PROFILE_SCOPE("draw") {
+    if (G_APP.draw) {
+      G_APP.draw(
+          G_APP.pipeline.thread && G_APP.pipeline.drawState
+              ? G_APP.pipeline.drawState
+              : G_APP.state);
+    }
+  }
+  if (G_APP.dynres.enabled) { mio_dynres_update(sys_get_time() - drawStart); }
+  mio_assets_update();
+}
+
 int32 mio_app_run(
     mioApp* app, const char *title, int32 width, int32 height, int32 res,
     int32 fps) {
@@ -8698,6 +15121,7 @@ int32 mio_app_run(
   uint32 run = TRUE;
   real64 last_time = 0.0;
   real64 accumulated_time = 0.0;
+  real64 frame_dt = 0.0;
   const real64 fixed_dt = 1.0 / 60.0;
   size_t fbSize = sizeof(uint32) * 2560 * 1440 * 4;
   void *fbMem = sys_alloc((int32)fbSize);
@@ -8713,6 +15137,9 @@ int32 mio_app_run(
     sys_shutdown();
     return 1;
   }
+  if (app->pipeline.enabled && app->draw && !mio_pipeline_start()) {
+    sys_log("Render pipeline unavailable, drawing on the main thread.\n");
+  }
   last_time = sys_get_time();
   sys_set_timer(16);
   G_SYS.fpsUpdateCount = 0;
@@ -8720,23 +15147,45 @@ int32 mio_app_run(
     real64 current_time = sys_get_time();
     real64 delta_time = current_time - last_time;
     mioSystemSize winSize = sys_get_window_size();
-    mio_render_context_resize(winSize.width/res, winSize.height/res);
+    int32 rw, rh;
+    if (!app->pipeline.thread) {
+      mio_dynres_render_size(winSize.width, winSize.height, &rw, &rh);
+      mio_render_context_resize(rw, rh);
+    }
     last_time = current_time;
     accumulated_time += delta_time;
+    if (app->pipeline.thread && !app->pipeline.drawState &&
+        accumulated_time >= fixed_dt) {
+      mio_pipeline_wait();
+    }
     while (accumulated_time >= fixed_dt) {
       if (app->update) {
         run = sys_process_messages();
-				mio_3d_camera_update(
-					&app->render.camera,
-					app->render.width,
-					app->render.height,
-					TRUE, fixed_dt);
-        app->update(app->state, fixed_dt);
+        if (app->pipeline.thread) {
+          frame_dt += fixed_dt;
+        } else {
+          mio_3d_camera_update(
+              &app->render.camera, app->render.width, app->render.height,
+              TRUE, fixed_dt);
+        }
+        MIO_PROFILE_SCOPE("update") { app->update(app->state, fixed_dt); }
         G_SYS.fpsUpdateCount++;
       }
+      if (G_PHYSICS) {
+        MIO_PROFILE_SCOPE("physics") {
+          if (app->pipeline.drawState) {
+            mio_physics_step(G_PHYSICS, (real32)fixed_dt);
+          } else {
+            mio_physics_step_mt(G_PHYSICS, (real32)fixed_dt);
+          }
+        }
+      }
       accumulated_time -= fixed_dt;
     }
-    if (app->draw) {
+    if (app->pipeline.thread) {
+      mio_pipeline_frame(frame_dt);
+      frame_dt = 0.0;
+    } else if (app->draw) {
 			sys_present();
 		}
     sys_log_perf();
@@ -8744,12 +15193,40 @@ int32 mio_app_run(
 		sys_sleep(2);
 #endif
 	}
+  mio_pipeline_stop();
   if (app->shutdown) { app->shutdown(app->state); }
+  mio_assets_shutdown();
+  if (G_APP.dynres.output) { sys_free(G_APP.dynres.output); }
+  if (G_APP.dynres.tileOwner) { sys_free(G_APP.dynres.tileOwner); }
+  sys_free(G_APP.occlusion.depth);
   sys_free(fbMem);
   sys_shutdown();
   return ret;
 }
 
+SYSRET mio_headless_init(int32 width, int32 height) {
+  size_t fbSize = sizeof(uint32) * width * height * 2;
+  void *fbMem;
+  if (width <= 0 || height <= 0 || !sys_init_headless(width, height)) {
+    return FALSE;
+  }
+  fbMem = sys_alloc((int32)fbSize);
+  if (!fbMem) { return FALSE; }
+  G_APP.render = mio_render_context(fbMem, fbSize, TRUE, 1);
+  G_APP.render.camera = mio_3d_camera(TRUE, 0.8f, 0.01f, 100.0f, 20.0f, 2.0f);
+  mio_render_context_resize(width, height);
+  return TRUE;
+}
+
+void mio_headless_shutdown(void) {
+  if (G_APP.render.colourData) { sys_free(G_APP.render.colourData); }
+  sys_free(G_APP.occlusion.depth);
+  memset(&G_APP.render, 0, sizeof(G_APP.render));
+  memset(&G_APP.occlusion, 0, sizeof(G_APP.occlusion));
+  G_SYS.fb = NULL;
+  G_SYS.running = 0;
+}
+
 int32 mio_user_init(void *state);
 int32 mio_user_update(void *state, real64 dt);
 int32 mio_user_draw(void *state);
@@ -1,6 +1,10 @@
 #ifndef PLAT_H
 #define PLAT_H
 #define _CRT_SECURE_NO_WARNINGS
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+/* madvise, usleep and friends are hidden under -std=c89/c99 otherwise */
+#define _DEFAULT_SOURCE
+#endif
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +36,8 @@ typedef CRITICAL_SECTION PlatformMutex;
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #define PLATFORM_SLEEP(ms) usleep((ms) * 1000)
 #define PATH_SEP '/'
 typedef void *PlatformLibraryHandle;
@@ -44,6 +50,14 @@ typedef int SOCKET;
 #define MAX_PATH_CUSTOM 512
 #define MAX_HTTP_BUF 4096
 
+#define PLATFORM_AUDIO_AUTO 0
+#define PLATFORM_AUDIO_PULSE 1
+#define PLATFORM_AUDIO_ALSA 2
+#define PLATFORM_AUDIO_NULL 3
+#define PLATFORM_AUDIO_WAV 4
+#define PLATFORM_AUDIO_RING_FRAMES 2048
+#define PLATFORM_AUDIO_MIX_FRAMES 256
+
 typedef struct {
 #ifdef _WIN32
   HANDLE hFind;
@@ -55,6 +69,31 @@ typedef struct {
   char path[MAX_PATH_CUSTOM];
 } PlatformDirHandle;
 
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE hFile;
+  HANDLE hMapping;
+#endif
+} PlatformFileMap;
+
+typedef void (*PlatformAudioCallback)(void *user, float *out, int frames);
+
+typedef struct {
+  int backend;
+  unsigned int underruns;
+  unsigned int underrunFrames;
+  unsigned int deviceXruns;
+  long long framesMixed;
+  long long framesPlayed;
+  int ringFrames;
+  int ringCapacity;
+  double mixTimeAvg;
+  double mixTimeMax;
+  double headroom;
+} PlatformAudioStats;
+
 #if 1
 
 int platform_init(void);
@@ -68,6 +107,8 @@ void platform_dir_close(PlatformDirHandle *dirHandle);
 int platform_file_exists(const char *path);
 int platform_is_dir(const char *path);
 long platform_file_size(const char *path);
+int platform_file_map(const char *path, PlatformFileMap *map);
+void platform_file_unmap(PlatformFileMap *map);
 int platform_file_delete(const char *path);
 int platform_file_rename(const char *oldPath, const char *newPath);
 int platform_file_copy(const char *srcPath, const char *dstPath);
@@ -100,6 +141,11 @@ int platform_mutex_init(PlatformMutex *mutex);
 int platform_mutex_lock(PlatformMutex *mutex);
 int platform_mutex_unlock(PlatformMutex *mutex);
 int platform_mutex_destroy(PlatformMutex *mutex);
+int platform_audio_open(int sampleRate, int channels, int backend,
+                        const char *wavPath, PlatformAudioCallback callback,
+                        void *user);
+void platform_audio_close(void);
+void platform_audio_get_stats(PlatformAudioStats *stats);
 
 int platform_http_request(const char *method, const char *url, const char *data,
                           char *response, int response_size,
@@ -469,6 +515,47 @@ long platform_file_size(const char *path) {
   return size;
 }
 int platform_file_delete(const char *path) { return DeleteFile(path); }
+int platform_file_map(const char *path, PlatformFileMap *map) {
+  LARGE_INTEGER size;
+  memset(map, 0, sizeof(*map));
+  map->hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (map->hFile == INVALID_HANDLE_VALUE) {
+    map->hFile = NULL;
+    return 0;
+  }
+  if (!GetFileSizeEx(map->hFile, &size) || size.QuadPart <= 0 ||
+      (unsigned long long)size.QuadPart > (size_t)-1) {
+    platform_file_unmap(map);
+    return 0;
+  }
+  map->hMapping = CreateFileMapping(map->hFile, NULL, PAGE_READONLY, 0, 0,
+                                    NULL);
+  if (map->hMapping == NULL) {
+    platform_file_unmap(map);
+    return 0;
+  }
+  map->data = (const unsigned char *)MapViewOfFile(map->hMapping,
+                                                   FILE_MAP_READ, 0, 0, 0);
+  if (map->data == NULL) {
+    platform_file_unmap(map);
+    return 0;
+  }
+  map->size = (size_t)size.QuadPart;
+  return 1;
+}
+void platform_file_unmap(PlatformFileMap *map) {
+  if (map->data) {
+    UnmapViewOfFile((LPCVOID)map->data);
+  }
+  if (map->hMapping) {
+    CloseHandle(map->hMapping);
+  }
+  if (map->hFile) {
+    CloseHandle(map->hFile);
+  }
+  memset(map, 0, sizeof(*map));
+}
 
 #else
 
@@ -889,6 +976,36 @@ long platform_file_size(const char *path) {
   return (long)buffer.st_size;
 }
 int platform_file_delete(const char *path) { return unlink(path) == 0; }
+int platform_file_map(const char *path, PlatformFileMap *map) {
+  struct stat st;
+  void *view;
+  int fd;
+  memset(map, 0, sizeof(*map));
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    close(fd);
+    return 0;
+  }
+  view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    return 0;
+  }
+  madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+  madvise(view, (size_t)st.st_size, MADV_WILLNEED);
+  map->data = (const unsigned char *)view;
+  map->size = (size_t)st.st_size;
+  return 1;
+}
+void platform_file_unmap(PlatformFileMap *map) {
+  if (map->data) {
+    munmap((void *)map->data, map->size);
+  }
+  memset(map, 0, sizeof(*map));
+}
 
 #endif
 
@@ -947,6 +1064,432 @@ int platform_init(void) {
 #endif
 }
 
+#ifdef _WIN32
+typedef HANDLE PlatformAudioThread;
+#define PLATFORM_AUDIO_LOAD(p) InterlockedCompareExchange((p), 0, 0)
+#define PLATFORM_AUDIO_STORE(p, v) InterlockedExchange((p), (v))
+#define PLATFORM_AUDIO_ADD(p, v) InterlockedExchangeAdd((p), (v))
+#define PLATFORM_AUDIO_LOAD64(p) InterlockedCompareExchange64((p), 0, 0)
+#define PLATFORM_AUDIO_STORE64(p, v) InterlockedExchange64((p), (v))
+#define PLATFORM_AUDIO_ADD64(p, v) InterlockedExchangeAdd64((p), (v))
+#else
+typedef pthread_t PlatformAudioThread;
+#define PLATFORM_AUDIO_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PLATFORM_AUDIO_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define PLATFORM_AUDIO_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define PLATFORM_AUDIO_LOAD64(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define PLATFORM_AUDIO_STORE64(p, v)                                           \
+  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define PLATFORM_AUDIO_ADD64(p, v) PLATFORM_AUDIO_ADD(p, v)
+#endif
+
+#define PLATFORM_AUDIO_SYM(lib, fn, name)                                      \
+  (*(void **)&(fn) = platform_library_get_func((lib), (name)))
+
+typedef struct {
+  int format;
+  unsigned int rate;
+  unsigned char channels;
+} PlatformPulseSpec;
+
+typedef struct {
+  unsigned int maxlength;
+  unsigned int tlength;
+  unsigned int prebuf;
+  unsigned int minreq;
+  unsigned int fragsize;
+} PlatformPulseAttr;
+
+typedef struct {
+  int backend;
+  int sampleRate;
+  int channels;
+  int periodFrames;
+  int ringTarget;
+  int ringCapacity;
+  PlatformAudioCallback callback;
+  void *user;
+  float *ring;
+  float *mixBuffer;
+  float *deviceBuffer;
+  short *pcm;
+  volatile long head;
+  volatile long tail;
+  volatile long quit;
+  int threads;
+  PlatformAudioThread mixThread;
+  PlatformAudioThread deviceThread;
+  FILE *wav;
+  unsigned long wavBytes;
+  PlatformLibraryHandle lib;
+  void *device;
+  int (*alsaOpen)(void **, const char *, int, int);
+  int (*alsaSetParams)(void *, int, int, unsigned int, unsigned int, int,
+                       unsigned int);
+  long (*alsaWritei)(void *, const void *, unsigned long);
+  int (*alsaRecover)(void *, int, int);
+  int (*alsaClose)(void *);
+  void *(*pulseNew)(const char *, const char *, int, const char *,
+                    const char *, const PlatformPulseSpec *, const void *,
+                    const PlatformPulseAttr *, int *);
+  int (*pulseWrite)(void *, const void *, size_t, int *);
+  void (*pulseFree)(void *);
+  /* Written by the mixer and device threads, read by
+     platform_audio_get_stats; only touched through the atomic macros. */
+  volatile long underruns;
+  volatile long underrunFrames;
+  volatile long deviceXruns;
+  volatile long long framesMixed;
+  volatile long long framesPlayed;
+  volatile long mixCount;
+  volatile long long mixNanos;
+  volatile long long mixNanosMax;
+} PlatformAudioState;
+
+static PlatformAudioState g_platform_audio;
+
+static int platform_audio_ring_count(PlatformAudioState *a) {
+  return (int)((unsigned long)PLATFORM_AUDIO_LOAD(&a->head) -
+               (unsigned long)PLATFORM_AUDIO_LOAD(&a->tail));
+}
+
+static int platform_audio_mix_block(PlatformAudioState *a) {
+  unsigned long head = (unsigned long)PLATFORM_AUDIO_LOAD(&a->head);
+  int frames = PLATFORM_AUDIO_MIX_FRAMES;
+  int at, first;
+  double t0;
+  long long ns;
+  if (platform_audio_ring_count(a) >= a->ringTarget) return 0;
+  t0 = platform_get_time_s();
+  a->callback(a->user, a->mixBuffer, frames);
+  ns = (long long)((platform_get_time_s() - t0) * 1e9);
+  PLATFORM_AUDIO_ADD64(&a->mixNanos, ns);
+  if (ns > PLATFORM_AUDIO_LOAD64(&a->mixNanosMax)) {
+    PLATFORM_AUDIO_STORE64(&a->mixNanosMax, ns);
+  }
+  PLATFORM_AUDIO_ADD(&a->mixCount, 1);
+  at = (int)(head & (unsigned long)(a->ringCapacity - 1));
+  first = frames < a->ringCapacity - at ? frames : a->ringCapacity - at;
+  memcpy(a->ring + at * a->channels, a->mixBuffer,
+         first * a->channels * sizeof(float));
+  memcpy(a->ring, a->mixBuffer + first * a->channels,
+         (frames - first) * a->channels * sizeof(float));
+  PLATFORM_AUDIO_STORE(&a->head, (long)(head + (unsigned long)frames));
+  PLATFORM_AUDIO_ADD64(&a->framesMixed, (long long)frames);
+  return 1;
+}
+
+static void platform_audio_pull(PlatformAudioState *a, float *dst,
+                                int frames) {
+  unsigned long tail = (unsigned long)PLATFORM_AUDIO_LOAD(&a->tail);
+  int count = platform_audio_ring_count(a);
+  int got = count < frames ? count : frames;
+  int at = (int)(tail & (unsigned long)(a->ringCapacity - 1));
+  int first = got < a->ringCapacity - at ? got : a->ringCapacity - at;
+  memcpy(dst, a->ring + at * a->channels, first * a->channels * sizeof(float));
+  memcpy(dst + first * a->channels, a->ring,
+         (got - first) * a->channels * sizeof(float));
+  PLATFORM_AUDIO_STORE(&a->tail, (long)(tail + (unsigned long)got));
+  if (got < frames) {
+    memset(dst + got * a->channels, 0,
+           (frames - got) * a->channels * sizeof(float));
+    PLATFORM_AUDIO_ADD(&a->underruns, 1);
+    PLATFORM_AUDIO_ADD(&a->underrunFrames, (long)(frames - got));
+  }
+  PLATFORM_AUDIO_ADD64(&a->framesPlayed, (long long)frames);
+}
+
+static void platform_audio_wav_header(PlatformAudioState *a) {
+  unsigned char h[44];
+  unsigned long v[7];
+  int i, j;
+  v[0] = a->wavBytes + 36;
+  v[1] = 16;
+  v[2] = 1 | ((unsigned long)a->channels << 16);
+  v[3] = (unsigned long)a->sampleRate;
+  v[4] = (unsigned long)(a->sampleRate * a->channels * 2);
+  v[5] = (unsigned long)(a->channels * 2) | (16UL << 16);
+  v[6] = a->wavBytes;
+  memcpy(h, "RIFF....WAVEfmt ", 16);
+  memcpy(h + 36, "data", 4);
+  for (i = 0; i < 4; i++) h[4 + i] = (unsigned char)(v[0] >> (i * 8));
+  for (j = 1; j < 6; j++) {
+    for (i = 0; i < 4; i++) {
+      h[12 + j * 4 + i] = (unsigned char)(v[j] >> (i * 8));
+    }
+  }
+  for (i = 0; i < 4; i++) h[40 + i] = (unsigned char)(v[6] >> (i * 8));
+  fseek(a->wav, 0, SEEK_SET);
+  fwrite(h, 1, sizeof(h), a->wav);
+  fseek(a->wav, 0, SEEK_END);
+}
+
+static void platform_audio_mix_loop(PlatformAudioState *a) {
+  while (!PLATFORM_AUDIO_LOAD(&a->quit)) {
+    if (!platform_audio_mix_block(a)) PLATFORM_SLEEP(1);
+  }
+}
+
+static void platform_audio_device_loop(PlatformAudioState *a) {
+  int n = a->periodFrames * a->channels;
+  double next = platform_get_time_s();
+  double wait;
+  long r;
+  int i, err;
+  while (!PLATFORM_AUDIO_LOAD(&a->quit)) {
+    if (a->backend == PLATFORM_AUDIO_NULL || a->backend == PLATFORM_AUDIO_WAV) {
+      next += (double)a->periodFrames / (double)a->sampleRate;
+      wait = next - platform_get_time_s();
+      if (wait > 0.0) PLATFORM_SLEEP((int)(wait * 1000.0));
+    }
+    platform_audio_pull(a, a->deviceBuffer, a->periodFrames);
+    for (i = 0; i < n; i++) {
+      float x = a->deviceBuffer[i];
+      if (x > 1.0f) x = 1.0f;
+      if (x < -1.0f) x = -1.0f;
+      a->pcm[i] = (short)(x * 32767.0f);
+    }
+    if (a->backend == PLATFORM_AUDIO_WAV) {
+      a->wavBytes += (unsigned long)fwrite(a->pcm, 2, n, a->wav) * 2;
+    } else if (a->backend == PLATFORM_AUDIO_ALSA) {
+      r = a->alsaWritei(a->device, a->pcm, (unsigned long)a->periodFrames);
+      if (r < 0) {
+        PLATFORM_AUDIO_ADD(&a->deviceXruns, 1);
+        a->alsaRecover(a->device, (int)r, 1);
+      }
+    } else if (a->backend == PLATFORM_AUDIO_PULSE) {
+      if (a->pulseWrite(a->device, a->pcm, n * sizeof(short), &err) < 0) {
+        PLATFORM_AUDIO_ADD(&a->deviceXruns, 1);
+      }
+    }
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI platform_audio_mix_entry(LPVOID p) {
+  platform_audio_mix_loop((PlatformAudioState *)p);
+  return 0;
+}
+static DWORD WINAPI platform_audio_device_entry(LPVOID p) {
+  platform_audio_device_loop((PlatformAudioState *)p);
+  return 0;
+}
+static int platform_audio_start_threads(PlatformAudioState *a) {
+  a->mixThread = CreateThread(NULL, 0, platform_audio_mix_entry, a, 0, NULL);
+  if (!a->mixThread) return 0;
+  a->threads = 1;
+  a->deviceThread =
+      CreateThread(NULL, 0, platform_audio_device_entry, a, 0, NULL);
+  if (!a->deviceThread) return 0;
+  a->threads = 2;
+  SetThreadPriority(a->mixThread, THREAD_PRIORITY_TIME_CRITICAL);
+  SetThreadPriority(a->deviceThread, THREAD_PRIORITY_TIME_CRITICAL);
+  return 1;
+}
+static void platform_audio_join(PlatformAudioThread t) {
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+}
+static int platform_audio_open_device(PlatformAudioState *a) {
+  if (a->backend == PLATFORM_AUDIO_NULL || a->backend == PLATFORM_AUDIO_WAV) {
+    return 1;
+  }
+  fprintf(stderr, "Audio: only null and WAV sinks are available on Windows\n");
+  return 0;
+}
+static void platform_audio_close_device(PlatformAudioState *a) { (void)a; }
+#else
+static void *platform_audio_mix_entry(void *p) {
+  platform_audio_mix_loop((PlatformAudioState *)p);
+  return NULL;
+}
+static void *platform_audio_device_entry(void *p) {
+  platform_audio_device_loop((PlatformAudioState *)p);
+  return NULL;
+}
+static int platform_audio_start_threads(PlatformAudioState *a) {
+  if (pthread_create(&a->mixThread, NULL, platform_audio_mix_entry, a) != 0) {
+    return 0;
+  }
+  a->threads = 1;
+  if (pthread_create(&a->deviceThread, NULL, platform_audio_device_entry, a) !=
+      0) {
+    return 0;
+  }
+  a->threads = 2;
+  return 1;
+}
+static void platform_audio_join(PlatformAudioThread t) {
+  pthread_join(t, NULL);
+}
+static int platform_audio_open_pulse(PlatformAudioState *a) {
+  PlatformPulseSpec spec;
+  PlatformPulseAttr attr;
+  int err = 0;
+  a->lib = platform_library_load("libpulse-simple.so.0");
+  if (!a->lib) return 0;
+  if (!PLATFORM_AUDIO_SYM(a->lib, a->pulseNew, "pa_simple_new") ||
+      !PLATFORM_AUDIO_SYM(a->lib, a->pulseWrite, "pa_simple_write") ||
+      !PLATFORM_AUDIO_SYM(a->lib, a->pulseFree, "pa_simple_free")) {
+    platform_library_unload(a->lib);
+    a->lib = NULL;
+    return 0;
+  }
+  spec.format = 3;
+  spec.rate = (unsigned int)a->sampleRate;
+  spec.channels = (unsigned char)a->channels;
+  attr.maxlength = (unsigned int)-1;
+  attr.tlength = (unsigned int)(a->periodFrames * a->channels * 2 * 4);
+  attr.prebuf = (unsigned int)-1;
+  attr.minreq = (unsigned int)-1;
+  attr.fragsize = (unsigned int)-1;
+  a->device = a->pulseNew(NULL, "plat", 1, NULL, "playback", &spec, NULL,
+                          &attr, &err);
+  if (!a->device) {
+    platform_library_unload(a->lib);
+    a->lib = NULL;
+    return 0;
+  }
+  a->backend = PLATFORM_AUDIO_PULSE;
+  return 1;
+}
+static int platform_audio_open_alsa(PlatformAudioState *a) {
+  a->lib = platform_library_load("libasound.so.2");
+  if (!a->lib) return 0;
+  if (!PLATFORM_AUDIO_SYM(a->lib, a->alsaOpen, "snd_pcm_open") ||
+      !PLATFORM_AUDIO_SYM(a->lib, a->alsaSetParams, "snd_pcm_set_params") ||
+      !PLATFORM_AUDIO_SYM(a->lib, a->alsaWritei, "snd_pcm_writei") ||
+      !PLATFORM_AUDIO_SYM(a->lib, a->alsaRecover, "snd_pcm_recover") ||
+      !PLATFORM_AUDIO_SYM(a->lib, a->alsaClose, "snd_pcm_close")) {
+    platform_library_unload(a->lib);
+    a->lib = NULL;
+    return 0;
+  }
+  if (a->alsaOpen(&a->device, "default", 0, 0) < 0) {
+    a->device = NULL;
+    platform_library_unload(a->lib);
+    a->lib = NULL;
+    return 0;
+  }
+  if (a->alsaSetParams(a->device, 2, 3, (unsigned int)a->channels,
+                       (unsigned int)a->sampleRate, 1, 40000) < 0) {
+    a->alsaClose(a->device);
+    a->device = NULL;
+    platform_library_unload(a->lib);
+    a->lib = NULL;
+    return 0;
+  }
+  a->backend = PLATFORM_AUDIO_ALSA;
+  return 1;
+}
+static int platform_audio_open_device(PlatformAudioState *a) {
+  switch (a->backend) {
+  case PLATFORM_AUDIO_NULL:
+  case PLATFORM_AUDIO_WAV:
+    return 1;
+  case PLATFORM_AUDIO_PULSE:
+    return platform_audio_open_pulse(a);
+  case PLATFORM_AUDIO_ALSA:
+    return platform_audio_open_alsa(a);
+  default:
+    return platform_audio_open_pulse(a) || platform_audio_open_alsa(a);
+  }
+}
+static void platform_audio_close_device(PlatformAudioState *a) {
+  if (a->device && a->backend == PLATFORM_AUDIO_ALSA) a->alsaClose(a->device);
+  if (a->device && a->backend == PLATFORM_AUDIO_PULSE) a->pulseFree(a->device);
+  a->device = NULL;
+  if (a->lib) platform_library_unload(a->lib);
+  a->lib = NULL;
+}
+#endif
+
+int platform_audio_open(int sampleRate, int channels, int backend,
+                        const char *wavPath, PlatformAudioCallback callback,
+                        void *user) {
+  PlatformAudioState *a = &g_platform_audio;
+  int capacity = PLATFORM_AUDIO_RING_FRAMES;
+  platform_audio_close();
+  if (!callback || sampleRate <= 0 || channels <= 0) return 0;
+  a->backend = backend;
+  a->sampleRate = sampleRate;
+  a->channels = channels;
+  a->callback = callback;
+  a->user = user;
+  a->periodFrames = sampleRate / 100 > 64 ? sampleRate / 100 : 64;
+  a->ringTarget = a->periodFrames * 2 + PLATFORM_AUDIO_MIX_FRAMES;
+  while (capacity < a->ringTarget + PLATFORM_AUDIO_MIX_FRAMES) capacity <<= 1;
+  a->ringCapacity = capacity;
+  a->ring = (float *)calloc((size_t)capacity * channels, sizeof(float));
+  a->mixBuffer =
+      (float *)malloc(PLATFORM_AUDIO_MIX_FRAMES * channels * sizeof(float));
+  a->deviceBuffer =
+      (float *)malloc((size_t)a->periodFrames * channels * sizeof(float));
+  a->pcm = (short *)malloc((size_t)a->periodFrames * channels * sizeof(short));
+  if (!a->ring || !a->mixBuffer || !a->deviceBuffer || !a->pcm) {
+    platform_audio_close();
+    return 0;
+  }
+  if (backend == PLATFORM_AUDIO_WAV) {
+    a->wav = wavPath ? fopen(wavPath, "wb") : NULL;
+    if (!a->wav) {
+      platform_audio_close();
+      return 0;
+    }
+    platform_audio_wav_header(a);
+  }
+  if (!platform_audio_open_device(a)) {
+    platform_audio_close();
+    return 0;
+  }
+  while (platform_audio_mix_block(a)) {
+  }
+  if (!platform_audio_start_threads(a)) {
+    platform_audio_close();
+    return 0;
+  }
+  return 1;
+}
+
+void platform_audio_close(void) {
+  PlatformAudioState *a = &g_platform_audio;
+  PLATFORM_AUDIO_STORE(&a->quit, 1);
+  if (a->threads > 1) platform_audio_join(a->deviceThread);
+  if (a->threads > 0) platform_audio_join(a->mixThread);
+  platform_audio_close_device(a);
+  if (a->wav) {
+    platform_audio_wav_header(a);
+    fclose(a->wav);
+  }
+  free(a->ring);
+  free(a->mixBuffer);
+  free(a->deviceBuffer);
+  free(a->pcm);
+  memset(a, 0, sizeof(*a));
+}
+
+void platform_audio_get_stats(PlatformAudioStats *stats) {
+  PlatformAudioState *a = &g_platform_audio;
+  double block = a->sampleRate > 0
+                     ? (double)PLATFORM_AUDIO_MIX_FRAMES / a->sampleRate
+                     : 1.0;
+  long mixCount = PLATFORM_AUDIO_LOAD(&a->mixCount);
+  memset(stats, 0, sizeof(*stats));
+  stats->backend = a->backend;
+  stats->underruns = (unsigned int)PLATFORM_AUDIO_LOAD(&a->underruns);
+  stats->underrunFrames =
+      (unsigned int)PLATFORM_AUDIO_LOAD(&a->underrunFrames);
+  stats->deviceXruns = (unsigned int)PLATFORM_AUDIO_LOAD(&a->deviceXruns);
+  stats->framesMixed = PLATFORM_AUDIO_LOAD64(&a->framesMixed);
+  stats->framesPlayed = PLATFORM_AUDIO_LOAD64(&a->framesPlayed);
+  stats->ringCapacity = a->ringCapacity;
+  if (a->ring) stats->ringFrames = platform_audio_ring_count(a);
+  stats->mixTimeAvg =
+      mixCount ? PLATFORM_AUDIO_LOAD64(&a->mixNanos) * 1e-9 / mixCount : 0.0;
+  stats->mixTimeMax = PLATFORM_AUDIO_LOAD64(&a->mixNanosMax) * 1e-9;
+  stats->headroom = 1.0 - stats->mixTimeAvg / block;
+}
+
 #endif
 
 #endif